@@ -4,6 +4,33 @@
 #include "ftl.h"
 #include "gc_wl.h"
 #include "nand_driver.h"
+#include "state_snapshot.h"
+
+namespace
+{
+    const char *const kPlaneAllocationSchemeNames[] = {
+        "CWDP", "CWPD", "CDWP", "CDPW", "CPWD", "CPDW",
+        "WCDP", "WCPD", "WDCP", "WDPC", "WPCD", "WPDC",
+        "DCWP", "DCPW", "DWCP", "DWPC", "DPCW", "DPWC",
+        "PCWD", "PCDW", "PWCD", "PWDC", "PDCW", "PDWC",
+        "DYNAMIC"};
+}
+
+bool ParsePlaneAllocationScheme(const std::string &name, PlaneAllocationScheme &scheme)
+{
+    std::string upper = name;
+    std::transform(upper.begin(), upper.end(), upper.begin(), [](unsigned char c)
+                   { return std::toupper(c); });
+    for (size_t i = 0; i <= static_cast<size_t>(PlaneAllocationScheme::DYNAMIC); i++)
+    {
+        if (upper == kPlaneAllocationSchemeNames[i])
+        {
+            scheme = static_cast<PlaneAllocationScheme>(i);
+            return true;
+        }
+    }
+    return false;
+}
 
 bool CachedMappingTable::Exists(uint64_t stream_id, uint64_t lpa)
 {
@@ -45,9 +72,9 @@ void CachedMappingTable::Insert(const uint64_t stream_id, const uint64_t lpa, co
 {
     uint64_t key = LPN_TO_UNIQUE_KEY(stream_id, lpa);
     auto it = address_map.find(key);
-    if (it == address_map.end() || it->second->status != CMTEntryStatus::VALID)
+    if (it == address_map.end())
     {
-        PRINT_ERROR("Mapping entry not found or not valid in CMT!")
+        PRINT_ERROR("Mapping entry not reserved in CMT!")
     }
     it->second->ppa = ppa;
     it->second->write_state_bitmap = write_state_bitmap;
@@ -99,6 +126,16 @@ void CachedMappingTable::ReserveSlotForLpn(const uint64_t stream_id, const uint6
     {
         throw std::logic_error("CMT overfull!");
     }
+    if (shadow_capacity > 0)
+    {
+        auto shadow = shadow_map.find(key);
+        if (shadow != shadow_map.end())
+        {
+            shadow_hit_count++;
+            shadow_lru.erase(shadow->second);
+            shadow_map.erase(shadow);
+        }
+    }
 
     CMTSlotPtr cmtEnt = std::make_shared<CMTSlot>();
     cmtEnt->dirty = false;
@@ -115,6 +152,16 @@ CMTSlotPtr CachedMappingTable::EvictOne(uint64_t &lpa)
     {
         PRINT_ERROR("No slot to evict in CMT!")
     }
+    if (shadow_capacity > 0)
+    {
+        shadow_lru.push_front(lru_list.back().first);
+        shadow_map[lru_list.back().first] = shadow_lru.begin();
+        if (shadow_lru.size() > shadow_capacity)
+        {
+            shadow_map.erase(shadow_lru.back());
+            shadow_lru.pop_back();
+        }
+    }
     address_map.erase(lru_list.back().first);
     lpa = UNIQUE_KEY_TO_LPN(lru_list.back().second->stream_id, lru_list.back().first);
     CMTSlotPtr evicted_slot = lru_list.back().second;
@@ -143,6 +190,42 @@ void CachedMappingTable::MakeClean(const uint64_t stream_id, const uint64_t lpa)
     it->second->dirty = false;
 }
 
+void CachedMappingTable::ForEachEntryInRange(const uint64_t stream_id, const uint64_t first_lpa, const uint64_t last_lpa,
+                                             const std::function<bool(uint64_t, uint64_t &, uint64_t &)> &fn)
+{
+    auto visit = [&](uint64_t lpa, CMTSlotPtr &slot)
+    {
+        if (slot->status == CMTEntryStatus::VALID && fn(lpa, slot->ppa, slot->write_state_bitmap))
+        {
+            slot->dirty = true;
+        }
+    };
+    if (last_lpa - first_lpa + 1 <= address_map.size())
+    {
+        for (uint64_t lpa = first_lpa; lpa <= last_lpa; lpa++)
+        {
+            auto it = address_map.find(LPN_TO_UNIQUE_KEY(stream_id, lpa));
+            if (it != address_map.end())
+            {
+                visit(lpa, it->second);
+            }
+        }
+        return;
+    }
+    for (auto &[key, slot] : address_map)
+    {
+        if (slot->stream_id != stream_id)
+        {
+            continue;
+        }
+        uint64_t lpa = UNIQUE_KEY_TO_LPN(stream_id, key);
+        if (lpa >= first_lpa && lpa <= last_lpa)
+        {
+            visit(lpa, slot);
+        }
+    }
+}
+
 //============================================== AddressMappingDomain ==============================================
 
 AddressMappingDomain::AddressMappingDomain(CachedMappingTablePtr cmt_ptr, uint64_t *channel_ids_, uint64_t channel_no, uint64_t *chip_ids_,
@@ -150,7 +233,8 @@ AddressMappingDomain::AddressMappingDomain(CachedMappingTablePtr cmt_ptr, uint64
                                            uint64_t total_physical_sector_no, uint64_t total_logical_sector_no, uint64_t sectors_per_page)
     : cmt(cmt_ptr), channel_no(channel_no), chip_no(chip_no), die_no(die_no), plane_no(plane_no),
       channel_ids(new uint64_t[channel_no]), chip_ids(new uint64_t[chip_no]),
-      die_ids(new uint64_t[die_no]), plane_ids(new uint64_t[plane_no])
+      die_ids(new uint64_t[die_no]), plane_ids(new uint64_t[plane_no]),
+      channel_no_div(channel_no), chip_no_div(chip_no), die_no_div(die_no), plane_no_div(plane_no)
 {
     total_physical_page_no = total_physical_sector_no / sectors_per_page;
     max_logical_sector_address = total_logical_sector_no;
@@ -172,6 +256,7 @@ AddressMappingDomain::AddressMappingDomain(CachedMappingTablePtr cmt_ptr, uint64
     {
         plane_ids[i] = plane_ids_[i];
     }
+    global_mapping_table.resize(total_logical_page_no);
     if (cmt_ptr == nullptr)
     {
         cmt = std::make_shared<CachedMappingTable>(total_logical_page_no); // 默认CMT大小为逻辑页数
@@ -202,8 +287,155 @@ bool AddressMappingDomain::Mapping_entry_accessible(const uint64_t stream_id, co
     return cmt->Exists(stream_id, lpa);
 }
 
+void AddressMappingDomain::SetStripeOrder(PlaneAllocationScheme scheme)
+{
+    if (scheme == PlaneAllocationScheme::DYNAMIC)
+    {
+        scheme = PlaneAllocationScheme::CWDP;
+    }
+    const char *name = kPlaneAllocationSchemeNames[static_cast<int>(scheme)];
+    for (int level = 0; level < 4; level++)
+    {
+        stripe_order[level] = static_cast<uint8_t>(std::string("CWDP").find(name[level]));
+    }
+}
+
+void AddressMappingDomain::StripeLpaToPlane(const uint64_t lpa, PhysicalPageAddress &address)
+{
+    // 实现 LPA 在所有 plane 间的均匀分布：按 stripe_order 依次在各维度上取余
+    const FastDivider *dividers[4] = {&channel_no_div, &chip_no_div, &die_no_div, &plane_no_div};
+    uint64_t index[4] = {0, 0, 0, 0};
+    uint64_t q = lpa;
+    for (int level = 0; level < 4; level++)
+    {
+        uint8_t dim = stripe_order[level];
+        q = dividers[dim]->DivMod(q, index[dim]);
+    }
+    address.channel_id = channel_ids[index[0]];
+    address.chip_id = chip_ids[index[1]];
+    address.die_id = die_ids[index[2]];
+    address.plane_id = plane_ids[index[3]];
+}
+
 //============================================== AddressMappingPageLevel ==============================================
 
+void CachedMappingTable::ForEachEntryFromLeastRecent(const std::function<void(uint64_t, uint64_t, const CMTSlot &)> &fn) const
+{
+    for (auto it = lru_list.rbegin(); it != lru_list.rend(); ++it)
+    {
+        const CMTSlot &slot = *it->second;
+        if (slot.status == CMTEntryStatus::VALID)
+        {
+            fn(slot.stream_id, UNIQUE_KEY_TO_LPN(slot.stream_id, it->first), slot);
+        }
+    }
+}
+
+void CachedMappingTable::Clear()
+{
+    address_map.clear();
+    lru_list.clear();
+    shadow_lru.clear();
+    shadow_map.clear();
+    shadow_hit_count = 0;
+}
+
+uint64_t CachedMappingTable::TakeShadowHitCount()
+{
+    uint64_t hits = shadow_hit_count;
+    shadow_hit_count = 0;
+    return hits;
+}
+
+AddressMappingPageLevel::AddressMappingPageLevel(FTLPtr ftl_ptr, NandDriverPtr nand_driver_ptr, BlockManagerPtr block_manager_ptr)
+    : ftl(ftl_ptr), nand_driver(nand_driver_ptr), block_manager(block_manager_ptr)
+{
+    sharing_mode = config.cache_param.cmt_sharing_mode;
+    total_stream_count = config.ssd_param.StreamNum;
+    overprovisioning_ratio = config.ssd_param.OverprovisioningRatio;
+
+    channel_no = config.ssd_param.ChannelNum;
+    chips_per_channel = config.ssd_param.ChipPerChannel;
+    dies_per_chip = config.nand_param.DiePerChip;
+    planes_per_die = config.nand_param.PlanePerDie;
+    blocks_per_plane = config.nand_param.BlockPerPlane;
+    pages_per_block = config.nand_param.PagePerBlock;
+    page_size_in_bytes = config.nand_param.PageSize;
+    sectors_per_page = page_size_in_bytes / SECTOR_SIZE_IN_BYTE;
+
+    geometry = FlashGeometry(channel_no, chips_per_channel, dies_per_chip, planes_per_die, blocks_per_plane, pages_per_block);
+    pages_per_plane = geometry.pages_per_plane;
+    pages_per_die = geometry.pages_per_die;
+    pages_per_chip = geometry.pages_per_chip;
+    pages_per_channel = geometry.pages_per_channel;
+    total_physical_pages_no = geometry.total_pages_no;
+    total_logical_pages_no = static_cast<uint64_t>(total_physical_pages_no * (1 - overprovisioning_ratio));
+    max_logical_sector_address = total_logical_pages_no * sectors_per_page;
+
+    cmt_capacity_in_entries = config.cache_param.CMT_size * 1024 * 1024 / sizeof(uint64_t);
+
+    // 所有流共享全部 channel/chip/die/plane，逻辑空间按流数平均划分
+    std::vector<uint64_t> channel_ids(channel_no), chip_ids(chips_per_channel), die_ids(dies_per_chip), plane_ids(planes_per_die);
+    for (uint64_t i = 0; i < channel_no; i++)
+        channel_ids[i] = i;
+    for (uint64_t i = 0; i < chips_per_channel; i++)
+        chip_ids[i] = i;
+    for (uint64_t i = 0; i < dies_per_chip; i++)
+        die_ids[i] = i;
+    for (uint64_t i = 0; i < planes_per_die; i++)
+        plane_ids[i] = i;
+
+    CachedMappingTablePtr shared_cmt = nullptr;
+    if (sharing_mode == CMTSharingMode::SHARED)
+    {
+        shared_cmt = std::make_shared<CachedMappingTable>(cmt_capacity_in_entries);
+    }
+    if (sharing_mode == CMTSharingMode::UTILITY_PARTITIONING)
+    {
+        cmt_rebalance_step = std::max<uint64_t>(1, static_cast<uint64_t>(cmt_capacity_in_entries * config.cache_param.cmt_rebalance_step));
+        cmt_min_partition = std::max<uint64_t>(1, static_cast<uint64_t>(cmt_capacity_in_entries / total_stream_count * config.cache_param.cmt_min_share));
+    }
+    for (uint64_t stream_id = 0; stream_id < total_stream_count; stream_id++)
+    {
+        CachedMappingTablePtr cmt = shared_cmt;
+        if (sharing_mode != CMTSharingMode::SHARED)
+        {
+            // 各流只淘汰自己的表项，一个流的访问不会挤掉其他流的热表项
+            cmt = std::make_shared<CachedMappingTable>(cmt_capacity_in_entries / total_stream_count);
+            cmt->TrackShadowEntries(cmt_rebalance_step);
+        }
+        domains.push_back(std::make_shared<AddressMappingDomain>(cmt, channel_ids.data(), channel_no, chip_ids.data(), chips_per_channel,
+                                                                 die_ids.data(), dies_per_chip, plane_ids.data(), planes_per_die,
+                                                                 total_physical_pages_no * sectors_per_page / total_stream_count,
+                                                                 max_logical_sector_address / total_stream_count, sectors_per_page));
+        domains.back()->CMT_entry_size = sizeof(uint64_t);
+        domains.back()->SetStripeOrder(config.ssd_param.placement_param.plane_allocation_scheme);
+        // 每个 plane 最多同时回收 max_ongoing_gc_reqs_per_plane 个块，按此上限预留锁表，GC 期间不再扩容
+        domains.back()->locked_lpa.Reserve(config.ssd_param.gc_param.max_ongoing_gc_reqs_per_plane * channel_no * chips_per_channel *
+                                           dies_per_chip * planes_per_die * pages_per_block);
+    }
+    cmt_hit_count.assign(total_stream_count, 0);
+    cmt_miss_count.assign(total_stream_count, 0);
+    plane_allocation_scheme = config.ssd_param.placement_param.plane_allocation_scheme;
+    chip_program_backlog.assign(channel_no * chips_per_channel, 0);
+    die_program_backlog.assign(channel_no * chips_per_channel * dies_per_chip, 0);
+    plane_program_backlog.assign(channel_no * chips_per_channel * dies_per_chip * planes_per_die, 0);
+
+    Write_transactions_for_overfull_planes.resize(channel_no);
+    for (auto &chips : Write_transactions_for_overfull_planes)
+    {
+        chips.resize(chips_per_channel);
+        for (auto &dies : chips)
+        {
+            dies.resize(dies_per_chip);
+            for (auto &planes : dies)
+            {
+                planes.resize(planes_per_die);
+            }
+        }
+    }
+}
+
 uint64_t AddressMappingPageLevel::GetCMTCapacity()
 {
     return cmt_capacity_in_entries;
@@ -216,117 +448,320 @@ uint64_t AddressMappingPageLevel::GetLogicalPagesNo(uint64_t stream_id)
 
 void AddressMappingPageLevel::GetDataMappingForGC(uint64_t stream_id, uint64_t lpa, uint64_t &ppa, uint64_t &write_state_bitmap)
 {
-    if (domains[stream_id]->Mapping_entry_accessible(stream_id, lpa))
+    // GC 只读映射，不为此挤占 CMT
+    LookupMapping(stream_id, lpa, ppa, write_state_bitmap);
+}
+
+void AddressMappingPageLevel::LookupMapping(const uint64_t stream_id, const uint64_t lpa, uint64_t &ppa, uint64_t &write_state_bitmap)
+{
+    auto domain = domains[stream_id];
+    if (domain->Mapping_entry_accessible(stream_id, lpa))
     {
-        ppa = domains[stream_id]->GetPPA(stream_id, lpa);
-        write_state_bitmap = domains[stream_id]->GetPageStatus(stream_id, lpa);
+        ppa = domain->GetPPA(stream_id, lpa);
+        write_state_bitmap = domain->GetPageStatus(stream_id, lpa);
+        return;
     }
-    else
+    const GMTEntry &entry = domain->global_mapping_table[lpa];
+    ppa = entry.ppa;
+    write_state_bitmap = entry.write_state_bitmap;
+}
+
+void AddressMappingPageLevel::StoreMapping(const uint64_t stream_id, const uint64_t lpa, const uint64_t ppa, const uint64_t write_state_bitmap)
+{
+    auto domain = domains[stream_id];
+    if (domain->Mapping_entry_accessible(stream_id, lpa))
     {
-        PRINT_ERROR("Mapping entry not found in CMT during GC!")
+        domain->UpdateMappingInfo(stream_id, lpa, ppa, write_state_bitmap);
+        return;
     }
+    GMTEntry &entry = domain->global_mapping_table[lpa];
+    entry.ppa = ppa;
+    entry.write_state_bitmap = write_state_bitmap;
 }
 
 void AddressMappingPageLevel::AllocateNewPageForGC(TransactionWritePtr tr)
 {
+    if (!domains[tr->stream_id]->Mapping_entry_accessible(tr->stream_id, tr->lpa))
+    {
+        LoadMappingEntryFromGMT(tr->stream_id, tr->lpa);
+    }
+    // 搬移写留在回收块所在的 plane：每个 plane 为自己在途的回收预留空闲块，写到别的 plane 会吃掉对方的预留
     AllocatePageInPlaneForGCWrite(tr);
     tr->physical_address_determined = true;
 }
 
-PhysicalPageAddressPtr AddressMappingPageLevel::ConvertPPAtoAddress(const uint64_t ppa)
+PhysicalPageAddress AddressMappingPageLevel::ConvertPPAtoAddress(const uint64_t ppa)
 {
-    // Ensure pages_per_channel and related variables are initialized before use
-    if (pages_per_channel == 0 || pages_per_chip == 0 || pages_per_die == 0 || pages_per_plane == 0 || pages_per_block == 0)
-    {
-        throw std::logic_error("One or more page mapping variables are not initialized!");
-    }
-    PhysicalPageAddressPtr target = std::make_shared<PhysicalPageAddress>();
-    target->channel_id = ppa / pages_per_channel;
-    target->chip_id = (ppa % pages_per_channel) / pages_per_chip;
-    target->die_id = ((ppa % pages_per_channel) % pages_per_chip) / pages_per_die;
-    target->plane_id = (((ppa % pages_per_channel) % pages_per_chip) % pages_per_die) / pages_per_plane;
-    target->block_id = ((((ppa % pages_per_channel) % pages_per_chip) % pages_per_die) % pages_per_plane) / pages_per_block;
-    target->page_id = (((((ppa % pages_per_channel) % pages_per_chip) % pages_per_die) % pages_per_plane) % pages_per_block);
-
-    return target;
+    return geometry.ConvertPPAtoAddress(ppa);
 }
 
-void AddressMappingPageLevel::ConvertPPAtoAddress(const uint64_t ppa, PhysicalPageAddressPtr address)
+void AddressMappingPageLevel::ConvertPPAtoAddress(const uint64_t ppa, PhysicalPageAddress &address)
 {
-    if (pages_per_channel == 0 || pages_per_chip == 0 || pages_per_die == 0 || pages_per_plane == 0 || pages_per_block == 0)
-    {
-        throw std::logic_error("One or more page mapping variables are not initialized!");
-    }
-    address->channel_id = ppa / pages_per_channel;
-    address->chip_id = (ppa % pages_per_channel) / pages_per_chip;
-    address->die_id = ((ppa % pages_per_channel) % pages_per_chip) / pages_per_die;
-    address->plane_id = (((ppa % pages_per_channel) % pages_per_chip) % pages_per_die) / pages_per_plane;
-    address->block_id = ((((ppa % pages_per_channel) % pages_per_chip) % pages_per_die) % pages_per_plane) / pages_per_block;
-    address->page_id = (((((ppa % pages_per_channel) % pages_per_chip) % pages_per_die) % pages_per_plane) % pages_per_block);
+    address = geometry.ConvertPPAtoAddress(ppa);
 }
 
-uint64_t AddressMappingPageLevel::ConvertAddresstoPPA(const PhysicalPageAddressPtr address)
+uint64_t AddressMappingPageLevel::ConvertAddresstoPPA(const PhysicalPageAddress address)
 {
-    return pages_per_chip * (address->channel_id * chips_per_channel + address->chip_id) + pages_per_die * address->die_id + pages_per_plane * address->plane_id + pages_per_block * address->block_id + address->page_id;
+    return geometry.ConvertAddresstoPPA(address);
 }
 
-void AddressMappingPageLevel::SetBarrierForPhysicalBlock(const PhysicalPageAddressPtr address)
+void AddressMappingPageLevel::SetBarrierForPhysicalBlock(const PhysicalPageAddress address)
 {
-    auto block = block_manager->GetPlaneBookKeepingEntry(address)->blocks[address->block_id];
-    auto addr = std::make_shared<PhysicalPageAddress>(*address);
-    for (uint64_t page_id = 0; page_id < block->current_write_page_index; ++page_id)
+    auto block = block_manager->GetPlaneBookKeepingEntry(address)->blocks[address.block_id];
+    PhysicalPageAddress addr = address;
+    std::vector<uint64_t> valid_page_ids;
+    block_manager->EnumerateValidPages(block, valid_page_ids);
+    for (uint64_t page_id : valid_page_ids)
     {
-        if (block_manager->IsPageValid(block, page_id))
+        addr.page_id = page_id;
+        uint64_t lpa = nand_driver->GetLPA(addr);
+        uint64_t ppa = NO_VALUE, write_state_bitmap = 0;
+        LookupMapping(block->stream_id, lpa, ppa, write_state_bitmap);
+        if (ppa != ConvertAddresstoPPA(addr))
         {
-            addr->page_id = page_id;
-            uint64_t lpa = nand_driver->GetLPA(addr);
-            uint64_t ppa = domains[block->stream_id]->GetPPA(block->stream_id, lpa);
-            if (domains[block->stream_id]->cmt->Exists(block->stream_id, lpa))
-            {
-                ppa = domains[block->stream_id]->cmt->RetrievePPA(block->stream_id, lpa);
-            }
-            if (ppa != ConvertAddresstoPPA(addr))
-            {
-                PRINT_ERROR("Inconsistent mapping table between FTL and NAND driver!")
-            }
-            SetBarrierForLPA(block->stream_id, lpa);
+            PRINT_ERROR("Inconsistent mapping table between FTL and NAND driver!")
         }
+        SetBarrierForLPA(block->stream_id, lpa);
     }
 }
 
 void AddressMappingPageLevel::SetBarrierForLPA(const uint64_t stream_id, const uint64_t lpa)
 {
-    auto it = domains[stream_id]->locked_lpa.find(lpa);
-    if (it != domains[stream_id]->locked_lpa.end())
+    if (!domains[stream_id]->locked_lpa.Insert(lpa))
     {
         PRINT_ERROR("LPA already locked!");
     }
-    domains[stream_id]->locked_lpa.insert(lpa);
 }
 
 void AddressMappingPageLevel::RemoveBarrierForLPA(const uint64_t stream_id, const uint64_t lpa)
 {
-    auto it = domains[stream_id]->locked_lpa.find(lpa);
-    if (it == domains[stream_id]->locked_lpa.end())
+    if (!domains[stream_id]->locked_lpa.Erase(lpa))
     {
         PRINT_ERROR("LPA not locked!");
     }
-    domains[stream_id]->locked_lpa.erase(it);
-    // TODO...
-    // read behind barrier
 
-    // program behind barrier
+    auto waiters = domains[stream_id]->transactions_behind_LPA_barrier.find(lpa);
+    if (waiters == domains[stream_id]->transactions_behind_LPA_barrier.end())
+    {
+        return;
+    }
+    TransactionBatchStack::Batch released(transaction_batches);
+    released.transactions.swap(waiters->second);
+    domains[stream_id]->transactions_behind_LPA_barrier.erase(waiters);
+    TranslateLpaToPpaAndDispatch(released.transactions);
+}
+
+void AddressMappingPageLevel::StartServicingWritesForOverfullPlane(const PhysicalPageAddress plane_address)
+{
+    // 先整体取出再重试：仍然无法写入的事务按原顺序重新排到空队列中
+    TransactionBatchStack::Batch batch(transaction_batches);
+    std::vector<TransactionPtr> &released = batch.transactions;
+    auto take_waiters = [&](std::deque<TransactionPtr> &waiting)
+    {
+        released.insert(released.end(), waiting.begin(), waiting.end());
+        overfull_waiting_write_count -= waiting.size();
+        waiting.clear();
+    };
+    if (plane_allocation_scheme == PlaneAllocationScheme::DYNAMIC)
+    {
+        for (auto &chips : Write_transactions_for_overfull_planes)
+            for (auto &dies : chips)
+                for (auto &planes : dies)
+                    for (auto &waiting : planes)
+                        take_waiters(waiting);
+    }
+    else
+    {
+        if (ftl->gcwl_unit->StopServicingWrites(plane_address))
+        {
+            return;
+        }
+        take_waiters(Write_transactions_for_overfull_planes[plane_address.channel_id][plane_address.chip_id][plane_address.die_id][plane_address.plane_id]);
+    }
+    // 等待期间 LPA 被 GC 加了屏障：屏障上排队的写都晚于 plane 队列中的写到达，按原顺序插到屏障队列最前面
+    for (auto it = released.rbegin(); it != released.rend(); ++it)
+    {
+        const TransactionPtr &tr = *it;
+        if (IsLPALockedForGC(tr->stream_id, tr->lpa))
+        {
+            auto &waiters = domains[tr->stream_id]->transactions_behind_LPA_barrier[tr->lpa];
+            waiters.insert(waiters.begin(), tr);
+        }
+    }
+    released.erase(std::remove_if(released.begin(), released.end(), [&](const TransactionPtr &tr)
+                                  { return IsLPALockedForGC(tr->stream_id, tr->lpa); }),
+                   released.end());
+    if (!released.empty())
+    {
+        TranslateLpaToPpaAndDispatch(released);
+    }
+}
+
+uint64_t AddressMappingPageLevel::TrimLpaRange(const uint64_t stream_id, const uint64_t first_lpa, const uint64_t page_count,
+                                               const uint64_t first_page_bitmap, const uint64_t last_page_bitmap)
+{
+    if (page_count == 0)
+    {
+        return 0;
+    }
+    auto domain = domains[stream_id];
+    uint64_t last_lpa = first_lpa + page_count - 1;
+    uint64_t full_page_bitmap = sectors_per_page >= 64 ? ~0ULL : ((1ULL << sectors_per_page) - 1);
+    uint64_t unmapped_page_count = 0;
+    auto trim_entry = [&](uint64_t lpa, uint64_t &ppa, uint64_t &write_state_bitmap)
+    {
+        if (ppa == NO_VALUE)
+        {
+            return false;
+        }
+        uint64_t trim_bitmap = full_page_bitmap;
+        if (lpa == first_lpa)
+            trim_bitmap &= first_page_bitmap;
+        if (lpa == last_lpa)
+            trim_bitmap &= last_page_bitmap;
+        if ((write_state_bitmap & trim_bitmap) == 0)
+        {
+            return false;
+        }
+        if (IsLPALockedForGC(stream_id, lpa))
+        {
+            // 正在被 GC 搬移的页搬完后映射才指向新页：TRIM 和用户读写一样排在屏障上，搬移完成后按到达顺序作用在新页上
+            auto trim_tr = MakeTransaction<TransactionWrite>(stream_id, TransactionSourceType::USERIO, TransactionType::WRITE, Priority::MEDIUM,
+                                                             PhysicalPageAddress(), false, UserRequestType::TRIM, lpa, NO_VALUE, 0, 0);
+            trim_tr->write_sectors_bitmap = trim_bitmap;
+            ManageUserTransactionFacingBarrier(trim_tr);
+            return false;
+        }
+        write_state_bitmap &= ~trim_bitmap;
+        if (write_state_bitmap == 0)
+        {
+            block_manager->InvalidatePageInBlock(stream_id, ConvertPPAtoAddress(ppa));
+            ppa = NO_VALUE;
+            unmapped_page_count++;
+        }
+        if (trim_listener)
+        {
+            trim_listener(stream_id, lpa, ppa, write_state_bitmap);
+        }
+        return true;
+    };
+
+    // CMT 中的表项比 GMT 新，先处理；GMT 中对应的旧表项跳过
+    domain->cmt->ForEachEntryInRange(stream_id, first_lpa, last_lpa, trim_entry);
+    for (uint64_t lpa = first_lpa; lpa <= last_lpa; lpa++)
+    {
+        GMTEntry &entry = domain->global_mapping_table[lpa];
+        if (entry.ppa == NO_VALUE || domain->cmt->Exists(stream_id, lpa))
+        {
+            continue;
+        }
+        trim_entry(lpa, entry.ppa, entry.write_state_bitmap);
+    }
+    return unmapped_page_count;
+}
+
+void AddressMappingPageLevel::RestoreMappingEntry(const uint64_t stream_id, const uint64_t lpa, const uint64_t ppa, const uint64_t write_state_bitmap)
+{
+    GMTEntry &entry = domains[stream_id]->global_mapping_table[lpa];
+    entry.ppa = ppa;
+    entry.write_state_bitmap = write_state_bitmap;
 }
 
 void AddressMappingPageLevel::AllocatePlaneForUserWrite(TransactionWritePtr tr)
 {
-    uint64_t lpa = tr->lpa;
-    PhysicalPageAddressPtr targetAddress = tr->physical_address;
-    // 实现 LPA 在所有 plane 间的均匀分布。
-    targetAddress->channel_id = domains[tr->stream_id]->channel_ids[lpa % domains[tr->stream_id]->channel_no];
-    targetAddress->chip_id = domains[tr->stream_id]->chip_ids[(lpa / domains[tr->stream_id]->channel_no) % domains[tr->stream_id]->chip_no];
-    targetAddress->die_id = domains[tr->stream_id]->die_ids[(lpa / (domains[tr->stream_id]->channel_no * domains[tr->stream_id]->chip_no)) % domains[tr->stream_id]->die_no];
-    targetAddress->plane_id = domains[tr->stream_id]->plane_ids[(lpa / (domains[tr->stream_id]->channel_no * domains[tr->stream_id]->chip_no * domains[tr->stream_id]->die_no)) % domains[tr->stream_id]->plane_no];
+    if (plane_allocation_scheme == PlaneAllocationScheme::DYNAMIC)
+    {
+        AllocatePlaneDynamically(tr->stream_id, tr->lpa, tr->physical_address);
+        return;
+    }
+    domains[tr->stream_id]->StripeLpaToPlane(tr->lpa, tr->physical_address);
+}
+
+void AddressMappingPageLevel::AllocatePlaneDynamically(const uint64_t stream_id, const uint64_t lpa, PhysicalPageAddress &address)
+{
+    auto domain = domains[stream_id];
+    uint64_t chip_count = domain->channel_no * domain->chip_no;
+    std::vector<bool> &rejected_chips = scratch_rejected_chips;
+    rejected_chips.assign(chip_count, false);
+    for (uint64_t attempt = 0; attempt < chip_count; attempt++)
+    {
+        // 先按 channel 枚举，负载相同时相邻两次写落在不同 channel 上
+        uint64_t best_chip = NO_VALUE, best_load = NO_VALUE;
+        for (uint64_t i = 0; i < chip_count; i++)
+        {
+            uint64_t candidate = (chip_cursor + i) % chip_count;
+            if (rejected_chips[candidate])
+                continue;
+            uint64_t channel_id = domain->channel_ids[candidate % domain->channel_no];
+            uint64_t chip_id = domain->chip_ids[candidate / domain->channel_no];
+            uint64_t load = nand_driver->GetChipInflightCommandCount(channel_id, chip_id) + chip_program_backlog[channel_id * chips_per_channel + chip_id];
+            if (load < best_load)
+            {
+                best_load = load;
+                best_chip = candidate;
+            }
+        }
+        PhysicalPageAddress candidate_address;
+        candidate_address.channel_id = domain->channel_ids[best_chip % domain->channel_no];
+        candidate_address.chip_id = domain->chip_ids[best_chip / domain->channel_no];
+        uint64_t chip_index = candidate_address.channel_id * chips_per_channel + candidate_address.chip_id;
+
+        // 芯片内按 (die 积压, plane 积压, 空闲块多者优先) 选可写的 plane
+        bool found = false;
+        uint64_t best_die_load = 0, best_plane_load = 0, best_free_blocks = 0;
+        for (uint64_t d = 0; d < domain->die_no; d++)
+        {
+            candidate_address.die_id = domain->die_ids[d];
+            uint64_t die_index = chip_index * dies_per_chip + candidate_address.die_id;
+            uint64_t die_load = die_program_backlog[die_index];
+            if (found && die_load > best_die_load)
+                continue;
+            for (uint64_t p = 0; p < domain->plane_no; p++)
+            {
+                candidate_address.plane_id = domain->plane_ids[p];
+                if (ftl->gcwl_unit->StopServicingWrites(candidate_address))
+                    continue;
+                uint64_t plane_load = plane_program_backlog[die_index * planes_per_die + candidate_address.plane_id];
+                uint64_t free_blocks = block_manager->GetFreeBlockPoolSize(candidate_address);
+                if (!found || die_load < best_die_load || (die_load == best_die_load && (plane_load < best_plane_load || (plane_load == best_plane_load && free_blocks > best_free_blocks))))
+                {
+                    found = true;
+                    best_die_load = die_load;
+                    best_plane_load = plane_load;
+                    best_free_blocks = free_blocks;
+                    address.channel_id = candidate_address.channel_id;
+                    address.chip_id = candidate_address.chip_id;
+                    address.die_id = candidate_address.die_id;
+                    address.plane_id = candidate_address.plane_id;
+                }
+            }
+        }
+        if (found)
+        {
+            chip_cursor = best_chip + 1;
+            return;
+        }
+        rejected_chips[best_chip] = true;
+    }
+    domain->StripeLpaToPlane(lpa, address);
+}
+
+void AddressMappingPageLevel::ProgramAllocated(const PhysicalPageAddress &address)
+{
+    uint64_t chip_index = address.channel_id * chips_per_channel + address.chip_id;
+    uint64_t die_index = chip_index * dies_per_chip + address.die_id;
+    chip_program_backlog[chip_index]++;
+    die_program_backlog[die_index]++;
+    plane_program_backlog[die_index * planes_per_die + address.plane_id]++;
+}
+
+void AddressMappingPageLevel::ProgramFinished(const PhysicalPageAddress &address)
+{
+    uint64_t chip_index = address.channel_id * chips_per_channel + address.chip_id;
+    uint64_t die_index = chip_index * dies_per_chip + address.die_id;
+    chip_program_backlog[chip_index]--;
+    die_program_backlog[die_index]--;
+    plane_program_backlog[die_index * planes_per_die + address.plane_id]--;
 }
 
 void AddressMappingPageLevel::AllocatePageInPlaneForUserWrite(TransactionWritePtr tr)
@@ -336,24 +771,39 @@ void AddressMappingPageLevel::AllocatePageInPlaneForUserWrite(TransactionWritePt
 
     uint64_t prev_page_bitmap = domain->GetPageStatus(tr->stream_id, tr->lpa);
     uint64_t status_intersection = prev_page_bitmap & tr->write_sectors_bitmap;
-    if (status_intersection == prev_page_bitmap)
+    if (old_ppa == NO_VALUE)
+    { // 首次写入该 LPA，没有旧页
+    }
+    else if (status_intersection == prev_page_bitmap)
     { // 新写入完全覆盖先前写入的扇区，直接把原page标记为无效
-        PhysicalPageAddressPtr old_address = ConvertPPAtoAddress(old_ppa);
+        PhysicalPageAddress old_address = ConvertPPAtoAddress(old_ppa);
         block_manager->InvalidatePageInBlock(tr->stream_id, old_address);
+        block_manager->OverwriteIssuedOnBlock(old_address);
+        tr->overwritten_ppa = old_ppa;
     }
     else // 新写入未完全覆盖先前的扇区，需要读取旧数据
     {
         uint64_t read_page_bitmap = status_intersection ^ prev_page_bitmap; // 新写入没有覆盖到的扇区
-        read_page_bitmap &= 1;                                              // delete
-        auto update_read_tr = std::make_shared<TransactionRead>(/*TODO */);
+        uint64_t read_sectors_no = __builtin_popcountll(read_page_bitmap);
+        auto update_read_tr = MakeTransaction<TransactionRead>(tr->stream_id, TransactionSourceType::USERIO, TransactionType::READ, tr->priority,
+                                                                PhysicalPageAddress(), false, UserRequestType::READ,
+                                                                tr->lpa, old_ppa, read_sectors_no * (page_size_in_bytes / sectors_per_page), read_sectors_no);
+        update_read_tr->read_sectors_bitmap = read_page_bitmap;
         ConvertPPAtoAddress(old_ppa, update_read_tr->physical_address);
+        update_read_tr->physical_address_determined = true;
         block_manager->ReadTransactionStartedOnBlock(update_read_tr->physical_address);
         block_manager->InvalidatePageInBlock(tr->stream_id, update_read_tr->physical_address);
+        block_manager->OverwriteIssuedOnBlock(update_read_tr->physical_address);
+        tr->overwritten_ppa = old_ppa;
         tr->related_read = update_read_tr;
     }
-    block_manager->AllocateBlockAndPageInPlaneForUserWrite(tr->stream_id, tr->physical_address);
+    // 编程后的页还包含从旧页合并进来的扇区
+    tr->write_sectors_bitmap |= prev_page_bitmap;
+    block_manager->AllocateBlockAndPageInPlaneForUserWrite(tr->stream_id, tr->physical_address, tr->write_hint);
+    ProgramAllocated(tr->physical_address);
     tr->ppa = ConvertAddresstoPPA(tr->physical_address);
-    domain->UpdateMappingInfo(tr->stream_id, tr->lpa, tr->ppa, tr->write_sectors_bitmap | domain->GetPageStatus(tr->stream_id, tr->lpa));
+    tr->sequence = program_sequence++;
+    domain->UpdateMappingInfo(tr->stream_id, tr->lpa, tr->ppa, tr->write_sectors_bitmap);
 }
 
 void AddressMappingPageLevel::AllocatePageInPlaneForGCWrite(TransactionWritePtr tr)
@@ -366,7 +816,7 @@ void AddressMappingPageLevel::AllocatePageInPlaneForGCWrite(TransactionWritePtr
     }
     else
     {
-        PhysicalPageAddressPtr old_address = ConvertPPAtoAddress(old_ppa);
+        PhysicalPageAddress old_address = ConvertPPAtoAddress(old_ppa);
         block_manager->InvalidatePageInBlock(tr->stream_id, old_address);
         uint64_t prev_page_bitmap = domain->GetPageStatus(tr->stream_id, tr->lpa);
         if ((prev_page_bitmap & tr->write_sectors_bitmap) != prev_page_bitmap)
@@ -374,22 +824,85 @@ void AddressMappingPageLevel::AllocatePageInPlaneForGCWrite(TransactionWritePtr
             PRINT_ERROR("Unexpected mapping table status for GC write!");
         }
     }
-    block_manager->AllocateBlockAndPageInPlaneForGcWrite(tr->stream_id, tr->physical_address);
+    block_manager->AllocateBlockAndPageInPlaneForGcWrite(tr->stream_id, tr->physical_address, tr->write_hint);
+    ProgramAllocated(tr->physical_address);
     tr->ppa = ConvertAddresstoPPA(tr->physical_address);
+    tr->sequence = program_sequence++;
     domain->UpdateMappingInfo(tr->stream_id, tr->lpa, tr->ppa, tr->write_sectors_bitmap | domain->GetPageStatus(tr->stream_id, tr->lpa));
 }
 
+void AddressMappingPageLevel::PreconditionWrite(const uint64_t stream_id, const uint64_t lpa, const uint64_t write_sectors_bitmap, const uint64_t write_hint)
+{
+    PhysicalPageAddress address;
+    if (plane_allocation_scheme == PlaneAllocationScheme::DYNAMIC)
+    {
+        AllocatePlaneDynamically(stream_id, lpa, address);
+    }
+    else
+    {
+        domains[stream_id]->StripeLpaToPlane(lpa, address);
+    }
+    // 回收是同步的，不会有在途回收来补充空闲块；随机类策略一次可能选不到回收块，多试几次
+    for (uint64_t attempt = 0; ftl->gcwl_unit->StopServicingWrites(address); attempt++)
+    {
+        if (attempt == blocks_per_plane)
+        {
+            PRINT_ERROR("No block can be reclaimed on plane @" << address.channel_id << "@" << address.chip_id << "@" << address.die_id << "@"
+                                                              << address.plane_id << " during preconditioning!")
+        }
+        ftl->gcwl_unit->CheckGcRequired(block_manager->GetFreeBlockPoolSize(address), address);
+    }
+    uint64_t old_ppa = NO_VALUE, prev_page_bitmap = 0;
+    LookupMapping(stream_id, lpa, old_ppa, prev_page_bitmap);
+    if (old_ppa != NO_VALUE)
+    {
+        block_manager->InvalidatePageInBlock(stream_id, ConvertPPAtoAddress(old_ppa));
+    }
+    block_manager->AllocateBlockAndPageInPlaneForUserWrite(stream_id, address, write_hint);
+    ProgramImmediately(stream_id, lpa, address, write_sectors_bitmap | prev_page_bitmap);
+}
+
+void AddressMappingPageLevel::RelocatePageImmediately(const uint64_t stream_id, const uint64_t lpa, const PhysicalPageAddress &old_address, const uint64_t temperature)
+{
+    uint64_t ppa = NO_VALUE, write_state_bitmap = 0;
+    LookupMapping(stream_id, lpa, ppa, write_state_bitmap);
+    if (ppa != ConvertAddresstoPPA(old_address))
+    {
+        PRINT_ERROR("Inconsistent mapping table between FTL and NAND driver!")
+    }
+    block_manager->InvalidatePageInBlock(stream_id, old_address);
+    PhysicalPageAddress address = old_address;
+    block_manager->AllocateBlockAndPageInPlaneForGcWrite(stream_id, address, temperature);
+    ProgramImmediately(stream_id, lpa, address, write_state_bitmap);
+}
+
+void AddressMappingPageLevel::ProgramImmediately(const uint64_t stream_id, const uint64_t lpa, const PhysicalPageAddress &address, const uint64_t write_state_bitmap)
+{
+    // 分配时计入的在途编程立即完成，块写满后即可被选为回收块
+    block_manager->ProgramTransactionFinishedOnBlock(address);
+    PageMetadata metadata;
+    metadata.lpa = lpa;
+    metadata.stream_id = stream_id;
+    metadata.sequence = program_sequence++;
+    metadata.write_state_bitmap = write_state_bitmap;
+    metadata.erase_count = block_manager->GetPlaneBookKeepingEntry(address)->blocks[address.block_id]->erase_count;
+    nand_driver->SetPageMetadata(address, metadata);
+    StoreMapping(stream_id, lpa, ConvertAddresstoPPA(address), write_state_bitmap);
+}
+
 bool AddressMappingPageLevel::TranslateLpaToPpa(uint64_t stream_id, TransactionPtr tr)
 {
     auto domain = domains[stream_id];
     auto ppa = domain->GetPPA(stream_id, tr->lpa);
     if (tr->type == TransactionType::READ)
     {
+        tr->ppa = ppa;
         if (ppa == NO_VALUE)
         {
-            ppa = OnlineCreateEntryForRead(stream_id, tr->lpa, tr->physical_address, static_cast<TransactionRead *>(tr.get())->read_sectors_bitmap);
+            // 未写过或已 TRIM 的 LPA 没有物理页，由 FTL 直接完成，不访问 NAND
+            tr->physical_address_determined = true;
+            return true;
         }
-        tr->ppa = ppa;
         ConvertPPAtoAddress(ppa, tr->physical_address);
         block_manager->ReadTransactionStartedOnBlock(tr->physical_address);
         tr->physical_address_determined = true;
@@ -397,12 +910,12 @@ bool AddressMappingPageLevel::TranslateLpaToPpa(uint64_t stream_id, TransactionP
     }
     else
     {
-        AllocatePlaneForUserWrite(std::dynamic_pointer_cast<TransactionWrite>(tr));
+        AllocatePlaneForUserWrite(TransactionCast<TransactionWrite>(tr));
         if (ftl->gcwl_unit->StopServicingWrites(tr->physical_address))
         {
             return false;
         }
-        AllocatePageInPlaneForUserWrite(std::dynamic_pointer_cast<TransactionWrite>(tr));
+        AllocatePageInPlaneForUserWrite(TransactionCast<TransactionWrite>(tr));
         tr->physical_address_determined = true;
         return true;
     }
@@ -426,39 +939,282 @@ bool AddressMappingPageLevel::QueryCMT(TransactionPtr tr)
     return false;
 }
 
-uint64_t AddressMappingPageLevel::OnlineCreateEntryForRead(uint64_t stream_id, uint64_t lpa, PhysicalPageAddressPtr addr, uint64_t read_sectors_bitmap)
+void AddressMappingPageLevel::RebalanceCMTPartitions()
+{
+    cmt_lookups_since_rebalance = 0;
+    // 影子表项命中数近似各流再多 cmt_rebalance_step 个表项能多得的命中；LRU 下命中随栈深递减，
+    // 命中最少的流让出末尾同样多的表项损失也最小
+    std::vector<uint64_t> shadow_hits(total_stream_count);
+    uint64_t receiver = 0;
+    for (uint64_t stream_id = 0; stream_id < total_stream_count; stream_id++)
+    {
+        shadow_hits[stream_id] = domains[stream_id]->cmt->TakeShadowHitCount();
+        if (shadow_hits[stream_id] > shadow_hits[receiver])
+        {
+            receiver = stream_id;
+        }
+    }
+    uint64_t donor = NO_VALUE;
+    for (uint64_t stream_id = 0; stream_id < total_stream_count; stream_id++)
+    {
+        if (stream_id != receiver && domains[stream_id]->cmt->GetCapacity() >= cmt_min_partition + cmt_rebalance_step &&
+            (donor == NO_VALUE || shadow_hits[stream_id] < shadow_hits[donor]))
+        {
+            donor = stream_id;
+        }
+    }
+    if (donor == NO_VALUE || shadow_hits[donor] >= shadow_hits[receiver])
+    {
+        return;
+    }
+    domains[donor]->cmt->SetCapacity(domains[donor]->cmt->GetCapacity() - cmt_rebalance_step);
+    domains[receiver]->cmt->SetCapacity(domains[receiver]->cmt->GetCapacity() + cmt_rebalance_step);
+}
+
+void AddressMappingPageLevel::LoadMappingEntryFromGMT(const uint64_t stream_id, const uint64_t lpa)
 {
     auto domain = domains[stream_id];
-    addr->channel_id = domain->channel_ids[lpa % domain->channel_no];
-    addr->chip_id = domain->chip_ids[(lpa / domain->channel_no) % domain->chip_no];
-    addr->die_id = domain->die_ids[(lpa / (domain->channel_no * domain->chip_no)) % domain->die_no];
-    addr->plane_id = domain->plane_ids[(lpa / (domain->channel_no * domain->chip_no * domain->die_no)) % domain->plane_no];
+    while (!domain->cmt->CheckFreeSlotAvailability())
+    {
+        uint64_t evicted_lpa = 0;
+        CMTSlotPtr evicted_slot = domain->cmt->EvictOne(evicted_lpa);
+        if (evicted_slot->dirty)
+        {
+            // 共享 CMT 时被淘汰的表项可能属于其他流
+            GMTEntry &entry = domains[evicted_slot->stream_id]->global_mapping_table[evicted_lpa];
+            entry.ppa = evicted_slot->ppa;
+            entry.write_state_bitmap = evicted_slot->write_state_bitmap;
+        }
+    }
+    const GMTEntry &entry = domain->global_mapping_table[lpa];
+    domain->cmt->ReserveSlotForLpn(stream_id, lpa);
+    domain->cmt->Insert(stream_id, lpa, entry.ppa, entry.write_state_bitmap);
+}
 
-    block_manager->AllocateBlockAndPageInPlaneForUserWrite(stream_id, addr);
-    uint64_t ppa = ConvertAddresstoPPA(addr);
-    domain->UpdateMappingInfo(stream_id, lpa, ppa, read_sectors_bitmap);
-    return ppa;
+void AddressMappingPageLevel::TranslateLpaToPpaAndDispatch(std::vector<TransactionPtr> &transaction_list)
+{
+    TransactionBatchStack::Batch batch(transaction_batches);
+    std::vector<TransactionPtr> &ready_transactions = batch.transactions;
+    for (auto &tr : transaction_list)
+    {
+        if (IsLPALockedForGC(tr->stream_id, tr->lpa))
+        {
+            ManageUserTransactionFacingBarrier(tr);
+            continue;
+        }
+        if (tr->req_type == UserRequestType::TRIM)
+        {
+            // 在屏障上推迟的 TRIM，只修改映射
+            uint64_t trim_bitmap = static_cast<TransactionWrite *>(tr.get())->write_sectors_bitmap;
+            TrimLpaRange(tr->stream_id, tr->lpa, 1, trim_bitmap, trim_bitmap);
+            continue;
+        }
+        if (tr->type == TransactionType::WRITE && IsWriteQueuedBehindOverfullPlane(tr))
+        {
+            ManageUnsuccessfulTransaction(tr);
+            continue;
+        }
+        if (domains[tr->stream_id]->Mapping_entry_accessible(tr->stream_id, tr->lpa))
+        {
+            cmt_hit_count[tr->stream_id]++;
+        }
+        else
+        {
+            cmt_miss_count[tr->stream_id]++;
+            LoadMappingEntryFromGMT(tr->stream_id, tr->lpa);
+        }
+        if (sharing_mode == CMTSharingMode::UTILITY_PARTITIONING && ++cmt_lookups_since_rebalance == config.cache_param.cmt_rebalance_interval)
+        {
+            RebalanceCMTPartitions();
+        }
+        if (QueryCMT(tr))
+        {
+            ready_transactions.push_back(tr);
+        }
+    }
+    // 整批一次下发，按芯片分组提交
+    ftl->DispatchTransactions(ready_transactions);
+}
+
+bool AddressMappingPageLevel::IsWriteQueuedBehindOverfullPlane(TransactionPtr tr)
+{
+    if (overfull_waiting_write_count == 0)
+    {
+        return false;
+    }
+    AllocatePlaneForUserWrite(TransactionCast<TransactionWrite>(tr));
+    // 动态分配时同一 LPA 的写可能落到不同 plane，只要有写在等待就排队
+    if (plane_allocation_scheme == PlaneAllocationScheme::DYNAMIC)
+    {
+        return true;
+    }
+    return !Write_transactions_for_overfull_planes[tr->physical_address.channel_id][tr->physical_address.chip_id][tr->physical_address.die_id][tr->physical_address.plane_id].empty();
+}
+
+bool AddressMappingPageLevel::HasWritesWaitingForPlane(const PhysicalPageAddress plane_address) const
+{
+    if (plane_allocation_scheme == PlaneAllocationScheme::DYNAMIC)
+    {
+        return overfull_waiting_write_count != 0;
+    }
+    return !Write_transactions_for_overfull_planes[plane_address.channel_id][plane_address.chip_id][plane_address.die_id][plane_address.plane_id].empty();
+}
+
+bool AddressMappingPageLevel::ServiceWaitingWritesInOpenBlocks(const PhysicalPageAddress plane_address)
+{
+    auto &waiting = Write_transactions_for_overfull_planes[plane_address.channel_id][plane_address.chip_id][plane_address.die_id][plane_address.plane_id];
+    TransactionBatchStack::Batch batch(transaction_batches);
+    std::vector<TransactionPtr> &issued = batch.transactions;
+    while (!waiting.empty())
+    {
+        TransactionPtr tr = waiting.front();
+        if (IsLPALockedForGC(tr->stream_id, tr->lpa) ||
+            !block_manager->HasRoomInUserOpenBlock(tr->stream_id, tr->physical_address, static_cast<TransactionWrite *>(tr.get())->write_hint))
+        {
+            break;
+        }
+        waiting.pop_front();
+        overfull_waiting_write_count--;
+        if (!domains[tr->stream_id]->Mapping_entry_accessible(tr->stream_id, tr->lpa))
+        {
+            LoadMappingEntryFromGMT(tr->stream_id, tr->lpa);
+        }
+        AllocatePageInPlaneForUserWrite(TransactionCast<TransactionWrite>(tr));
+        tr->physical_address_determined = true;
+        issued.push_back(tr);
+    }
+    if (issued.empty())
+    {
+        return false;
+    }
+    ftl->DispatchTransactions(issued);
+    return true;
+}
+
+void AddressMappingPageLevel::TakeWaitingWrites(std::vector<TransactionPtr> &transactions)
+{
+    for (auto &chips : Write_transactions_for_overfull_planes)
+        for (auto &dies : chips)
+            for (auto &planes : dies)
+                for (auto &waiting : planes)
+                {
+                    transactions.insert(transactions.end(), waiting.begin(), waiting.end());
+                    waiting.clear();
+                }
+    overfull_waiting_write_count = 0;
 }
 
 void AddressMappingPageLevel::ManageUnsuccessfulTransaction(TransactionPtr tr)
 {
-    Write_transactions_for_overfull_planes[tr->physical_address->channel_id][tr->physical_address->chip_id][tr->physical_address->die_id]->insert(std::dynamic_pointer_cast<TransactionWrite>(tr));
+    if (ftl->IsReadOnly())
+    {
+        ftl->RejectWrite(tr);
+        return;
+    }
+    Write_transactions_for_overfull_planes[tr->physical_address.channel_id][tr->physical_address.chip_id][tr->physical_address.die_id][tr->physical_address.plane_id].push_back(tr);
+    overfull_waiting_write_count++;
+    // 回收未在进行时(例如选块时候选块都有在途读)主动再试一次，否则挂起的写可能等不到唤醒
+    ftl->gcwl_unit->ResumeGcForWaitingWrites(tr->physical_address);
 }
 
 void AddressMappingPageLevel::ManageUserTransactionFacingBarrier(TransactionPtr tr)
 {
-    auto domain = domains[tr->stream_id];
-    if (tr->type == TransactionType::READ)
+    domains[tr->stream_id]->transactions_behind_LPA_barrier[tr->lpa].push_back(tr);
+}
+
+bool AddressMappingPageLevel::IsLPALockedForGC(const uint64_t stream_id, const uint64_t lpa)
+{
+    return domains[stream_id]->locked_lpa.Contains(lpa);
+}
+
+void AddressMappingPageLevel::SaveSnapshot(SnapshotWriter &writer) const
+{
+    if (overfull_waiting_write_count != 0)
     {
-        domain->read_transactions_behind_LPA_barrier.insert({tr->lpa, tr});
+        PRINT_ERROR("Cannot take a snapshot while writes are waiting for free blocks!")
     }
-    else
+    writer.BeginSection(SnapshotSection::ADDRESS_MAPPING);
+    writer.Write(program_sequence);
+    writer.Write(chip_cursor);
+    std::vector<GMTEntry> table;
+    for (uint64_t stream_id = 0; stream_id < total_stream_count; stream_id++)
+    {
+        const AddressMappingDomain &domain = *domains[stream_id];
+        if (domain.locked_lpa.Size() != 0 || !domain.transactions_behind_LPA_barrier.empty() ||
+            !domain.waiting_unmapped_read_transactions.empty() || !domain.waiting_unmapped_program_transactions.empty())
+        {
+            PRINT_ERROR("Cannot take a snapshot while transactions of stream " << stream_id << " are waiting!")
+        }
+        table = domain.global_mapping_table;
+        domain.cmt->ForEachEntryFromLeastRecent([&](uint64_t entry_stream_id, uint64_t lpa, const CMTSlot &slot)
+                                                {
+                                                    if (entry_stream_id == stream_id)
+                                                    {
+                                                        table[lpa] = {slot.ppa, slot.write_state_bitmap};
+                                                    } });
+        writer.WriteVector(table);
+    }
+    // 共享 CMT 只写一次；每个表项记录 (stream_id, lpa, dirty)，值取自上面合并后的表
+    std::vector<CachedMappingTablePtr> cmts;
+    for (const auto &domain : domains)
     {
-        domain->program_transactions_behind_LPA_barrier.insert({tr->lpa, tr});
+        if (std::find(cmts.begin(), cmts.end(), domain->cmt) == cmts.end())
+        {
+            cmts.push_back(domain->cmt);
+        }
     }
+    std::vector<uint64_t> cmt_entries;
+    for (const auto &cmt : cmts)
+    {
+        cmt->ForEachEntryFromLeastRecent([&](uint64_t stream_id, uint64_t lpa, const CMTSlot &slot)
+                                         {
+                                             cmt_entries.push_back(stream_id);
+                                             cmt_entries.push_back(lpa);
+                                             cmt_entries.push_back(slot.dirty); });
+    }
+    writer.WriteVector(cmt_entries);
 }
 
-bool AddressMappingPageLevel::IsLPALockedForGC(const uint64_t stream_id, const uint64_t lpa)
+void AddressMappingPageLevel::LoadSnapshot(SnapshotReader &reader)
 {
-    return domains[stream_id]->locked_lpa.find(lpa) != domains[stream_id]->locked_lpa.end();
+    reader.ExpectSection(SnapshotSection::ADDRESS_MAPPING);
+    program_sequence = reader.Read<uint64_t>();
+    chip_cursor = reader.Read<uint64_t>() % chip_program_backlog.size();
+    for (auto &domain : domains)
+    {
+        if (reader.ReadCount(sizeof(GMTEntry)) != domain->global_mapping_table.size())
+        {
+            PRINT_ERROR("Snapshot was taken with a different logical space!")
+        }
+        reader.ReadArray(domain->global_mapping_table.data(), domain->global_mapping_table.size());
+        domain->cmt->Clear();
+    }
+    // 按从旧到新的顺序装入，CMT 满时淘汰最旧的表项，保存时的 LRU 顺序得以保留
+    std::vector<uint64_t> cmt_entries;
+    reader.ReadVector(cmt_entries);
+    if (cmt_entries.size() % 3 != 0)
+    {
+        PRINT_ERROR("Corrupted CMT entries in snapshot!")
+    }
+    for (uint64_t i = 0; i < cmt_entries.size(); i += 3)
+    {
+        uint64_t stream_id = cmt_entries[i], lpa = cmt_entries[i + 1];
+        if (stream_id >= total_stream_count || lpa >= domains[stream_id]->global_mapping_table.size())
+        {
+            PRINT_ERROR("Corrupted CMT entries in snapshot!")
+        }
+        auto &cmt = domains[stream_id]->cmt;
+        if (!cmt->CheckFreeSlotAvailability())
+        {
+            uint64_t evicted_lpa = 0;
+            cmt->EvictOne(evicted_lpa);
+        }
+        const GMTEntry &entry = domains[stream_id]->global_mapping_table[lpa];
+        cmt->ReserveSlotForLpn(stream_id, lpa);
+        cmt->Insert(stream_id, lpa, entry.ppa, entry.write_state_bitmap);
+        if (cmt_entries[i + 2])
+        {
+            cmt->Update(stream_id, lpa, entry.ppa, entry.write_state_bitmap);
+        }
+    }
 }
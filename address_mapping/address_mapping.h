@@ -1,6 +1,8 @@
 #pragma once
 #include "param.h"
 #include "nand_driver.h"
+#include "flash_geometry.h"
+#include "lpa_lock_table.h"
 
 enum class CMTEntryStatus
 {
@@ -20,6 +22,16 @@ public:
     uint64_t stream_id;
 };
 
+// 全局映射表(GMT)表项：CMT 未命中时从这里装入，CMT 淘汰脏表项时写回这里
+struct GMTEntry
+{
+    uint64_t ppa = NO_VALUE;
+    uint64_t write_state_bitmap = 0;
+};
+
+// 按名字解析 plane 分配方案(CWDP、DYNAMIC 等，不区分大小写)，失败返回 false
+bool ParsePlaneAllocationScheme(const std::string &name, PlaneAllocationScheme &scheme);
+
 class CachedMappingTable
 {
 public:
@@ -37,11 +49,29 @@ public:
     CMTSlotPtr EvictOne(uint64_t &lpa);
     bool IsDirty(const uint64_t stream_id, const uint64_t lpa);
     void MakeClean(const uint64_t stream_id, const uint64_t lpa);
+    // 对 [first_lpa, last_lpa] 内已装入的有效表项调用 fn(lpa, ppa, write_state_bitmap)，fn 返回 true 表示表项被修改，置脏。
+    // 区间比 CMT 大时改为扫描整个 CMT，避免逐个 LPA 查表
+    void ForEachEntryInRange(const uint64_t stream_id, const uint64_t first_lpa, const uint64_t last_lpa,
+                             const std::function<bool(uint64_t, uint64_t &, uint64_t &)> &fn);
+    // 从最久未用到最近使用依次对有效表项调用 fn(stream_id, lpa, slot)
+    void ForEachEntryFromLeastRecent(const std::function<void(uint64_t, uint64_t, const CMTSlot &)> &fn) const;
+    void Clear();
+    // 缩小容量时多出的表项留到下次装入时按 LRU 淘汰
+    void SetCapacity(const uint64_t capacity) { capacity_in_entries = capacity; }
+    uint64_t GetCapacity() const { return capacity_in_entries; }
+    // 记住最近淘汰的 count 个表项(影子表项)；装入的表项在其中说明容量再大 count 就能命中
+    void TrackShadowEntries(const uint64_t count) { shadow_capacity = count; }
+    // 返回上次调用以来影子表项的命中数并清零
+    uint64_t TakeShadowHitCount();
 
 private:
     std::unordered_map<uint64_t, CMTSlotPtr> address_map; // key: LPN, value: slot_ptr
     std::list<std::pair<uint64_t, CMTSlotPtr>> lru_list;  // LRU链表，存储 (LPN, slot) pair
     size_t capacity_in_entries;                           // 缓存容量，以映射表项数为
+    std::list<uint64_t> shadow_lru;                       // 影子表项的 key，最近淘汰的在前
+    std::unordered_map<uint64_t, std::list<uint64_t>::iterator> shadow_map;
+    uint64_t shadow_capacity = 0;
+    uint64_t shadow_hit_count = 0;
 };
 
 class AddressMappingDomain
@@ -56,14 +86,18 @@ public:
     uint64_t GetPageStatus(const uint64_t stream_id, const uint64_t lpa);
     uint64_t GetPPA(const uint64_t stream_id, const uint64_t lpa);
     bool Mapping_entry_accessible(const uint64_t stream_id, const uint64_t lpa);
+    void StripeLpaToPlane(const uint64_t lpa, PhysicalPageAddress &address);
+    // 设置静态条带化的维度顺序；DYNAMIC 时条带化只用于给未写过的 LPA 建立读映射，按 CWDP 处理
+    void SetStripeOrder(PlaneAllocationScheme scheme);
 
     uint64_t CMT_entry_size;
     CachedMappingTablePtr cmt;
+    std::vector<GMTEntry> global_mapping_table; // 按 LPA 下标
     std::multimap<uint64_t, TransactionPtr> waiting_unmapped_read_transactions;    // key: LPA, value: tr_ptr
     std::multimap<uint64_t, TransactionPtr> waiting_unmapped_program_transactions; // key: LPA, value: tr_ptr
-    std::set<uint64_t> locked_lpa;
-    std::multimap<uint64_t, TransactionPtr> read_transactions_behind_LPA_barrier;    // key: LPA, value: tr_ptr
-    std::multimap<uint64_t, TransactionPtr> program_transactions_behind_LPA_barrier; // key: LPA, value: tr_ptr
+    LpaLockTable locked_lpa; // 正在被 GC 搬移的 LPA
+    // key: LPA，value: 按到达顺序排队的读/写事务；读写共用一个队列，解锁后保持同一 LPA 上的先后顺序
+    std::unordered_map<uint64_t, std::vector<TransactionPtr>> transactions_behind_LPA_barrier;
 
     uint64_t channel_no;
     uint64_t chip_no;
@@ -73,6 +107,11 @@ public:
     std::shared_ptr<uint64_t[]> chip_ids;
     std::shared_ptr<uint64_t[]> die_ids;
     std::shared_ptr<uint64_t[]> plane_ids;
+    FastDivider channel_no_div;
+    FastDivider chip_no_div;
+    FastDivider die_no_div;
+    FastDivider plane_no_div;
+    uint8_t stripe_order[4] = {0, 1, 2, 3}; // 条带化时依次取余的维度：0 channel，1 chip，2 die，3 plane
 
     uint64_t max_logical_sector_address;
     uint64_t total_logical_page_no;
@@ -82,26 +121,64 @@ public:
 class AddressMappingPageLevel
 {
 public:
-    AddressMappingPageLevel();
+    AddressMappingPageLevel(FTLPtr ftl_ptr, NandDriverPtr nand_driver_ptr, BlockManagerPtr block_manager_ptr);
     ~AddressMappingPageLevel() = default;
     uint64_t GetCMTCapacity();
     uint64_t GetLogicalPagesNo(uint64_t stream_id);
     uint64_t GetStreamsNo() { return total_stream_count; };
 
-    void TranslateLpaToPpaAndDispatch(std::list<TransactionPtr> &tr);
+    void TranslateLpaToPpaAndDispatch(std::vector<TransactionPtr> &tr);
     void GetDataMappingForGC(uint64_t stream_id, uint64_t lpa, uint64_t &ppa, uint64_t &write_state_bitmap);
     void AllocateNewPageForGC(TransactionWritePtr tr);
     uint64_t GetDevicePhysicalPagesCount() { return total_physical_pages_no; };
     uint64_t GetDeviceLogicalPagesCount(uint64_t stream_id) { return domains[stream_id]->total_logical_page_no; };
     CMTSharingMode GetCMTSharingMode() const { return sharing_mode; }
-    PhysicalPageAddressPtr ConvertPPAtoAddress(const uint64_t ppa);
-    void ConvertPPAtoAddress(const uint64_t ppa, PhysicalPageAddressPtr address);
-    uint64_t ConvertAddresstoPPA(const PhysicalPageAddressPtr address);
+    // 分区时为该流的 CMT 分区容量，共享时为整个 CMT 的容量
+    uint64_t GetCMTPartitionCapacity(uint64_t stream_id) const { return domains[stream_id]->cmt->GetCapacity(); }
+    uint64_t GetCMTHitCount(uint64_t stream_id) const { return cmt_hit_count[stream_id]; }
+    uint64_t GetCMTMissCount(uint64_t stream_id) const { return cmt_miss_count[stream_id]; }
+    PhysicalPageAddress ConvertPPAtoAddress(const uint64_t ppa);
+    void ConvertPPAtoAddress(const uint64_t ppa, PhysicalPageAddress &address);
+    uint64_t ConvertAddresstoPPA(const PhysicalPageAddress address);
 
-    void SetBarrierForPhysicalBlock(const PhysicalPageAddressPtr address);
+    void SetBarrierForPhysicalBlock(const PhysicalPageAddress address);
     void SetBarrierForLPA(const uint64_t stream_id, const uint64_t lpa);
+    // 解除 LPA 的 GC 屏障，并按到达顺序重新翻译、下发在该 LPA 上等待的事务
     void RemoveBarrierForLPA(const uint64_t stream_id, const uint64_t lpa);
-    void StartServicingWritesForOverfullPlane(const PhysicalPageAddressPtr plane_address);
+    // plane 回收出空闲块后，按到达顺序重新下发因该 plane 空闲块不足而挂起的写；动态分配时挂起的写可落到任意 plane，全部重试
+    void StartServicingWritesForOverfullPlane(const PhysicalPageAddress plane_address);
+    // 该 plane 队列中有等待空闲块的写；动态分配时等待的写可能落到任意 plane，只要有写在等待就返回 true
+    bool HasWritesWaitingForPlane(const PhysicalPageAddress plane_address) const;
+    // 停写的 plane 没有可回收的块时，按到达顺序下发该 plane 队列中写入打开块剩余页即可的写，不消耗空闲块；
+    // 它们覆盖的旧页成为无效页后 GC 才有块可回收。返回是否下发了写
+    bool ServiceWaitingWritesInOpenBlocks(const PhysicalPageAddress plane_address);
+    // 取出所有 plane 队列中等待空闲块的写，按原顺序追加到 transactions
+    void TakeWaitingWrites(std::vector<TransactionPtr> &transactions);
+    // 写事务(用户或 GC)在 NAND 上完成，用于动态 plane 分配的负载统计
+    void ProgramFinished(const PhysicalPageAddress &address);
+    PlaneAllocationScheme GetPlaneAllocationScheme() const { return plane_allocation_scheme; }
+    // TRIM 连续的 page_count 个逻辑页：首/尾页只 TRIM 位图中的扇区，中间页整页 TRIM。
+    // 扇区全部被 TRIM 的页解除映射并在块管理中置为无效；不在 CMT 中的表项直接改 GMT，不装入 CMT。返回解除映射的页数。
+    // 正在被 GC 搬移的 LPA 排在屏障上，搬移完成后再 TRIM，不计入返回值
+    uint64_t TrimLpaRange(const uint64_t stream_id, const uint64_t first_lpa, const uint64_t page_count,
+                          const uint64_t first_page_bitmap, const uint64_t last_page_bitmap);
+    // 上电恢复：直接写入 GMT 表项，CMT 保持为空
+    void RestoreMappingEntry(const uint64_t stream_id, const uint64_t lpa, const uint64_t ppa, const uint64_t write_state_bitmap);
+    void GetMappingEntry(const uint64_t stream_id, const uint64_t lpa, uint64_t &ppa, uint64_t &write_state_bitmap) { LookupMapping(stream_id, lpa, ppa, write_state_bitmap); }
+    uint64_t GetProgramSequence() const { return program_sequence; }
+    void SetProgramSequence(const uint64_t sequence) { program_sequence = sequence; }
+    // TRIM 修改表项后回调(整页解除映射时 ppa 为 NO_VALUE)，检查点日志据此记录 TRIM
+    using TrimListener = std::function<void(uint64_t stream_id, uint64_t lpa, uint64_t ppa, uint64_t write_state_bitmap)>;
+    void SetTrimListener(TrimListener listener) { trim_listener = std::move(listener); }
+    // 保存/恢复 L2P 表(CMT 中较新的表项合并进 GMT 后保存)、CMT 中的表项及其 LRU 顺序和编程序号；保存时不能有等待中的事务。
+    // 载入时 CMT 容量可以与保存时不同，放不下的表项按 LRU 丢弃，其映射已在 GMT 中
+    void SaveSnapshot(SnapshotWriter &writer) const;
+    void LoadSnapshot(SnapshotReader &reader);
+    // 快速预处理：不产生事务和 NAND 命令，当场完成一次用户写(选 plane、置旧页无效、分配页、更新映射并写入页备用区)。
+    // write_sectors_bitmap 与旧页中的扇区合并，相当于读改写；空闲块不足时由 GC 单元同步回收
+    void PreconditionWrite(const uint64_t stream_id, const uint64_t lpa, const uint64_t write_sectors_bitmap, const uint64_t write_hint);
+    // 快速预处理中 GC 同步回收时搬移一个有效页，留在原 plane 中该温度类别的 GC 打开块中
+    void RelocatePageImmediately(const uint64_t stream_id, const uint64_t lpa, const PhysicalPageAddress &old_address, const uint64_t temperature);
 
 private:
     FTLPtr ftl;
@@ -113,6 +190,13 @@ private:
     uint64_t max_logical_sector_address;
 
     uint64_t cmt_capacity_in_entries;
+    std::vector<uint64_t> cmt_hit_count;  // 按流统计用户事务翻译时的 CMT 命中/未命中
+    std::vector<uint64_t> cmt_miss_count;
+    // UTILITY_PARTITIONING：每次挪动的表项数(也是每个分区的影子表项数)、分区下限和距上次调整的查询数
+    uint64_t cmt_rebalance_step = 0;
+    uint64_t cmt_min_partition = 0;
+    uint64_t cmt_lookups_since_rebalance = 0;
+    void RebalanceCMTPartitions();
 
     uint64_t channel_no;
     uint64_t chips_per_channel;
@@ -130,17 +214,44 @@ private:
     uint64_t pages_per_chip;
     uint64_t pages_per_die;
     uint64_t pages_per_plane;
-    std::unique_ptr<std::set<TransactionWritePtr> ***[]> Write_transactions_for_overfull_planes;
+    FlashGeometry geometry; // 构造时预计算的几何参数，PPA 转换热路径只用移位/乘法
+    // [channel][chip][die][plane]，每个 plane 一个按到达顺序排队的写事务队列
+    std::vector<std::vector<std::vector<std::vector<std::deque<TransactionPtr>>>>> Write_transactions_for_overfull_planes;
+    uint64_t overfull_waiting_write_count = 0; // 所有 plane 队列中等待的写事务总数
 
     double overprovisioning_ratio;
 
+    // 动态 plane 分配：已分配页、尚未编程完成的写事务数
+    PlaneAllocationScheme plane_allocation_scheme;
+    std::vector<uint64_t> chip_program_backlog;  // [channel * chips_per_channel + chip]
+    std::vector<uint64_t> die_program_backlog;   // [chip 下标 * dies_per_chip + die]
+    std::vector<uint64_t> plane_program_backlog; // [die 下标 * planes_per_die + plane]
+    uint64_t chip_cursor = 0;                    // 负载相同时从这里开始轮转，使连续的写分散到各芯片
+    uint64_t program_sequence = 0;               // 下一个编程序号，每分配一个物理页加一
+    std::vector<bool> scratch_rejected_chips;
+    TransactionBatchStack transaction_batches; // 释放的等待事务和翻译完成待下发的事务
+    TrimListener trim_listener;
+
     void AllocatePlaneForUserWrite(TransactionWritePtr tr);
+    // 选出 NAND 队列最短的芯片，再在芯片内选积压最少、空闲块最多且未因空闲块不足停止写入的 plane。
+    // 所有 plane 都停止写入时退回静态条带化，由 overfull plane 队列等待 GC
+    void AllocatePlaneDynamically(const uint64_t stream_id, const uint64_t lpa, PhysicalPageAddress &address);
+    void ProgramAllocated(const PhysicalPageAddress &address);
     void AllocatePageInPlaneForUserWrite(TransactionWritePtr tr);
     void AllocatePageInPlaneForGCWrite(TransactionWritePtr tr);
     bool TranslateLpaToPpa(uint64_t stream_id, TransactionPtr tr);
 
     bool QueryCMT(TransactionPtr tr);
-    uint64_t OnlineCreateEntryForRead(uint64_t stream_id, uint64_t lpa, PhysicalPageAddressPtr addr, uint64_t read_sectors_bitmap);
+    // CMT 未命中：必要时按 LRU 淘汰表项(脏表项写回 GMT)，再从 GMT 装入该 LPA 的映射
+    void LoadMappingEntryFromGMT(const uint64_t stream_id, const uint64_t lpa);
+    // 不装入 CMT 查询映射：CMT 中的表项比 GMT 新，优先使用
+    void LookupMapping(const uint64_t stream_id, const uint64_t lpa, uint64_t &ppa, uint64_t &write_state_bitmap);
+    // 不装入 CMT 修改映射：表项在 CMT 中时改 CMT 并置脏，否则直接改 GMT
+    void StoreMapping(const uint64_t stream_id, const uint64_t lpa, const uint64_t ppa, const uint64_t write_state_bitmap);
+    // 快速预处理：刚分配的页当场编程完成，只写备用区
+    void ProgramImmediately(const uint64_t stream_id, const uint64_t lpa, const PhysicalPageAddress &address, const uint64_t write_state_bitmap);
+    // 写不能越过目标 plane 队列中已在等待的写，否则同一 LPA 先到的写可能晚于后到的写分配物理页，映射回退到旧数据
+    bool IsWriteQueuedBehindOverfullPlane(TransactionPtr tr);
     void ManageUnsuccessfulTransaction(TransactionPtr tr);
     void ManageUserTransactionFacingBarrier(TransactionPtr tr);
     bool IsLPALockedForGC(const uint64_t stream_id, const uint64_t lpa);
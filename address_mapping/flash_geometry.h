@@ -0,0 +1,151 @@
+#pragma once
+#include "param.h"
+#include "transaction.h"
+
+/*
+ * 常量除数的快速除法/取模
+ * 除数为2的幂时直接移位/掩码；否则按 libdivide 的无符号64位算法预先计算乘法逆元，
+ * 运行时一次 128 位乘法取高位 + 移位即可得到商，避免硬件除法。
+ * 构造函数是 constexpr 的，若除数在编译期已知，magic/shift 会被常量折叠。
+ */
+class FastDivider
+{
+public:
+    constexpr FastDivider(uint64_t divisor = 1) : divisor(divisor), magic(0), shift(0), add_indicator(false), is_power_of_2(false)
+    {
+        if (divisor == 0)
+        {
+            throw std::logic_error("FastDivider: division by zero!");
+        }
+        uint64_t floor_log_2_d = 63 - __builtin_clzll(divisor);
+        if ((divisor & (divisor - 1)) == 0)
+        {
+            is_power_of_2 = true;
+            shift = floor_log_2_d;
+            return;
+        }
+        // proposed_m = floor(2^(64+log2(d)) / d)，商一定小于 2^64
+        unsigned __int128 numerator = static_cast<unsigned __int128>(1) << (64 + floor_log_2_d);
+        uint64_t proposed_m = static_cast<uint64_t>(numerator / divisor);
+        uint64_t rem = static_cast<uint64_t>(numerator - static_cast<unsigned __int128>(proposed_m) * divisor);
+        uint64_t e = divisor - rem;
+        if (e < (1ULL << floor_log_2_d))
+        {
+            shift = floor_log_2_d;
+        }
+        else
+        {
+            // 逆元需要65位，额外用一次 "加回再右移" 修正
+            proposed_m += proposed_m;
+            uint64_t twice_rem = rem + rem;
+            if (twice_rem >= divisor || twice_rem < rem)
+            {
+                proposed_m += 1;
+            }
+            shift = floor_log_2_d;
+            add_indicator = true;
+        }
+        magic = proposed_m + 1;
+    }
+
+    constexpr uint64_t Divide(uint64_t n) const
+    {
+        if (is_power_of_2)
+        {
+            return n >> shift;
+        }
+        uint64_t q = static_cast<uint64_t>((static_cast<unsigned __int128>(magic) * n) >> 64);
+        if (add_indicator)
+        {
+            return (((n - q) >> 1) + q) >> shift;
+        }
+        return q >> shift;
+    }
+
+    constexpr uint64_t Mod(uint64_t n) const
+    {
+        if (is_power_of_2)
+        {
+            return n & (divisor - 1);
+        }
+        return n - Divide(n) * divisor;
+    }
+
+    // 同时得到商和余数，余数由商回乘得到，只做一次乘法逆元
+    constexpr uint64_t DivMod(uint64_t n, uint64_t &remainder) const
+    {
+        uint64_t q = Divide(n);
+        remainder = n - q * divisor;
+        return q;
+    }
+
+    constexpr uint64_t GetDivisor() const { return divisor; }
+
+private:
+    uint64_t divisor;
+    uint64_t magic;
+    uint64_t shift;
+    bool add_indicator;
+    bool is_power_of_2;
+};
+
+/*
+ * 闪存几何参数及 PPA <-> 物理地址 转换
+ * 所有除数在构造时预计算。PPA 按 channel/chip/die/plane/block/page 由高到低线性排布。
+ * 若以 constexpr 方式构造(几何参数编译期已知)，转换代码会被完全特化为常量移位/乘法。
+ */
+class FlashGeometry
+{
+public:
+    constexpr FlashGeometry(uint64_t channel_no = 1, uint64_t chips_per_channel = 1, uint64_t dies_per_chip = 1,
+                            uint64_t planes_per_die = 1, uint64_t blocks_per_plane = 1, uint64_t pages_per_block = 1)
+        : channel_no(channel_no), chips_per_channel(chips_per_channel), dies_per_chip(dies_per_chip),
+          planes_per_die(planes_per_die), blocks_per_plane(blocks_per_plane), pages_per_block(pages_per_block),
+          pages_per_plane(pages_per_block * blocks_per_plane),
+          pages_per_die(pages_per_block * blocks_per_plane * planes_per_die),
+          pages_per_chip(pages_per_block * blocks_per_plane * planes_per_die * dies_per_chip),
+          pages_per_channel(pages_per_block * blocks_per_plane * planes_per_die * dies_per_chip * chips_per_channel),
+          total_pages_no(pages_per_block * blocks_per_plane * planes_per_die * dies_per_chip * chips_per_channel * channel_no),
+          pages_per_block_div(pages_per_block), blocks_per_plane_div(blocks_per_plane), planes_per_die_div(planes_per_die),
+          dies_per_chip_div(dies_per_chip), chips_per_channel_div(chips_per_channel)
+    {
+    }
+
+    constexpr PhysicalPageAddress ConvertPPAtoAddress(uint64_t ppa) const
+    {
+        // 由低到高逐级拆分，每级一次快速除法
+        uint64_t page_id = 0, block_id = 0, plane_id = 0, die_id = 0, chip_id = 0;
+        uint64_t q = pages_per_block_div.DivMod(ppa, page_id);
+        q = blocks_per_plane_div.DivMod(q, block_id);
+        q = planes_per_die_div.DivMod(q, plane_id);
+        q = dies_per_chip_div.DivMod(q, die_id);
+        q = chips_per_channel_div.DivMod(q, chip_id);
+        return PhysicalPageAddress(q, chip_id, die_id, plane_id, block_id, page_id);
+    }
+
+    constexpr uint64_t ConvertAddresstoPPA(const PhysicalPageAddress address) const
+    {
+        return pages_per_channel * address.channel_id + pages_per_chip * address.chip_id + pages_per_die * address.die_id +
+               pages_per_plane * address.plane_id + pages_per_block * address.block_id + address.page_id;
+    }
+
+    uint64_t channel_no;
+    uint64_t chips_per_channel;
+    uint64_t dies_per_chip;
+    uint64_t planes_per_die;
+    uint64_t blocks_per_plane;
+    uint64_t pages_per_block;
+
+    uint64_t pages_per_plane;
+    uint64_t pages_per_die;
+    uint64_t pages_per_chip;
+    uint64_t pages_per_channel;
+    uint64_t total_pages_no;
+
+private:
+    FastDivider pages_per_block_div;
+    FastDivider blocks_per_plane_div;
+    FastDivider planes_per_die_div;
+    FastDivider dies_per_chip_div;
+    FastDivider chips_per_channel_div;
+};
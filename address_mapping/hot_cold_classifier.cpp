@@ -0,0 +1,80 @@
+#include "hot_cold_classifier.h"
+#include "state_snapshot.h"
+
+HotColdClassifier::HotColdClassifier(uint64_t class_count, uint64_t table_size, uint64_t decay_interval)
+    : class_count(class_count == 0 ? 1 : class_count)
+{
+    if (table_size == 0 || (table_size & (table_size - 1)) != 0)
+    {
+        PRINT_ERROR("Hot/cold classifier table size must be a power of two!")
+    }
+    table_mask = table_size - 1;
+    this->decay_interval = decay_interval == 0 ? table_size : decay_interval;
+    counters.assign(table_size, 0);
+}
+
+uint64_t HotColdClassifier::EstimateCount(uint64_t key, uint64_t &index0, uint64_t &index1) const
+{
+    uint64_t h = key * 0x9e3779b97f4a7c15ULL;
+    h ^= h >> 32;
+    index0 = h & table_mask;
+    index1 = (h * 0xc2b2ae3d27d4eb4fULL >> 29) & table_mask;
+    return std::min(counters[index0], counters[index1]);
+}
+
+uint64_t HotColdClassifier::CountToClass(uint64_t count) const
+{
+    // 0 次 -> 0，1 次 -> 1，2~3 次 -> 2，4~7 次 -> 3 ...
+    uint64_t level = count == 0 ? 0 : 64 - __builtin_clzll(count);
+    return std::min(level, class_count - 1);
+}
+
+uint64_t HotColdClassifier::Classify(const uint64_t stream_id, const uint64_t lpa) const
+{
+    uint64_t index0, index1;
+    return CountToClass(EstimateCount(LPN_TO_UNIQUE_KEY(stream_id, lpa), index0, index1));
+}
+
+uint64_t HotColdClassifier::RecordWriteAndClassify(const uint64_t stream_id, const uint64_t lpa)
+{
+    uint64_t index0, index1;
+    uint64_t count = EstimateCount(LPN_TO_UNIQUE_KEY(stream_id, lpa), index0, index1);
+    if (count < UINT8_MAX)
+    {
+        // 保守更新：只增加等于最小值的计数器，减少哈希冲突带来的高估
+        if (counters[index0] == count)
+            counters[index0]++;
+        if (counters[index1] == count)
+            counters[index1]++;
+    }
+    if (++writes_since_decay >= decay_interval)
+    {
+        Decay();
+    }
+    return CountToClass(count);
+}
+
+void HotColdClassifier::Decay()
+{
+    writes_since_decay = 0;
+    for (auto &counter : counters)
+    {
+        counter >>= 1;
+    }
+}
+
+void HotColdClassifier::SaveSnapshot(SnapshotWriter &writer) const
+{
+    writer.Write(writes_since_decay);
+    writer.WriteVector(counters);
+}
+
+void HotColdClassifier::LoadSnapshot(SnapshotReader &reader)
+{
+    writes_since_decay = reader.Read<uint64_t>();
+    if (reader.ReadCount(sizeof(uint8_t)) != counters.size())
+    {
+        PRINT_ERROR("Snapshot was taken with a different hot/cold classifier table size!")
+    }
+    reader.ReadArray(counters.data(), counters.size());
+}
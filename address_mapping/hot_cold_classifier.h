@@ -0,0 +1,33 @@
+#pragma once
+#include "param.h"
+
+/*
+ * 按 LPA 更新频率估计数据冷热
+ * 两路哈希的饱和计数器(count-min，保守更新)记录近期写入次数，每 decay_interval 次写入全部减半，
+ * 使分类反映近期而不是历史累计的更新频率。类别按写入前的计数取对数分级：0 最冷，class_count-1 最热
+ */
+class HotColdClassifier
+{
+public:
+    HotColdClassifier(uint64_t class_count, uint64_t table_size, uint64_t decay_interval);
+
+    // 记录一次写入并返回该 LPA 的温度类别
+    uint64_t RecordWriteAndClassify(const uint64_t stream_id, const uint64_t lpa);
+    // 只查询不记录
+    uint64_t Classify(const uint64_t stream_id, const uint64_t lpa) const;
+    // 保存/恢复计数器；载入时计数器个数必须相同
+    void SaveSnapshot(SnapshotWriter &writer) const;
+    void LoadSnapshot(SnapshotReader &reader);
+
+private:
+    uint64_t EstimateCount(uint64_t key, uint64_t &index0, uint64_t &index1) const;
+    uint64_t CountToClass(uint64_t count) const;
+    void Decay();
+
+    uint64_t class_count;
+    uint64_t table_mask;
+    uint64_t decay_interval;
+    uint64_t writes_since_decay = 0;
+    std::vector<uint8_t> counters;
+};
+using HotColdClassifierPtr = std::shared_ptr<HotColdClassifier>;
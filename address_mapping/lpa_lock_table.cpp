@@ -0,0 +1,84 @@
+#include "lpa_lock_table.h"
+
+LpaLockTable::LpaLockTable(uint64_t expected_count)
+{
+    Rehash(16);
+    Reserve(expected_count);
+}
+
+void LpaLockTable::Reserve(uint64_t expected_count)
+{
+    uint64_t capacity = slots.size();
+    while (capacity < expected_count * 2)
+    {
+        capacity *= 2;
+    }
+    if (capacity != slots.size())
+    {
+        Rehash(capacity);
+    }
+}
+
+void LpaLockTable::Rehash(uint64_t new_capacity)
+{
+    std::vector<uint64_t> old_slots;
+    old_slots.swap(slots);
+    slots.assign(new_capacity, NO_VALUE);
+    mask = new_capacity - 1;
+    shift = 64 - __builtin_ctzll(new_capacity);
+    count = 0;
+    for (uint64_t lpa : old_slots)
+    {
+        if (lpa != NO_VALUE)
+        {
+            Insert(lpa);
+        }
+    }
+}
+
+bool LpaLockTable::Insert(const uint64_t lpa)
+{
+    if ((count + 1) * 2 > slots.size())
+    {
+        Rehash(slots.size() * 2);
+    }
+    uint64_t index = Home(lpa);
+    while (slots[index] != NO_VALUE)
+    {
+        if (slots[index] == lpa)
+        {
+            return false;
+        }
+        index = (index + 1) & mask;
+    }
+    slots[index] = lpa;
+    count++;
+    return true;
+}
+
+bool LpaLockTable::Erase(const uint64_t lpa)
+{
+    uint64_t index = Home(lpa);
+    while (slots[index] != lpa)
+    {
+        if (slots[index] == NO_VALUE)
+        {
+            return false;
+        }
+        index = (index + 1) & mask;
+    }
+    // 向前回填：空出的位置之后、探测链没有断开的元素，若其初始位置不在 (hole, 当前位置] 之间就移到空位
+    uint64_t hole = index;
+    for (uint64_t next = (hole + 1) & mask; slots[next] != NO_VALUE; next = (next + 1) & mask)
+    {
+        uint64_t home = Home(slots[next]);
+        if (((next - home) & mask) >= ((next - hole) & mask))
+        {
+            slots[hole] = slots[next];
+            hole = next;
+        }
+    }
+    slots[hole] = NO_VALUE;
+    count--;
+    return true;
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include "param.h"
+
+/*
+ * GC 搬移期间被加锁的 LPA 集合
+ * 线性探测的开放寻址哈希表，槽位为 LPA 本身，空槽为 NO_VALUE；删除时把后继元素向前回填(backward shift)，不留墓碑。
+ * 容量按同时在途的 GC 搬移页数预留，稳态下加锁、解锁和查询都不分配内存；表为空时查询直接返回
+ */
+class LpaLockTable
+{
+public:
+    explicit LpaLockTable(uint64_t expected_count = 64);
+
+    // 预留至少容纳 expected_count 个 LPA 的空间(负载因子不超过 1/2)
+    void Reserve(uint64_t expected_count);
+    // 已存在时返回 false
+    bool Insert(const uint64_t lpa);
+    // 不存在时返回 false
+    bool Erase(const uint64_t lpa);
+    bool Contains(const uint64_t lpa) const
+    {
+        if (count == 0)
+        {
+            return false;
+        }
+        for (uint64_t index = Home(lpa);; index = (index + 1) & mask)
+        {
+            if (slots[index] == lpa)
+                return true;
+            if (slots[index] == NO_VALUE)
+                return false;
+        }
+    }
+    uint64_t Size() const { return count; }
+
+private:
+    uint64_t Home(const uint64_t lpa) const { return (lpa * 0x9e3779b97f4a7c15ULL) >> shift; }
+    void Rehash(uint64_t new_capacity);
+
+    std::vector<uint64_t> slots;
+    uint64_t mask = 0;
+    uint64_t shift = 64; // 64 - log2(容量)，取乘法哈希的高位
+    uint64_t count = 0;
+};
@@ -0,0 +1,231 @@
+#include "bitmap_kernel.h"
+#include <immintrin.h>
+
+namespace
+{
+    // 返回 words[from, to) 中第一个不是全1的字的下标，找不到返回 to
+    using FindNonFullFunc = uint64_t (*)(const uint64_t *, uint64_t, uint64_t);
+    using PopcountFunc = uint64_t (*)(const uint64_t *, uint64_t);
+
+    //============================================== 标量实现 ==============================================
+
+    uint64_t PopcountScalar(const uint64_t *words, uint64_t word_cnt)
+    {
+        uint64_t cnt = 0;
+        for (uint64_t i = 0; i < word_cnt; i++)
+        {
+            cnt += __builtin_popcountll(words[i]);
+        }
+        return cnt;
+    }
+
+    uint64_t FindNonFullScalar(const uint64_t *words, uint64_t from, uint64_t to)
+    {
+        for (uint64_t i = from; i < to; i++)
+        {
+            if (words[i] != ~0ULL)
+            {
+                return i;
+            }
+        }
+        return to;
+    }
+
+    //============================================== AVX2 实现 ==============================================
+
+    __attribute__((target("avx2,popcnt"))) uint64_t PopcountAvx2(const uint64_t *words, uint64_t word_cnt)
+    {
+        // Mula 算法: 以 4bit 为索引查表得到每个字节的置位数，再用 sad 横向累加到 64bit 通道
+        const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                                0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+        const __m256i low_mask = _mm256_set1_epi8(0x0f);
+        __m256i acc = _mm256_setzero_si256();
+        uint64_t i = 0;
+        for (; i + 4 <= word_cnt; i += 4)
+        {
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(words + i));
+            __m256i lo = _mm256_and_si256(v, low_mask);
+            __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), low_mask);
+            __m256i cnt = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, lo), _mm256_shuffle_epi8(lookup, hi));
+            acc = _mm256_add_epi64(acc, _mm256_sad_epu8(cnt, _mm256_setzero_si256()));
+        }
+        uint64_t cnt = static_cast<uint64_t>(_mm256_extract_epi64(acc, 0)) + static_cast<uint64_t>(_mm256_extract_epi64(acc, 1)) +
+                       static_cast<uint64_t>(_mm256_extract_epi64(acc, 2)) + static_cast<uint64_t>(_mm256_extract_epi64(acc, 3));
+        for (; i < word_cnt; i++)
+        {
+            cnt += _mm_popcnt_u64(words[i]);
+        }
+        return cnt;
+    }
+
+    __attribute__((target("avx2"))) uint64_t FindNonFullAvx2(const uint64_t *words, uint64_t from, uint64_t to)
+    {
+        const __m256i ones = _mm256_set1_epi64x(-1);
+        uint64_t i = from;
+        for (; i + 4 <= to; i += 4)
+        {
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(words + i));
+            int full_mask = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(v, ones)));
+            if (full_mask != 0xF)
+            {
+                return i + __builtin_ctz(~full_mask & 0xF);
+            }
+        }
+        return FindNonFullScalar(words, i, to);
+    }
+
+    //============================================== AVX-512 实现 ==============================================
+
+    __attribute__((target("avx512f,avx512bw,popcnt"))) uint64_t PopcountAvx512(const uint64_t *words, uint64_t word_cnt)
+    {
+        const __m512i lookup = _mm512_set4_epi32(0x04030302, 0x03020201, 0x03020201, 0x02010100);
+        const __m512i low_mask = _mm512_set1_epi8(0x0f);
+        __m512i acc = _mm512_setzero_si512();
+        uint64_t i = 0;
+        for (; i + 8 <= word_cnt; i += 8)
+        {
+            __m512i v = _mm512_loadu_si512(words + i);
+            __m512i lo = _mm512_and_si512(v, low_mask);
+            __m512i hi = _mm512_and_si512(_mm512_srli_epi16(v, 4), low_mask);
+            __m512i cnt = _mm512_add_epi8(_mm512_shuffle_epi8(lookup, lo), _mm512_shuffle_epi8(lookup, hi));
+            acc = _mm512_add_epi64(acc, _mm512_sad_epu8(cnt, _mm512_setzero_si512()));
+        }
+        // 不用 _mm512_reduce_add_epi64：GCC 12 在 -O2 下会对其内部未初始化的临时变量报 -Wuninitialized
+        alignas(64) uint64_t lanes[8];
+        _mm512_store_si512(lanes, acc);
+        uint64_t cnt = lanes[0] + lanes[1] + lanes[2] + lanes[3] + lanes[4] + lanes[5] + lanes[6] + lanes[7];
+        for (; i < word_cnt; i++)
+        {
+            cnt += _mm_popcnt_u64(words[i]);
+        }
+        return cnt;
+    }
+
+    __attribute__((target("avx512f"))) uint64_t FindNonFullAvx512(const uint64_t *words, uint64_t from, uint64_t to)
+    {
+        const __m512i ones = _mm512_set1_epi64(-1);
+        uint64_t i = from;
+        for (; i + 8 <= to; i += 8)
+        {
+            __mmask8 not_full = _mm512_cmpneq_epu64_mask(_mm512_loadu_si512(words + i), ones);
+            if (not_full)
+            {
+                return i + __builtin_ctz(not_full);
+            }
+        }
+        return FindNonFullScalar(words, i, to);
+    }
+
+    //============================================== 运行时分发 ==============================================
+
+    struct BitmapKernelTable
+    {
+        PopcountFunc popcount;
+        FindNonFullFunc find_non_full;
+        const char *isa;
+    };
+
+    BitmapKernelTable SelectKernels()
+    {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+        {
+            return {PopcountAvx512, FindNonFullAvx512, "avx512"};
+        }
+        if (__builtin_cpu_supports("avx2"))
+        {
+            return {PopcountAvx2, FindNonFullAvx2, "avx2"};
+        }
+        return {PopcountScalar, FindNonFullScalar, "scalar"};
+    }
+
+    const BitmapKernelTable &Kernels()
+    {
+        static const BitmapKernelTable table = SelectKernels();
+        return table;
+    }
+
+    // 位区间右端 end 所在字的掩码: 只保留 [0, end % 64) 的位，end 恰好对齐时保留整个字
+    inline uint64_t TailMask(uint64_t end)
+    {
+        uint64_t bits = end % 64;
+        return bits == 0 ? ~0ULL : ((1ULL << bits) - 1);
+    }
+}
+
+uint64_t BitmapPopcount(const uint64_t *words, uint64_t word_cnt)
+{
+    return Kernels().popcount(words, word_cnt);
+}
+
+uint64_t BitmapFindNextZero(const uint64_t *words, uint64_t begin, uint64_t end)
+{
+    if (begin >= end)
+    {
+        return NO_VALUE;
+    }
+    uint64_t first_word = begin / 64;
+    uint64_t last_word = (end - 1) / 64;
+
+    uint64_t zeros = ~words[first_word] & (~0ULL << (begin % 64));
+    if (first_word == last_word)
+    {
+        zeros &= TailMask(end);
+    }
+    if (zeros)
+    {
+        return first_word * 64 + __builtin_ctzll(zeros);
+    }
+    if (first_word == last_word)
+    {
+        return NO_VALUE;
+    }
+
+    // 中间的整字交给向量内核跳过全无效的字
+    uint64_t word = Kernels().find_non_full(words, first_word + 1, last_word);
+    if (word < last_word)
+    {
+        return word * 64 + __builtin_ctzll(~words[word]);
+    }
+
+    zeros = ~words[last_word] & TailMask(end);
+    if (zeros)
+    {
+        return last_word * 64 + __builtin_ctzll(zeros);
+    }
+    return NO_VALUE;
+}
+
+uint64_t BitmapEnumerateZeros(const uint64_t *words, uint64_t begin, uint64_t end, uint64_t *out)
+{
+    uint64_t cnt = 0;
+    uint64_t last_word = end == 0 ? 0 : (end - 1) / 64;
+    uint64_t pos = begin;
+    while (pos < end)
+    {
+        uint64_t found = BitmapFindNextZero(words, pos, end);
+        if (found == NO_VALUE)
+        {
+            break;
+        }
+        // 一次展开整个字，逐个取出最低的清零位
+        uint64_t word = found / 64;
+        uint64_t zeros = ~words[word] & (~0ULL << (found % 64));
+        if (word == last_word)
+        {
+            zeros &= TailMask(end);
+        }
+        while (zeros)
+        {
+            out[cnt++] = word * 64 + __builtin_ctzll(zeros);
+            zeros &= zeros - 1;
+        }
+        pos = (word + 1) * 64;
+    }
+    return cnt;
+}
+
+const char *BitmapKernelIsa()
+{
+    return Kernels().isa;
+}
@@ -0,0 +1,21 @@
+#pragma once
+#include "param.h"
+
+/*
+ * invalid_page_bitmap 扫描内核
+ * 位为1表示该页无效，位为0表示有效(或尚未写入，调用者负责用 current_write_page_index 截断范围)。
+ * 首次调用时根据 CPU 特性选择 AVX-512 / AVX2 / 标量实现，之后通过函数指针直接分发。
+ */
+
+// 统计 words[0, word_cnt) 中置位的总数
+uint64_t BitmapPopcount(const uint64_t *words, uint64_t word_cnt);
+
+// 在位区间 [begin, end) 中查找第一个清零位，找不到返回 NO_VALUE
+uint64_t BitmapFindNextZero(const uint64_t *words, uint64_t begin, uint64_t end);
+
+// 将位区间 [begin, end) 中所有清零位的下标按升序写入 out，返回写入个数
+// out 至少需要 end - begin 个元素的空间
+uint64_t BitmapEnumerateZeros(const uint64_t *words, uint64_t begin, uint64_t end, uint64_t *out);
+
+// 当前选中的指令集实现名称: "avx512" / "avx2" / "scalar"
+const char *BitmapKernelIsa();
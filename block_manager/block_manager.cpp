@@ -1,6 +1,38 @@
 #include "block_manager.h"
 #include "transaction.h"
 #include "gc_wl.h"
+#include "nand_driver.h"
+#include "bitmap_kernel.h"
+#include "state_snapshot.h"
+
+namespace
+{
+    // 快照中的块状态，块号由位置隐含
+    struct BlockSnapshotEntry
+    {
+        uint64_t current_write_page_index;
+        uint64_t invalid_page_count;
+        uint64_t erase_count;
+        uint64_t stream_id;
+        uint64_t write_hint;
+        uint64_t read_count;
+        uint64_t data_age_ns; // 保存时距擦除后第一次编程的时长，载入时换算回编程时刻
+        uint32_t current_status;
+        uint8_t hot_block;
+        uint8_t is_bad;
+        uint8_t is_reserved;
+        uint8_t read_reclaim_pending;
+    };
+
+    void WriteBlockIds(SnapshotWriter &writer, const std::vector<BlockPtr> &blocks)
+    {
+        writer.Write<uint64_t>(blocks.size());
+        for (const auto &block : blocks)
+        {
+            writer.Write<uint64_t>(block == nullptr ? NO_VALUE : block->block_id);
+        }
+    }
+}
 
 uint64_t BlockSlot::page_bitmap_size = 0;
 
@@ -9,6 +41,7 @@ void BlockSlot::Erase()
     current_write_page_index = 0;
     invalid_page_count = 0;
     erase_count++;
+    read_count = 0;
     stream_id = 0xff;
     ongoing_erase_tr = nullptr;
     for (size_t i = 0; i < page_bitmap_size; i++)
@@ -17,7 +50,7 @@ void BlockSlot::Erase()
     }
 }
 
-BlockPtr PlaneBookKeeping::GetOneFreeBlock(uint64_t stream_id)
+BlockPtr PlaneBookKeeping::GetOneFreeBlock(uint64_t stream_id, uint64_t write_hint)
 {
     if (free_block_pool.empty())
     {
@@ -26,11 +59,12 @@ BlockPtr PlaneBookKeeping::GetOneFreeBlock(uint64_t stream_id)
     auto block = free_block_pool.begin()->second;
     free_block_pool.erase(free_block_pool.begin());
     block->stream_id = stream_id;
+    block->write_hint = write_hint;
     block_usage_history.push(block->block_id);
     return block;
 }
 
-void PlaneBookKeeping::CheckBookKeepingCorrectness(const PhysicalPageAddressPtr plane_address)
+void PlaneBookKeeping::CheckBookKeepingCorrectness(const PhysicalPageAddress plane_address)
 {
     uint64_t all_pages_cnt = free_pages_count + valid_pages_count + invalid_pages_count;
     if (all_pages_cnt != total_pages_count)
@@ -39,7 +73,7 @@ void PlaneBookKeeping::CheckBookKeepingCorrectness(const PhysicalPageAddressPtr
     }
     if (free_pages_count == 0)
     {
-        PRINT_ERROR("Plane " << "@" << plane_address->channel_id << "@" << plane_address->chip_id << "@" << plane_address->die_id << "@" << plane_address->plane_id << " pool size: " << GetFreeBlockCount() << " ran out of free pages! Bad resource management! It is not safe to continue simulation!");
+        PRINT_ERROR("Plane " << "@" << plane_address.channel_id << "@" << plane_address.chip_id << "@" << plane_address.die_id << "@" << plane_address.plane_id << " pool size: " << GetFreeBlockCount() << " ran out of free pages! Bad resource management! It is not safe to continue simulation!");
     }
 }
 
@@ -58,12 +92,17 @@ void PlaneBookKeeping::AddToFreeBlockPool(BlockPtr block, bool consider_dynamic_
 BlockManager::BlockManager(GcWlUnitPtr gc_ptr, uint64_t block_pe_cycle,
                            uint64_t total_stream_count, uint64_t total_channel_count, uint64_t chips_per_channel,
                            uint64_t dies_per_chip, uint64_t planes_per_die, uint64_t blocks_per_plane,
-                           uint64_t pages_per_block)
+                           uint64_t pages_per_block, uint64_t write_hint_count, uint64_t gc_temperature_count, NandDriverPtr nand_driver)
     : gc_unit(gc_ptr), block_pe_cycle(block_pe_cycle), total_stream_count(total_stream_count),
       total_channel_count(total_channel_count), chips_per_channel(chips_per_channel),
       dies_per_chip(dies_per_chip), planes_per_die(planes_per_die),
-      blocks_per_plane(blocks_per_plane), pages_per_block(pages_per_block)
+      blocks_per_plane(blocks_per_plane), pages_per_block(pages_per_block), write_hint_count(write_hint_count == 0 ? 1 : write_hint_count),
+      gc_temperature_count(gc_temperature_count == 0 ? 1 : gc_temperature_count), nand_driver(nand_driver)
 {
+    if (!PhysicalPageAddress::FitsGeometry(total_channel_count, chips_per_channel, dies_per_chip, planes_per_die, blocks_per_plane, pages_per_block))
+    {
+        PRINT_ERROR("Flash geometry does not fit into the packed physical page address!")
+    }
     plane_manager.resize(total_channel_count);
     for (size_t channel_id = 0; channel_id < total_channel_count; channel_id++)
     {
@@ -84,6 +123,13 @@ BlockManager::BlockManager(GcWlUnitPtr gc_ptr, uint64_t block_pe_cycle,
                     plane->invalid_pages_count = 0;
                     plane->ongoing_erase_blocks.clear();
                     plane->blocks.resize(blocks_per_plane);
+                    // 计算每个Block的页位图数组大小
+                    // page_bitmap_size 表示需要多少个uint64_t元素来存储所有页的有效性信息
+                    // 1. 一个uint64_t有64位，可以表示64个页的状态
+                    // 2. pages_per_block/(8*sizeof(uint64_t)) 计算能被完整uint64_t覆盖的页组数
+                    // 3. pages_per_block%(8*sizeof(uint64_t))?1:0 判断是否有剩余页，若有则再多分配一个uint64_t
+                    BlockSlot::page_bitmap_size = pages_per_block / (8 * sizeof(uint64_t)) + (pages_per_block % (8 * sizeof(uint64_t)) ? 1 : 0);
+                    plane->invalid_page_bitmap.assign(blocks_per_plane * BlockSlot::page_bitmap_size, 0ULL);
 
                     for (size_t block_id = 0; block_id < blocks_per_plane; block_id++)
                     {
@@ -99,27 +145,34 @@ BlockManager::BlockManager(GcWlUnitPtr gc_ptr, uint64_t block_pe_cycle,
                         block->ongoing_user_program_cnt = 0;
                         block->ongoing_user_read_cnt = 0;
                         block->stream_id = 0xff; // 初始时不属于任何流
+                        block->write_hint = 0;
                         block->hot_block = false;
-                        // 计算每个Block的页位图数组大小
-                        // page_bitmap_size 表示需要多少个uint64_t元素来存储所有页的有效性信息
-                        // 1. 一个uint64_t有64位，可以表示64个页的状态
-                        // 2. pages_per_block/(8*sizeof(uint64_t)) 计算能被完整uint64_t覆盖的页组数
-                        // 3. pages_per_block%(8*sizeof(uint64_t))?1:0 判断是否有剩余页，若有则再多分配一个uint64_t
-                        BlockSlot::page_bitmap_size = pages_per_block / (8 * sizeof(uint64_t)) + (pages_per_block % (8 * sizeof(uint64_t)) ? 1 : 0);
-                        block->invalid_page_bitmap.resize(BlockSlot::page_bitmap_size);
-                        for (size_t i = 0; i < BlockSlot::page_bitmap_size; i++)
+                        block->invalid_page_bitmap = plane->invalid_page_bitmap.data() + block_id * BlockSlot::page_bitmap_size;
+                        // 坏块表中的块(出厂坏块和之前退役的块)不计入容量，也不进空闲池
+                        if (nand_driver != nullptr && nand_driver->IsBadBlock(PhysicalPageAddress(channel_id, chip_id, die_id, plane_id, block_id, 0)))
                         {
-                            block->invalid_page_bitmap[i] = 0ULL;
+                            block->is_bad = true;
+                            plane->bad_blocks.push_back(block);
+                            plane->total_pages_count -= pages_per_block;
+                            plane->free_pages_count -= pages_per_block;
+                            initial_bad_block_count++;
+                            continue;
                         }
                         plane->AddToFreeBlockPool(block, true); // 初始时将所有块加入空闲块池，考虑动态磨损均衡
                     }
-                    plane->data_open_blocks.resize(total_stream_count);
-                    plane->gc_open_blocks.resize(total_stream_count);
+                    plane->data_open_blocks.resize(total_stream_count * this->write_hint_count);
+                    plane->gc_open_blocks.resize(total_stream_count * this->gc_temperature_count);
                     plane->translation_open_blocks.resize(total_stream_count);
                     for (size_t stream_id = 0; stream_id < total_stream_count; stream_id++)
                     {
-                        plane->data_open_blocks[stream_id] = plane->GetOneFreeBlock(stream_id);
-                        plane->gc_open_blocks[stream_id] = plane->GetOneFreeBlock(stream_id);
+                        for (uint64_t write_hint = 0; write_hint < this->write_hint_count; write_hint++)
+                        {
+                            plane->data_open_blocks[stream_id * this->write_hint_count + write_hint] = plane->GetOneFreeBlock(stream_id, write_hint);
+                        }
+                        for (uint64_t temperature = 0; temperature < this->gc_temperature_count; temperature++)
+                        {
+                            plane->gc_open_blocks[stream_id * this->gc_temperature_count + temperature] = plane->GetOneFreeBlock(stream_id, temperature);
+                        }
                         plane->translation_open_blocks[stream_id] = plane->GetOneFreeBlock(stream_id);
                     }
                 }
@@ -128,47 +181,72 @@ BlockManager::BlockManager(GcWlUnitPtr gc_ptr, uint64_t block_pe_cycle,
     }
 }
 
-void BlockManager::AllocateBlockAndPageInPlaneForUserWrite(const uint64_t stream_id, PhysicalPageAddressPtr page_address)
+void BlockManager::AllocateBlockAndPageInPlaneForUserWrite(const uint64_t stream_id, PhysicalPageAddress &page_address, const uint64_t write_hint)
 {
     auto plane = GetPlaneBookKeepingEntry(page_address);
+    uint64_t hint = std::min(write_hint, write_hint_count - 1);
+    BlockPtr &open_block = plane->data_open_blocks[stream_id * write_hint_count + hint];
+    if (open_block->is_bad)
+    {
+        // 打开块编程失败后已封闭，到这次分配才换下
+        open_block = plane->GetOneFreeBlock(stream_id, hint);
+    }
     plane->valid_pages_count++;
     plane->free_pages_count--;
-    page_address->block_id = plane->data_open_blocks[stream_id]->block_id;
-    page_address->page_id = plane->data_open_blocks[stream_id]->current_write_page_index++;
+    page_address.block_id = open_block->block_id;
+    page_address.page_id = open_block->current_write_page_index++;
     ProgramTransactionIssued(page_address);
 
-    if (plane->data_open_blocks[stream_id]->current_write_page_index == pages_per_block)
+    if (open_block->current_write_page_index == pages_per_block)
     {
         // 当前块写满，分配新块
-        plane->data_open_blocks[stream_id] = plane->GetOneFreeBlock(stream_id);
+        open_block = plane->GetOneFreeBlock(stream_id, hint);
         gc_unit->CheckGcRequired(plane->GetFreeBlockCount(), page_address);
     }
     plane->CheckBookKeepingCorrectness(page_address);
 }
 
-void BlockManager::AllocateBlockAndPageInPlaneForGcWrite(const uint64_t stream_id, PhysicalPageAddressPtr page_address)
+bool BlockManager::HasRoomInUserOpenBlock(const uint64_t stream_id, const PhysicalPageAddress plane_address, const uint64_t write_hint)
+{
+    auto plane = GetPlaneBookKeepingEntry(plane_address);
+    const BlockPtr &open_block = plane->data_open_blocks[stream_id * write_hint_count + std::min(write_hint, write_hint_count - 1)];
+    return !open_block->is_bad && open_block->current_write_page_index + 1 < pages_per_block;
+}
+
+void BlockManager::AllocateBlockAndPageInPlaneForGcWrite(const uint64_t stream_id, PhysicalPageAddress &page_address, const uint64_t temperature)
 {
     auto plane = GetPlaneBookKeepingEntry(page_address);
+    uint64_t temp = std::min(temperature, gc_temperature_count - 1);
+    BlockPtr &open_block = plane->gc_open_blocks[stream_id * gc_temperature_count + temp];
+    if (open_block->is_bad)
+    {
+        open_block = plane->GetOneFreeBlock(stream_id, temp);
+    }
     plane->valid_pages_count++;
     plane->free_pages_count--;
-    page_address->block_id = plane->gc_open_blocks[stream_id]->block_id;
-    page_address->page_id = plane->gc_open_blocks[stream_id]->current_write_page_index++;
-    if (plane->gc_open_blocks[stream_id]->current_write_page_index == pages_per_block)
+    page_address.block_id = open_block->block_id;
+    page_address.page_id = open_block->current_write_page_index++;
+    ProgramTransactionIssued(page_address);
+    if (open_block->current_write_page_index == pages_per_block)
     {
         // 当前块写满，分配新块
-        plane->gc_open_blocks[stream_id] = plane->GetOneFreeBlock(stream_id);
+        open_block = plane->GetOneFreeBlock(stream_id, temp);
         gc_unit->CheckGcRequired(plane->GetFreeBlockCount(), page_address);
     }
     plane->CheckBookKeepingCorrectness(page_address);
 }
 
-void BlockManager::AllocateBlockAndPageInPlaneForTranslationGcWrite(const uint64_t stream_id, PhysicalPageAddressPtr page_address)
+void BlockManager::AllocateBlockAndPageInPlaneForTranslationGcWrite(const uint64_t stream_id, PhysicalPageAddress &page_address)
 {
     auto plane = GetPlaneBookKeepingEntry(page_address);
+    if (plane->translation_open_blocks[stream_id]->is_bad)
+    {
+        plane->translation_open_blocks[stream_id] = plane->GetOneFreeBlock(stream_id);
+    }
     plane->valid_pages_count++;
     plane->free_pages_count--;
-    page_address->block_id = plane->translation_open_blocks[stream_id]->block_id;
-    page_address->page_id = plane->translation_open_blocks[stream_id]->current_write_page_index++;
+    page_address.block_id = plane->translation_open_blocks[stream_id]->block_id;
+    page_address.page_id = plane->translation_open_blocks[stream_id]->current_write_page_index++;
     if (plane->translation_open_blocks[stream_id]->current_write_page_index == pages_per_block)
     {
         // 当前块写满，分配新块
@@ -178,24 +256,25 @@ void BlockManager::AllocateBlockAndPageInPlaneForTranslationGcWrite(const uint64
     plane->CheckBookKeepingCorrectness(page_address);
 }
 
-void BlockManager::InvalidatePageInBlock(const uint64_t stream_id, const PhysicalPageAddressPtr page_address)
+void BlockManager::InvalidatePageInBlock(const uint64_t stream_id, const PhysicalPageAddress page_address)
 {
     auto plane = GetPlaneBookKeepingEntry(page_address);
     plane->valid_pages_count--;
     plane->invalid_pages_count++;
-    if (plane->blocks[page_address->block_id]->stream_id != stream_id)
+    if (plane->blocks[page_address.block_id]->stream_id != stream_id)
     {
         PRINT_ERROR("Inconsistent status in the Invalidate_page_in_block function! The accessed block is not allocated to stream " << stream_id)
     }
-    plane->blocks[page_address->block_id]->invalid_page_count++;
-    plane->blocks[page_address->block_id]->invalid_page_bitmap[page_address->page_id / 64] |= (1ULL << (page_address->page_id % 64));
+    plane->blocks[page_address.block_id]->invalid_page_count++;
+    plane->blocks[page_address.block_id]->invalid_page_bitmap[page_address.page_id / 64] |= (1ULL << (page_address.page_id % 64));
 }
 
-void BlockManager::AddErasedBlockToPool(const PhysicalPageAddressPtr block_address)
+void BlockManager::AddErasedBlockToPool(const PhysicalPageAddress block_address)
 {
     auto plane = GetPlaneBookKeepingEntry(block_address);
-    auto block = plane->blocks[block_address->block_id];
-    plane->free_pages_count += (pages_per_block - block->invalid_page_count);
+    auto block = plane->blocks[block_address.block_id];
+    // 回收块已写满且有效页都已搬走，块内的页全部是无效页
+    plane->free_pages_count += block->invalid_page_count;
     plane->invalid_pages_count -= block->invalid_page_count;
 
     block->Erase();
@@ -203,19 +282,23 @@ void BlockManager::AddErasedBlockToPool(const PhysicalPageAddressPtr block_addre
     plane->CheckBookKeepingCorrectness(block_address);
 }
 
-uint64_t BlockManager::GetFreeBlockPoolSize(const PhysicalPageAddressPtr plane_address)
+uint64_t BlockManager::GetFreeBlockPoolSize(const PhysicalPageAddress plane_address)
 {
     auto plane = GetPlaneBookKeepingEntry(plane_address);
     return plane->free_block_pool.size();
 }
 
-uint64_t BlockManager::GetColdestBlockId(const PhysicalPageAddressPtr plane_address)
+uint64_t BlockManager::GetColdestBlockId(const PhysicalPageAddress plane_address)
 {
     uint64_t coldest_block_id = 0;
     auto plane = GetPlaneBookKeepingEntry(plane_address);
     uint64_t min_erase_count = std::numeric_limits<uint64_t>::max();
     for (const auto &block : plane->blocks)
     {
+        if (block->is_reserved || block->is_bad)
+        {
+            continue;
+        }
         if (block->erase_count < min_erase_count)
         {
             min_erase_count = block->erase_count;
@@ -225,13 +308,17 @@ uint64_t BlockManager::GetColdestBlockId(const PhysicalPageAddressPtr plane_addr
     return coldest_block_id;
 }
 
-uint64_t BlockManager::GetMinMaxEraseDifference(const PhysicalPageAddressPtr plane_address)
+uint64_t BlockManager::GetMinMaxEraseDifference(const PhysicalPageAddress plane_address)
 {
     auto plane = GetPlaneBookKeepingEntry(plane_address);
     uint64_t min_erase_count = std::numeric_limits<uint64_t>::max();
     uint64_t max_erase_count = 0;
     for (const auto &block : plane->blocks)
     {
+        if (block->is_reserved || block->is_bad)
+        {
+            continue;
+        }
         if (block->erase_count < min_erase_count)
         {
             min_erase_count = block->erase_count;
@@ -244,72 +331,86 @@ uint64_t BlockManager::GetMinMaxEraseDifference(const PhysicalPageAddressPtr pla
     return max_erase_count - min_erase_count;
 }
 
-PlaneBookKeepingPtr BlockManager::GetPlaneBookKeepingEntry(const PhysicalPageAddressPtr plane_address)
+PlaneBookKeepingPtr BlockManager::GetPlaneBookKeepingEntry(const PhysicalPageAddress plane_address)
 {
-    return plane_manager[plane_address->channel_id][plane_address->chip_id][plane_address->die_id][plane_address->plane_id];
+    return plane_manager[plane_address.channel_id][plane_address.chip_id][plane_address.die_id][plane_address.plane_id];
 }
 
-bool BlockManager::BlockHasOngoingGC(const PhysicalPageAddressPtr block_address)
+bool BlockManager::BlockHasOngoingGC(const PhysicalPageAddress block_address)
 {
     auto plane = GetPlaneBookKeepingEntry(block_address);
-    auto block = plane->blocks[block_address->block_id];
+    auto block = plane->blocks[block_address.block_id];
     return block->has_ongoing_gc;
 }
 
-bool BlockManager::CanExecGC(const PhysicalPageAddressPtr block_address)
+bool BlockManager::CanExecGC(const PhysicalPageAddress block_address)
 {
     auto plane_record = GetPlaneBookKeepingEntry(block_address);
-    auto block = plane_record->blocks[block_address->block_id];
-    return (block->ongoing_user_program_cnt + block->ongoing_user_read_cnt == 0);
+    auto block = plane_record->blocks[block_address.block_id];
+    return (block->ongoing_user_program_cnt + block->ongoing_user_read_cnt + block->ongoing_overwrite_cnt == 0);
 }
 
-void BlockManager::GcStartedOnBlock(const PhysicalPageAddressPtr block_address)
+void BlockManager::GcStartedOnBlock(const PhysicalPageAddress block_address)
 {
     auto plane = GetPlaneBookKeepingEntry(block_address);
-    plane->blocks[block_address->block_id]->has_ongoing_gc = true;
+    plane->blocks[block_address.block_id]->has_ongoing_gc = true;
+    // 不论因何被选中，回收后数据都会重写到新块
+    plane->read_reclaim_blocks.erase(block_address.block_id);
 }
 
-void BlockManager::GcFinishedOnBlock(const PhysicalPageAddressPtr block_address)
+void BlockManager::GcFinishedOnBlock(const PhysicalPageAddress block_address)
 {
     auto plane = GetPlaneBookKeepingEntry(block_address);
-    plane->blocks[block_address->block_id]->has_ongoing_gc = false;
+    plane->blocks[block_address.block_id]->has_ongoing_gc = false;
 }
 
-void BlockManager::ReadTransactionStartedOnBlock(const PhysicalPageAddressPtr block_address)
+void BlockManager::ReadTransactionStartedOnBlock(const PhysicalPageAddress block_address)
 {
     auto plane = GetPlaneBookKeepingEntry(block_address);
-    plane->blocks[block_address->block_id]->ongoing_user_read_cnt++;
+    plane->blocks[block_address.block_id]->ongoing_user_read_cnt++;
 }
 
-void BlockManager::ReadTransactionFinishedOnBlock(const PhysicalPageAddressPtr block_address)
+void BlockManager::ReadTransactionFinishedOnBlock(const PhysicalPageAddress block_address)
 {
     auto plane = GetPlaneBookKeepingEntry(block_address);
-    plane->blocks[block_address->block_id]->ongoing_user_read_cnt--;
+    plane->blocks[block_address.block_id]->ongoing_user_read_cnt--;
+}
+
+void BlockManager::OverwriteIssuedOnBlock(const PhysicalPageAddress page_address)
+{
+    auto plane = GetPlaneBookKeepingEntry(page_address);
+    plane->blocks[page_address.block_id]->ongoing_overwrite_cnt++;
+}
+
+void BlockManager::OverwriteFinishedOnBlock(const PhysicalPageAddress page_address)
+{
+    auto plane = GetPlaneBookKeepingEntry(page_address);
+    plane->blocks[page_address.block_id]->ongoing_overwrite_cnt--;
 }
 
-void BlockManager::ProgramTransactionStartedOnBlock(const PhysicalPageAddressPtr block_address)
+void BlockManager::ProgramTransactionStartedOnBlock(const PhysicalPageAddress block_address)
 {
     auto plane = GetPlaneBookKeepingEntry(block_address);
-    plane->blocks[block_address->block_id]->ongoing_user_program_cnt++;
+    plane->blocks[block_address.block_id]->ongoing_user_program_cnt++;
 }
 
-void BlockManager::ProgramTransactionFinishedOnBlock(const PhysicalPageAddressPtr block_address)
+void BlockManager::ProgramTransactionFinishedOnBlock(const PhysicalPageAddress block_address)
 {
     auto plane = GetPlaneBookKeepingEntry(block_address);
-    plane->blocks[block_address->block_id]->ongoing_user_program_cnt--;
+    plane->blocks[block_address.block_id]->ongoing_user_program_cnt--;
 }
 
-bool BlockManager::IsHavingOngoingProgramOnBlock(const PhysicalPageAddressPtr block_address)
+bool BlockManager::IsHavingOngoingProgramOnBlock(const PhysicalPageAddress block_address)
 {
     auto plane = GetPlaneBookKeepingEntry(block_address);
-    return plane->blocks[block_address->block_id]->ongoing_user_program_cnt > 0;
+    return plane->blocks[block_address.block_id]->ongoing_user_program_cnt > 0;
 }
 
-bool BlockManager::IsPageValid(const PhysicalPageAddressPtr page_address)
+bool BlockManager::IsPageValid(const PhysicalPageAddress page_address)
 {
     auto plane = GetPlaneBookKeepingEntry(page_address);
-    auto block = plane->blocks[page_address->block_id];
-    return (block->invalid_page_bitmap[page_address->page_id / 64] & (1ULL << (page_address->page_id % 64))) == 0;
+    auto block = plane->blocks[page_address.block_id];
+    return (block->invalid_page_bitmap[page_address.page_id / 64] & (1ULL << (page_address.page_id % 64))) == 0;
 }
 
 bool BlockManager::IsPageValid(BlockPtr block, uint64_t page_id)
@@ -317,8 +418,470 @@ bool BlockManager::IsPageValid(BlockPtr block, uint64_t page_id)
     return (block->invalid_page_bitmap[page_id / 64] & (1ULL << (page_id % 64))) == 0;
 }
 
-void BlockManager::ProgramTransactionIssued(PhysicalPageAddressPtr page_address)
+uint64_t BlockManager::GetValidPagesCount(const PhysicalPageAddress plane_address, uint64_t first_block_id, uint64_t block_count)
+{
+    auto plane = GetPlaneBookKeepingEntry(plane_address);
+    if (first_block_id + block_count > blocks_per_plane)
+    {
+        PRINT_ERROR("Block range out of plane in GetValidPagesCount!")
+    }
+    // 已写入的页数减去位图中的无效页数；位图在 plane 内连续，整个区间一次向量化统计
+    uint64_t written_pages_count = 0;
+    for (uint64_t block_id = first_block_id; block_id < first_block_id + block_count; block_id++)
+    {
+        written_pages_count += plane->blocks[block_id]->current_write_page_index;
+    }
+    uint64_t invalid_pages_count = BitmapPopcount(plane->invalid_page_bitmap.data() + first_block_id * BlockSlot::page_bitmap_size,
+                                                  block_count * BlockSlot::page_bitmap_size);
+    return written_pages_count - invalid_pages_count;
+}
+
+uint64_t BlockManager::FindNextValidPage(BlockPtr block, uint64_t page_id)
+{
+    // 只在已写入的页中查找，返回 NO_VALUE 表示 page_id 之后没有有效页
+    return BitmapFindNextZero(block->invalid_page_bitmap, page_id, block->current_write_page_index);
+}
+
+uint64_t BlockManager::EnumerateValidPages(BlockPtr block, std::vector<uint64_t> &page_ids)
+{
+    page_ids.resize(pages_per_block);
+    uint64_t valid_pages_count = BitmapEnumerateZeros(block->invalid_page_bitmap, 0, block->current_write_page_index, page_ids.data());
+    page_ids.resize(valid_pages_count);
+    return valid_pages_count;
+}
+
+void BlockManager::ProgramTransactionIssued(const PhysicalPageAddress page_address)
 {
     auto plane = GetPlaneBookKeepingEntry(page_address);
-    plane->blocks[page_address->block_id]->ongoing_user_program_cnt++;
+    plane->blocks[page_address.block_id]->ongoing_user_program_cnt++;
+    if (page_address.page_id == 0)
+    {
+        plane->blocks[page_address.block_id]->program_time = std::chrono::steady_clock::now();
+    }
+}
+
+void BlockManager::ReserveBlocks(const uint64_t blocks_per_plane_to_reserve)
+{
+    if (blocks_per_plane_to_reserve >= blocks_per_plane)
+    {
+        PRINT_ERROR("Cannot reserve " << blocks_per_plane_to_reserve << " blocks in a plane of " << blocks_per_plane << " blocks!")
+    }
+    for (auto &chips : plane_manager)
+        for (auto &dies : chips)
+            for (auto &planes : dies)
+                for (auto &plane : planes)
+                {
+                    // 跳过坏块从末尾往前取
+                    plane->reserved_blocks.clear();
+                    for (uint64_t block_id = blocks_per_plane; block_id-- > 0 && plane->reserved_blocks.size() < blocks_per_plane_to_reserve;)
+                    {
+                        if (plane->blocks[block_id]->is_bad)
+                        {
+                            continue;
+                        }
+                        auto it = plane->free_block_pool.begin();
+                        while (it != plane->free_block_pool.end() && it->second->block_id != block_id)
+                        {
+                            ++it;
+                        }
+                        if (it == plane->free_block_pool.end())
+                        {
+                            PRINT_ERROR("Block " << block_id << " is already in use and cannot be reserved for checkpoints!")
+                        }
+                        plane->free_block_pool.erase(it);
+                        plane->blocks[block_id]->is_reserved = true;
+                        plane->total_pages_count -= pages_per_block;
+                        plane->free_pages_count -= pages_per_block;
+                        plane->reserved_blocks.insert(plane->reserved_blocks.begin(), block_id);
+                    }
+                    if (plane->reserved_blocks.size() < blocks_per_plane_to_reserve)
+                    {
+                        PRINT_ERROR("Not enough good blocks to reserve " << blocks_per_plane_to_reserve << " blocks per plane for checkpoints!")
+                    }
+                }
+}
+
+void BlockManager::MarkBlockBad(const PhysicalPageAddress block_address)
+{
+    auto plane = GetPlaneBookKeepingEntry(block_address);
+    auto block = plane->blocks[block_address.block_id];
+    if (block->is_bad)
+    {
+        return;
+    }
+    block->is_bad = true;
+    // 已分配的页照常完成编程，其余的页不再使用
+    uint64_t remaining_pages = pages_per_block - block->current_write_page_index;
+    for (uint64_t page_id = block->current_write_page_index; page_id < pages_per_block; page_id++)
+    {
+        block->invalid_page_bitmap[page_id / 64] |= (1ULL << (page_id % 64));
+    }
+    block->invalid_page_count += remaining_pages;
+    block->current_write_page_index = pages_per_block;
+    plane->free_pages_count -= remaining_pages;
+    plane->invalid_pages_count += remaining_pages;
+    plane->CheckBookKeepingCorrectness(block_address);
+}
+
+void BlockManager::RetireBadBlock(const PhysicalPageAddress block_address)
+{
+    auto plane = GetPlaneBookKeepingEntry(block_address);
+    auto block = plane->blocks[block_address.block_id];
+    if (!block->is_bad || block->invalid_page_count != pages_per_block)
+    {
+        PRINT_ERROR("Block " << block_address.block_id << " still holds valid data and cannot be retired!")
+    }
+    plane->total_pages_count -= pages_per_block;
+    plane->invalid_pages_count -= pages_per_block;
+    // 清空写入状态但保留擦除次数，退役的块不会再被选为回收块
+    block->current_write_page_index = 0;
+    block->invalid_page_count = 0;
+    block->read_count = 0;
+    block->stream_id = 0xff;
+    block->ongoing_erase_tr = nullptr;
+    std::fill(block->invalid_page_bitmap, block->invalid_page_bitmap + BlockSlot::page_bitmap_size, 0ULL);
+    plane->bad_blocks.push_back(block);
+    if (nand_driver != nullptr)
+    {
+        nand_driver->MarkBadBlock(block_address);
+    }
+    plane->CheckBookKeepingCorrectness(block_address);
+}
+
+uint64_t BlockManager::GetBadBlockCount() const
+{
+    uint64_t bad_block_count = 0;
+    for (auto &chips : plane_manager)
+        for (auto &dies : chips)
+            for (auto &planes : dies)
+                for (auto &plane : planes)
+                    bad_block_count += plane->bad_blocks.size();
+    return bad_block_count;
+}
+
+uint64_t BlockManager::GetUsablePagesCount() const
+{
+    uint64_t usable_pages_count = 0;
+    for (auto &chips : plane_manager)
+        for (auto &dies : chips)
+            for (auto &planes : dies)
+                for (auto &plane : planes)
+                    usable_pages_count += plane->total_pages_count;
+    return usable_pages_count;
+}
+
+void BlockManager::ResetForRecovery()
+{
+    for (auto &chips : plane_manager)
+        for (auto &dies : chips)
+            for (auto &planes : dies)
+                for (auto &plane : planes)
+                {
+                    plane->free_pages_count = plane->total_pages_count;
+                    plane->valid_pages_count = 0;
+                    plane->invalid_pages_count = 0;
+                    plane->free_block_pool.clear();
+                    plane->block_usage_history = std::queue<uint64_t>();
+                    plane->ongoing_erase_blocks.clear();
+                    plane->read_reclaim_blocks.clear();
+                    std::fill(plane->data_open_blocks.begin(), plane->data_open_blocks.end(), nullptr);
+                    std::fill(plane->gc_open_blocks.begin(), plane->gc_open_blocks.end(), nullptr);
+                    std::fill(plane->translation_open_blocks.begin(), plane->translation_open_blocks.end(), nullptr);
+                    for (auto &block : plane->blocks)
+                    {
+                        if (block->is_reserved || block->is_bad)
+                        {
+                            continue;
+                        }
+                        block->Erase();
+                        block->erase_count = 0;
+                        block->write_hint = 0;
+                        block->has_ongoing_gc = false;
+                        block->ongoing_user_program_cnt = 0;
+                        block->ongoing_user_read_cnt = 0;
+                        block->ongoing_overwrite_cnt = 0;
+                    }
+                }
+}
+
+void BlockManager::RestoreBlock(const PhysicalPageAddress block_address, const uint64_t stream_id, const uint64_t programmed_page_count, const uint64_t erase_count)
+{
+    auto plane = GetPlaneBookKeepingEntry(block_address);
+    auto block = plane->blocks[block_address.block_id];
+    block->erase_count = erase_count;
+    if (programmed_page_count == 0)
+    {
+        return;
+    }
+    block->stream_id = stream_id;
+    block->current_write_page_index = programmed_page_count;
+    // 读次数和编程时刻不在闪存上，挂载后从零开始计
+    block->program_time = std::chrono::steady_clock::now();
+    plane->free_pages_count -= programmed_page_count;
+    plane->valid_pages_count += programmed_page_count;
+}
+
+uint64_t BlockManager::FinishRecovery()
+{
+    uint64_t closed_block_count = 0;
+    for (auto &chips : plane_manager)
+        for (auto &dies : chips)
+            for (auto &planes : dies)
+                for (auto &plane : planes)
+                {
+                    for (auto &block : plane->blocks)
+                    {
+                        if (block->is_reserved || block->is_bad)
+                        {
+                            continue;
+                        }
+                        if (block->current_write_page_index == 0)
+                        {
+                            plane->AddToFreeBlockPool(block, gc_unit->UseDynamicWearLeveling());
+                            continue;
+                        }
+                        plane->block_usage_history.push(block->block_id);
+                        if (block->current_write_page_index == pages_per_block)
+                        {
+                            continue;
+                        }
+                        // 掉电前的打开块：依次续用为所属流的用户数据、GC、映射打开块，多出来的封闭
+                        BlockPtr *slot = nullptr;
+                        for (uint64_t hint = 0; hint < write_hint_count && slot == nullptr; hint++)
+                        {
+                            if (plane->data_open_blocks[block->stream_id * write_hint_count + hint] == nullptr)
+                                slot = &plane->data_open_blocks[block->stream_id * write_hint_count + hint];
+                        }
+                        for (uint64_t temperature = 0; temperature < gc_temperature_count && slot == nullptr; temperature++)
+                        {
+                            if (plane->gc_open_blocks[block->stream_id * gc_temperature_count + temperature] == nullptr)
+                                slot = &plane->gc_open_blocks[block->stream_id * gc_temperature_count + temperature];
+                        }
+                        if (slot == nullptr && plane->translation_open_blocks[block->stream_id] == nullptr)
+                            slot = &plane->translation_open_blocks[block->stream_id];
+                        if (slot != nullptr)
+                        {
+                            *slot = block;
+                            continue;
+                        }
+                        uint64_t remaining_pages = pages_per_block - block->current_write_page_index;
+                        for (uint64_t page_id = block->current_write_page_index; page_id < pages_per_block; page_id++)
+                        {
+                            block->invalid_page_bitmap[page_id / 64] |= (1ULL << (page_id % 64));
+                        }
+                        block->invalid_page_count += remaining_pages;
+                        block->current_write_page_index = pages_per_block;
+                        plane->free_pages_count -= remaining_pages;
+                        plane->invalid_pages_count += remaining_pages;
+                        closed_block_count++;
+                    }
+                    for (uint64_t stream_id = 0; stream_id < total_stream_count; stream_id++)
+                    {
+                        for (uint64_t hint = 0; hint < write_hint_count; hint++)
+                        {
+                            BlockPtr &open_block = plane->data_open_blocks[stream_id * write_hint_count + hint];
+                            if (open_block == nullptr)
+                                open_block = plane->GetOneFreeBlock(stream_id, hint);
+                            else
+                                open_block->write_hint = hint;
+                        }
+                        for (uint64_t temperature = 0; temperature < gc_temperature_count; temperature++)
+                        {
+                            BlockPtr &open_block = plane->gc_open_blocks[stream_id * gc_temperature_count + temperature];
+                            if (open_block == nullptr)
+                                open_block = plane->GetOneFreeBlock(stream_id, temperature);
+                            else
+                                open_block->write_hint = temperature;
+                        }
+                        if (plane->translation_open_blocks[stream_id] == nullptr)
+                            plane->translation_open_blocks[stream_id] = plane->GetOneFreeBlock(stream_id);
+                    }
+                }
+    return closed_block_count;
+}
+
+void BlockManager::AgeProgrammedBlocks(const std::chrono::nanoseconds age)
+{
+    for (auto &chips : plane_manager)
+        for (auto &dies : chips)
+            for (auto &planes : dies)
+                for (auto &plane : planes)
+                    for (auto &block : plane->blocks)
+                    {
+                        if (block->current_write_page_index > 0)
+                        {
+                            block->program_time -= age;
+                        }
+                    }
+}
+
+void BlockManager::SaveSnapshot(SnapshotWriter &writer) const
+{
+    writer.BeginSection(SnapshotSection::BLOCK_MANAGER);
+    std::vector<BlockSnapshotEntry> entries(blocks_per_plane);
+    auto now = std::chrono::steady_clock::now();
+    for (auto &chips : plane_manager)
+        for (auto &dies : chips)
+            for (auto &planes : dies)
+                for (auto &plane : planes)
+                {
+                    if (!plane->ongoing_erase_blocks.empty())
+                    {
+                        PRINT_ERROR("Cannot take a snapshot while blocks are being erased!")
+                    }
+                    writer.Write(plane->total_pages_count);
+                    writer.Write(plane->free_pages_count);
+                    writer.Write(plane->valid_pages_count);
+                    writer.Write(plane->invalid_pages_count);
+                    for (uint64_t block_id = 0; block_id < blocks_per_plane; block_id++)
+                    {
+                        const BlockSlot &block = *plane->blocks[block_id];
+                        if (block.has_ongoing_gc || block.ongoing_user_program_cnt != 0 || block.ongoing_user_read_cnt != 0 ||
+                            block.ongoing_overwrite_cnt != 0)
+                        {
+                            PRINT_ERROR("Cannot take a snapshot while block " << block_id << " has operations in flight!")
+                        }
+                        uint64_t data_age_ns = block.current_write_page_index == 0 ? 0 : std::chrono::duration_cast<std::chrono::nanoseconds>(now - block.program_time).count();
+                        entries[block_id] = {block.current_write_page_index, block.invalid_page_count, block.erase_count, block.stream_id,
+                                             block.write_hint, block.read_count, data_age_ns, static_cast<uint32_t>(block.current_status),
+                                             block.hot_block, block.is_bad, block.is_reserved,
+                                             static_cast<uint8_t>(plane->read_reclaim_blocks.count(block_id))};
+                    }
+                    writer.WriteArray(entries.data(), entries.size());
+                    writer.WriteVector(plane->invalid_page_bitmap);
+                    WriteBlockIds(writer, plane->data_open_blocks);
+                    WriteBlockIds(writer, plane->gc_open_blocks);
+                    WriteBlockIds(writer, plane->translation_open_blocks);
+                    WriteBlockIds(writer, plane->bad_blocks);
+                    // 空闲池按顺序写出块号，载入时按当前的动态磨损均衡设置重新取键，键相同的块保持原来的先后
+                    writer.Write<uint64_t>(plane->free_block_pool.size());
+                    for (auto &entry : plane->free_block_pool)
+                    {
+                        writer.Write(entry.second->block_id);
+                    }
+                    std::queue<uint64_t> history = plane->block_usage_history;
+                    writer.Write<uint64_t>(history.size());
+                    for (; !history.empty(); history.pop())
+                    {
+                        writer.Write(history.front());
+                    }
+                }
+}
+
+void BlockManager::LoadSnapshot(SnapshotReader &reader)
+{
+    reader.ExpectSection(SnapshotSection::BLOCK_MANAGER);
+    auto read_block_id = [&]()
+    {
+        uint64_t block_id = reader.Read<uint64_t>();
+        if (block_id >= blocks_per_plane)
+        {
+            PRINT_ERROR("Corrupted block id " << block_id << " in snapshot!")
+        }
+        return block_id;
+    };
+    // 打开块的个数由流数和写入点数决定，文件头已核对过；未分配的打开块记为 NO_VALUE
+    auto read_open_blocks = [&](PlaneBookKeeping &plane, std::vector<BlockPtr> &blocks)
+    {
+        if (reader.ReadCount(sizeof(uint64_t)) != blocks.size())
+        {
+            PRINT_ERROR("Snapshot was taken with a different number of open blocks!")
+        }
+        for (auto &block : blocks)
+        {
+            uint64_t block_id = reader.Read<uint64_t>();
+            if (block_id != NO_VALUE && block_id >= blocks_per_plane)
+            {
+                PRINT_ERROR("Corrupted block id " << block_id << " in snapshot!")
+            }
+            block = block_id == NO_VALUE ? nullptr : plane.blocks[block_id];
+        }
+    };
+    std::vector<BlockSnapshotEntry> entries(blocks_per_plane);
+    auto now = std::chrono::steady_clock::now();
+    for (auto &chips : plane_manager)
+        for (auto &dies : chips)
+            for (auto &planes : dies)
+                for (auto &plane : planes)
+                {
+                    plane->total_pages_count = reader.Read<uint64_t>();
+                    plane->free_pages_count = reader.Read<uint64_t>();
+                    plane->valid_pages_count = reader.Read<uint64_t>();
+                    plane->invalid_pages_count = reader.Read<uint64_t>();
+                    reader.ReadArray(entries.data(), entries.size());
+                    plane->read_reclaim_blocks.clear();
+                    for (uint64_t block_id = 0; block_id < blocks_per_plane; block_id++)
+                    {
+                        const BlockSnapshotEntry &entry = entries[block_id];
+                        BlockSlot &block = *plane->blocks[block_id];
+                        block.current_write_page_index = entry.current_write_page_index;
+                        block.invalid_page_count = entry.invalid_page_count;
+                        block.erase_count = entry.erase_count;
+                        block.stream_id = entry.stream_id;
+                        block.write_hint = entry.write_hint;
+                        block.read_count = entry.read_count;
+                        block.program_time = now - std::chrono::nanoseconds(entry.data_age_ns);
+                        if (entry.read_reclaim_pending)
+                        {
+                            plane->read_reclaim_blocks.insert(block_id);
+                        }
+                        block.current_status = static_cast<BlockServiceStatus>(entry.current_status);
+                        block.hot_block = entry.hot_block;
+                        block.is_bad = entry.is_bad;
+                        block.is_reserved = entry.is_reserved;
+                        block.has_ongoing_gc = false;
+                        block.ongoing_erase_tr = nullptr;
+                        block.ongoing_user_program_cnt = 0;
+                        block.ongoing_user_read_cnt = 0;
+                        block.ongoing_overwrite_cnt = 0;
+                    }
+                    // 块的位图指针指向 plane 位图，只能原地覆盖
+                    if (reader.ReadCount(sizeof(uint64_t)) != plane->invalid_page_bitmap.size())
+                    {
+                        PRINT_ERROR("Snapshot was taken with a different block geometry!")
+                    }
+                    reader.ReadArray(plane->invalid_page_bitmap.data(), plane->invalid_page_bitmap.size());
+                    read_open_blocks(*plane, plane->data_open_blocks);
+                    read_open_blocks(*plane, plane->gc_open_blocks);
+                    read_open_blocks(*plane, plane->translation_open_blocks);
+                    plane->bad_blocks.resize(reader.ReadCount(sizeof(uint64_t)));
+                    for (auto &block : plane->bad_blocks)
+                    {
+                        block = plane->blocks[read_block_id()];
+                    }
+                    plane->free_block_pool.clear();
+                    for (uint64_t count = reader.ReadCount(sizeof(uint64_t)); count > 0; count--)
+                    {
+                        plane->AddToFreeBlockPool(plane->blocks[read_block_id()], gc_unit->UseDynamicWearLeveling());
+                    }
+                    plane->block_usage_history = std::queue<uint64_t>();
+                    for (uint64_t count = reader.ReadCount(sizeof(uint64_t)); count > 0; count--)
+                    {
+                        plane->block_usage_history.push(read_block_id());
+                    }
+                    plane->ongoing_erase_blocks.clear();
+                }
+    if (nand_driver == nullptr)
+    {
+        return;
+    }
+    // 出厂坏块由芯片决定，快照中的坏块至少要包含它们；快照中已退役的块补记到芯片的坏块表
+    for (uint64_t channel_id = 0; channel_id < total_channel_count; channel_id++)
+        for (uint64_t chip_id = 0; chip_id < chips_per_channel; chip_id++)
+            for (uint64_t die_id = 0; die_id < dies_per_chip; die_id++)
+                for (uint64_t plane_id = 0; plane_id < planes_per_die; plane_id++)
+                {
+                    for (auto &block : plane_manager[channel_id][chip_id][die_id][plane_id]->bad_blocks)
+                    {
+                        nand_driver->MarkBadBlock(PhysicalPageAddress(channel_id, chip_id, die_id, plane_id, block->block_id, 0));
+                    }
+                    for (uint64_t block_id = 0; block_id < blocks_per_plane; block_id++)
+                    {
+                        PhysicalPageAddress block_address(channel_id, chip_id, die_id, plane_id, block_id, 0);
+                        if (nand_driver->IsBadBlock(block_address) && !plane_manager[channel_id][chip_id][die_id][plane_id]->blocks[block_id]->is_bad)
+                        {
+                            PRINT_ERROR("Snapshot was taken with a different bad block layout!")
+                        }
+                    }
+                }
 }
@@ -1,5 +1,6 @@
 #pragma once
 #include "param.h"
+#include <chrono>
 
 enum class BlockServiceStatus
 {
@@ -19,15 +20,20 @@ public:
     BlockServiceStatus current_status;
     uint64_t invalid_page_count;
     static uint64_t page_bitmap_size;
-    std::vector<uint64_t> invalid_page_bitmap;
+    uint64_t *invalid_page_bitmap; // 指向所属 plane 连续位图中本块的起始字
     uint64_t erase_count;
     TransactionErasePtr ongoing_erase_tr;
     uint64_t stream_id;
+    uint64_t write_hint; // 用户数据块所属的写入点(温度类别)；GC 块为搬移时的温度类别
     bool hot_block;
     bool has_ongoing_gc;
     int ongoing_user_read_cnt;
     int ongoing_user_program_cnt;
-    bool is_bad = false;
+    int ongoing_overwrite_cnt = 0; // 本块中被尚未编程完成的用户写取代的页数，此时擦除本块，掉电后这些 LPA 会回退到更旧的副本
+    bool is_bad = false; // 出厂坏块或编程/擦除失败的块，不再分配；有效数据搬走前仍保留已写入的页，之后退役
+    bool is_reserved = false; // 留给检查点和日志的块，不进空闲池也不参与 GC
+    uint64_t read_count = 0; // 自擦除以来的读次数(含重读)，用于估计读干扰
+    std::chrono::steady_clock::time_point program_time; // 擦除后第一页开始编程的时刻，用于估计数据保持时间
     void Erase();
 };
 
@@ -39,20 +45,23 @@ public:
     uint64_t valid_pages_count;
     uint64_t invalid_pages_count;
 
-    std::vector<BlockPtr> data_open_blocks;        // per stream_id
-    std::vector<BlockPtr> gc_open_blocks;          // per stream_id
+    std::vector<BlockPtr> data_open_blocks;        // per (stream_id, write_hint)，下标 stream_id * write_hint_count + write_hint
+    std::vector<BlockPtr> gc_open_blocks;          // per (stream_id, temperature)，下标 stream_id * gc_temperature_count + temperature
     std::vector<BlockPtr> translation_open_blocks; // per stream_id
 
     std::queue<uint64_t> block_usage_history; // block 使用历史，存放block_id
     std::set<uint64_t> ongoing_erase_blocks;  // 正在擦除的block_id
+    std::set<uint64_t> read_reclaim_blocks;   // 误码率过高或编程失败、等待尽快搬走数据的block_id，开始回收时移出
 
-    BlockPtr GetOneFreeBlock(uint64_t stream_id);
+    BlockPtr GetOneFreeBlock(uint64_t stream_id, uint64_t write_hint = 0);
     uint64_t GetFreeBlockCount() const { return free_block_pool.size(); }
-    void CheckBookKeepingCorrectness(const PhysicalPageAddressPtr plane_address);
+    void CheckBookKeepingCorrectness(const PhysicalPageAddress plane_address);
     void AddToFreeBlockPool(BlockPtr block, bool consider_dynamic_wl);
 
     std::vector<BlockPtr> blocks;
-    std::vector<BlockPtr> bad_blocks;
+    std::vector<BlockPtr> bad_blocks;          // 出厂坏块和已退役的块，不计入 total_pages_count
+    std::vector<uint64_t> reserved_blocks;     // 留给检查点的块号，升序
+    std::vector<uint64_t> invalid_page_bitmap; // 整个 plane 的无效页位图，按 block_id 连续排布，便于跨块向量化扫描
     std::multimap<uint64_t, BlockPtr> free_block_pool; // key: erase_count, value: block_ptr
 };
 
@@ -61,31 +70,68 @@ class BlockManager
 public:
     BlockManager(GcWlUnitPtr gc_ptr, uint64_t block_pe_cycle, uint64_t total_stream_count,
                  uint64_t total_channel_count, uint64_t chips_per_channel, uint64_t dies_per_chip,
-                 uint64_t planes_per_die, uint64_t blocks_per_plane, uint64_t pages_per_block);
+                 uint64_t planes_per_die, uint64_t blocks_per_plane, uint64_t pages_per_block, uint64_t write_hint_count = 1,
+                 uint64_t gc_temperature_count = 1, NandDriverPtr nand_driver = nullptr);
     ~BlockManager() = default;
-    void AllocateBlockAndPageInPlaneForUserWrite(const uint64_t stream_id, PhysicalPageAddressPtr page_address);
-    void AllocateBlockAndPageInPlaneForGcWrite(const uint64_t stream_id, PhysicalPageAddressPtr page_address);
-    void AllocateBlockAndPageInPlaneForTranslationGcWrite(const uint64_t stream_id, PhysicalPageAddressPtr page_address);
-    void InvalidatePageInBlock(const uint64_t stream_id, const PhysicalPageAddressPtr page_address);
-    void AddErasedBlockToPool(const PhysicalPageAddressPtr block_address);
-    uint64_t GetFreeBlockPoolSize(const PhysicalPageAddressPtr plane_address);
-
-    uint64_t GetColdestBlockId(const PhysicalPageAddressPtr plane_address);
-    uint64_t GetMinMaxEraseDifference(const PhysicalPageAddressPtr plane_address);
+    // write_hint 选择流内的用户数据打开块，超出 write_hint_count 的按最热处理
+    void AllocateBlockAndPageInPlaneForUserWrite(const uint64_t stream_id, PhysicalPageAddress &page_address, const uint64_t write_hint = 0);
+    // 用户数据打开块再写一页后不用换新块，即这次写不消耗空闲块
+    bool HasRoomInUserOpenBlock(const uint64_t stream_id, const PhysicalPageAddress plane_address, const uint64_t write_hint = 0);
+    // temperature 选择流内的 GC 打开块，超出 gc_temperature_count 的按最热处理
+    void AllocateBlockAndPageInPlaneForGcWrite(const uint64_t stream_id, PhysicalPageAddress &page_address, const uint64_t temperature = 0);
+    void AllocateBlockAndPageInPlaneForTranslationGcWrite(const uint64_t stream_id, PhysicalPageAddress &page_address);
+    void InvalidatePageInBlock(const uint64_t stream_id, const PhysicalPageAddress page_address);
+    void AddErasedBlockToPool(const PhysicalPageAddress block_address);
+    uint64_t GetFreeBlockPoolSize(const PhysicalPageAddress plane_address);
+
+    uint64_t GetColdestBlockId(const PhysicalPageAddress plane_address);
+    uint64_t GetMinMaxEraseDifference(const PhysicalPageAddress plane_address);
     uint64_t GetInputStreamCnt() const { return total_stream_count; }
+    uint64_t GetWriteHintCnt() const { return write_hint_count; }
+    uint64_t GetGcTemperatureCnt() const { return gc_temperature_count; }
     void SetGarbageCollectionUnit(GcWlUnitPtr gc_ptr) { gc_unit = gc_ptr; }
-    PlaneBookKeepingPtr GetPlaneBookKeepingEntry(const PhysicalPageAddressPtr plane_address);
-    bool BlockHasOngoingGC(const PhysicalPageAddressPtr block_address);
-    bool CanExecGC(const PhysicalPageAddressPtr block_address);
-    void GcStartedOnBlock(const PhysicalPageAddressPtr block_address);
-    void GcFinishedOnBlock(const PhysicalPageAddressPtr block_address);
-    void ReadTransactionStartedOnBlock(const PhysicalPageAddressPtr block_address);
-    void ReadTransactionFinishedOnBlock(const PhysicalPageAddressPtr block_address);
-    void ProgramTransactionStartedOnBlock(const PhysicalPageAddressPtr block_address);
-    void ProgramTransactionFinishedOnBlock(const PhysicalPageAddressPtr block_address);
-    bool IsHavingOngoingProgramOnBlock(const PhysicalPageAddressPtr block_address);
-    bool IsPageValid(const PhysicalPageAddressPtr page_address);
+    PlaneBookKeepingPtr GetPlaneBookKeepingEntry(const PhysicalPageAddress plane_address);
+    bool BlockHasOngoingGC(const PhysicalPageAddress block_address);
+    bool CanExecGC(const PhysicalPageAddress block_address);
+    void GcStartedOnBlock(const PhysicalPageAddress block_address);
+    void GcFinishedOnBlock(const PhysicalPageAddress block_address);
+    void ReadTransactionStartedOnBlock(const PhysicalPageAddress block_address);
+    void ReadTransactionFinishedOnBlock(const PhysicalPageAddress block_address);
+    void ProgramTransactionStartedOnBlock(const PhysicalPageAddress block_address);
+    void ProgramTransactionFinishedOnBlock(const PhysicalPageAddress block_address);
+    bool IsHavingOngoingProgramOnBlock(const PhysicalPageAddress block_address);
+    void OverwriteIssuedOnBlock(const PhysicalPageAddress page_address);
+    void OverwriteFinishedOnBlock(const PhysicalPageAddress page_address);
+    bool IsPageValid(const PhysicalPageAddress page_address);
     bool IsPageValid(BlockPtr block, uint64_t page_id);
+    uint64_t GetValidPagesCount(const PhysicalPageAddress plane_address, uint64_t first_block_id, uint64_t block_count);
+    uint64_t FindNextValidPage(BlockPtr block, uint64_t page_id);
+    uint64_t EnumerateValidPages(BlockPtr block, std::vector<uint64_t> &page_ids);
+
+    // 把每个 plane 块号最大的 blocks_per_plane_to_reserve 个好块从空闲池中取出留给检查点，必须在分配任何页之前调用
+    void ReserveBlocks(const uint64_t blocks_per_plane_to_reserve);
+
+    // 编程/擦除失败：块不再分配新页，未写的页记为无效；块内的有效数据留给 GC 搬走。
+    // 仍是打开块时等该写入点下一次分配才换下(那时用户写已确认空闲块够用)
+    void MarkBlockBad(const PhysicalPageAddress block_address);
+    // 坏块的有效数据搬完后退役：从 plane 容量中扣除，记入芯片的坏块表
+    void RetireBadBlock(const PhysicalPageAddress block_address);
+    uint64_t GetInitialBadBlockCount() const { return initial_bad_block_count; }
+    uint64_t GetBadBlockCount() const;
+    uint64_t GetUsablePagesCount() const; // 不含坏块和检查点保留块的物理页数
+
+    // 上电恢复：先把所有块置为空白，再按扫描结果逐块恢复已编程的页数(先视为全部有效，旧副本随后用 InvalidatePageInBlock 置无效)，
+    // 最后重建空闲池和打开块。返回因打开块不够而被封闭的部分写入块数，封闭块剩余的页记为无效
+    void ResetForRecovery();
+    void RestoreBlock(const PhysicalPageAddress block_address, const uint64_t stream_id, const uint64_t programmed_page_count, const uint64_t erase_count);
+    uint64_t FinishRecovery();
+
+    // 把所有已编程块的编程时刻提前 age，相当于数据已经多保存了这么久
+    void AgeProgrammedBlocks(const std::chrono::nanoseconds age);
+
+    // 保存/恢复所有块的状态、空闲池和打开块；保存时不能有进行中的 GC、擦除或块上的在途读写
+    void SaveSnapshot(SnapshotWriter &writer) const;
+    void LoadSnapshot(SnapshotReader &reader);
 
 private:
     GcWlUnitPtr gc_unit;
@@ -100,6 +146,10 @@ private:
     uint64_t planes_per_die;
     uint64_t blocks_per_plane;
     uint64_t pages_per_block;
+    uint64_t write_hint_count; // 每个流每个 plane 的用户数据打开块个数
+    uint64_t gc_temperature_count; // 每个流每个 plane 的 GC 打开块个数
+    NandDriverPtr nand_driver; // 坏块表所在；为空时不排除出厂坏块
+    uint64_t initial_bad_block_count = 0; // 构造时坏块表中已有的块：出厂坏块，以及掉电前已退役的块
 
-    void ProgramTransactionIssued(PhysicalPageAddressPtr page_address);
+    void ProgramTransactionIssued(const PhysicalPageAddress page_address);
 };
\ No newline at end of file
@@ -0,0 +1,107 @@
+#include "reliability_model.h"
+#include "block_manager.h"
+#include <cmath>
+
+ReliabilityModel::ReliabilityModel(const ReliabilityParam &param, uint64_t block_pe_cycle, uint64_t initial_pe_cycles, uint64_t page_size)
+    : param(param), block_pe_cycle(std::max<uint64_t>(block_pe_cycle, 1)), initial_pe_cycles(initial_pe_cycles), rng(param.seed)
+{
+    if (param.ldpc_correctable_bits.empty() || param.ldpc_correctable_bits.size() != param.ldpc_decode_latency_ns.size())
+    {
+        PRINT_ERROR("Each LDPC decoding level needs both a correction capability and a latency!")
+    }
+    if (param.codeword_size == 0 || page_size % param.codeword_size != 0)
+    {
+        PRINT_ERROR("Page size " << page_size << " is not a multiple of the ECC codeword size " << param.codeword_size)
+    }
+    codewords_per_page = page_size / param.codeword_size;
+    codeword_bits = param.codeword_size * 8;
+    corrected_counts.assign(param.ldpc_correctable_bits.size(), 0);
+}
+
+double ReliabilityModel::EstimateRber(const BlockSlot &block, uint64_t retry_step) const
+{
+    double wear = static_cast<double>(block.erase_count + initial_pe_cycles) / block_pe_cycle;
+    double retention_hours = 0;
+    if (block.current_write_page_index > 0)
+    {
+        retention_hours = std::chrono::duration<double>(std::chrono::steady_clock::now() - block.program_time).count() * param.time_scale / 3600;
+    }
+    // 保持和读干扰使阈值电压整体漂移，换参考电压重读能消掉其中一部分；磨损造成的分布展宽重读也无济于事
+    double shift = (param.rber_retention_per_hour * retention_hours + param.rber_read_disturb * block.read_count) *
+                   (1 + (param.wear_acceleration - 1) * wear) * std::pow(param.read_retry_rber_factor, static_cast<double>(retry_step));
+    return param.rber_base + param.rber_wear * std::pow(wear, param.wear_exponent) + shift;
+}
+
+ReadDecodeResult ReliabilityModel::DecodeRead(BlockSlot &block, uint64_t retry_step, uint64_t &latency_ns)
+{
+    block.read_count++;
+    sensing_count++;
+    if (retry_step > 0)
+    {
+        retry_count++;
+    }
+    latency_ns += param.page_read_latency_ns;
+
+    double mean_errors = std::min(EstimateRber(block, retry_step), 0.5) * codeword_bits;
+    uint64_t worst_errors = 0;
+    if (mean_errors > 0)
+    {
+        std::poisson_distribution<uint64_t> errors(mean_errors);
+        for (uint64_t codeword = 0; codeword < codewords_per_page; codeword++)
+        {
+            worst_errors = std::max(worst_errors, errors(rng));
+        }
+    }
+    for (size_t level = 0; level < param.ldpc_correctable_bits.size(); level++)
+    {
+        if (worst_errors <= param.ldpc_correctable_bits[level])
+        {
+            latency_ns += param.ldpc_decode_latency_ns[level];
+            corrected_counts[level]++;
+            return ReadDecodeResult::CORRECTED;
+        }
+    }
+    latency_ns += param.ldpc_decode_latency_ns.back();
+    if (retry_step < param.max_read_retries)
+    {
+        return ReadDecodeResult::RETRY;
+    }
+    uncorrectable_count++;
+    return ReadDecodeResult::UNCORRECTABLE;
+}
+
+void ReliabilityModel::RecordReadCompletion(uint64_t latency_ns, bool host_read)
+{
+    if (!host_read)
+    {
+        return;
+    }
+    host_read_count++;
+    host_read_latency_histogram[latency_ns]++;
+}
+
+bool ReliabilityModel::NeedsReadReclaim(const BlockSlot &block, ReadDecodeResult result, uint64_t retry_step) const
+{
+    return result == ReadDecodeResult::UNCORRECTABLE ||
+           (param.read_reclaim_retry_threshold > 0 && retry_step >= param.read_reclaim_retry_threshold) ||
+           (param.read_reclaim_read_count > 0 && block.read_count >= param.read_reclaim_read_count);
+}
+
+uint64_t ReliabilityModel::GetHostReadLatencyPercentileNs(double percentile) const
+{
+    if (host_read_count == 0)
+    {
+        return 0;
+    }
+    uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(percentile * host_read_count)));
+    uint64_t seen = 0;
+    for (auto &entry : host_read_latency_histogram)
+    {
+        seen += entry.second;
+        if (seen >= rank)
+        {
+            return entry.first;
+        }
+    }
+    return host_read_latency_histogram.rbegin()->first;
+}
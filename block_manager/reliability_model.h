@@ -0,0 +1,54 @@
+#pragma once
+#include "param.h"
+
+// 一次 NAND 读的译码结果
+enum class ReadDecodeResult
+{
+    CORRECTED,    // 某一级 LDPC 译码成功
+    RETRY,        // 所有级别都纠不过来，换下一档参考电压重读
+    UNCORRECTABLE // 重试档位用尽仍纠不过来
+};
+
+/*
+ * 读可靠性模型(公式和参数见 ReliabilityParam)
+ * 每次感测先累加块的读干扰计数，再按块的擦写次数、保持时间和读次数算出 RBER，
+ * 对页内每个码字按泊松分布抽样错误比特数，以最差的码字选择能纠正它的最低译码级别。
+ * 每次感测记一次 tR，译码成功记到该级别为止的累计时延，失败记最高级别的时延。
+ * 模型只决定时延、重读和统计，不改动读出的数据
+ */
+class ReliabilityModel
+{
+public:
+    ReliabilityModel(const ReliabilityParam &param, uint64_t block_pe_cycle, uint64_t initial_pe_cycles, uint64_t page_size);
+
+    double EstimateRber(const BlockSlot &block, uint64_t retry_step) const;
+    // 模拟第 retry_step 档的一次读，latency_ns 累加本次感测和译码的时延
+    ReadDecodeResult DecodeRead(BlockSlot &block, uint64_t retry_step, uint64_t &latency_ns);
+    // 一次读最终纠正或确认不可纠正后调用；主机读的建模时延计入时延分布
+    void RecordReadCompletion(uint64_t latency_ns, bool host_read);
+    // 块自擦除以来读得太多、这次读用了太多档重试或者已经不可纠正时，应尽快把块内数据搬走
+    bool NeedsReadReclaim(const BlockSlot &block, ReadDecodeResult result, uint64_t retry_step) const;
+
+    uint64_t GetSensingCount() const { return sensing_count; }
+    uint64_t GetRetryCount() const { return retry_count; }
+    uint64_t GetUncorrectableCount() const { return uncorrectable_count; }
+    const std::vector<uint64_t> &GetCorrectedCounts() const { return corrected_counts; }
+    uint64_t GetHostReadCount() const { return host_read_count; }
+    // 主机读建模时延的分位数，percentile 取 (0, 1]
+    uint64_t GetHostReadLatencyPercentileNs(double percentile) const;
+
+private:
+    ReliabilityParam param;
+    uint64_t block_pe_cycle;
+    uint64_t initial_pe_cycles;
+    uint64_t codewords_per_page;
+    uint64_t codeword_bits;
+    std::mt19937_64 rng;
+
+    uint64_t sensing_count = 0;
+    uint64_t retry_count = 0;
+    uint64_t uncorrectable_count = 0;
+    std::vector<uint64_t> corrected_counts; // 每个译码级别成功的次数
+    uint64_t host_read_count = 0;
+    std::map<uint64_t, uint64_t> host_read_latency_histogram; // 建模时延(ns) -> 次数；时延只由重试次数和译码级别决定，取值很少
+};
@@ -85,12 +85,38 @@ void DataCache::RemoveSlot(const uint64_t stream_id, const uint64_t lpa) {
     uint64_t key = LPN_TO_UNIQUE_KEY(stream_id, lpa);
     auto it = slots.find(key);
     if (it != slots.end()) {
-        slots.erase(it);
         lru_list.erase(it->second->lru_pos);
+        slots.erase(it);
+    }
+}
+
+uint64_t DataCache::RemoveRange(const uint64_t stream_id, const uint64_t first_lpa, const uint64_t last_lpa) {
+    uint64_t removed = 0;
+    if (last_lpa - first_lpa + 1 <= slots.size()) {
+        for (uint64_t lpa = first_lpa; lpa <= last_lpa; lpa++) {
+            auto it = slots.find(LPN_TO_UNIQUE_KEY(stream_id, lpa));
+            if (it != slots.end()) {
+                lru_list.erase(it->second->lru_pos);
+                slots.erase(it);
+                removed++;
+            }
+        }
+        return removed;
+    }
+    // 区间比缓存大时直接扫描 LRU 链表
+    for (auto it = lru_list.begin(); it != lru_list.end();) {
+        if (it->first == LPN_TO_UNIQUE_KEY(stream_id, it->second->LPA) && it->second->LPA >= first_lpa && it->second->LPA <= last_lpa) {
+            slots.erase(it->first);
+            it = lru_list.erase(it);
+            removed++;
+        } else {
+            ++it;
+        }
     }
+    return removed;
 }
 
-void DataCache::InsertReadData(const uint64_t stream_id, const uint64_t lpa, const std::vector<uint8_t>& data, const uint64_t timestamp, const uint64_t read_sector_bitmap) {
+void DataCache::InsertReadData(const uint64_t stream_id, const uint64_t lpa, const PageBufferPtr& data, const uint64_t timestamp, const uint64_t read_sector_bitmap) {
     uint64_t key = LPN_TO_UNIQUE_KEY(stream_id, lpa);
     if(slots.find(key) == slots.end()){
         if(slots.size() >= capacity_in_pages){
@@ -109,7 +135,7 @@ void DataCache::InsertReadData(const uint64_t stream_id, const uint64_t lpa, con
     }
 }
 
-void DataCache::InsertWriteData(const uint64_t stream_id, const uint64_t lpa, const std::vector<uint8_t>& data, const uint64_t timestamp, const uint64_t write_sector_bitmap) {
+void DataCache::InsertWriteData(const uint64_t stream_id, const uint64_t lpa, const PageBufferPtr& data, const uint64_t timestamp, const uint64_t write_sector_bitmap) {
     uint64_t key = LPN_TO_UNIQUE_KEY(stream_id, lpa);
     if(slots.find(key) == slots.end()){
         if(slots.size() >= capacity_in_pages){
@@ -128,7 +154,7 @@ void DataCache::InsertWriteData(const uint64_t stream_id, const uint64_t lpa, co
     }
 }
 
-void DataCache::UpdateData(const uint64_t stream_id, const uint64_t lpa, const std::vector<uint8_t>& data, const uint64_t timestamp, const uint64_t write_sector_bitmap) {
+void DataCache::UpdateData(const uint64_t stream_id, const uint64_t lpa, const PageBufferPtr& data, const uint64_t timestamp, const uint64_t write_sector_bitmap) {
     uint64_t key = LPN_TO_UNIQUE_KEY(stream_id, lpa);
     auto it = slots.find(key);
     if (it != slots.end()) {
@@ -1,5 +1,6 @@
 #pragma once
 #include "param.h"
+#include "page_buffer.h"
 
 
 
@@ -28,7 +29,7 @@ struct PageDataCacheSlot
     uint64_t sector_bitmap; //page中有效的sector位图
     uint64_t LPA;
     uint64_t time_stamp;
-    std::vector<uint8_t> data; // 缓存页数据
+    PageBufferPtr data; // 缓存页数据，与请求/NAND命令共享同一个页缓冲区
     CacheStatus status;
     std::list<std::pair<uint64_t,PageDataCacheSlotPtr>>::iterator lru_pos; //指向LRU链表中的位置 
 };
@@ -64,9 +65,11 @@ public:
 
     void ChangeSlotStatusToWriteBack(const uint64_t stream_id, const uint64_t lpa);
     void RemoveSlot(const uint64_t stream_id, const uint64_t lpa);
-    void InsertReadData(const uint64_t stream_id, const uint64_t lpa, const std::vector<uint8_t>& data,const uint64_t timestamp, const uint64_t read_sector_bitmap);
-    void InsertWriteData(const uint64_t stream_id, const uint64_t lpa, const std::vector<uint8_t>& data,const uint64_t timestamp, const uint64_t write_sector_bitmap);
-    void UpdateData(const uint64_t stream_id, const uint64_t lpa, const std::vector<uint8_t>& data,const uint64_t timestamp, const uint64_t write_sector_bitmap);
+    // 删除 [first_lpa, last_lpa] 内的所有缓存页(TRIM)，返回删除的页数
+    uint64_t RemoveRange(const uint64_t stream_id, const uint64_t first_lpa, const uint64_t last_lpa);
+    void InsertReadData(const uint64_t stream_id, const uint64_t lpa, const PageBufferPtr& data,const uint64_t timestamp, const uint64_t read_sector_bitmap);
+    void InsertWriteData(const uint64_t stream_id, const uint64_t lpa, const PageBufferPtr& data,const uint64_t timestamp, const uint64_t write_sector_bitmap);
+    void UpdateData(const uint64_t stream_id, const uint64_t lpa, const PageBufferPtr& data,const uint64_t timestamp, const uint64_t write_sector_bitmap);
 
 private:
     std::unordered_map<uint64_t, PageDataCacheSlotPtr> slots; // key: LPN_TO_UNIQUE_KEY(STREAM,LPA)
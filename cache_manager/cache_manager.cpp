@@ -0,0 +1,13 @@
+#include "cache_maneger.h"
+
+void CacheManager::Trim(uint64_t stream_id, const uint64_t first_lpa, const uint64_t last_lpa)
+{
+    if (stream_id >= per_stream_cache.size())
+    {
+        return;
+    }
+    for (auto &cache : per_stream_cache[stream_id])
+    {
+        cache.RemoveRange(stream_id, first_lpa, last_lpa);
+    }
+}
@@ -24,8 +24,10 @@ public:
                  uint64_t sector_per_page, uint64_t back_pressure_buffer_max_depth);
     ~CacheManager();
 
-    void check_read(uint64_t stream_id, const uint64_t lpa, std::vector<uint8_t> &data, const uint64_t timestamp);
-    void check_write(uint64_t stream_id, const uint64_t lpa, const std::vector<uint8_t> &data, const uint64_t timestamp);
+    void check_read(uint64_t stream_id, const uint64_t lpa, PageBufferPtr &data, const uint64_t timestamp);
+    void check_write(uint64_t stream_id, const uint64_t lpa, const PageBufferPtr &data, const uint64_t timestamp);
+    // TRIM：丢弃该流在 [first_lpa, last_lpa] 内的缓存页
+    void Trim(uint64_t stream_id, const uint64_t first_lpa, const uint64_t last_lpa);
 
 private:
     NandDriverPtr nand_driver;
@@ -0,0 +1,789 @@
+#include "ftl.h"
+#include "user_request.h"
+#include "transaction.h"
+#include "address_mapping.h"
+#include "block_manager.h"
+#include "gc_wl.h"
+#include "nand_driver.h"
+#include "cache_maneger.h"
+#include "hot_cold_classifier.h"
+#include "checkpoint_manager.h"
+#include "reliability_model.h"
+#include "state_snapshot.h"
+
+namespace
+{
+    // 低 sector_count 位为1的掩码
+    inline uint64_t LowSectorMask(uint64_t sector_count)
+    {
+        return sector_count >= 64 ? ~0ULL : ((1ULL << sector_count) - 1);
+    }
+
+    // 快照文件头中与状态布局有关的配置
+    StateSnapshotHeader MakeSnapshotHeader(const AddressMappingPageLevelPtr &address_mapping, const BlockManagerPtr &block_manager)
+    {
+        StateSnapshotHeader header{};
+        header.magic = STATE_SNAPSHOT_MAGIC;
+        header.version = STATE_SNAPSHOT_VERSION;
+        header.channel_no = config.ssd_param.ChannelNum;
+        header.chips_per_channel = config.ssd_param.ChipPerChannel;
+        header.dies_per_chip = config.nand_param.DiePerChip;
+        header.planes_per_die = config.nand_param.PlanePerDie;
+        header.blocks_per_plane = config.nand_param.BlockPerPlane;
+        header.pages_per_block = config.nand_param.PagePerBlock;
+        header.page_size = config.nand_param.PageSize;
+        header.stream_no = address_mapping->GetStreamsNo();
+        header.write_hint_count = block_manager->GetWriteHintCnt();
+        header.gc_temperature_count = block_manager->GetGcTemperatureCnt();
+        header.reserved_blocks_per_plane = config.ssd_param.checkpoint_param.enabled ? config.ssd_param.checkpoint_param.reserved_blocks_per_plane : 0;
+        for (uint64_t stream_id = 0; stream_id < header.stream_no; stream_id++)
+        {
+            header.logical_pages_no += address_mapping->GetLogicalPagesNo(stream_id);
+        }
+        return header;
+    }
+}
+
+void FTL::Init()
+{
+    sectors_per_page = config.nand_param.PageSize / SECTOR_SIZE_IN_BYTE;
+    if (sectors_per_page == 0 || sectors_per_page > 64)
+    {
+        PRINT_ERROR("Sector bitmaps require 1 to 64 sectors per page!")
+    }
+    const GcParam &gc_param = config.ssd_param.gc_param;
+    const PlacementParam &placement_param = config.ssd_param.placement_param;
+    write_hint_mode = placement_param.write_hint_mode;
+    uint64_t write_hint_count = write_hint_mode == WriteHintMode::NONE ? 1 : std::max<uint64_t>(placement_param.write_hint_count, 1);
+    uint64_t gc_temperature_count = std::max<uint64_t>(placement_param.gc_temperature_count, 1);
+    if (nand_driver == nullptr)
+    {
+        nand_driver = std::make_shared<NandDriver>();
+    }
+    block_manager = std::make_shared<BlockManager>(nullptr, config.nand_param.BlockPECycle, config.ssd_param.StreamNum,
+                                                   config.ssd_param.ChannelNum, config.ssd_param.ChipPerChannel, config.nand_param.DiePerChip,
+                                                   config.nand_param.PlanePerDie, config.nand_param.BlockPerPlane, config.nand_param.PagePerBlock,
+                                                   write_hint_count, gc_temperature_count, nand_driver);
+    const CheckpointParam &checkpoint_param = config.ssd_param.checkpoint_param;
+    if (checkpoint_param.enabled)
+    {
+        block_manager->ReserveBlocks(checkpoint_param.reserved_blocks_per_plane);
+    }
+    address_mapping = std::make_shared<AddressMappingPageLevel>(shared_from_this(), nand_driver, block_manager);
+    if (write_hint_mode == WriteHintMode::AUTO || gc_temperature_count > 1)
+    {
+        // 衰减周期默认取逻辑页数：大约每个 LPA 平均写一次减半一次，只有明显比平均更新得勤的 LPA 才会升温，
+        // 周期远大于逻辑页数时冷页也会积累计数，所有页都被判成热的
+        uint64_t decay_interval = placement_param.classifier_decay_interval;
+        if (decay_interval == 0)
+        {
+            for (uint64_t stream_id = 0; stream_id < config.ssd_param.StreamNum; stream_id++)
+            {
+                decay_interval += address_mapping->GetLogicalPagesNo(stream_id);
+            }
+        }
+        // 用户写入点和 GC 打开块共用一个分类器，类别数取两者中大的，各自分配时再截到自己的个数
+        hot_cold_classifier = std::make_shared<HotColdClassifier>(std::max(write_hint_count, gc_temperature_count), placement_param.classifier_table_size,
+                                                                  decay_interval);
+    }
+    gcwl_unit = std::make_shared<GcWlUnit>(address_mapping, block_manager, nand_driver, gc_param.mode, gc_param.gc_threshold_low,
+                                           gc_param.preemptible_gc_enabled, gc_param.gc_hard_threshold, config.ssd_param.ChannelNum,
+                                           config.ssd_param.ChipPerChannel, config.nand_param.DiePerChip, config.nand_param.PlanePerDie,
+                                           config.nand_param.BlockPerPlane, config.nand_param.PagePerBlock, sectors_per_page,
+                                           gc_param.use_copyback, gc_param.rho, gc_param.max_ongoing_gc_reqs_per_plane,
+                                           gc_param.dynamic_wl_enabled, gc_param.static_wl_enabled, gc_param.static_wl_threshold);
+    block_manager->SetGarbageCollectionUnit(gcwl_unit);
+    gcwl_unit->SetSpareBlocksForProgramFailure(config.nand_param.ProgramFailureRate > 0 ? 1 : 0);
+    gcwl_unit->SetHotColdClassifier(hot_cold_classifier);
+    gcwl_unit->SetTransactionDispatcher([this](std::vector<TransactionPtr> &transactions)
+                                        { DispatchTransactions(transactions); });
+    gcwl_unit->SetOutOfSpaceHandler([this](const PhysicalPageAddress plane_address)
+                                    { EnterReadOnlyMode(plane_address); });
+    if (checkpoint_param.enabled)
+    {
+        checkpoint_manager = std::make_shared<CheckpointManager>(nand_driver, address_mapping, block_manager, checkpoint_param.interval,
+                                                                 checkpoint_param.reserved_blocks_per_plane);
+        checkpoint_manager->SetTransactionDispatcher([this](std::vector<TransactionPtr> &transactions)
+                                                     { DispatchTransactions(transactions); });
+        address_mapping->SetTrimListener([this](uint64_t stream_id, uint64_t lpa, uint64_t ppa, uint64_t write_state_bitmap)
+                                         {
+                                             // 预处理结束时的检查点会包含预处理期间的 TRIM
+                                             if (!preconditioning)
+                                             {
+                                                 checkpoint_manager->OnTrim(stream_id, lpa, ppa, write_state_bitmap);
+                                             } });
+    }
+    const ReliabilityParam &reliability_param = config.ssd_param.reliability_param;
+    if (reliability_param.enabled && reliability_model == nullptr)
+    {
+        reliability_model = std::make_shared<ReliabilityModel>(reliability_param, config.nand_param.BlockPECycle, config.nand_param.InitialPECycles,
+                                                               config.nand_param.PageSize);
+    }
+    powered_on = true;
+}
+
+void FTL::SimulatePowerLoss()
+{
+    powered_on = false;
+    nand_driver->PowerOff();
+    deferred_program_retries.clear();
+    block_manager->SetGarbageCollectionUnit(nullptr);
+    gcwl_unit = nullptr;
+    checkpoint_manager = nullptr;
+    address_mapping = nullptr;
+    block_manager = nullptr;
+    hot_cold_classifier = nullptr;
+}
+
+MountStatistics FTL::Mount()
+{
+    Init();
+    RecoveryManager recovery_manager(nand_driver, address_mapping, block_manager, checkpoint_manager, config.ssd_param.recovery_param.parallel_scan);
+    return recovery_manager.Recover();
+}
+
+uint64_t FTL::SaveSnapshot(const std::string &path, bool include_page_data)
+{
+    if (!powered_on)
+    {
+        PRINT_ERROR("Cannot take a snapshot of a powered-off drive!")
+    }
+    nand_driver->WaitForAllCompletions();
+    if (!deferred_program_retries.empty())
+    {
+        PRINT_ERROR("Cannot take a snapshot while failed programs are waiting for free blocks!")
+    }
+    StateSnapshotHeader header = MakeSnapshotHeader(address_mapping, block_manager);
+    header.flags = include_page_data ? STATE_SNAPSHOT_FLAG_PAGE_DATA : 0;
+    SnapshotWriter writer(path);
+    writer.Write(header);
+    nand_driver->SaveSnapshot(writer, include_page_data);
+    block_manager->SaveSnapshot(writer);
+    address_mapping->SaveSnapshot(writer);
+    if (checkpoint_manager != nullptr)
+    {
+        checkpoint_manager->SaveSnapshot(writer);
+    }
+    // 冷热分类器只在 WriteHintMode::AUTO 或 GC 分冷热时存在，载入时两边都有才恢复
+    writer.BeginSection(SnapshotSection::CLASSIFIER);
+    writer.Write<uint64_t>(hot_cold_classifier != nullptr);
+    if (hot_cold_classifier != nullptr)
+    {
+        hot_cold_classifier->SaveSnapshot(writer);
+    }
+    return writer.Finish();
+}
+
+void FTL::LoadSnapshot(const std::string &path)
+{
+    if (!powered_on)
+    {
+        PRINT_ERROR("Cannot load a snapshot into a powered-off drive!")
+    }
+    nand_driver->WaitForAllCompletions();
+    SnapshotReader reader(path);
+    const StateSnapshotHeader &header = reader.GetHeader();
+    StateSnapshotHeader expected = MakeSnapshotHeader(address_mapping, block_manager);
+    if (header.channel_no != expected.channel_no || header.chips_per_channel != expected.chips_per_channel ||
+        header.dies_per_chip != expected.dies_per_chip || header.planes_per_die != expected.planes_per_die ||
+        header.blocks_per_plane != expected.blocks_per_plane || header.pages_per_block != expected.pages_per_block ||
+        header.page_size != expected.page_size)
+    {
+        PRINT_ERROR("Snapshot " << path << " was taken with a different flash geometry!")
+    }
+    if (header.stream_no != expected.stream_no || header.write_hint_count != expected.write_hint_count ||
+        header.gc_temperature_count != expected.gc_temperature_count || header.logical_pages_no != expected.logical_pages_no)
+    {
+        PRINT_ERROR("Snapshot " << path << " was taken with a different stream, write hint, GC temperature or overprovisioning configuration!")
+    }
+    if (header.reserved_blocks_per_plane != expected.reserved_blocks_per_plane)
+    {
+        PRINT_ERROR("Snapshot " << path << " was taken with a different checkpoint configuration!")
+    }
+    nand_driver->LoadSnapshot(reader);
+    block_manager->LoadSnapshot(reader);
+    address_mapping->LoadSnapshot(reader);
+    if (checkpoint_manager != nullptr)
+    {
+        checkpoint_manager->LoadSnapshot(reader);
+    }
+    reader.ExpectSection(SnapshotSection::CLASSIFIER);
+    if (reader.Read<uint64_t>() != 0)
+    {
+        if (hot_cold_classifier != nullptr)
+        {
+            hot_cold_classifier->LoadSnapshot(reader);
+        }
+        else
+        {
+            reader.Read<uint64_t>();
+            reader.ReadBytes(reader.ReadCount(sizeof(uint8_t)));
+        }
+    }
+    reader.Finish();
+}
+
+void FTL::StartPreconditioning()
+{
+    if (!powered_on)
+    {
+        PRINT_ERROR("Cannot precondition a powered-off drive!")
+    }
+    nand_driver->WaitForAllCompletions();
+    preconditioning = true;
+    gcwl_unit->SetPreconditioning(true);
+}
+
+uint64_t FTL::PreconditionUserRequest(const UserRequestPtr &req)
+{
+    if (!preconditioning)
+    {
+        PRINT_ERROR("PreconditionUserRequest called outside preconditioning!")
+    }
+    if (req->req_type == UserRequestType::TRIM)
+    {
+        trimmed_page_count += TrimUserRequest(req);
+        return 0;
+    }
+    if (req->req_type != UserRequestType::WRITE || req->size_in_sectors == 0)
+    {
+        return 0;
+    }
+    uint64_t first_lpa = req->start_lsa / sectors_per_page;
+    uint64_t last_lpa = (req->start_lsa + req->size_in_sectors - 1) / sectors_per_page;
+    if (last_lpa >= address_mapping->GetLogicalPagesNo(req->stream_id))
+    {
+        PRINT_ERROR("User request " << req->id << " is beyond the logical space of stream " << req->stream_id)
+    }
+    if (cache_manager != nullptr)
+    {
+        cache_manager->Trim(req->stream_id, first_lpa, last_lpa);
+    }
+    uint64_t first_page_bitmap = ~LowSectorMask(req->start_lsa % sectors_per_page);
+    uint64_t last_page_bitmap = LowSectorMask((req->start_lsa + req->size_in_sectors - 1) % sectors_per_page + 1);
+    for (uint64_t lpa = first_lpa; lpa <= last_lpa; lpa++)
+    {
+        uint64_t sectors_bitmap = LowSectorMask(sectors_per_page);
+        if (lpa == first_lpa)
+            sectors_bitmap &= first_page_bitmap;
+        if (lpa == last_lpa)
+            sectors_bitmap &= last_page_bitmap;
+        address_mapping->PreconditionWrite(req->stream_id, lpa, sectors_bitmap, GetWriteHint(req, lpa));
+    }
+    return last_lpa - first_lpa + 1;
+}
+
+void FTL::FinishPreconditioning()
+{
+    preconditioning = false;
+    gcwl_unit->SetPreconditioning(false);
+    if (checkpoint_manager != nullptr)
+    {
+        checkpoint_manager->RequestCheckpoint();
+        nand_driver->WaitForAllCompletions();
+    }
+}
+
+uint64_t FTL::CreateTransactionFromUserRequest(UserRequestPtr req, std::vector<TransactionPtr> &transaction_list)
+{
+    if (req->size_in_sectors == 0)
+    {
+        return 0;
+    }
+    // 只按页做整数运算：首尾页用偏移算出部分位图，中间页都是整页
+    uint64_t first_lpa = req->start_lsa / sectors_per_page;
+    uint64_t last_lpa = (req->start_lsa + req->size_in_sectors - 1) / sectors_per_page;
+    uint64_t first_offset = req->start_lsa % sectors_per_page;
+    uint64_t last_end = (req->start_lsa + req->size_in_sectors - 1) % sectors_per_page + 1;
+    uint64_t page_count = last_lpa - first_lpa + 1;
+    if (last_lpa >= address_mapping->GetLogicalPagesNo(req->stream_id))
+    {
+        PRINT_ERROR("User request " << req->id << " is beyond the logical space of stream " << req->stream_id)
+    }
+    req->start_lpa = first_lpa;
+
+    bool is_write = req->req_type == UserRequestType::WRITE;
+    if (req->data.size() < page_count)
+    {
+        req->data.resize(page_count);
+    }
+    for (uint64_t i = 0; i < page_count; i++)
+    {
+        uint64_t lpa = first_lpa + i;
+        uint64_t sector_begin = (i == 0) ? first_offset : 0;
+        uint64_t sector_end = (i == page_count - 1) ? last_end : sectors_per_page;
+        uint64_t sectors_bitmap = LowSectorMask(sector_end) & ~LowSectorMask(sector_begin);
+        uint64_t size_in_sectors = sector_end - sector_begin;
+        if (is_write)
+        {
+            auto tr = MakeTransaction<TransactionWrite>(req->stream_id, TransactionSourceType::USERIO, TransactionType::WRITE, Priority::MEDIUM,
+                                                        PhysicalPageAddress(), false, req->req_type, lpa, NO_VALUE,
+                                                        size_in_sectors * SECTOR_SIZE_IN_BYTE, size_in_sectors);
+            tr->write_sectors_bitmap = sectors_bitmap;
+            tr->write_hint = GetWriteHint(req, lpa);
+            if (req->data[i] == nullptr)
+            {
+                req->data[i] = PageBufferPool::GetInstance().Allocate();
+            }
+            tr->content = req->data[i];
+            tr->user_request = req;
+            transaction_list.push_back(tr);
+        }
+        else
+        {
+            auto tr = MakeTransaction<TransactionRead>(req->stream_id, TransactionSourceType::USERIO, TransactionType::READ, Priority::MEDIUM,
+                                                       PhysicalPageAddress(), false, req->req_type, lpa, NO_VALUE,
+                                                       size_in_sectors * SECTOR_SIZE_IN_BYTE, size_in_sectors);
+            tr->read_sectors_bitmap = sectors_bitmap;
+            tr->user_request = req;
+            transaction_list.push_back(tr);
+        }
+    }
+    return page_count;
+}
+
+uint64_t FTL::GetWriteHint(const UserRequestPtr &req, const uint64_t lpa)
+{
+    // 分类器存在时每次写入都要计入更新频率，GC 搬移时也按它分冷热
+    uint64_t temperature = hot_cold_classifier == nullptr ? 0 : hot_cold_classifier->RecordWriteAndClassify(req->stream_id, lpa);
+    switch (write_hint_mode)
+    {
+    case WriteHintMode::HOST:
+        return req->write_hint == NO_VALUE ? 0 : req->write_hint;
+    case WriteHintMode::AUTO:
+        // 主机给出的提示优先
+        return req->write_hint == NO_VALUE ? temperature : req->write_hint;
+    default:
+        return 0;
+    }
+}
+
+uint64_t FTL::TrimUserRequest(const UserRequestPtr &req)
+{
+    if (req->size_in_sectors == 0)
+    {
+        return 0;
+    }
+    uint64_t first_lpa = req->start_lsa / sectors_per_page;
+    uint64_t last_lpa = (req->start_lsa + req->size_in_sectors - 1) / sectors_per_page;
+    if (last_lpa >= address_mapping->GetLogicalPagesNo(req->stream_id))
+    {
+        PRINT_ERROR("User request " << req->id << " is beyond the logical space of stream " << req->stream_id)
+    }
+    req->start_lpa = first_lpa;
+    uint64_t first_page_bitmap = ~LowSectorMask(req->start_lsa % sectors_per_page);
+    uint64_t last_page_bitmap = LowSectorMask((req->start_lsa + req->size_in_sectors - 1) % sectors_per_page + 1);
+    if (cache_manager != nullptr)
+    {
+        cache_manager->Trim(req->stream_id, first_lpa, last_lpa);
+    }
+    return address_mapping->TrimLpaRange(req->stream_id, first_lpa, last_lpa - first_lpa + 1, first_page_bitmap, last_page_bitmap);
+}
+
+void FTL::ProcessUserRequest(UserRequestPtr req)
+{
+    TransactionBatchStack::Batch batch(transaction_batches);
+    std::vector<TransactionPtr> &transaction_list = batch.transactions;
+    if (read_only && req->req_type != UserRequestType::READ)
+    {
+        // 只读后 TRIM 也不再修改映射
+        MarkWriteRejected(req);
+    }
+    else if (req->req_type == UserRequestType::TRIM)
+    {
+        trimmed_page_count += TrimUserRequest(req);
+    }
+    else
+    {
+        CreateTransactionFromUserRequest(req, transaction_list);
+    }
+    req->pending_transaction_count = transaction_list.size();
+    if (transaction_list.empty())
+    {
+        // 空请求和 TRIM 只修改映射，不产生 NAND 操作，直接完成
+        if (request_completion_handler)
+        {
+            request_completion_handler(req);
+        }
+        return;
+    }
+    address_mapping->TranslateLpaToPpaAndDispatch(transaction_list);
+}
+
+void FTL::DispatchTransactions(std::vector<TransactionPtr> &transactions)
+{
+    TransactionBatchStack::Batch batch(transaction_batches);
+    std::vector<TransactionPtr> &unmapped_reads = batch.transactions;
+    for (auto &tr : transactions)
+    {
+        if (tr->type == TransactionType::READ && tr->ppa == NO_VALUE)
+        {
+            unmapped_reads.push_back(tr);
+            continue;
+        }
+        TransactionPtr issued = tr;
+        if (tr->type == TransactionType::WRITE)
+        {
+            auto write_tr = static_cast<TransactionWrite *>(tr.get());
+            if (write_tr->related_read != nullptr)
+            {
+                // 部分页更新：先读出旧页中未被覆盖的扇区，读完成后再下发写。
+                // 改为由读事务反向引用写事务，避免两者互相持有
+                TransactionReadPtr update_read = write_tr->related_read;
+                write_tr->related_read = nullptr;
+                update_read->related_write = TransactionCast<TransactionWrite>(tr);
+                issued = update_read;
+            }
+        }
+        NandTask task;
+        task.tag = reinterpret_cast<uint64_t>(issued.get());
+        task.addr = issued->physical_address;
+        task.callback = &FTL::OnNandCommandCompleted;
+        task.context = this;
+        switch (issued->type)
+        {
+        case TransactionType::READ:
+            task.cmd = NandCmd::READ;
+            break;
+        case TransactionType::WRITE:
+        {
+            auto write_tr = static_cast<TransactionWrite *>(issued.get());
+            task.cmd = NandCmd::PROGRAM;
+            task.data = write_tr->content;
+            // 备用区记录 (流, LPA, 编程序号, 扇区位图, 擦除次数)：GC 据此找回映射，掉电后挂载据此重建映射表
+            task.metadata.lpa = write_tr->lpa;
+            task.metadata.stream_id = write_tr->stream_id;
+            task.metadata.sequence = write_tr->sequence;
+            task.metadata.write_state_bitmap = write_tr->write_sectors_bitmap;
+            task.metadata.erase_count = block_manager->GetPlaneBookKeepingEntry(write_tr->physical_address)->blocks[write_tr->physical_address.block_id]->erase_count;
+            // 检查点保留块按 SLC 方式使用，不注入失败
+            task.inject_failures = issued->source != TransactionSourceType::MAPPING;
+            break;
+        }
+        case TransactionType::ERASE:
+            task.cmd = NandCmd::ERASE;
+            task.metadata.erase_count = block_manager->GetPlaneBookKeepingEntry(issued->physical_address)->blocks[issued->physical_address.block_id]->erase_count;
+            task.inject_failures = issued->source != TransactionSourceType::MAPPING;
+            break;
+        default:
+            PRINT_ERROR("Unsupported transaction type for NAND dispatch!")
+        }
+        issued->AddRef(); // 命令在途期间由 tag 持有一个引用，完成回调中释放
+        dispatch_batch.push_back(std::move(task));
+    }
+    if (!dispatch_batch.empty())
+    {
+        nand_driver->SubmitCommands(dispatch_batch);
+    }
+    // 没有物理页的读不访问 NAND，等本批命令提交后直接完成，数据为空
+    for (auto &tr : unmapped_reads)
+    {
+        OnSubTransactionCompleted(tr->user_request);
+    }
+}
+
+void FTL::OnNandCommandCompleted(void *context, NandResult &result)
+{
+    Transaction *raw_tr = reinterpret_cast<Transaction *>(result.tag);
+    TransactionPtr tr(raw_tr);
+    raw_tr->Release(); // 接管提交时增加的引用
+    static_cast<FTL *>(context)->OnTransactionServiced(tr, result);
+}
+
+void FTL::OnTransactionServiced(const TransactionPtr &tr, NandResult &result)
+{
+    if (!powered_on)
+    {
+        // 掉电后不再推进任何事务，只拆开 GC 读/写/擦除事务之间的相互引用，让它们随易失状态一起释放
+        if (tr->type == TransactionType::READ && static_cast<TransactionRead *>(tr.get())->related_write != nullptr)
+        {
+            auto read_tr = static_cast<TransactionRead *>(tr.get());
+            read_tr->related_write->related_erase = nullptr;
+            read_tr->related_write = nullptr;
+        }
+        else if (tr->type == TransactionType::WRITE)
+        {
+            static_cast<TransactionWrite *>(tr.get())->related_erase = nullptr;
+        }
+        else if (tr->type == TransactionType::ERASE)
+        {
+            static_cast<TransactionErase *>(tr.get())->page_movement_actions.clear();
+        }
+        return;
+    }
+    if (result.status == NAND_STATUS_PROGRAM_FAILED && tr->source != TransactionSourceType::MAPPING)
+    {
+        if (!HandleProgramFailure(tr))
+        {
+            return;
+        }
+    }
+    else if (result.status == NAND_STATUS_ERASE_FAILED && tr->source == TransactionSourceType::GC)
+    {
+        // 块内已没有有效数据，GC 完成时直接退役
+        erase_failure_count++;
+        block_manager->MarkBlockBad(tr->physical_address);
+    }
+    else if (result.status != 0)
+    {
+        PRINT_ERROR("NAND command failed on @" << tr->physical_address.channel_id << "@" << tr->physical_address.chip_id << "@"
+                                              << tr->physical_address.die_id << "@" << tr->physical_address.plane_id << "@"
+                                              << tr->physical_address.block_id << "@" << tr->physical_address.page_id)
+    }
+    // 检查点和日志页不经过误码模型
+    if (reliability_model != nullptr && tr->type == TransactionType::READ && tr->source != TransactionSourceType::MAPPING && !DecodeReadData(tr))
+    {
+        return;
+    }
+    if (tr->source == TransactionSourceType::MAPPING)
+    {
+        checkpoint_manager->OnTransactionServiced(tr);
+        return;
+    }
+    if (tr->source == TransactionSourceType::GC)
+    {
+        if (tr->type == TransactionType::WRITE)
+        {
+            address_mapping->ProgramFinished(tr->physical_address);
+        }
+        gcwl_unit->OnTransactionServiced(tr, std::move(result.data));
+        if (!deferred_program_retries.empty())
+        {
+            RetryDeferredPrograms();
+        }
+        if (checkpoint_manager != nullptr && tr->type == TransactionType::WRITE)
+        {
+            checkpoint_manager->OnProgramCompleted(*static_cast<TransactionWrite *>(tr.get()));
+        }
+        else if (checkpoint_manager != nullptr && tr->type == TransactionType::ERASE)
+        {
+            checkpoint_manager->OnBlockErased(tr->physical_address);
+        }
+        return;
+    }
+    switch (tr->type)
+    {
+    case TransactionType::READ:
+    {
+        auto read_tr = static_cast<TransactionRead *>(tr.get());
+        block_manager->ReadTransactionFinishedOnBlock(tr->physical_address);
+        if (reliability_model != nullptr)
+        {
+            // 等待读回收的块可能正因这次读不能回收
+            gcwl_unit->CheckReadReclaim(tr->physical_address);
+        }
+        // 停写的 plane 上候选块可能正因这次读不能回收，之后再没有分配来触发回收
+        gcwl_unit->ResumeGcForWaitingWrites(tr->physical_address);
+        read_tr->content = std::move(result.data);
+        if (read_tr->related_write != nullptr)
+        {
+            // 把旧页中未被覆盖的扇区合并进待写页，然后下发写
+            TransactionWritePtr write_tr = read_tr->related_write;
+            read_tr->related_write = nullptr;
+            uint64_t bitmap = read_tr->read_sectors_bitmap;
+            while (bitmap != 0)
+            {
+                uint64_t first = __builtin_ctzll(bitmap);
+                uint64_t shifted = bitmap >> first;
+                uint64_t run = shifted == ~0ULL ? 64 : __builtin_ctzll(~shifted); // 连续置位的扇区数
+                std::memcpy(write_tr->content->data + first * SECTOR_SIZE_IN_BYTE, read_tr->content->data + first * SECTOR_SIZE_IN_BYTE,
+                            run * SECTOR_SIZE_IN_BYTE);
+                bitmap &= ~LowSectorMask(first + run);
+            }
+            TransactionBatchStack::Batch write_batch(transaction_batches);
+            write_batch.transactions.push_back(write_tr);
+            DispatchTransactions(write_batch.transactions);
+        }
+        else if (tr->user_request != nullptr)
+        {
+            tr->user_request->data[tr->lpa - tr->user_request->start_lpa] = read_tr->content;
+            OnSubTransactionCompleted(tr->user_request);
+        }
+        break;
+    }
+    case TransactionType::WRITE:
+        FinishUserWrite(tr);
+        break;
+    default:
+        break;
+    }
+}
+
+void FTL::FinishUserWrite(const TransactionPtr &tr)
+{
+    block_manager->ProgramTransactionFinishedOnBlock(tr->physical_address);
+    address_mapping->ProgramFinished(tr->physical_address);
+    // 编程失败的块要等在途编程都完成才能搬移
+    gcwl_unit->CheckReadReclaim(tr->physical_address);
+    gcwl_unit->ResumeGcForWaitingWrites(tr->physical_address);
+    if (static_cast<TransactionWrite *>(tr.get())->overwritten_ppa != NO_VALUE)
+    {
+        PhysicalPageAddress overwritten_address = address_mapping->ConvertPPAtoAddress(static_cast<TransactionWrite *>(tr.get())->overwritten_ppa);
+        block_manager->OverwriteFinishedOnBlock(overwritten_address);
+        // 旧页所在的块在新版本落盘前不能回收
+        gcwl_unit->ResumeGcForWaitingWrites(overwritten_address);
+    }
+    if (checkpoint_manager != nullptr)
+    {
+        checkpoint_manager->OnProgramCompleted(*static_cast<TransactionWrite *>(tr.get()));
+    }
+    if (tr->user_request != nullptr)
+    {
+        OnSubTransactionCompleted(tr->user_request);
+    }
+}
+
+bool FTL::DecodeReadData(const TransactionPtr &tr)
+{
+    auto read_tr = static_cast<TransactionRead *>(tr.get());
+    BlockPtr block = block_manager->GetPlaneBookKeepingEntry(tr->physical_address)->blocks[tr->physical_address.block_id];
+    ReadDecodeResult result = reliability_model->DecodeRead(*block, read_tr->read_retry_step, read_tr->modeled_latency_ns);
+    if (result == ReadDecodeResult::RETRY)
+    {
+        // 重读期间块上的在途读计数不释放，块不会被擦除
+        read_tr->read_retry_step++;
+        TransactionBatchStack::Batch retry_batch(transaction_batches);
+        retry_batch.transactions.push_back(tr);
+        DispatchTransactions(retry_batch.transactions);
+        return false;
+    }
+    // 部分页更新的读属于写请求，不计入主机读时延
+    reliability_model->RecordReadCompletion(read_tr->modeled_latency_ns, tr->user_request != nullptr && tr->user_request->req_type == UserRequestType::READ);
+    if (result == ReadDecodeResult::UNCORRECTABLE && tr->user_request != nullptr)
+    {
+        // 模拟器中的数据并未损坏，照常返回，只标记介质错误
+        tr->user_request->media_error = true;
+    }
+    if (reliability_model->NeedsReadReclaim(*block, result, read_tr->read_retry_step))
+    {
+        gcwl_unit->RequestReadReclaim(tr->physical_address);
+    }
+    return true;
+}
+
+bool FTL::HandleProgramFailure(const TransactionPtr &tr)
+{
+    program_failure_count++;
+    block_manager->MarkBlockBad(tr->physical_address);
+    if (tr->source != TransactionSourceType::GC && read_only && gcwl_unit->StopServicingWrites(tr->physical_address))
+    {
+        // 不会再回收出空闲块，不再挂起
+        return SalvageFailedProgram(tr);
+    }
+    if (tr->source != TransactionSourceType::GC && gcwl_unit->StopServicingWrites(tr->physical_address))
+    {
+        // 剩下的空闲块留给在途回收；失败页的在途编程计数保留到重写时，失败块在此之前不会被选为回收块
+        deferred_program_retries.push_back(tr);
+        gcwl_unit->CheckGcRequired(block_manager->GetFreeBlockPoolSize(tr->physical_address), tr->physical_address);
+        return false;
+    }
+    return RewriteFailedProgram(tr);
+}
+
+bool FTL::RewriteFailedProgram(const TransactionPtr &tr)
+{
+    uint64_t ppa = NO_VALUE, write_state_bitmap = 0;
+    address_mapping->GetDataMappingForGC(tr->stream_id, tr->lpa, ppa, write_state_bitmap);
+    if (ppa != tr->ppa)
+    {
+        // 失败页已被取代为无效页，块在这次编程完成后即可搬移
+        gcwl_unit->RequestReadReclaim(tr->physical_address);
+        return true;
+    }
+    PhysicalPageAddress failed_address = tr->physical_address;
+    block_manager->ProgramTransactionFinishedOnBlock(failed_address);
+    address_mapping->ProgramFinished(failed_address);
+    // 写到失败块所在 plane 的 GC 打开块，失败页随之无效，之后才能搬移失败块；页缓冲区还在事务中，直接重新下发
+    address_mapping->AllocateNewPageForGC(TransactionCast<TransactionWrite>(tr));
+    gcwl_unit->RequestReadReclaim(failed_address);
+    TransactionBatchStack::Batch retry_batch(transaction_batches);
+    retry_batch.transactions.push_back(tr);
+    DispatchTransactions(retry_batch.transactions);
+    return false;
+}
+
+void FTL::OnSubTransactionCompleted(const UserRequestPtr &req)
+{
+    if (--req->pending_transaction_count == 0 && request_completion_handler)
+    {
+        request_completion_handler(req);
+    }
+}
+
+void FTL::RetryDeferredPrograms()
+{
+    std::list<TransactionPtr> retries;
+    retries.swap(deferred_program_retries);
+    for (auto &tr : retries)
+    {
+        if (gcwl_unit->StopServicingWrites(tr->physical_address))
+        {
+            deferred_program_retries.push_back(tr);
+        }
+        else if (RewriteFailedProgram(tr))
+        {
+            FinishUserWrite(tr);
+        }
+    }
+}
+
+void FTL::RejectWrite(const TransactionPtr &tr)
+{
+    MarkWriteRejected(tr->user_request);
+    OnSubTransactionCompleted(tr->user_request);
+}
+
+void FTL::MarkWriteRejected(const UserRequestPtr &req)
+{
+    if (!req->write_rejected)
+    {
+        req->write_rejected = true;
+        rejected_write_count++;
+    }
+}
+
+void FTL::EnterReadOnlyMode(const PhysicalPageAddress plane_address)
+{
+    if (!read_only)
+    {
+        read_only = true;
+        PRINT_MESSAGE("Plane @" << plane_address.channel_id << "@" << plane_address.chip_id << "@" << plane_address.die_id << "@" << plane_address.plane_id
+                                << " is out of spare capacity (" << block_manager->GetFreeBlockPoolSize(plane_address) << " free blocks, "
+                                << block_manager->GetPlaneBookKeepingEntry(plane_address)->bad_blocks.size()
+                                << " bad blocks), the drive is now read-only and further writes are rejected")
+    }
+    std::vector<TransactionPtr> waiting;
+    address_mapping->TakeWaitingWrites(waiting);
+    for (auto &tr : waiting)
+    {
+        RejectWrite(tr);
+    }
+    std::list<TransactionPtr> retries;
+    retries.swap(deferred_program_retries);
+    for (auto &tr : retries)
+    {
+        if (SalvageFailedProgram(tr))
+        {
+            FinishUserWrite(tr);
+        }
+    }
+}
+
+bool FTL::SalvageFailedProgram(const TransactionPtr &tr)
+{
+    PlaneBookKeepingPtr plane = block_manager->GetPlaneBookKeepingEntry(tr->physical_address);
+    // 用户写已停，剩下的空闲块除了给在途回收各留一块，都可以用来重写已接受的数据
+    if (plane->GetFreeBlockCount() > plane->ongoing_erase_blocks.size())
+    {
+        return RewriteFailedProgram(tr);
+    }
+    // 数据写不下：LPA 仍指向失败页时解除映射，不能留下指向坏块的映射
+    MarkWriteRejected(tr->user_request);
+    uint64_t ppa = NO_VALUE, write_state_bitmap = 0;
+    address_mapping->GetDataMappingForGC(tr->stream_id, tr->lpa, ppa, write_state_bitmap);
+    if (ppa == tr->ppa)
+    {
+        address_mapping->TrimLpaRange(tr->stream_id, tr->lpa, 1, ~0ULL, ~0ULL);
+    }
+    return true;
+}
@@ -1,15 +1,93 @@
 #pragma once
 #include "param.h"
+#include "nand_chip.h"
+#include "recovery_manager.h"
+#include <functional>
 
-class FTL
+class HotColdClassifier;
+
+class FTL : public std::enable_shared_from_this<FTL>
 {
 public:
+    using RequestCompletionHandler = std::function<void(const UserRequestPtr &)>;
+
+    // 按 config 构建 NAND 驱动(已有时保留)、块管理、地址映射和 GC 单元；地址映射需要持有 FTL 自身，必须在 FTL 交给 shared_ptr 管理之后调用
+    void Init();
+
     void ProcessUserRequest(UserRequestPtr req);
-    TransactionPtr CreateTransactionFromUserRequest(UserRequestPtr req);
+    // 把请求的扇区区间按 LPA 拆成读/写事务，返回事务数
+    uint64_t CreateTransactionFromUserRequest(UserRequestPtr req, std::vector<TransactionPtr> &transaction_list);
+    // TRIM：丢弃缓存页并解除映射，被 TRIM 的物理页置为无效，之后不再被 GC 搬移；返回解除映射的页数
+    uint64_t TrimUserRequest(const UserRequestPtr &req);
+    uint64_t GetTrimmedPageCount() const { return trimmed_page_count; }
+    uint64_t GetProgramFailureCount() const { return program_failure_count; }
+    uint64_t GetEraseFailureCount() const { return erase_failure_count; }
+    // 某个 plane 空闲块耗尽且回收不出空间后设备转为只读：新写和未写入的写都以 write_rejected 完成，读照常
+    bool IsReadOnly() const { return read_only; }
+    uint64_t GetRejectedWriteCount() const { return rejected_write_count; }
+    // 只读时拒绝一个尚未分配物理页的写事务，按已完成计入所属请求
+    void RejectWrite(const TransactionPtr &tr);
+    // 把已确定物理地址的事务转换成 NAND 命令批量下发
+    void DispatchTransactions(std::vector<TransactionPtr> &transactions);
+    void SetRequestCompletionHandler(RequestCompletionHandler handler) { request_completion_handler = std::move(handler); }
+    // 模拟掉电：尚未进入芯片队列的命令被丢弃，已在芯片中的命令执行完毕，之后丢弃全部易失状态(映射表、块管理、GC)，只保留 NAND 内容
+    void SimulatePowerLoss();
+    // 上电挂载：按 config 重建各模块，再以最新的检查点和日志为基础扫描页备用区，恢复映射表和块状态
+    MountStatistics Mount();
+    bool IsPoweredOn() const { return powered_on; }
+    // 等待所有在途命令完成后把 NAND 内容和各模块状态写入快照文件，返回文件大小；include_page_data 为 false 时只保存页备用区
+    uint64_t SaveSnapshot(const std::string &path, bool include_page_data);
+    // 在 Init 之后载入快照，取代当前的 NAND 内容和各模块状态；快照的几何、流数等必须与 config 一致
+    void LoadSnapshot(const std::string &path);
+    // 快速预处理：StartPreconditioning 与 FinishPreconditioning 之间，PreconditionUserRequest 把写和 TRIM 直接作用于映射表和块管理，
+    // GC 照常选择回收块、累计擦除次数，但同步完成；不产生事务、NAND 命令和页数据，只写页备用区，读请求忽略。
+    // 开始时不能有在途命令；结束时启用检查点则做一次检查点，之后的挂载不依赖预处理期间没有记录的日志。返回写入的页数
+    void StartPreconditioning();
+    uint64_t PreconditionUserRequest(const UserRequestPtr &req);
+    void FinishPreconditioning();
 
     AddressMappingPageLevelPtr address_mapping;
     BlockManagerPtr block_manager;
     NandDriverPtr nand_driver;
     GcWlUnitPtr gcwl_unit;
     CacheManagerPtr cache_manager;
-};
\ No newline at end of file
+    std::shared_ptr<HotColdClassifier> hot_cold_classifier; // 仅 WriteHintMode::AUTO 或 gc_temperature_count 大于1时创建
+    CheckpointManagerPtr checkpoint_manager;                // 仅启用检查点时创建
+    ReliabilityModelPtr reliability_model;                  // 仅启用可靠性模型时创建，掉电后保留
+
+private:
+    // NAND 完成回调：context 为 FTL，tag 为提交时额外持有一个引用的事务指针
+    static void OnNandCommandCompleted(void *context, NandResult &result);
+    void OnTransactionServiced(const TransactionPtr &tr, NandResult &result);
+    void OnSubTransactionCompleted(const UserRequestPtr &req);
+    // 按可靠性模型译码一次读出的数据：需要重读时换下一档重新下发并返回 false；纠正或不可纠正时返回 true，并按需登记读回收
+    bool DecodeReadData(const TransactionPtr &tr);
+    // 编程失败：所在块标记为坏块并登记搬移。用户写所在 plane 空闲块不足时先挂起，回收出空闲块后再重写，返回 false
+    bool HandleProgramFailure(const TransactionPtr &tr);
+    // LPA 仍映射到失败页时在同一 plane 重新分配一页重写并返回 false，已被更新的写或 TRIM 取代时返回 true，照常完成
+    bool RewriteFailedProgram(const TransactionPtr &tr);
+    // GC 事务完成后重试挂起的失败写
+    void RetryDeferredPrograms();
+    void FinishUserWrite(const TransactionPtr &tr);
+    // 转为只读并拒绝所有等待空闲块的写
+    void EnterReadOnlyMode(const PhysicalPageAddress plane_address);
+    void MarkWriteRejected(const UserRequestPtr &req);
+    // 只读后用户写编程失败：空闲块够时照常重写并返回 false，否则以 write_rejected 放弃，返回 true 照常完成
+    bool SalvageFailedProgram(const TransactionPtr &tr);
+    // 按 write_hint_mode 决定写事务的写入点
+    uint64_t GetWriteHint(const UserRequestPtr &req, const uint64_t lpa);
+
+    RequestCompletionHandler request_completion_handler;
+    uint64_t sectors_per_page = 0;
+    uint64_t trimmed_page_count = 0;
+    uint64_t program_failure_count = 0;
+    uint64_t erase_failure_count = 0;
+    uint64_t rejected_write_count = 0; // 只读后被拒绝的写请求数
+    WriteHintMode write_hint_mode = WriteHintMode::NONE;
+    std::vector<NandTask> dispatch_batch;
+    TransactionBatchStack transaction_batches; // 按请求拆出的事务、单个重新下发的事务等暂存批次
+    std::list<TransactionPtr> deferred_program_retries; // 编程失败后等待空闲块重写的用户写
+    bool powered_on = false;
+    bool read_only = false;
+    bool preconditioning = false;
+};
@@ -2,6 +2,9 @@
 #include "transaction.h"
 #include "block_manager.h"
 #include "nand_chip.h"
+#include "nand_driver.h"
+#include "address_mapping.h"
+#include "hot_cold_classifier.h"
 
 int GcWlUnit::GetRandomBlockId()
 {
@@ -26,6 +29,8 @@ GcWlUnit::GcWlUnit(AddressMappingPageLevelPtr amu, BlockManagerPtr bmu, NandDriv
     block_pool_gc_hard_threshold = static_cast<uint64_t>(gc_hard_threshold * block_per_plane);
     if (block_pool_gc_hard_threshold < 1)
         block_pool_gc_hard_threshold = 1;
+    dist = std::uniform_int_distribution<int>(0, static_cast<int>(block_per_plane) - 1);
+    rga_set_size = std::max<uint64_t>(1, block_per_plane / 8);
     random_pp_threshold = static_cast<uint64_t>(rho * page_per_block);
     if (random_pp_threshold < max_ongoing_gc_reqs_per_plane)
         random_pp_threshold = max_ongoing_gc_reqs_per_plane;
@@ -36,14 +41,14 @@ bool GcWlUnit::GcIsUrgentMode(NandChipPtr nand_chip)
     if (!preemptible_gc_enabled)
         return true;
 
-    PhysicalPageAddressPtr addr = std::make_shared<PhysicalPageAddress>();
-    addr->channel_id = nand_chip->channel_id;
+    PhysicalPageAddress addr;
+    addr.channel_id = nand_chip->channel_id;
     for (uint64_t die_id = 0; die_id < die_per_chip; die_id++)
     {
         for (uint64_t plane_id = 0; plane_id < plane_per_die; plane_id++)
         {
-            addr->die_id = die_id;
-            addr->plane_id = plane_id;
+            addr.die_id = die_id;
+            addr.plane_id = plane_id;
             if (block_manager->GetFreeBlockPoolSize(addr) < block_pool_gc_hard_threshold)
             {
                 return true;
@@ -54,95 +59,404 @@ bool GcWlUnit::GcIsUrgentMode(NandChipPtr nand_chip)
     return false;
 }
 
-void GcWlUnit::CheckGcRequired(const uint64_t free_block_pool_size, const PhysicalPageAddressPtr plane_address)
+void GcWlUnit::CheckGcRequired(const uint64_t free_block_pool_size, const PhysicalPageAddress plane_address)
 {
-    if (free_block_pool_size < block_pool_gc_threshold)
+    CheckReadReclaim(plane_address);
+    // 阈值不高于停写线时，用户写停下后不会再有分配来触发回收，所以到停写线也要回收
+    if (free_block_pool_size >= block_pool_gc_threshold && !StopServicingWrites(plane_address))
     {
-        uint64_t gc_candidate_block_id = UINT32_MAX;
-        PlaneBookKeepingPtr plane = block_manager->GetPlaneBookKeepingEntry(plane_address);
-        if (plane->ongoing_erase_blocks.size() >= max_ongoing_gc_reqs_per_plane)
+        return;
+    }
+    // 异步回收跟不上用户写时空闲块通常压在停写线附近；同步回收也推迟到用户写即将停下时才做，
+    // 否则空闲块一直偏多，被选中的块无效页偏少，搬移量明显高于完整模拟
+    if (preconditioning && !StopServicingWrites(plane_address))
+    {
+        return;
+    }
+    uint64_t gc_candidate_block_id = UINT32_MAX;
+    PlaneBookKeepingPtr plane = block_manager->GetPlaneBookKeepingEntry(plane_address);
+    if (plane->ongoing_erase_blocks.size() >= max_ongoing_gc_reqs_per_plane || !CanAbsorbRelocation(plane))
+    {
+        return;
+    }
+    switch (gc_policy)
+    {
+    case GC_POLICY::GREEDY:
+    { // 选择无效页最多的块
+        for (size_t block_id = 0; block_id < block_per_plane; ++block_id)
+        {
+            if (plane->blocks[block_id]->current_write_page_index == page_per_block // 已满
+                && (gc_candidate_block_id == UINT32_MAX || plane->blocks[block_id]->invalid_page_count > plane->blocks[gc_candidate_block_id]->invalid_page_count) && IsSafeGcCandidate(plane, block_id))
+            {
+                gc_candidate_block_id = block_id;
+            }
+        }
+        break;
+    }
+    case GC_POLICY::RGA:
+    { // 从随机选择的几个块中选择无效页最多的块
+        std::set<uint64_t> candidate_set;
+        uint64_t repeat = 0;
+        while (candidate_set.size() < rga_set_size && repeat++ < block_per_plane)
+        {
+            uint64_t id = GetRandomBlockId();
+            if (plane->ongoing_erase_blocks.find(id) == plane->ongoing_erase_blocks.end() && IsSafeGcCandidate(plane, id))
+                candidate_set.insert(id);
+        }
+        if (candidate_set.empty())
         {
             return;
         }
-        switch (gc_policy)
+        gc_candidate_block_id = *candidate_set.begin();
+        for (auto &id : candidate_set)
         {
-        case GC_POLICY::GREEDY:
-        { // 直接选择最冷块
-            gc_candidate_block_id = 0;
-            if (plane->ongoing_erase_blocks.find(0) != plane->ongoing_erase_blocks.end())
-                gc_candidate_block_id++;
-            for (size_t block_id = 1; block_id < block_per_plane; ++block_id)
+            if (plane->blocks[id]->invalid_page_count > plane->blocks[gc_candidate_block_id]->invalid_page_count && plane->blocks[id]->current_write_page_index == page_per_block) // 已满
             {
-                if (plane->blocks[block_id]->invalid_page_count > plane->blocks[gc_candidate_block_id]->invalid_page_count && plane->blocks[block_id]->current_write_page_index == page_per_block // 已满
-                    && IsSafeGcCandidate(plane, block_id))
-                {
-                    gc_candidate_block_id = block_id;
-                }
-                break;
+                gc_candidate_block_id = id;
             }
-        case GC_POLICY::RGA:
-        { // 从随机选择的几个块中选择最冷块
-            std::set<uint64_t> candidate_set;
-            while (candidate_set.size() < rga_set_size)
-            {
-                uint64_t id = GetRandomBlockId();
-                if (plane->ongoing_erase_blocks.find(id) == plane->ongoing_erase_blocks.end() && IsSafeGcCandidate(plane, id))
-                    candidate_set.insert(id);
-            }
-            gc_candidate_block_id = *candidate_set.begin();
-            for (auto &id : candidate_set)
-            {
-                if (plane->blocks[id]->invalid_page_count > plane->blocks[gc_candidate_block_id]->invalid_page_count && plane->blocks[id]->current_write_page_index == page_per_block) // 已满
-                {
-                    gc_candidate_block_id = id;
-                }
-            }
-            break;
         }
-        case GC_POLICY::RANDOM:
-        { // 随机选择一个块
+        break;
+    }
+    case GC_POLICY::RANDOM:
+    { // 随机选择一个块
+        gc_candidate_block_id = GetRandomBlockId();
+        uint64_t repeat = 0;
+        while (!IsSafeGcCandidate(plane, gc_candidate_block_id) && repeat++ < block_per_plane)
+        {
             gc_candidate_block_id = GetRandomBlockId();
-            uint64_t repeat = 0;
-            while (!IsSafeGcCandidate(plane, gc_candidate_block_id) && repeat++ < block_per_plane)
-            {
-                gc_candidate_block_id = GetRandomBlockId();
-            }
-            break;
         }
-        case GC_POLICY::RANDOM_P:
-        { // 随机选择一个块，要求有效页数小于某个阈值
+        break;
+    }
+    case GC_POLICY::RANDOM_P:
+    { // 随机选择一个块，要求有效页数小于某个阈值
+        gc_candidate_block_id = GetRandomBlockId();
+        uint64_t repeat = 0;
+        // 如果该块未写满，或该块不安全，则在尝试次数内继续随机选块
+        while ((plane->blocks[gc_candidate_block_id]->current_write_page_index < page_per_block || !IsSafeGcCandidate(plane, gc_candidate_block_id)) && repeat++ < block_per_plane)
+        {
             gc_candidate_block_id = GetRandomBlockId();
-            uint64_t repeat = 0;
-            // 如果该块未写满，或（该块不安全且尝试次数未超限），则继续随机选块
-            while (plane->blocks[gc_candidate_block_id]->current_write_page_index < page_per_block || (!IsSafeGcCandidate(plane, gc_candidate_block_id) && repeat++ < block_per_plane))
-            {
-                gc_candidate_block_id = GetRandomBlockId();
-            }
-            break;
         }
-        case GC_POLICY::RANDOM_PP:
-        { // 随机选择一个块，要求有效页数小于某个阈值，否则选择最冷块
-            gc_candidate_block_id = GetRandomBlockId();
-            uint64_t repeat = 0;
+        break;
+    }
+    case GC_POLICY::RANDOM_PP:
+    { // 随机选择一个块，要求有效页数小于某个阈值，否则选择最冷块
+        gc_candidate_block_id = GetRandomBlockId();
+        uint64_t repeat = 0;
 
-            while (plane->blocks[gc_candidate_block_id]->current_write_page_index < page_per_block || plane->blocks[gc_candidate_block_id]->invalid_page_count < random_pp_threshold || (!IsSafeGcCandidate(plane, gc_candidate_block_id) && repeat++ < block_per_plane))
-            {
-                gc_candidate_block_id = GetRandomBlockId();
-            }
-            break;
+        while ((plane->blocks[gc_candidate_block_id]->current_write_page_index < page_per_block || plane->blocks[gc_candidate_block_id]->invalid_page_count < random_pp_threshold || !IsSafeGcCandidate(plane, gc_candidate_block_id)) && repeat++ < block_per_plane)
+        {
+            gc_candidate_block_id = GetRandomBlockId();
+        }
+        break;
+    }
+    case GC_POLICY::FIFO:
+    { // 选择最早使用的块；队首块尚不能回收时保留在队首，下次再试
+        // 退役的坏块不会再写满，直接从历史中丢掉
+        while (!plane->block_usage_history.empty() && plane->blocks[plane->block_usage_history.front()]->is_bad &&
+               plane->blocks[plane->block_usage_history.front()]->current_write_page_index == 0)
+        {
+            plane->block_usage_history.pop();
+        }
+        if (plane->block_usage_history.empty())
+        {
+            return;
         }
-        case GC_POLICY::FIFO:
-        { // 选择最早使用的块
-            gc_candidate_block_id = plane->block_usage_history.front();
+        gc_candidate_block_id = plane->block_usage_history.front();
+        if (plane->blocks[gc_candidate_block_id]->current_write_page_index == page_per_block && IsSafeGcCandidate(plane, gc_candidate_block_id))
+        {
             plane->block_usage_history.pop();
-            break;
         }
-        default:
-            PRINT_ERROR("Unsupported GC policy!")
+        break;
+    }
+    default:
+        PRINT_ERROR("Unsupported GC policy!")
+        break;
+    }
+
+    // 随机类策略在尝试次数用完时可能选到不能回收的块；没有无效页的块回收后也腾不出空间
+    if (gc_candidate_block_id >= block_per_plane || plane->blocks[gc_candidate_block_id]->current_write_page_index < page_per_block ||
+        plane->blocks[gc_candidate_block_id]->invalid_page_count == 0 || !IsSafeGcCandidate(plane, gc_candidate_block_id))
+    {
+        return;
+    }
+    PhysicalPageAddress block_address = plane_address;
+    block_address.block_id = gc_candidate_block_id;
+    block_address.page_id = 0;
+    if (preconditioning)
+    {
+        CollectBlockImmediately(block_address);
+        return;
+    }
+    StartGarbageCollection(block_address);
+}
+
+void GcWlUnit::StartGarbageCollection(const PhysicalPageAddress block_address)
+{
+    PlaneBookKeepingPtr plane = block_manager->GetPlaneBookKeepingEntry(block_address);
+    BlockPtr block = plane->blocks[block_address.block_id];
+    block_manager->GcStartedOnBlock(block_address);
+    plane->ongoing_erase_blocks.insert(block_address.block_id);
+    executed_gc_count++;
+
+    auto erase_tr = MakeTransaction<TransactionErase>(block->stream_id, TransactionSourceType::GC, TransactionType::ERASE, Priority::MEDIUM,
+                                                      block_address, true, UserRequestType::WRITE, NO_VALUE, NO_VALUE, 0, 0);
+    block->ongoing_erase_tr = erase_tr;
+
+    std::vector<uint64_t> valid_page_ids;
+    block_manager->EnumerateValidPages(block, valid_page_ids);
+    erase_tr->page_movement_actions.reserve(valid_page_ids.size());
+    TransactionBatchStack::Batch batch(transaction_batches);
+    std::vector<TransactionPtr> &gc_reads = batch.transactions;
+    PhysicalPageAddress page_address = block_address;
+    for (uint64_t page_id : valid_page_ids)
+    {
+        // 页备用区记录了 LPA；搬移期间给 LPA 加屏障，用户读写在屏障上排队
+        page_address.page_id = page_id;
+        uint64_t lpa = nand_driver->GetLPA(page_address);
+        uint64_t ppa = NO_VALUE, write_state_bitmap = 0;
+        address_mapping->GetDataMappingForGC(block->stream_id, lpa, ppa, write_state_bitmap);
+        if (ppa != address_mapping->ConvertAddresstoPPA(page_address))
+        {
+            PRINT_ERROR("Inconsistent mapping table between FTL and NAND driver!")
+        }
+        address_mapping->SetBarrierForLPA(block->stream_id, lpa);
+
+        uint64_t sector_count = __builtin_popcountll(write_state_bitmap);
+        auto write_tr = MakeTransaction<TransactionWrite>(block->stream_id, TransactionSourceType::GC, TransactionType::WRITE, Priority::MEDIUM,
+                                                          block_address, false, UserRequestType::WRITE, lpa, NO_VALUE,
+                                                          sector_count * SECTOR_SIZE_IN_BYTE, sector_count);
+        write_tr->write_sectors_bitmap = write_state_bitmap;
+        // GC 写的 write_hint 是目标 GC 打开块的温度类别
+        write_tr->write_hint = GetRelocationTemperature(block->stream_id, lpa);
+        write_tr->related_erase = erase_tr;
+        erase_tr->page_movement_actions.push_back(write_tr);
+
+        auto read_tr = MakeTransaction<TransactionRead>(block->stream_id, TransactionSourceType::GC, TransactionType::READ, Priority::MEDIUM,
+                                                        page_address, true, UserRequestType::READ, lpa, ppa,
+                                                        sector_count * SECTOR_SIZE_IN_BYTE, sector_count);
+        read_tr->read_sectors_bitmap = write_state_bitmap;
+        read_tr->related_write = write_tr;
+        gc_reads.push_back(read_tr);
+    }
+    if (gc_reads.empty())
+    {
+        if (block->is_bad)
+        {
+            FinishCollection(block_address);
+            return;
+        }
+        gc_reads.push_back(erase_tr);
+    }
+    transaction_dispatcher(gc_reads);
+}
+
+void GcWlUnit::CollectBlockImmediately(const PhysicalPageAddress block_address)
+{
+    PlaneBookKeepingPtr plane = block_manager->GetPlaneBookKeepingEntry(block_address);
+    BlockPtr block = plane->blocks[block_address.block_id];
+    block_manager->GcStartedOnBlock(block_address);
+    plane->ongoing_erase_blocks.insert(block_address.block_id);
+    executed_gc_count++;
+
+    std::vector<uint64_t> valid_page_ids;
+    block_manager->EnumerateValidPages(block, valid_page_ids);
+    PhysicalPageAddress page_address = block_address;
+    for (uint64_t page_id : valid_page_ids)
+    {
+        page_address.page_id = page_id;
+        uint64_t lpa = nand_driver->GetLPA(page_address);
+        address_mapping->RelocatePageImmediately(block->stream_id, lpa, page_address, GetRelocationTemperature(block->stream_id, lpa));
+        moved_page_count++;
+    }
+    if (block->is_bad)
+    {
+        block_manager->RetireBadBlock(block_address);
+    }
+    else
+    {
+        nand_driver->EraseBlockMetadata(block_address);
+        block_manager->AddErasedBlockToPool(block_address);
+    }
+    block_manager->GcFinishedOnBlock(block_address);
+    plane->ongoing_erase_blocks.erase(block_address.block_id);
+}
+
+void GcWlUnit::OnTransactionServiced(const TransactionPtr &tr, PageBufferPtr data)
+{
+    switch (tr->type)
+    {
+    case TransactionType::READ:
+    {
+        auto read_tr = static_cast<TransactionRead *>(tr.get());
+        TransactionWritePtr write_tr = read_tr->related_write;
+        read_tr->related_write = nullptr;
+        write_tr->content = std::move(data);
+        address_mapping->AllocateNewPageForGC(write_tr);
+        TransactionBatchStack::Batch write_batch(transaction_batches);
+        write_batch.transactions.push_back(write_tr);
+        transaction_dispatcher(write_batch.transactions);
+        break;
+    }
+    case TransactionType::WRITE:
+    {
+        auto write_tr = static_cast<TransactionWrite *>(tr.get());
+        moved_page_count++;
+        block_manager->ProgramTransactionFinishedOnBlock(tr->physical_address);
+        TransactionErasePtr erase_tr = write_tr->related_erase;
+        write_tr->related_erase = nullptr;
+        auto &moves = erase_tr->page_movement_actions;
+        moves.erase(std::find(moves.begin(), moves.end(), TransactionCast<TransactionWrite>(tr)));
+        address_mapping->RemoveBarrierForLPA(tr->stream_id, tr->lpa);
+        if (moves.empty() && block_manager->GetPlaneBookKeepingEntry(erase_tr->physical_address)->blocks[erase_tr->physical_address.block_id]->is_bad)
+        {
+            // 坏块不再擦除，数据搬完即退役
+            FinishCollection(erase_tr->physical_address);
+        }
+        else if (moves.empty())
+        {
+            TransactionBatchStack::Batch erase_batch(transaction_batches);
+            erase_batch.transactions.push_back(erase_tr);
+            transaction_dispatcher(erase_batch.transactions);
+        }
+        // 搬移写的目标块可能编程失败后在等在途编程完成
+        CheckReadReclaim(tr->physical_address);
+        break;
+    }
+    case TransactionType::ERASE:
+        FinishCollection(tr->physical_address);
+        break;
+    default:
+        break;
+    }
+}
+
+void GcWlUnit::FinishCollection(const PhysicalPageAddress block_address)
+{
+    PlaneBookKeepingPtr plane = block_manager->GetPlaneBookKeepingEntry(block_address);
+    if (plane->blocks[block_address.block_id]->is_bad)
+    {
+        block_manager->RetireBadBlock(block_address);
+    }
+    else
+    {
+        block_manager->AddErasedBlockToPool(block_address);
+    }
+    block_manager->GcFinishedOnBlock(block_address);
+    plane->ongoing_erase_blocks.erase(block_address.block_id);
+    address_mapping->StartServicingWritesForOverfullPlane(block_address);
+    CheckGcRequired(plane->GetFreeBlockCount(), block_address);
+    // 擦除失败的块不还回空闲块，停写的 plane 可能已回收不出空间
+    ResumeGcForWaitingWrites(block_address);
+}
+
+void GcWlUnit::RequestReadReclaim(const PhysicalPageAddress block_address)
+{
+    PlaneBookKeepingPtr plane = block_manager->GetPlaneBookKeepingEntry(block_address);
+    // 正在回收的块数据马上会被重写，不用再登记
+    if (plane->blocks[block_address.block_id]->has_ongoing_gc || plane->blocks[block_address.block_id]->is_reserved)
+    {
+        return;
+    }
+    plane->read_reclaim_blocks.insert(block_address.block_id);
+    CheckReadReclaim(block_address);
+}
+
+void GcWlUnit::CheckReadReclaim(const PhysicalPageAddress plane_address)
+{
+    PlaneBookKeepingPtr plane = block_manager->GetPlaneBookKeepingEntry(plane_address);
+    // 还在写的打开块、有在途读写的块先留在登记表里，等之后再检查；同步回收可能嵌套修改登记表，每回收一个块重新遍历
+    bool started = true;
+    while (started && !plane->read_reclaim_blocks.empty() && plane->ongoing_erase_blocks.size() < max_ongoing_gc_reqs_per_plane &&
+           CanAbsorbRelocation(plane))
+    {
+        started = false;
+        for (uint64_t block_id : plane->read_reclaim_blocks)
+        {
+            if (!IsSafeGcCandidate(plane, block_id))
+            {
+                continue;
+            }
+            PhysicalPageAddress block_address = plane_address;
+            block_address.block_id = block_id;
+            block_address.page_id = 0;
+            if (!plane->blocks[block_id]->is_bad)
+            {
+                read_reclaim_count++;
+            }
+            if (preconditioning)
+            {
+                CollectBlockImmediately(block_address);
+            }
+            else
+            {
+                StartGarbageCollection(block_address);
+            }
+            started = true;
             break;
         }
+    }
+}
+
+void GcWlUnit::ResumeGcForWaitingWrites(const PhysicalPageAddress plane_address)
+{
+    if (!address_mapping->HasWritesWaitingForPlane(plane_address))
+    {
+        return;
+    }
+    CheckGcRequired(block_manager->GetFreeBlockPoolSize(plane_address), plane_address);
+    if (!IsOutOfSpareCapacity(plane_address) || address_mapping->ServiceWaitingWritesInOpenBlocks(plane_address))
+    {
+        return;
+    }
+    PhysicalPageAddress address;
+    if (config.ssd_param.placement_param.plane_allocation_scheme == PlaneAllocationScheme::DYNAMIC)
+    {
+        // 动态分配时等待的写会重新选 plane，只要还有 plane 能回收就不算卡死
+        for (address.channel_id = 0; address.channel_id < channel_count; address.channel_id++)
+            for (address.chip_id = 0; address.chip_id < chip_per_channel; address.chip_id++)
+                for (address.die_id = 0; address.die_id < die_per_chip; address.die_id++)
+                    for (address.plane_id = 0; address.plane_id < plane_per_die; address.plane_id++)
+                    {
+                        if (!IsOutOfSpareCapacity(address))
+                        {
+                            return;
+                        }
+                    }
+    }
+    out_of_space_handler(plane_address);
+}
+
+bool GcWlUnit::IsOutOfSpareCapacity(const PhysicalPageAddress plane_address)
+{
+    PlaneBookKeepingPtr plane = block_manager->GetPlaneBookKeepingEntry(plane_address);
+    if (!StopServicingWrites(plane_address) || !plane->ongoing_erase_blocks.empty())
+    {
+        return false;
+    }
+    if (!CanAbsorbRelocation(plane))
+    {
+        return true;
+    }
+    if (!plane->read_reclaim_blocks.empty())
+    {
+        return false;
+    }
+    // 无效页只会因为新的写入或 TRIM 增加，在途的读写结束后仍有可回收块的 plane 迟早能腾出空间
+    for (auto &block : plane->blocks)
+    {
+        if (block->current_write_page_index == page_per_block && block->invalid_page_count > 0 && !block->is_reserved)
+        {
+            return false;
         }
     }
+    return true;
+}
+
+bool GcWlUnit::CanAbsorbRelocation(PlaneBookKeepingPtr plane) const
+{
+    // 一次回收搬移的页不到一块，但分散到各温度的 GC 打开块时每个打开块都可能换一次新块；在途回收按最坏情况各再占一块。
+    // 回收块擦除失败时不会还回空闲块，不预先留够就可能在搬移途中把空闲池用空
+    return plane->GetFreeBlockCount() >= plane->ongoing_erase_blocks.size() + block_manager->GetGcTemperatureCnt() + spare_blocks_for_program_failure;
 }
 
 uint64_t GcWlUnit::GetGcPolicySpecificParam()
@@ -166,24 +480,59 @@ uint64_t GcWlUnit::GetMinimumNumberOfFreePagesBeforeGc()
     return block_pool_gc_threshold;
 }
 
-bool GcWlUnit::StopServicingWrites(const PhysicalPageAddressPtr plane_address)
+bool GcWlUnit::StopServicingWrites(const PhysicalPageAddress plane_address)
 {
-    return block_manager->GetFreeBlockPoolSize(plane_address) < max_ongoing_gc_reqs_per_plane;
+    // 在途回收搬移的页合计不到每个回收一块，分散到各温度的 GC 打开块时每个打开块还可能多换一次新块，
+    // 用户写停下时至少给它们留够这么多空闲块
+    return block_manager->GetFreeBlockPoolSize(plane_address) <= max_ongoing_gc_reqs_per_plane + block_manager->GetGcTemperatureCnt() - 1 +
+                                                                     spare_blocks_for_program_failure;
+}
+
+uint64_t GcWlUnit::GetRelocationTemperature(const uint64_t stream_id, const uint64_t lpa) const
+{
+    // 只查询不计数：搬移不是主机的更新
+    return hot_cold_classifier == nullptr ? 0 : hot_cold_classifier->Classify(stream_id, lpa);
 }
 
 bool GcWlUnit::IsSafeGcCandidate(PlaneBookKeepingPtr plane, uint64_t gc_candidate_block_id)
 {
+    // 编程失败的打开块已封闭，不会再分配新页，不必等它被换下
+    bool closed = plane->blocks[gc_candidate_block_id]->is_bad;
+    for (auto &open_block : plane->data_open_blocks)
+    {
+        if (!closed && open_block->block_id == gc_candidate_block_id)
+        {
+            return false;
+        }
+    }
+    for (auto &open_block : plane->gc_open_blocks)
+    {
+        if (!closed && open_block->block_id == gc_candidate_block_id)
+        {
+            return false;
+        }
+    }
     for (uint64_t stream_id = 0; stream_id < block_manager->GetInputStreamCnt(); ++stream_id)
     {
-        if (plane->data_open_blocks[stream_id]->block_id == gc_candidate_block_id || plane->gc_open_blocks[stream_id]->block_id == gc_candidate_block_id || plane->translation_open_blocks[stream_id]->block_id == gc_candidate_block_id)
+        if (!closed && plane->translation_open_blocks[stream_id]->block_id == gc_candidate_block_id)
         {
             return false;
         }
     }
-    if (plane->blocks[gc_candidate_block_id]->ongoing_user_program_cnt > 0)
+    // 在途的读/写还要访问该块，擦除必须等它们完成
+    if (plane->blocks[gc_candidate_block_id]->ongoing_user_program_cnt > 0 || plane->blocks[gc_candidate_block_id]->ongoing_user_read_cnt > 0)
+        return false;
+    // 块中旧页的新版本尚未落盘，旧页仍是这些 LPA 唯一持久的副本
+    if (plane->blocks[gc_candidate_block_id]->ongoing_overwrite_cnt > 0)
         return false;
 
     if (plane->blocks[gc_candidate_block_id]->has_ongoing_gc)
         return false;
+    // 检查点保留块由 CheckpointManager 自行擦除
+    if (plane->blocks[gc_candidate_block_id]->is_reserved)
+        return false;
+    // 已退役的坏块
+    if (plane->blocks[gc_candidate_block_id]->is_bad && plane->blocks[gc_candidate_block_id]->current_write_page_index == 0)
+        return false;
     return true;
 }
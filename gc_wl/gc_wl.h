@@ -1,5 +1,9 @@
 #pragma once
 #include "param.h"
+#include "transaction.h"
+#include <functional>
+
+class HotColdClassifier;
 
 /*
 •	GREEDY：效率优先，磨损不均。
@@ -11,6 +15,11 @@
 class GcWlUnit
 {
 public:
+    // 把 GC 产生的读/写/擦除事务交给 FTL 转换成 NAND 命令下发
+    using TransactionDispatcher = std::function<void(std::vector<TransactionPtr> &)>;
+    // plane 的空闲块耗尽且再也回收不出空间时调用
+    using OutOfSpaceHandler = std::function<void(const PhysicalPageAddress)>;
+
     GcWlUnit(AddressMappingPageLevelPtr amu, BlockManagerPtr bmu, NandDriverPtr nd,
              GC_POLICY gc_policy, double gc_threshold, bool preemptible_gc_enabled, double gc_hard_threshold,
              uint64_t channel_count, uint64_t chip_per_channel, uint64_t die_per_chip,
@@ -20,11 +29,33 @@ public:
     ~GcWlUnit() = default;
 
     bool GcIsUrgentMode(NandChipPtr chip);
-    void CheckGcRequired(const uint64_t free_block_pool_size, const PhysicalPageAddressPtr plane_address);
+    // 空闲块低于阈值时按策略选出回收块并开始回收：给块内有效页的 LPA 加屏障，读出有效页，写到新位置后解除屏障，最后擦除
+    void CheckGcRequired(const uint64_t free_block_pool_size, const PhysicalPageAddress plane_address);
+    // GC 事务在 NAND 上完成：读完成后下发搬移写，写完成后解除 LPA 屏障，全部搬完后擦除(坏块不擦除，直接退役)；
+    // 擦除完成后把块放回空闲池(擦除失败的块退役)并唤醒因该 plane 空闲块不足而挂起的写
+    void OnTransactionServiced(const TransactionPtr &tr, PageBufferPtr data);
+    // 读回收：块的误码率过高或编程失败时登记到所在 plane，块可以安全回收且在途回收数未满时不论空闲块多少都先回收它
+    void RequestReadReclaim(const PhysicalPageAddress block_address);
+    void CheckReadReclaim(const PhysicalPageAddress plane_address);
+    // 有写在等待该 plane 的空闲块时，块上的在途读写结束后调用：之前因在途读写不能选的块可能已能回收。
+    // 既没有在途回收也没有可回收的块(或空闲块已不够容纳一次回收)时，先下发打开块剩余页写得下的等待写，
+    // 一个也下发不了时等待的写永远等不到空间，交给 OutOfSpaceHandler
+    void ResumeGcForWaitingWrites(const PhysicalPageAddress plane_address);
+    void SetTransactionDispatcher(TransactionDispatcher dispatcher) { transaction_dispatcher = std::move(dispatcher); }
+    void SetOutOfSpaceHandler(OutOfSpaceHandler handler) { out_of_space_handler = std::move(handler); }
+    // 快速预处理期间选出的回收块当场搬移、擦除，不产生事务和 NAND 命令
+    void SetPreconditioning(bool enabled) { preconditioning = enabled; }
+    // 用户写停下时在回收预留之外再留的空闲块，用来换下编程失败的 GC 打开块
+    void SetSpareBlocksForProgramFailure(uint64_t blocks) { spare_blocks_for_program_failure = blocks; }
+    // 搬移的页按分类器估计的 LPA 更新频率写入对应温度的 GC 打开块；为空时都写入温度 0 的块
+    void SetHotColdClassifier(std::shared_ptr<HotColdClassifier> classifier) { hot_cold_classifier = std::move(classifier); }
+    uint64_t GetExecutedGcCount() const { return executed_gc_count; }
+    uint64_t GetMovedPageCount() const { return moved_page_count; }
+    uint64_t GetReadReclaimCount() const { return read_reclaim_count; }
     GC_POLICY GetGcPolicy() const { return gc_policy; }
     uint64_t GetGcPolicySpecificParam();
     uint64_t GetMinimumNumberOfFreePagesBeforeGc();
-    bool StopServicingWrites(const PhysicalPageAddressPtr plane_address);
+    bool StopServicingWrites(const PhysicalPageAddress plane_address);
     bool IsSafeGcCandidate(PlaneBookKeepingPtr plane, uint64_t gc_candidate_block_id);
     bool UseStaticWearLeveling() const { return static_wl_enabled; }
     bool UseDynamicWearLeveling() const { return dynamic_wl_enabled; }
@@ -41,7 +72,10 @@ private:
     uint64_t block_pool_gc_threshold;
     uint64_t block_pool_gc_hard_threshold;
     uint64_t max_ongoing_gc_reqs_per_plane;
+    uint64_t spare_blocks_for_program_failure = 0;
     uint64_t rga_set_size;
+    std::shared_ptr<HotColdClassifier> hot_cold_classifier;
+    uint64_t GetRelocationTemperature(const uint64_t stream_id, const uint64_t lpa) const;
 
     bool dynamic_wl_enabled;
     bool static_wl_enabled;
@@ -51,6 +85,23 @@ private:
     std::uniform_int_distribution<int> dist;  // 随机数分布
     int GetRandomBlockId();
 
+    TransactionDispatcher transaction_dispatcher;
+    TransactionBatchStack transaction_batches; // 搬移读、搬移写和擦除的暂存批次
+    OutOfSpaceHandler out_of_space_handler;
+    uint64_t executed_gc_count = 0;
+    uint64_t moved_page_count = 0;
+    uint64_t read_reclaim_count = 0;
+    void StartGarbageCollection(const PhysicalPageAddress block_address);
+    // 同步回收：有效页直接重映射到 GC 打开块，备用区随之改写，随后擦除并放回空闲池
+    void CollectBlockImmediately(const PhysicalPageAddress block_address);
+    // 回收块的数据搬完并擦除后(坏块不擦除)放回空闲池或退役
+    void FinishCollection(const PhysicalPageAddress block_address);
+    // plane 停止用户写、没有在途回收，并且空闲块不够开始回收或没有写满且有无效页的块
+    bool IsOutOfSpareCapacity(const PhysicalPageAddress plane_address);
+    // 空闲块够这次回收和在途回收都换完 GC 打开块，并留出编程失败备用块
+    bool CanAbsorbRelocation(PlaneBookKeepingPtr plane) const;
+    bool preconditioning = false;
+
     std::queue<BlockPtr> block_usage_fifo; // 用于 FIFO 策略的块使用历史队列
     uint64_t random_pp_threshold;          // 用于 RANDOM_PP 策略的阈值
 
@@ -0,0 +1,230 @@
+#include "host_interface.h"
+#include "ftl.h"
+
+bool ParseQueuePriorities(const std::string &list, std::vector<Priority> &priorities)
+{
+    static const char *const kPriorityNames[] = {"urgent", "high", "medium", "low"};
+    priorities.clear();
+    size_t begin = 0;
+    while (begin <= list.size())
+    {
+        size_t end = std::min(list.find(',', begin), list.size());
+        std::string name = list.substr(begin, end - begin);
+        size_t i = 0;
+        for (; i <= static_cast<size_t>(Priority::LOW); i++)
+        {
+            if (name == kPriorityNames[i])
+            {
+                priorities.push_back(static_cast<Priority>(i));
+                break;
+            }
+        }
+        if (i > static_cast<size_t>(Priority::LOW))
+        {
+            return false;
+        }
+        begin = end + 1;
+    }
+    return true;
+}
+
+HostInterface::HostInterface(FTLPtr ftl, const HostInterfaceParam &param)
+    : ftl(ftl), param(param), start_time(std::chrono::steady_clock::now())
+{
+    if (param.queue_count == 0 || param.queue_depth == 0 || param.device_queue_depth == 0)
+    {
+        PRINT_ERROR("Host interface requires at least one queue and non-zero queue depths")
+    }
+    if (param.queue_priorities.size() > param.queue_count)
+    {
+        PRINT_ERROR("Queue priorities given for " << param.queue_priorities.size() << " queues, but only " << param.queue_count << " queues exist")
+    }
+    if (this->param.arbitration_burst == 0)
+    {
+        this->param.arbitration_burst = 1;
+    }
+    uint64_t stream_no = config.ssd_param.StreamNum == 0 ? 1 : config.ssd_param.StreamNum;
+    queues.resize(param.queue_count);
+    for (uint64_t queue_id = 0; queue_id < param.queue_count; queue_id++)
+    {
+        HostQueuePair &queue = queues[queue_id];
+        queue.queue_id = queue_id;
+        queue.stream_id = queue_id % stream_no;
+        queue.priority = queue_id < param.queue_priorities.size() ? param.queue_priorities[queue_id] : Priority::MEDIUM;
+        queue.depth = param.queue_depth;
+        all_queue_ids.push_back(queue_id);
+        class_queue_ids[static_cast<int>(queue.priority)].push_back(queue_id);
+    }
+    class_credit[static_cast<int>(Priority::HIGH)] = param.weight_high;
+    class_credit[static_cast<int>(Priority::MEDIUM)] = param.weight_medium;
+    class_credit[static_cast<int>(Priority::LOW)] = param.weight_low;
+    ftl->SetRequestCompletionHandler([this](const UserRequestPtr &req)
+                                     { OnRequestCompleted(req); });
+}
+
+uint64_t HostInterface::NowNs() const
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_time).count();
+}
+
+void HostInterface::BindQueueToStream(uint64_t queue_id, uint64_t stream_id)
+{
+    if (queue_id >= queues.size() || stream_id >= config.ssd_param.StreamNum)
+    {
+        PRINT_ERROR("Cannot bind host queue " << queue_id << " to stream " << stream_id)
+    }
+    queues[queue_id].stream_id = stream_id;
+}
+
+void HostInterface::SetQueuePriority(uint64_t queue_id, Priority priority)
+{
+    if (queue_id >= queues.size())
+    {
+        PRINT_ERROR("Host queue " << queue_id << " does not exist")
+    }
+    auto &old_class = class_queue_ids[static_cast<int>(queues[queue_id].priority)];
+    old_class.erase(std::find(old_class.begin(), old_class.end(), queue_id));
+    queues[queue_id].priority = priority;
+    auto &new_class = class_queue_ids[static_cast<int>(priority)];
+    new_class.insert(std::upper_bound(new_class.begin(), new_class.end(), queue_id), queue_id);
+}
+
+bool HostInterface::SubmitRequest(uint64_t queue_id, UserRequestPtr req)
+{
+    if (queue_id >= queues.size())
+    {
+        PRINT_ERROR("Host queue " << queue_id << " does not exist")
+    }
+    HostQueuePair &queue = queues[queue_id];
+    if (queue.GetOutstandingCount() >= queue.depth)
+    {
+        return false;
+    }
+    req->queue_id = queue_id;
+    req->submit_time = NowNs();
+    queue.submission_queue.push_back(std::move(req));
+    queue.submitted_count++;
+    return true;
+}
+
+uint64_t HostInterface::FetchFromQueue(HostQueuePair &queue, uint64_t max_count)
+{
+    uint64_t fetched = 0;
+    while (fetched < max_count && !queue.submission_queue.empty())
+    {
+        UserRequestPtr req = std::move(queue.submission_queue.front());
+        queue.submission_queue.pop_front();
+        req->stream_id = queue.stream_id;
+        queue.inflight_count++;
+        device_inflight_count++;
+        fetched++;
+        ftl->ProcessUserRequest(req);
+    }
+    return fetched;
+}
+
+uint64_t HostInterface::ServiceRoundRobin(std::vector<uint64_t> &queue_ids, uint64_t &cursor, uint64_t budget, uint64_t max_picks, uint64_t &picks)
+{
+    uint64_t fetched = 0;
+    uint64_t idle_queues = 0; // 连续遇到的空队列数，转满一圈都为空则停止
+    picks = 0;
+    while (!queue_ids.empty() && fetched < budget && picks < max_picks && idle_queues < queue_ids.size())
+    {
+        cursor %= queue_ids.size();
+        HostQueuePair &queue = queues[queue_ids[cursor]];
+        cursor++;
+        uint64_t n = FetchFromQueue(queue, std::min(param.arbitration_burst, budget - fetched));
+        if (n == 0)
+        {
+            idle_queues++;
+            continue;
+        }
+        idle_queues = 0;
+        picks++;
+        fetched += n;
+    }
+    return fetched;
+}
+
+uint64_t HostInterface::ServiceQueues()
+{
+    if (device_inflight_count >= param.device_queue_depth)
+    {
+        return 0;
+    }
+    uint64_t budget = param.device_queue_depth - device_inflight_count;
+    uint64_t picks = 0;
+    if (param.arbitration == ArbitrationMode::ROUND_ROBIN)
+    {
+        return ServiceRoundRobin(all_queue_ids, rr_cursor, budget, NO_VALUE, picks);
+    }
+
+    // URGENT 类严格优先
+    int urgent = static_cast<int>(Priority::URGENT);
+    uint64_t fetched = ServiceRoundRobin(class_queue_ids[urgent], class_cursor[urgent], budget, NO_VALUE, picks);
+    const Priority weighted_classes[3] = {Priority::HIGH, Priority::MEDIUM, Priority::LOW};
+    const uint64_t weights[3] = {param.weight_high, param.weight_medium, param.weight_low};
+    while (fetched < budget)
+    {
+        bool progress = false;
+        for (Priority priority : weighted_classes)
+        {
+            int c = static_cast<int>(priority);
+            if (class_credit[c] == 0 || fetched >= budget)
+            {
+                continue;
+            }
+            uint64_t n = ServiceRoundRobin(class_queue_ids[c], class_cursor[c], budget - fetched, class_credit[c], picks);
+            class_credit[c] -= picks;
+            fetched += n;
+            progress |= n > 0;
+        }
+        if (progress)
+        {
+            continue;
+        }
+        // 有积分的类都没有命令可取：若仍有类在排队则开始新一轮积分，否则结束
+        bool waiting = false;
+        for (Priority priority : weighted_classes)
+        {
+            for (uint64_t queue_id : class_queue_ids[static_cast<int>(priority)])
+            {
+                waiting |= !queues[queue_id].submission_queue.empty();
+            }
+        }
+        if (!waiting)
+        {
+            break;
+        }
+        for (int i = 0; i < 3; i++)
+        {
+            class_credit[static_cast<int>(weighted_classes[i])] = std::max<uint64_t>(weights[i], 1);
+        }
+    }
+    return fetched;
+}
+
+void HostInterface::OnRequestCompleted(const UserRequestPtr &req)
+{
+    HostQueuePair &queue = queues[req->queue_id];
+    uint64_t latency = NowNs() - req->submit_time;
+    queue.inflight_count--;
+    device_inflight_count--;
+    queue.completed_count++;
+    queue.total_latency_ns += latency;
+    queue.max_latency_ns = std::max(queue.max_latency_ns, latency);
+    queue.completion_queue.push_back(req);
+}
+
+uint64_t HostInterface::ReapCompletions(uint64_t queue_id, std::vector<UserRequestPtr> &completions, uint64_t max_count)
+{
+    HostQueuePair &queue = queues[queue_id];
+    uint64_t reaped = 0;
+    while (reaped < max_count && !queue.completion_queue.empty())
+    {
+        completions.push_back(std::move(queue.completion_queue.front()));
+        queue.completion_queue.pop_front();
+        reaped++;
+    }
+    return reaped;
+}
@@ -0,0 +1,77 @@
+#pragma once
+#include "param.h"
+#include "user_request.h"
+#include <chrono>
+#include <deque>
+
+// 解析逗号分隔的队列优先级列表(urgent|high|medium|low)，第 i 项为队列 i 的优先级
+bool ParseQueuePriorities(const std::string &list, std::vector<Priority> &priorities);
+
+// 一对主机提交/完成队列及其统计
+class HostQueuePair
+{
+public:
+    uint64_t queue_id;
+    uint64_t stream_id; // 从该队列取出的请求都归入这个流
+    Priority priority;  // 加权轮转仲裁时所属的优先级类
+    uint64_t depth;
+
+    std::deque<UserRequestPtr> submission_queue; // 已提交、尚未被设备取走的请求
+    std::deque<UserRequestPtr> completion_queue; // 已完成、尚未被主机取回的请求
+    uint64_t inflight_count = 0;                 // 已被设备取走、尚未完成的请求数
+
+    uint64_t submitted_count = 0;
+    uint64_t completed_count = 0;
+    uint64_t total_latency_ns = 0;
+    uint64_t max_latency_ns = 0;
+
+    // 队列中未完成的请求数(提交队列中 + 设备中)
+    uint64_t GetOutstandingCount() const { return submission_queue.size() + inflight_count; }
+};
+
+/*
+ * NVMe 风格的多队列主机接口
+ * 主机向各提交队列提交请求；设备侧按仲裁策略从提交队列取命令交给 FTL，
+ * 同时在设备中处理的请求数不超过 device_queue_depth；完成后放入请求所在队列的完成队列。
+ * 仲裁：ROUND_ROBIN 在所有非空队列间轮转；WEIGHTED_ROUND_ROBIN 时 URGENT 队列严格优先，
+ * HIGH/MEDIUM/LOW 三类按权重分配取命令的机会，同类内部轮转。
+ */
+class HostInterface
+{
+public:
+    HostInterface(FTLPtr ftl, const HostInterfaceParam &param);
+
+    // 提交请求，队列已满返回 false
+    bool SubmitRequest(uint64_t queue_id, UserRequestPtr req);
+    // 按仲裁策略从提交队列取命令交给 FTL，返回本次取出的命令数
+    uint64_t ServiceQueues();
+    // 从完成队列取回最多 max_count 个已完成请求
+    uint64_t ReapCompletions(uint64_t queue_id, std::vector<UserRequestPtr> &completions, uint64_t max_count = NO_VALUE);
+
+    void BindQueueToStream(uint64_t queue_id, uint64_t stream_id);
+    void SetQueuePriority(uint64_t queue_id, Priority priority);
+    uint64_t GetQueueCount() const { return queues.size(); }
+    const HostQueuePair &GetQueue(uint64_t queue_id) const { return queues[queue_id]; }
+    uint64_t GetInflightRequestCount() const { return device_inflight_count; }
+
+private:
+    void OnRequestCompleted(const UserRequestPtr &req);
+    uint64_t FetchFromQueue(HostQueuePair &queue, uint64_t max_count);
+    // 在 queue_ids 间轮转取命令，每次选中一个队列最多取 arbitration_burst 个；
+    // 取满 budget、选中 max_picks 次或转满一圈都为空时停止，picks 返回实际选中次数
+    uint64_t ServiceRoundRobin(std::vector<uint64_t> &queue_ids, uint64_t &cursor, uint64_t budget, uint64_t max_picks, uint64_t &picks);
+    uint64_t NowNs() const;
+
+    FTLPtr ftl;
+    HostInterfaceParam param;
+    std::vector<HostQueuePair> queues;
+    uint64_t device_inflight_count = 0;
+    std::chrono::steady_clock::time_point start_time;
+
+    // 仲裁状态
+    std::vector<uint64_t> all_queue_ids;
+    uint64_t rr_cursor = 0;
+    std::vector<uint64_t> class_queue_ids[4]; // 按 Priority 分类的队列
+    uint64_t class_cursor[4] = {0, 0, 0, 0};
+    uint64_t class_credit[4] = {0, 0, 0, 0};
+};
@@ -1,9 +1,388 @@
 #include <iostream>
 #include "param.h"
+#include "trace_replayer.h"
+#include "binary_trace.h"
+#include "workload_generator.h"
+#include "ftl.h"
+#include "nand_driver.h"
+#include "user_request.h"
+#include "host_interface.h"
+#include "address_mapping.h"
+#include "gc_wl.h"
+#include "block_manager.h"
+#include "checkpoint_manager.h"
+#include "reliability_model.h"
+#include <chrono>
 Config config;
 
-int main()
+static void PrintUsage(const char *prog)
 {
-    
+    std::cout << "Usage: " << prog << " --trace <file> | --synthetic <request count> [--seed N] [--format msr|snia|blktrace|fio|bin] [--convert <binary file>] [--mode open|closed] [--qd N] [--speedup X] [--queues N] [--arbitration rr|wrr] [--queue-priority <urgent|high|medium|low,...>] [--streams N] [--cmt-sharing shared|equal|utility] [--write-hint none|host|auto] [--gc-temperatures N] [--classifier-decay <writes>] [--plane-allocation CWDP|CDWP|...|dynamic] [--power-loss parallel|serial] [--checkpoint-interval <journal pages>] [--load-snapshot <file>] [--save-snapshot <file>] [--snapshot-page-data on|off] [--precondition <write request count>] [--precondition-trace <file>] [--reliability on|off] [--initial-pe <cycles>] [--retention-hours <hours>] [--bad-block-ratio <ratio>] [--program-fail-rate <p>] [--erase-fail-rate <p>]" << std::endl;
+}
+
+// 同一流的请求按 id 分散到绑定该流的各个队列(队列 q 默认绑定流 q % StreamNum)
+static uint64_t PickHostQueue(const UserRequestPtr &req, uint64_t queue_count)
+{
+    uint64_t stream_no = config.ssd_param.StreamNum == 0 ? 1 : config.ssd_param.StreamNum;
+    uint64_t stream_id = req->stream_id % stream_no;
+    if (stream_id >= queue_count)
+    {
+        return stream_id % queue_count;
+    }
+    uint64_t queues_of_stream = (queue_count - stream_id + stream_no - 1) / stream_no;
+    return stream_id + stream_no * (req->id % queues_of_stream);
+}
+
+int main(int argc, char **argv)
+{
+    std::string trace_path;
+    std::string convert_path;
+    bool binary_format = false;
+    bool synthetic = false;
+    TraceFormat format = TraceFormat::MSR_CAMBRIDGE;
+    ReplayMode mode = ReplayMode::OPEN_LOOP;
+    uint64_t queue_depth = 32;
+    double speedup = 1.0;
+    bool power_loss = false;
+    std::string load_snapshot_path;
+    std::string save_snapshot_path;
+    bool snapshot_page_data = true;
+    uint64_t precondition_request_count = 0;
+    std::string precondition_trace_path;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (i + 1 >= argc)
+        {
+            PrintUsage(argv[0]);
+            return 1;
+        }
+        std::string value = argv[++i];
+        if (arg == "--trace")
+            trace_path = value;
+        else if (arg == "--format" && value == "bin")
+            binary_format = true;
+        else if (arg == "--format" && ParseTraceFormat(value, format))
+            continue;
+        else if (arg == "--synthetic")
+        {
+            synthetic = true;
+            config.workload_param.request_count = std::strtoull(value.c_str(), nullptr, 10);
+        }
+        else if (arg == "--seed")
+            config.workload_param.seed = std::strtoull(value.c_str(), nullptr, 10);
+        else if (arg == "--convert")
+            convert_path = value;
+        else if (arg == "--mode" && ParseReplayMode(value, mode))
+            continue;
+        else if (arg == "--qd")
+            queue_depth = std::strtoull(value.c_str(), nullptr, 10);
+        else if (arg == "--speedup")
+            speedup = std::strtod(value.c_str(), nullptr);
+        else if (arg == "--queues")
+            config.host_param.queue_count = std::strtoull(value.c_str(), nullptr, 10);
+        else if (arg == "--write-hint" && (value == "none" || value == "host" || value == "auto"))
+            config.ssd_param.placement_param.write_hint_mode = value == "none" ? WriteHintMode::NONE : (value == "host" ? WriteHintMode::HOST : WriteHintMode::AUTO);
+        else if (arg == "--gc-temperatures")
+            config.ssd_param.placement_param.gc_temperature_count = std::strtoull(value.c_str(), nullptr, 10);
+        else if (arg == "--classifier-decay")
+            config.ssd_param.placement_param.classifier_decay_interval = std::strtoull(value.c_str(), nullptr, 10);
+        else if (arg == "--plane-allocation" && ParsePlaneAllocationScheme(value, config.ssd_param.placement_param.plane_allocation_scheme))
+            continue;
+        else if (arg == "--power-loss" && (value == "parallel" || value == "serial"))
+        {
+            // 回放结束后模拟一次掉电并重新挂载，value 选择挂载时是否按 channel 并行扫描
+            power_loss = true;
+            config.ssd_param.recovery_param.parallel_scan = value == "parallel";
+        }
+        else if (arg == "--checkpoint-interval")
+        {
+            // 每写满这么多日志页做一次映射表检查点
+            config.ssd_param.checkpoint_param.enabled = true;
+            config.ssd_param.checkpoint_param.interval = std::strtoull(value.c_str(), nullptr, 10);
+        }
+        else if (arg == "--load-snapshot")
+            load_snapshot_path = value;
+        else if (arg == "--save-snapshot")
+            save_snapshot_path = value;
+        else if (arg == "--snapshot-page-data" && (value == "on" || value == "off"))
+            snapshot_page_data = value == "on";
+        else if (arg == "--precondition")
+            precondition_request_count = std::strtoull(value.c_str(), nullptr, 10);
+        else if (arg == "--precondition-trace")
+            precondition_trace_path = value;
+        else if (arg == "--reliability" && (value == "on" || value == "off"))
+            config.ssd_param.reliability_param.enabled = value == "on";
+        else if (arg == "--initial-pe")
+        {
+            // 从已经磨损/存放过一段时间的盘开始，隐含启用可靠性模型；初始磨损同样计入编程/擦除失败概率
+            config.ssd_param.reliability_param.enabled = true;
+            config.nand_param.InitialPECycles = std::strtoull(value.c_str(), nullptr, 10);
+        }
+        else if (arg == "--retention-hours")
+        {
+            config.ssd_param.reliability_param.enabled = true;
+            config.ssd_param.reliability_param.initial_retention_hours = std::strtod(value.c_str(), nullptr);
+        }
+        else if (arg == "--bad-block-ratio")
+            config.nand_param.FactoryBadBlockRatio = std::strtod(value.c_str(), nullptr);
+        else if (arg == "--program-fail-rate")
+            config.nand_param.ProgramFailureRate = std::strtod(value.c_str(), nullptr);
+        else if (arg == "--erase-fail-rate")
+            config.nand_param.EraseFailureRate = std::strtod(value.c_str(), nullptr);
+        else if (arg == "--streams")
+        {
+            // 请求的流由提交队列决定(队列 q 绑定流 q % StreamNum)，队列和合成负载的流都至少补到流数，使每个流都有请求
+            config.ssd_param.StreamNum = std::max<uint64_t>(1, std::strtoull(value.c_str(), nullptr, 10));
+            config.host_param.queue_count = std::max(config.host_param.queue_count, config.ssd_param.StreamNum);
+            if (config.workload_param.streams.size() < config.ssd_param.StreamNum)
+                config.workload_param.streams.resize(config.ssd_param.StreamNum);
+        }
+        else if (arg == "--cmt-sharing" && (value == "shared" || value == "equal" || value == "utility"))
+            config.cache_param.cmt_sharing_mode = value == "shared" ? CMTSharingMode::SHARED : (value == "equal" ? CMTSharingMode::EQUAL_SIZE_PARTITIONING : CMTSharingMode::UTILITY_PARTITIONING);
+        else if (arg == "--arbitration" && (value == "rr" || value == "wrr"))
+            config.host_param.arbitration = value == "rr" ? ArbitrationMode::ROUND_ROBIN : ArbitrationMode::WEIGHTED_ROUND_ROBIN;
+        else if (arg == "--queue-priority" && ParseQueuePriorities(value, config.host_param.queue_priorities))
+            continue;
+        else
+        {
+            PrintUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (trace_path.empty() && !synthetic)
+    {
+        PrintUsage(argv[0]);
+        return 0;
+    }
+
+    if (!convert_path.empty())
+    {
+        uint64_t record_count = ConvertTraceToBinary(trace_path, format, convert_path);
+        PRINT_MESSAGE("Converted " << record_count << " requests to " << convert_path)
+        return 0;
+    }
+
+    uint64_t sectors_per_page = config.nand_param.PageSize / SECTOR_SIZE_IN_BYTE;
+    uint64_t logical_sector_no = GetLogicalSectorCount();
+
+    TraceReaderPtr text_reader;
+    BinaryTraceReaderPtr binary_reader;
+    TraceReplayer::RequestSource source;
+    if (synthetic)
+    {
+        source = generate_user_requests_ramdomly;
+    }
+    else if (binary_format)
+    {
+        binary_reader = std::make_shared<BinaryTraceReader>(trace_path, config.ssd_param.StreamNum, logical_sector_no, sectors_per_page);
+        source = [&]()
+        { return binary_reader->Next(); };
+    }
+    else
+    {
+        text_reader = std::make_shared<TraceReader>(trace_path, format, config.ssd_param.StreamNum, logical_sector_no, sectors_per_page);
+        source = [&]()
+        { return text_reader->Next(); };
+    }
+    auto ftl = std::make_shared<FTL>();
+    ftl->Init();
+    if (!load_snapshot_path.empty())
+    {
+        // 从预处理好的快照开始，跳过预处理
+        auto start_time = std::chrono::steady_clock::now();
+        ftl->LoadSnapshot(load_snapshot_path);
+        double elapsed_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_time).count();
+        PRINT_MESSAGE("Snapshot: loaded " << load_snapshot_path << " in " << elapsed_ms << " ms")
+    }
+    if (precondition_request_count > 0 || !precondition_trace_path.empty())
+    {
+        // 快速预处理：先按合成负载的地址分布写入，再回放预处理 trace 中的写和 TRIM，不模拟 NAND 命令
+        auto start_time = std::chrono::steady_clock::now();
+        uint64_t request_no = 0, page_no = 0;
+        ftl->StartPreconditioning();
+        if (precondition_request_count > 0)
+        {
+            WorkloadParam precondition_param = config.workload_param;
+            precondition_param.request_count = precondition_request_count;
+            if (precondition_param.streams.empty())
+            {
+                precondition_param.streams.emplace_back();
+            }
+            for (auto &stream : precondition_param.streams)
+            {
+                stream.read_ratio = 0;
+            }
+            WorkloadGenerator generator(precondition_param, logical_sector_no, sectors_per_page);
+            while (auto req = generator.Next())
+            {
+                page_no += ftl->PreconditionUserRequest(req);
+                request_no++;
+            }
+        }
+        if (!precondition_trace_path.empty())
+        {
+            TraceReplayer::RequestSource precondition_source;
+            TraceReaderPtr precondition_text_reader;
+            BinaryTraceReaderPtr precondition_binary_reader;
+            if (binary_format)
+            {
+                precondition_binary_reader = std::make_shared<BinaryTraceReader>(precondition_trace_path, config.ssd_param.StreamNum, logical_sector_no, sectors_per_page);
+                precondition_source = [&]()
+                { return precondition_binary_reader->Next(); };
+            }
+            else
+            {
+                precondition_text_reader = std::make_shared<TraceReader>(precondition_trace_path, format, config.ssd_param.StreamNum, logical_sector_no, sectors_per_page);
+                precondition_source = [&]()
+                { return precondition_text_reader->Next(); };
+            }
+            while (auto req = precondition_source())
+            {
+                page_no += ftl->PreconditionUserRequest(req);
+                request_no++;
+            }
+        }
+        ftl->FinishPreconditioning();
+        double elapsed_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_time).count();
+        PRINT_MESSAGE("Precondition: " << request_no << " requests, " << page_no << " pages written, " << ftl->gcwl_unit->GetExecutedGcCount()
+                                       << " blocks reclaimed, " << ftl->gcwl_unit->GetMovedPageCount() << " pages moved in " << elapsed_ms << " ms")
+    }
+    const ReliabilityParam &reliability_param = config.ssd_param.reliability_param;
+    if (reliability_param.initial_retention_hours > 0)
+    {
+        // 模拟时间按 time_scale 换算，预处理和快照中的数据都先老化到回放开始时
+        ftl->block_manager->AgeProgrammedBlocks(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::duration<double>(reliability_param.initial_retention_hours * 3600 / reliability_param.time_scale)));
+    }
+    // GC 统计只计回放期间
+    uint64_t gc_count_before_replay = ftl->gcwl_unit->GetExecutedGcCount();
+    uint64_t moved_pages_before_replay = ftl->gcwl_unit->GetMovedPageCount();
+    auto host = std::make_shared<HostInterface>(ftl, config.host_param);
+    uint64_t request_count[3] = {0, 0, 0};
+    uint64_t sector_count = 0;
+    TraceReplayer *replayer_ptr = nullptr;
+    std::vector<UserRequestPtr> completions;
+    auto poll = [&]()
+    {
+        host->ServiceQueues();
+        ftl->nand_driver->PollCompletions();
+        for (uint64_t queue_id = 0; queue_id < host->GetQueueCount(); queue_id++)
+        {
+            host->ReapCompletions(queue_id, completions);
+        }
+        for (auto &req : completions)
+        {
+            replayer_ptr->OnRequestCompleted(req);
+        }
+        completions.clear();
+    };
+    TraceReplayer replayer(source, mode, queue_depth, speedup, [&](const UserRequestPtr &req)
+                           {
+                               request_count[static_cast<int>(req->req_type)]++;
+                               sector_count += req->size_in_sectors;
+                               // 提交队列满时先推进设备，直到腾出位置
+                               while (!host->SubmitRequest(PickHostQueue(req, host->GetQueueCount()), req))
+                               {
+                                   poll();
+                               } }, poll);
+    replayer_ptr = &replayer;
+    replayer.Run();
+    // 回放结束时 GC 搬移等后台命令可能仍在途，先等它们完成再统计和退出
+    ftl->nand_driver->WaitForAllCompletions();
+
+    PRINT_MESSAGE("Replayed " << replayer.GetCompletedRequestCount() << " requests (read " << request_count[0]
+                              << ", write " << request_count[1] << ", trim " << request_count[2] << ", "
+                              << sector_count << " sectors, " << (text_reader ? text_reader->GetSkippedLineCount() : 0)
+                              << " lines skipped) in "
+                              << replayer.GetElapsedTimeNs() / 1e6 << " ms")
+    for (uint64_t queue_id = 0; queue_id < host->GetQueueCount(); queue_id++)
+    {
+        const HostQueuePair &queue = host->GetQueue(queue_id);
+        PRINT_MESSAGE("Queue " << queue_id << ": " << queue.completed_count << " completed, avg latency "
+                               << (queue.completed_count ? queue.total_latency_ns / queue.completed_count / 1e3 : 0)
+                               << " us, max latency " << queue.max_latency_ns / 1e3 << " us")
+    }
+    PRINT_MESSAGE("GC: " << ftl->gcwl_unit->GetExecutedGcCount() - gc_count_before_replay << " blocks reclaimed, "
+                         << ftl->gcwl_unit->GetMovedPageCount() - moved_pages_before_replay << " pages moved")
+    if (ftl->address_mapping->GetStreamsNo() > 1)
+    {
+        for (uint64_t stream_id = 0; stream_id < ftl->address_mapping->GetStreamsNo(); stream_id++)
+        {
+            uint64_t hit = ftl->address_mapping->GetCMTHitCount(stream_id);
+            uint64_t lookup = hit + ftl->address_mapping->GetCMTMissCount(stream_id);
+            PRINT_MESSAGE("CMT stream " << stream_id << ": " << ftl->address_mapping->GetCMTPartitionCapacity(stream_id) << " entries, hit rate "
+                                        << (lookup ? 100.0 * hit / lookup : 0) << "% over " << lookup << " lookups")
+        }
+    }
+    if (ftl->reliability_model != nullptr)
+    {
+        const ReliabilityModel &reliability = *ftl->reliability_model;
+        std::string corrected;
+        for (uint64_t count : reliability.GetCorrectedCounts())
+        {
+            corrected += (corrected.empty() ? "" : "/") + std::to_string(count);
+        }
+        PRINT_MESSAGE("Reliability: " << reliability.GetSensingCount() << " page reads (" << reliability.GetRetryCount() << " read retries), corrected by LDPC level "
+                                      << corrected << ", " << reliability.GetUncorrectableCount() << " uncorrectable, "
+                                      << ftl->gcwl_unit->GetReadReclaimCount() << " blocks read-reclaimed")
+        PRINT_MESSAGE("Reliability: modeled host page read latency p50 " << reliability.GetHostReadLatencyPercentileNs(0.5) / 1e3 << " us, p99 "
+                                                                         << reliability.GetHostReadLatencyPercentileNs(0.99) / 1e3 << " us, p99.9 "
+                                                                         << reliability.GetHostReadLatencyPercentileNs(0.999) / 1e3 << " us, max "
+                                                                         << reliability.GetHostReadLatencyPercentileNs(1.0) / 1e3 << " us over "
+                                                                         << reliability.GetHostReadCount() << " reads")
+    }
+    {
+        // 有效 OP 按扣除坏块和检查点保留块后的物理页数计算
+        uint64_t logical_pages = 0;
+        for (uint64_t stream_id = 0; stream_id < ftl->address_mapping->GetStreamsNo(); stream_id++)
+        {
+            logical_pages += ftl->address_mapping->GetLogicalPagesNo(stream_id);
+        }
+        uint64_t usable_pages = ftl->block_manager->GetUsablePagesCount();
+        PRINT_MESSAGE("Bad blocks: " << ftl->block_manager->GetBadBlockCount() << " (" << ftl->block_manager->GetInitialBadBlockCount()
+                                     << " at start), " << ftl->GetProgramFailureCount() << " program failures, " << ftl->GetEraseFailureCount()
+                                     << " erase failures, " << usable_pages << " usable pages, effective OP "
+                                     << 100.0 * (static_cast<double>(usable_pages) - logical_pages) / logical_pages << "%")
+    }
+    if (ftl->IsReadOnly())
+    {
+        PRINT_MESSAGE("Read-only: " << ftl->GetRejectedWriteCount() << " write requests rejected")
+    }
+    if (ftl->checkpoint_manager != nullptr)
+    {
+        const CheckpointManager &checkpoint = *ftl->checkpoint_manager;
+        PRINT_MESSAGE("Checkpoint: " << checkpoint.GetCommittedCheckpointCount() << " checkpoints (" << checkpoint.GetCheckpointPageCount()
+                                     << " pages), " << checkpoint.GetJournalPageCount() << " journal pages, " << checkpoint.GetEraseCount()
+                                     << " erases, " << checkpoint.GetDroppedJournalEntryCount() << " journal entries dropped, WAF +"
+                                     << checkpoint.GetWriteAmplification())
+    }
+    if (!save_snapshot_path.empty())
+    {
+        auto start_time = std::chrono::steady_clock::now();
+        uint64_t snapshot_size = ftl->SaveSnapshot(save_snapshot_path, snapshot_page_data);
+        double elapsed_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_time).count();
+        PRINT_MESSAGE("Snapshot: saved " << save_snapshot_path << " (" << snapshot_size / 1e6 << " MB"
+                                         << (snapshot_page_data ? "" : ", page metadata only") << ") in " << elapsed_ms << " ms")
+    }
+    if (power_loss)
+    {
+        ftl->SimulatePowerLoss();
+        MountStatistics mount = ftl->Mount();
+        PRINT_MESSAGE("Mount: scanned " << mount.scanned_pages << " pages (" << mount.programmed_pages << " programmed, "
+                                        << mount.unprogrammed_holes << " holes) with " << mount.scan_threads << " threads, recovered "
+                                        << mount.recovered_mappings << " mappings, " << mount.stale_pages << " stale pages, "
+                                        << mount.closed_blocks << " blocks closed in " << mount.elapsed_ns / 1e6 << " ms")
+        if (ftl->checkpoint_manager != nullptr)
+        {
+            PRINT_MESSAGE("Mount: checkpoint " << (mount.checkpoint_epoch == NO_VALUE ? std::string("none") : std::to_string(mount.checkpoint_epoch))
+                                               << " (" << mount.checkpoint_pages_read << " pages, " << mount.journal_pages_read << " journal pages, "
+                                               << mount.journal_entries << " entries), " << mount.verified_blocks << " blocks verified by first page, "
+                                               << mount.scanned_pages << " of " << mount.full_scan_pages << " pages scanned"
+                                               << ", " << mount.discarded_mappings << " mappings to reclaimed pages dropped"
+                                               << (mount.fallback_full_scan ? ", fell back to full scan" : ""))
+        }
+    }
+    ftl->nand_driver->WaitForAllCompletions();
     return 0;
-}
\ No newline at end of file
+}
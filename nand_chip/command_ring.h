@@ -0,0 +1,146 @@
+#pragma once
+#include "param.h"
+#include <atomic>
+
+/*
+ * NandChip 的无锁命令环，仿照 NVMe SQ/CQ：
+ * - MpscRing: 提交队列，允许多个线程并发提交，单个 NAND 工作线程消费
+ * - SpscRing: 完成队列，NAND 工作线程生产，提交方线程消费
+ * 容量必须是2的幂。两者都不做阻塞等待，满/空时直接返回 false，由调用者决定重试或休眠。
+ */
+
+#define RING_CACHE_LINE_SIZE 64
+
+template <typename T>
+class SpscRing
+{
+public:
+    explicit SpscRing(uint64_t capacity) : mask(capacity - 1), entries(capacity)
+    {
+        if (capacity == 0 || (capacity & (capacity - 1)) != 0)
+        {
+            PRINT_ERROR("SpscRing capacity must be a power of 2!")
+        }
+    }
+
+    bool TryPush(T &&item)
+    {
+        uint64_t tail = tail_index.load(std::memory_order_relaxed);
+        if (tail - head_cache == entries.size())
+        {
+            head_cache = head_index.load(std::memory_order_acquire);
+            if (tail - head_cache == entries.size())
+            {
+                return false;
+            }
+        }
+        entries[tail & mask] = std::move(item);
+        tail_index.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool TryPop(T &item)
+    {
+        uint64_t head = head_index.load(std::memory_order_relaxed);
+        if (head == tail_cache)
+        {
+            tail_cache = tail_index.load(std::memory_order_acquire);
+            if (head == tail_cache)
+            {
+                return false;
+            }
+        }
+        item = std::move(entries[head & mask]);
+        head_index.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool Empty() const { return head_index.load(std::memory_order_acquire) == tail_index.load(std::memory_order_acquire); }
+
+private:
+    const uint64_t mask;
+    std::vector<T> entries;
+    // 生产者和消费者各自的下标及对方下标的本地缓存分开放在不同缓存行，避免伪共享
+    alignas(RING_CACHE_LINE_SIZE) std::atomic<uint64_t> tail_index{0};
+    uint64_t head_cache = 0;
+    alignas(RING_CACHE_LINE_SIZE) std::atomic<uint64_t> head_index{0};
+    uint64_t tail_cache = 0;
+};
+
+template <typename T>
+class MpscRing
+{
+public:
+    explicit MpscRing(uint64_t capacity) : mask(capacity - 1), cells(capacity)
+    {
+        if (capacity == 0 || (capacity & (capacity - 1)) != 0)
+        {
+            PRINT_ERROR("MpscRing capacity must be a power of 2!")
+        }
+        for (uint64_t i = 0; i < capacity; i++)
+        {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    // Vyukov 有界队列：每个槽位带序号，生产者用 CAS 抢占 tail 位置
+    bool TryPush(T &&item)
+    {
+        uint64_t pos = tail_index.load(std::memory_order_relaxed);
+        Cell *cell;
+        while (true)
+        {
+            cell = &cells[pos & mask];
+            uint64_t seq = cell->sequence.load(std::memory_order_acquire);
+            int64_t diff = static_cast<int64_t>(seq) - static_cast<int64_t>(pos);
+            if (diff == 0)
+            {
+                if (tail_index.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false; // 队列已满
+            }
+            else
+            {
+                pos = tail_index.load(std::memory_order_relaxed);
+            }
+        }
+        cell->data = std::move(item);
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool TryPop(T &item)
+    {
+        Cell *cell = &cells[head_index & mask];
+        uint64_t seq = cell->sequence.load(std::memory_order_acquire);
+        if (seq != head_index + 1)
+        {
+            return false; // 队列为空或生产者尚未写完
+        }
+        item = std::move(cell->data);
+        cell->sequence.store(head_index + mask + 1, std::memory_order_release);
+        head_index++;
+        return true;
+    }
+
+    bool Empty() const
+    {
+        return cells[head_index & mask].sequence.load(std::memory_order_acquire) != head_index + 1;
+    }
+
+private:
+    struct Cell
+    {
+        std::atomic<uint64_t> sequence;
+        T data;
+    };
+    const uint64_t mask;
+    std::vector<Cell> cells;
+    alignas(RING_CACHE_LINE_SIZE) std::atomic<uint64_t> tail_index{0};
+    alignas(RING_CACHE_LINE_SIZE) uint64_t head_index = 0; // 只有消费者访问
+};
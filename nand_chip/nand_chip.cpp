@@ -1,13 +1,21 @@
 #include "nand_chip.h"
 #include "transaction.h"
+#include "state_snapshot.h"
 #include <cstring>
 #include <cstdio>
+#include <cmath>
 
-NandChip::NandChip(uint64_t channel_id, uint64_t chip_id, uint64_t dies_per_chip, uint64_t planes_per_die,
-                   uint64_t blocks_per_plane, uint64_t pages_per_block, uint64_t page_size)
-    : channel_id(channel_id), chip_id(chip_id), dies_per_chip(dies_per_chip), planes_per_die(planes_per_die),
-      blocks_per_plane(blocks_per_plane), pages_per_block(pages_per_block), page_size(page_size)
+NandChip::NandChip(uint64_t channel_id, uint64_t chip_id, const NandParam &nand_param, uint64_t queue_depth, bool busy_poll)
+    : channel_id(channel_id), chip_id(chip_id), dies_per_chip(nand_param.DiePerChip), planes_per_die(nand_param.PlanePerDie),
+      blocks_per_plane(nand_param.BlockPerPlane), pages_per_block(nand_param.PagePerBlock), page_size(nand_param.PageSize),
+      program_failure_rate(nand_param.ProgramFailureRate), erase_failure_rate(nand_param.EraseFailureRate),
+      failure_rate_growth(nand_param.FailureRateGrowth), block_pe_cycle(std::max<uint64_t>(nand_param.BlockPECycle, 1)),
+      initial_pe_cycles(nand_param.InitialPECycles), queue_depth(queue_depth), busy_poll(busy_poll),
+      submission_queue(queue_depth), completion_queue(queue_depth)
 {
+    std::seed_seq bad_block_seed{nand_param.BadBlockSeed, channel_id, chip_id};
+    std::mt19937_64 bad_block_rng(bad_block_seed);
+    failure_rng.seed(bad_block_rng());
     dies.resize(dies_per_chip);
     for (uint64_t i = 0; i < dies_per_chip; ++i)
     {
@@ -16,144 +24,345 @@ NandChip::NandChip(uint64_t channel_id, uint64_t chip_id, uint64_t dies_per_chip
         dies[i].planes.reserve(planes_per_die);
         for (uint64_t j = 0; j < planes_per_die; ++j)
         {
-            dies[i].planes.emplace_back(blocks_per_plane, pages_per_block, page_size);
+            dies[i].planes.emplace_back(blocks_per_plane, pages_per_block, page_size, nand_param.FactoryBadBlockRatio, bad_block_rng);
         }
     }
 
-    stop_flag = false;
     worker = std::thread(&NandChip::worker_loop, this);
 }
 
 NandChip::~NandChip()
 {
     {
-        std::lock_guard<std::mutex> lock(mtx);
-        stop_flag = true;
+        std::lock_guard<std::mutex> lock(doorbell_mtx);
+        stop_flag.store(true, std::memory_order_release);
     }
-    cv.notify_all();
+    doorbell_cv.notify_all();
     if (worker.joinable())
         worker.join();
 }
 
-std::vector<uint8_t> NandChip::GetMetaData(uint64_t die, uint64_t plane, uint64_t block, uint64_t page)
+PageMetadata NandChip::GetMetaData(uint64_t die, uint64_t plane, uint64_t block, uint64_t page) const
 {
     if (die >= dies.size() || plane >= dies[die].planes.size() ||
         block >= dies[die].planes[plane].blocks.size() ||
         page >= dies[die].planes[plane].pages_per_block)
     {
-        return std::vector<uint8_t>(); // 返回空向量表示错误
+        return PageMetadata();
     }
+    return dies[die].planes[plane].blocks[block].pages[page].spare;
+}
 
-    // 返回元数据，这里可以根据需要自定义
-    std::vector<uint8_t> metadata(16, 0x00); // 假设元数据长度为16字节
-    return metadata;
+void NandChip::SetMetaData(uint64_t die, uint64_t plane, uint64_t block, uint64_t page, const PageMetadata &metadata)
+{
+    dies[die].planes[plane].blocks[block].pages[page].spare = metadata;
 }
 
-std::future<NandResult> NandChip::push_command(NandCmd cmd, const PhysicalPageAddressPtr addr, const std::vector<uint8_t> &data)
+void NandChip::EraseMetaData(uint64_t die, uint64_t plane, uint64_t block)
 {
-    auto promise = std::make_shared<std::promise<NandResult>>();
-    std::future<NandResult> fut = promise->get_future();
+    for (Page &page : dies[die].planes[plane].blocks[block].pages)
     {
-        std::lock_guard<std::mutex> lock(mtx);
-        command_queue.push(NandTask{cmd, addr, data, promise});
+        page.spare = PageMetadata();
     }
-    cv.notify_one();
-    return fut;
 }
 
-int NandChip::erase_block(const PhysicalPageAddressPtr addr)
+bool NandChip::is_bad_block(uint64_t die, uint64_t plane, uint64_t block) const
 {
-    if (!addr)
-        return -1;
-    if (addr->die_id >= dies.size() || addr->plane_id >= dies[addr->die_id].planes.size() ||
-        addr->block_id >= dies[addr->die_id].planes[addr->plane_id].blocks.size())
+    return dies[die].planes[plane].blocks[block].is_bad;
+}
+
+void NandChip::mark_bad_block(uint64_t die, uint64_t plane, uint64_t block)
+{
+    dies[die].planes[plane].mark_bad_block(block);
+}
+
+void NandChip::save_snapshot(SnapshotWriter &writer, bool include_page_data) const
+{
+    std::vector<PageMetadata> spares(pages_per_block);
+    for (const Die &die : dies)
+        for (const Plane &plane : die.planes)
+            for (const Block &block : plane.blocks)
+            {
+                // 每块先写全部页的备用区，再依次写已编程页的主数据区；未编程页载入时按擦除状态恢复
+                for (uint64_t page_id = 0; page_id < pages_per_block; page_id++)
+                {
+                    spares[page_id] = block.pages[page_id].spare;
+                }
+                writer.WriteArray(spares.data(), spares.size());
+                if (!include_page_data)
+                {
+                    continue;
+                }
+                for (const Page &page : block.pages)
+                {
+                    if (page.spare.sequence != NO_VALUE)
+                    {
+                        writer.WriteArray(page.data.data(), page.data.size());
+                    }
+                }
+            }
+}
+
+void NandChip::load_snapshot(SnapshotReader &reader)
+{
+    if (get_outstanding_command_count() != 0)
+    {
+        PRINT_ERROR("Cannot load a snapshot into NAND chip " << channel_id << "@" << chip_id << " with commands in flight!")
+    }
+    bool has_page_data = reader.HasPageData();
+    std::vector<PageMetadata> spares(pages_per_block);
+    for (Die &die : dies)
+        for (Plane &plane : die.planes)
+            for (Block &block : plane.blocks)
+            {
+                reader.ReadArray(spares.data(), spares.size());
+                for (uint64_t page_id = 0; page_id < pages_per_block; page_id++)
+                {
+                    Page &page = block.pages[page_id];
+                    page.spare = spares[page_id];
+                    if (has_page_data && page.spare.sequence != NO_VALUE)
+                    {
+                        std::memcpy(page.data.data(), reader.ReadBytes(page_size), page_size);
+                    }
+                    else
+                    {
+                        std::fill(page.data.begin(), page.data.end(), 0xFF);
+                    }
+                }
+            }
+}
+
+uint64_t NandChip::submit_commands(NandTask *tasks, uint64_t count)
+{
+    // 先按队列深度预留名额，保证提交队列和完成队列都不会溢出
+    uint64_t outstanding = outstanding_commands.load(std::memory_order_relaxed);
+    uint64_t admitted = 0;
+    do
+    {
+        admitted = std::min(count, queue_depth - outstanding);
+        if (admitted == 0)
+        {
+            return 0;
+        }
+    } while (!outstanding_commands.compare_exchange_weak(outstanding, outstanding + admitted, std::memory_order_acq_rel));
+
+    for (uint64_t i = 0; i < admitted; i++)
+    {
+        if (!submission_queue.TryPush(std::move(tasks[i])))
+        {
+            PRINT_ERROR("NAND submission queue overflow!")
+        }
+    }
+    ring_doorbell();
+    return admitted;
+}
+
+bool NandChip::submit_command(NandTask &task)
+{
+    return submit_commands(&task, 1) == 1;
+}
+
+uint64_t NandChip::reap_completions(NandResult *results, uint64_t max_count)
+{
+    uint64_t reaped = 0;
+    while (reaped < max_count && completion_queue.TryPop(results[reaped]))
+    {
+        reaped++;
+    }
+    if (reaped > 0)
+    {
+        outstanding_commands.fetch_sub(reaped, std::memory_order_acq_rel);
+    }
+    return reaped;
+}
+
+uint64_t NandChip::process_completions(uint64_t max_count)
+{
+    constexpr uint64_t COMPLETION_BATCH_SIZE = 32;
+    NandResult results[COMPLETION_BATCH_SIZE];
+    uint64_t processed = 0;
+    while (processed < max_count)
+    {
+        uint64_t reaped = reap_completions(results, std::min(COMPLETION_BATCH_SIZE, max_count - processed));
+        if (reaped == 0)
+        {
+            break;
+        }
+        for (uint64_t i = 0; i < reaped; i++)
+        {
+            if (results[i].callback)
+            {
+                results[i].callback(results[i].context, results[i]);
+            }
+            results[i].data = nullptr;
+        }
+        processed += reaped;
+    }
+    return processed;
+}
+
+void NandChip::ring_doorbell()
+{
+    if (busy_poll)
+    {
+        return;
+    }
+    // 与 worker_loop 中 "置休眠标志 -> 再检查队列" 配对，保证不会丢失唤醒
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (worker_sleeping.load(std::memory_order_relaxed))
+    {
+        std::lock_guard<std::mutex> lock(doorbell_mtx);
+        doorbell_cv.notify_one();
+    }
+}
+
+int NandChip::erase_block(const PhysicalPageAddress addr)
+{
+    if (addr.die_id >= dies.size() || addr.plane_id >= dies[addr.die_id].planes.size() ||
+        addr.block_id >= dies[addr.die_id].planes[addr.plane_id].blocks.size())
     {
         return -1;
     }
 
     // 擦除整个块，将所有页重置为0xFF
-    Block &block = dies[addr->die_id].planes[addr->plane_id].blocks[addr->block_id];
+    Block &block = dies[addr.die_id].planes[addr.plane_id].blocks[addr.block_id];
+    if (block.is_bad)
+    {
+        return NAND_STATUS_ERASE_FAILED;
+    }
     for (auto &page : block.pages)
     {
         std::fill(page.data.begin(), page.data.end(), 0xFF);
+        page.spare = PageMetadata();
     }
     return 0;
 }
 
-int NandChip::write_page(const PhysicalPageAddressPtr addr, const uint8_t *data)
+int NandChip::write_page(const PhysicalPageAddress addr, const uint8_t *data, const PageMetadata &metadata)
 {
-    if (!addr || !data)
+    if (!data)
         return -1;
-    if (addr->die_id >= dies.size() || addr->plane_id >= dies[addr->die_id].planes.size() ||
-        addr->block_id >= dies[addr->die_id].planes[addr->plane_id].blocks.size() ||
-        addr->page_id >= dies[addr->die_id].planes[addr->plane_id].blocks[addr->block_id].pages.size())
+    if (addr.die_id >= dies.size() || addr.plane_id >= dies[addr.die_id].planes.size() ||
+        addr.block_id >= dies[addr.die_id].planes[addr.plane_id].blocks.size() ||
+        addr.page_id >= dies[addr.die_id].planes[addr.plane_id].blocks[addr.block_id].pages.size())
     {
         return -1;
     }
 
-    Page &page = dies[addr->die_id].planes[addr->plane_id].blocks[addr->block_id].pages[addr->page_id];
+    Block &block = dies[addr.die_id].planes[addr.plane_id].blocks[addr.block_id];
+    if (block.is_bad)
+    {
+        return NAND_STATUS_PROGRAM_FAILED;
+    }
+    Page &page = block.pages[addr.page_id];
     std::memcpy(page.data.data(), data, page.data.size());
+    page.spare = metadata;
     return 0;
 }
 
-int NandChip::read_page(const PhysicalPageAddressPtr addr, uint8_t *data)
+int NandChip::read_page(const PhysicalPageAddress addr, uint8_t *data, PageMetadata &metadata)
 {
-    if (!addr || !data)
+    if (!data)
         return -1;
-    if (addr->die_id >= dies.size() || addr->plane_id >= dies[addr->die_id].planes.size() ||
-        addr->block_id >= dies[addr->die_id].planes[addr->plane_id].blocks.size() ||
-        addr->page_id >= dies[addr->die_id].planes[addr->plane_id].blocks[addr->block_id].pages.size())
+    if (addr.die_id >= dies.size() || addr.plane_id >= dies[addr.die_id].planes.size() ||
+        addr.block_id >= dies[addr.die_id].planes[addr.plane_id].blocks.size() ||
+        addr.page_id >= dies[addr.die_id].planes[addr.plane_id].blocks[addr.block_id].pages.size())
     {
         return -1;
     }
 
-    const Page &page = dies[addr->die_id].planes[addr->plane_id].blocks[addr->block_id].pages[addr->page_id];
+    const Page &page = dies[addr.die_id].planes[addr.plane_id].blocks[addr.block_id].pages[addr.page_id];
     std::memcpy(data, page.data.data(), page.data.size());
+    metadata = page.spare;
     return 0;
 }
 
-void NandChip::worker_loop()
+bool NandChip::inject_failure(double failure_rate, uint64_t erase_count)
 {
-    while (!stop_flag)
+    if (failure_rate <= 0)
     {
-        NandTask task;
-        {
-            std::unique_lock<std::mutex> lock(mtx);
-            cv.wait(lock, [&]
-                    { return stop_flag || !command_queue.empty(); });
-            if (stop_flag && command_queue.empty())
-                return;
-            task = std::move(command_queue.front());
-            command_queue.pop();
-        }
-        NandResult result;
-        result.cmd = task.cmd;
-        switch (task.cmd)
-        {
-        case NandCmd::READ:
+        return false;
+    }
+    double wear = static_cast<double>(erase_count + initial_pe_cycles) / block_pe_cycle;
+    double probability = failure_rate * std::pow(failure_rate_growth, wear);
+    return std::uniform_real_distribution<double>(0.0, 1.0)(failure_rng) < probability;
+}
+
+void NandChip::execute_command(NandTask &task, NandResult &result)
+{
+    result.tag = task.tag;
+    result.cmd = task.cmd;
+    result.callback = task.callback;
+    result.context = task.context;
+    switch (task.cmd)
+    {
+    case NandCmd::READ:
+    {
+        PageBufferPtr buf = PageBufferPool::GetInstance().Allocate();
+        int status = read_page(task.addr, buf->data, result.metadata);
+        result.status = status;
+        result.data = std::move(buf);
+        break;
+    }
+    case NandCmd::PROGRAM:
+    {
+        if (task.inject_failures && inject_failure(program_failure_rate, task.metadata.erase_count))
         {
-            std::vector<uint8_t> buf(page_size, 0xFF);
-            int status = read_page(task.addr, buf.data());
-            result.status = status;
-            result.data = std::move(buf);
+            result.status = NAND_STATUS_PROGRAM_FAILED;
             break;
         }
-        case NandCmd::PROGRAM:
+        int status = write_page(task.addr, task.data ? task.data->data : nullptr, task.metadata);
+        result.status = status;
+        break;
+    }
+    case NandCmd::ERASE:
+    {
+        if (task.inject_failures && inject_failure(erase_failure_rate, task.metadata.erase_count))
         {
-            int status = write_page(task.addr, task.data.data());
-            result.status = status;
+            result.status = NAND_STATUS_ERASE_FAILED;
             break;
         }
-        case NandCmd::ERASE:
+        int status = erase_block(task.addr);
+        result.status = status;
+        break;
+    }
+    default:
+        result.status = -1;
+    }
+}
+
+void NandChip::worker_loop()
+{
+    NandTask task;
+    while (true)
+    {
+        if (!submission_queue.TryPop(task))
         {
-            int status = erase_block(task.addr);
-            result.status = status;
-            break;
+            if (stop_flag.load(std::memory_order_acquire))
+            {
+                break;
+            }
+            if (busy_poll)
+            {
+                std::this_thread::yield();
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(doorbell_mtx);
+            worker_sleeping.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            doorbell_cv.wait(lock, [&]
+                             { return stop_flag.load(std::memory_order_acquire) || !submission_queue.Empty(); });
+            worker_sleeping.store(false, std::memory_order_relaxed);
+            continue;
         }
-        default:
-            result.status = -1;
+        NandResult result;
+        execute_command(task, result);
+        task.data = nullptr;
+        // 提交时已按队列深度限流，完成队列不会长期处于满状态
+        while (!completion_queue.TryPush(std::move(result)))
+        {
+            std::this_thread::yield();
         }
-        task.promise->set_value(std::move(result));
     }
     std::cout << "NandChip worker thread exiting." << std::endl;
 }
@@ -1,5 +1,8 @@
 #pragma once
 #include "param.h"
+#include "transaction.h"
+#include "command_ring.h"
+#include <thread>
 
 enum class NandCmd
 {
@@ -12,18 +15,46 @@ enum class NandCmd
 class NandChip;
 using NandChipPtr = std::shared_ptr<NandChip>;
 
+struct NandResult;
+
+#define NAND_STATUS_POWER_LOSS (-2) // 掉电时尚未进入芯片队列的命令被丢弃，不会执行
+#define NAND_STATUS_PROGRAM_FAILED (-3) // 编程失败，页保持未编程状态
+#define NAND_STATUS_ERASE_FAILED (-4)   // 擦除失败，块内容不变
+
+// 页备用区(OOB)中的元数据：FTL 编程时随页写入，GC 据此找回 LPA，上电挂载时扫描重建映射和块状态
+struct PageMetadata
+{
+    uint64_t lpa = NO_VALUE;
+    uint64_t stream_id = NO_VALUE;
+    uint64_t sequence = NO_VALUE; // 全局递增的编程序号，同一 LPA 的多个副本以序号大者为准；NO_VALUE 表示页未编程
+    uint64_t write_state_bitmap = 0;
+    uint64_t erase_count = 0; // 编程时所在块的擦除次数
+};
+// 完成回调：在调用 process_completions 的线程上执行(而不是 NAND 工作线程)，context 的生命周期由提交者管理
+using NandCallback = void (*)(void *context, NandResult &result);
+
+// 完成队列条目
 struct NandResult
 {
+    uint64_t tag;       // 与提交时 NandTask::tag 相同
     NandCmd cmd;
-    int status;                // 0: success, 其他: 错误码
-    std::vector<uint8_t> data; // 仅READ时有效
+    int status;         // 0: success, 其他: 错误码
+    PageBufferPtr data; // 仅READ时有效，从页缓冲池借用
+    PageMetadata metadata; // 仅READ时有效，页备用区中的元数据
+    NandCallback callback = nullptr;
+    void *context = nullptr;
 };
+// 提交队列条目
 struct NandTask
 {
+    uint64_t tag; // 由提交者分配，用于把完成条目对应回原请求
     NandCmd cmd;
-    PhysicalPageAddressPtr addr;
-    std::vector<uint8_t> data; // 仅PROGRAM时有效
-    std::shared_ptr<std::promise<NandResult>> promise;
+    PhysicalPageAddress addr;
+    PageBufferPtr data; // 仅PROGRAM时有效，直接引用上层的页缓冲区
+    PageMetadata metadata; // PROGRAM时随页写入备用区；PROGRAM/ERASE时其中的 erase_count 决定失败概率
+    bool inject_failures = false; // 按 NandParam 中的失败率随机让 PROGRAM/ERASE 失败
+    NandCallback callback = nullptr;
+    void *context = nullptr;
 };
 
 class Page
@@ -31,6 +62,7 @@ class Page
 public:
     Page(int page_size) : data(page_size, 0xFF) {}
     std::vector<uint8_t> data; // 主数据区
+    PageMetadata spare; // 备用区(OOB)，擦除后恢复默认值
 };
 
 class Block
@@ -38,32 +70,33 @@ class Block
 public:
     Block(int block_id, int pages_per_block, int page_size) : block_id(block_id), pages(pages_per_block, Page(page_size)) {}
     uint64_t block_id;
+    bool is_bad = false; // 出厂坏块，或 FTL 搬走数据后退役的块；编程和擦除都会失败
     std::vector<Page> pages;
 };
 
 class Plane
 {
 private:
-    double bad_block_ratio = 0.02; // 坏块比例
-    void set_random_bad_blocks()
+    void set_random_bad_blocks(double bad_block_ratio, std::mt19937_64 &rng)
     {
-        uint64_t bad_block_count = static_cast<uint64_t>(blocks_no * bad_block_ratio);
+        uint64_t bad_block_count = std::min<uint64_t>(static_cast<uint64_t>(blocks_no * bad_block_ratio), blocks_no);
         if (bad_block_count == 0 && bad_block_ratio > 0)
-            bad_block_count = 2; // 至少2个坏块
+            bad_block_count = std::min<uint64_t>(2, blocks_no); // 至少2个坏块
         std::set<uint64_t> bad_blocks_set;
-        std::mt19937 rng{std::random_device{}()};
         std::uniform_int_distribution<uint64_t> dist(0, blocks_no - 1);
         while (bad_blocks_set.size() < bad_block_count)
         {
             bad_blocks_set.insert(dist(rng));
         }
-        bad_block_ids.assign(bad_blocks_set.begin(), bad_blocks_set.end());
-        bad_block_no = bad_block_ids.size();
-        healthy_block_no = blocks_no - bad_block_no;
+        bad_block_ids.clear();
+        for (uint64_t block_id : bad_blocks_set)
+        {
+            mark_bad_block(block_id);
+        }
     }
 
 public:
-    Plane(int blocks_per_plane, int pages_per_block, int page_size)
+    Plane(int blocks_per_plane, int pages_per_block, int page_size, double bad_block_ratio, std::mt19937_64 &rng)
         : blocks_no(blocks_per_plane), pages_per_block(pages_per_block)
     {
         blocks.reserve(blocks_no);
@@ -71,7 +104,16 @@ public:
         {
             blocks.emplace_back(i, pages_per_block, page_size);
         }
-        set_random_bad_blocks();
+        set_random_bad_blocks(bad_block_ratio, rng);
+    }
+    void mark_bad_block(uint64_t block_id)
+    {
+        if (blocks[block_id].is_bad)
+            return;
+        blocks[block_id].is_bad = true;
+        bad_block_ids.push_back(block_id);
+        bad_block_no = bad_block_ids.size();
+        healthy_block_no = blocks_no - bad_block_no;
     }
     uint64_t blocks_no;
     uint64_t bad_block_no;
@@ -104,14 +146,32 @@ public:
     };
 
 public:
-    NandChip(uint64_t channel_id, uint64_t chip_id, uint64_t dies_per_chip, uint64_t planes_per_die,
-             uint64_t blocks_per_plane, uint64_t pages_per_block, uint64_t page_size);
+    // 几何参数和坏块/失败注入参数取自 nand_param；出厂坏块由 BadBlockSeed 和芯片位置决定
+    NandChip(uint64_t channel_id, uint64_t chip_id, const NandParam &nand_param, uint64_t queue_depth = 1024, bool busy_poll = false);
     ~NandChip();
     uint64_t channel_id;
     uint64_t chip_id;
-    std::vector<uint8_t> GetMetaData(uint64_t die, uint64_t plane, uint64_t block, uint64_t page);
-
-    std::future<NandResult> push_command(NandCmd cmd, const PhysicalPageAddressPtr addr, const std::vector<uint8_t> &data = {});
+    // 读取页备用区中的元数据，地址越界时返回默认值；只应访问没有在途命令的页
+    PageMetadata GetMetaData(uint64_t die, uint64_t plane, uint64_t block, uint64_t page) const;
+    // 快速预处理：不经过命令队列直接写入页备用区/把块内所有页的备用区恢复为擦除状态，主数据区不变；只能在芯片没有在途命令时调用
+    void SetMetaData(uint64_t die, uint64_t plane, uint64_t block, uint64_t page, const PageMetadata &metadata);
+    void EraseMetaData(uint64_t die, uint64_t plane, uint64_t block);
+    // 坏块表：出厂坏块和退役块；只能在该块没有在途命令时标记
+    bool is_bad_block(uint64_t die, uint64_t plane, uint64_t block) const;
+    void mark_bad_block(uint64_t die, uint64_t plane, uint64_t block);
+
+    // 批量提交命令，整批只敲一次门铃；返回实际入队数，超出队列深度的部分由调用者稍后重试
+    uint64_t submit_commands(NandTask *tasks, uint64_t count);
+    // 单个提交：只有入队成功时才移走 task，队列满时 task 保持原样留给调用者重试
+    bool submit_command(NandTask &task);
+    // 从完成队列取回最多 max_count 个完成条目，不阻塞
+    uint64_t reap_completions(NandResult *results, uint64_t max_count);
+    // 取回完成条目并在当前线程依次执行各自的回调，返回处理的条目数
+    uint64_t process_completions(uint64_t max_count);
+    uint64_t get_outstanding_command_count() const { return outstanding_commands.load(std::memory_order_acquire); }
+    // 保存/恢复所有页的备用区，include_page_data 时再保存已编程页的主数据区；只能在芯片没有在途命令时调用
+    void save_snapshot(SnapshotWriter &writer, bool include_page_data) const;
+    void load_snapshot(SnapshotReader &reader);
 
 private:
     uint64_t dies_per_chip;
@@ -122,16 +182,33 @@ private:
 
     std::vector<Die> dies;
 
-    std::queue<NandTask> command_queue;
-    std::mutex mtx;
-    std::condition_variable cv;
+    // 失败注入只在工作线程中使用
+    double program_failure_rate;
+    double erase_failure_rate;
+    double failure_rate_growth;
+    uint64_t block_pe_cycle;
+    uint64_t initial_pe_cycles;
+    std::mt19937_64 failure_rng;
+    bool inject_failure(double failure_rate, uint64_t erase_count);
+
+    uint64_t queue_depth;
+    bool busy_poll; // true: 工作线程空闲时自旋轮询；false: 空闲时休眠，等待门铃唤醒
+    MpscRing<NandTask> submission_queue;
+    SpscRing<NandResult> completion_queue;
+    std::atomic<uint64_t> outstanding_commands{0}; // 已提交但尚未被取回完成条目的命令数，不超过 queue_depth
+
+    std::mutex doorbell_mtx;
+    std::condition_variable doorbell_cv;
+    std::atomic<bool> worker_sleeping{false};
+    std::atomic<bool> stop_flag{false};
     std::thread worker;
-    bool stop_flag = false;
 
     InternalState state = InternalState::IDLE;
-    int erase_block(const PhysicalPageAddressPtr addr);
-    int write_page(const PhysicalPageAddressPtr addr, const uint8_t *data);
-    int read_page(const PhysicalPageAddressPtr addr, uint8_t *data);
+    int erase_block(const PhysicalPageAddress addr);
+    int write_page(const PhysicalPageAddress addr, const uint8_t *data, const PageMetadata &metadata);
+    int read_page(const PhysicalPageAddress addr, uint8_t *data, PageMetadata &metadata);
 
+    void ring_doorbell();
+    void execute_command(NandTask &task, NandResult &result);
     void worker_loop();
 };
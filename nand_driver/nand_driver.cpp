@@ -0,0 +1,187 @@
+#include "nand_driver.h"
+#include "state_snapshot.h"
+
+NandDriver::NandDriver()
+{
+    uint64_t channel_no = config.ssd_param.ChannelNum;
+    uint64_t chips_per_channel = config.ssd_param.ChipPerChannel;
+    nand_chips.resize(channel_no);
+    pending_commands.resize(channel_no);
+    batch_buckets.resize(channel_no);
+    for (uint64_t channel_id = 0; channel_id < channel_no; channel_id++)
+    {
+        pending_commands[channel_id].resize(chips_per_channel);
+        batch_buckets[channel_id].resize(chips_per_channel);
+        for (uint64_t chip_id = 0; chip_id < chips_per_channel; chip_id++)
+        {
+            nand_chips[channel_id].push_back(std::make_shared<NandChip>(channel_id, chip_id, config.nand_param, config.ssd_param.NandQueueDepth,
+                                                                        config.ssd_param.NandBusyPoll));
+        }
+    }
+}
+
+uint64_t NandDriver::GetLPA(const PhysicalPageAddress addr)
+{
+    return GetPageMetadata(addr).lpa;
+}
+
+void NandDriver::SubmitCommand(NandTask task)
+{
+    inflight_command_count++;
+    auto &pending = pending_commands[task.addr.channel_id][task.addr.chip_id];
+    // 已有暂存命令时必须排在其后，保证同一芯片上的命令按提交顺序执行
+    if (pending.empty() && nand_chips[task.addr.channel_id][task.addr.chip_id]->submit_command(task))
+    {
+        return;
+    }
+    pending.push_back(std::move(task));
+    pending_command_count++;
+}
+
+void NandDriver::SubmitCommands(std::vector<NandTask> &tasks)
+{
+    if (tasks.size() == 1)
+    {
+        SubmitCommand(std::move(tasks[0]));
+        tasks.clear();
+        return;
+    }
+    for (auto &task : tasks)
+    {
+        batch_buckets[task.addr.channel_id][task.addr.chip_id].push_back(std::move(task));
+    }
+    inflight_command_count += tasks.size();
+    tasks.clear();
+    for (uint64_t channel_id = 0; channel_id < batch_buckets.size(); channel_id++)
+    {
+        for (uint64_t chip_id = 0; chip_id < batch_buckets[channel_id].size(); chip_id++)
+        {
+            auto &bucket = batch_buckets[channel_id][chip_id];
+            if (bucket.empty())
+            {
+                continue;
+            }
+            auto &pending = pending_commands[channel_id][chip_id];
+            uint64_t submitted = 0;
+            if (pending.empty())
+            {
+                submitted = nand_chips[channel_id][chip_id]->submit_commands(bucket.data(), bucket.size());
+            }
+            for (uint64_t i = submitted; i < bucket.size(); i++)
+            {
+                pending.push_back(std::move(bucket[i]));
+            }
+            pending_command_count += bucket.size() - submitted;
+            bucket.clear();
+        }
+    }
+}
+
+void NandDriver::FlushPendingCommands(uint64_t channel_id, uint64_t chip_id)
+{
+    auto &pending = pending_commands[channel_id][chip_id];
+    while (!pending.empty())
+    {
+        if (!nand_chips[channel_id][chip_id]->submit_command(pending.front()))
+        {
+            return;
+        }
+        pending.pop_front();
+        pending_command_count--;
+    }
+}
+
+uint64_t NandDriver::PollCompletions()
+{
+    uint64_t processed = 0;
+    for (uint64_t channel_id = 0; channel_id < nand_chips.size(); channel_id++)
+    {
+        for (uint64_t chip_id = 0; chip_id < nand_chips[channel_id].size(); chip_id++)
+        {
+            uint64_t chip_processed = nand_chips[channel_id][chip_id]->process_completions(config.ssd_param.NandQueueDepth);
+            inflight_command_count -= chip_processed;
+            processed += chip_processed;
+            if (pending_command_count > 0)
+            {
+                FlushPendingCommands(channel_id, chip_id);
+            }
+        }
+    }
+    return processed;
+}
+
+void NandDriver::WaitForAllCompletions()
+{
+    while (inflight_command_count > 0)
+    {
+        if (PollCompletions() == 0)
+        {
+            std::this_thread::yield();
+        }
+    }
+}
+
+void NandDriver::SaveSnapshot(SnapshotWriter &writer, bool include_page_data) const
+{
+    if (inflight_command_count != 0)
+    {
+        PRINT_ERROR("Cannot take a snapshot with " << inflight_command_count << " NAND commands in flight!")
+    }
+    writer.BeginSection(SnapshotSection::NAND);
+    for (auto &chips : nand_chips)
+    {
+        for (auto &chip : chips)
+        {
+            chip->save_snapshot(writer, include_page_data);
+        }
+    }
+}
+
+void NandDriver::LoadSnapshot(SnapshotReader &reader)
+{
+    if (inflight_command_count != 0)
+    {
+        PRINT_ERROR("Cannot load a snapshot with " << inflight_command_count << " NAND commands in flight!")
+    }
+    reader.ExpectSection(SnapshotSection::NAND);
+    for (auto &chips : nand_chips)
+    {
+        for (auto &chip : chips)
+        {
+            chip->load_snapshot(reader);
+        }
+    }
+}
+
+void NandDriver::PowerOff()
+{
+    for (auto &channel : pending_commands)
+    {
+        for (auto &pending : channel)
+        {
+            while (!pending.empty())
+            {
+                NandTask task = std::move(pending.front());
+                pending.pop_front();
+                pending_command_count--;
+                inflight_command_count--;
+                NandResult result;
+                result.tag = task.tag;
+                result.cmd = task.cmd;
+                result.status = NAND_STATUS_POWER_LOSS;
+                result.callback = task.callback;
+                result.context = task.context;
+                if (result.callback != nullptr)
+                {
+                    result.callback(result.context, result);
+                }
+            }
+        }
+    }
+    WaitForAllCompletions();
+}
+
+uint64_t NandDriver::GetChipInflightCommandCount(uint64_t channel_id, uint64_t chip_id) const
+{
+    return nand_chips[channel_id][chip_id]->get_outstanding_command_count() + pending_commands[channel_id][chip_id].size();
+}
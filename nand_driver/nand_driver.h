@@ -10,8 +10,56 @@ class NandDriver
 {
 
 public:
-    uint64_t GetLPA(PhysicalPageAddressPtr addr) { return addr->page_id; /* TODO... */ };
+    NandDriver();
+    ~NandDriver() = default;
+    // 从页备用区取出编程时写入的 LPA，未编程的页返回 NO_VALUE
+    uint64_t GetLPA(const PhysicalPageAddress addr);
+    PageMetadata GetPageMetadata(const PhysicalPageAddress addr) const
+    {
+        return nand_chips[addr.channel_id][addr.chip_id]->GetMetaData(addr.die_id, addr.plane_id, addr.block_id, addr.page_id);
+    }
+    // 快速预处理：不产生 NAND 命令，直接修改页备用区，相当于只写元数据、不写数据的编程和擦除
+    void SetPageMetadata(const PhysicalPageAddress addr, const PageMetadata &metadata)
+    {
+        nand_chips[addr.channel_id][addr.chip_id]->SetMetaData(addr.die_id, addr.plane_id, addr.block_id, addr.page_id, metadata);
+    }
+    void EraseBlockMetadata(const PhysicalPageAddress addr)
+    {
+        nand_chips[addr.channel_id][addr.chip_id]->EraseMetaData(addr.die_id, addr.plane_id, addr.block_id);
+    }
+    bool IsBadBlock(const PhysicalPageAddress addr) const
+    {
+        return nand_chips[addr.channel_id][addr.chip_id]->is_bad_block(addr.die_id, addr.plane_id, addr.block_id);
+    }
+    // 把块记入芯片的坏块表，掉电后仍然有效
+    void MarkBadBlock(const PhysicalPageAddress addr)
+    {
+        nand_chips[addr.channel_id][addr.chip_id]->mark_bad_block(addr.die_id, addr.plane_id, addr.block_id);
+    }
+
+    // 非阻塞提交：芯片提交队列满时先暂存在驱动中，轮询完成队列腾出名额后再补交
+    void SubmitCommand(NandTask task);
+    // 批量提交：按芯片分组后每个芯片只调用一次 submit_commands(一次门铃)，提交后 tasks 被清空
+    void SubmitCommands(std::vector<NandTask> &tasks);
+    // 轮询所有芯片的完成队列并执行回调，返回本次处理的完成条目数
+    uint64_t PollCompletions();
+    // 轮询直到所有已提交命令都完成
+    void WaitForAllCompletions();
+    // 模拟掉电：暂存在驱动中的命令不再下发，以 NAND_STATUS_POWER_LOSS 完成；已进入芯片队列的命令照常执行完毕
+    void PowerOff();
+    uint64_t GetInflightCommandCount() const { return inflight_command_count; }
+    // 保存/恢复所有芯片的页内容，只能在没有在途命令时调用
+    void SaveSnapshot(SnapshotWriter &writer, bool include_page_data) const;
+    void LoadSnapshot(SnapshotReader &reader);
+    uint64_t GetChipInflightCommandCount(uint64_t channel_id, uint64_t chip_id) const;
+    NandChipPtr GetChip(uint64_t channel_id, uint64_t chip_id) { return nand_chips[channel_id][chip_id]; }
 
 private:
-    std::vector<std::vector<NandChipPtr>> nand_chips; // [channel][chip_per_channel]
+    std::vector<std::vector<NandChipPtr>> nand_chips;               // [channel][chip_per_channel]
+    std::vector<std::vector<std::deque<NandTask>>> pending_commands; // [channel][chip_per_channel] 等待进入芯片队列的命令
+    uint64_t inflight_command_count = 0;                            // 已提交、尚未执行完回调的命令数(含暂存)
+    uint64_t pending_command_count = 0;
+    std::vector<std::vector<std::vector<NandTask>>> batch_buckets; // [channel][chip_per_channel] SubmitCommands 的分组缓冲，复用以免反复分配
+
+    void FlushPendingCommands(uint64_t channel_id, uint64_t chip_id);
 };
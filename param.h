@@ -16,6 +16,7 @@
 #include <mutex>
 #include <future>
 #include <condition_variable>
+#include "intrusive_ptr.h"
 
 #define PRINT_ERROR(MSG)               \
     {                                  \
@@ -26,6 +27,15 @@
     }
 
 #define NO_VALUE 0xffffffffffffffffULL
+#define SECTOR_SIZE_IN_BYTE 512
+
+// PhysicalPageAddress 各字段位宽，合计64位；Config 中的几何参数不能超过对应上限
+#define PPA_CHANNEL_BITS 8
+#define PPA_CHIP_BITS 8
+#define PPA_DIE_BITS 4
+#define PPA_PLANE_BITS 4
+#define PPA_BLOCK_BITS 24
+#define PPA_PAGE_BITS 16
 
 #define PRINT_MESSAGE(M) std::cout << M << std::endl;
 
@@ -95,16 +105,23 @@ enum class UserRequestType
 enum class CMTSharingMode
 {
     SHARED,
-    EQUAL_SIZE_PARTITIONING
+    EQUAL_SIZE_PARTITIONING,
+    UTILITY_PARTITIONING // 按流分区，定期按各流的边际命中(刚被淘汰的表项又被访问的次数)在流之间挪动容量
 };
 
 struct CacheParam
 {
-    CACHE_MODE mode;
-    uint64_t cache_size;       // in MB
-    uint64_t CMT_size;         // in MB
-    uint64_t Read_cache_size;  // in MB
-    uint64_t Write_cache_size; // in MB
+    CACHE_MODE mode = CACHE_MODE::CACHE_MODE_DRAM;
+    uint64_t cache_size = 16;      // in MB
+    uint64_t CMT_size = 2;         // in MB
+    uint64_t Read_cache_size = 8;  // in MB
+    uint64_t Write_cache_size = 8; // in MB
+    CMTSharingMode cmt_sharing_mode = CMTSharingMode::SHARED;
+    // UTILITY_PARTITIONING：每 cmt_rebalance_interval 次 CMT 查询调整一次，把 CMT 总容量的 cmt_rebalance_step
+    // 从边际命中最少的流挪给最多的流；每个流至少保留平均份额的 cmt_min_share
+    uint64_t cmt_rebalance_interval = 65536;
+    double cmt_rebalance_step = 1.0 / 64;
+    double cmt_min_share = 0.25;
 };
 
 struct GcParam
@@ -112,6 +129,14 @@ struct GcParam
     GC_POLICY mode = GC_POLICY::GREEDY;
     double gc_threshold_high = 0.8;
     double gc_threshold_low = 0.2;
+    double gc_hard_threshold = 0.05;              // 空闲块比例低于该值时 GC 不可被用户请求抢占
+    bool preemptible_gc_enabled = true;
+    bool use_copyback = false;
+    double rho = 0.2;                             // RANDOM_PP 策略的无效页比例阈值
+    uint64_t max_ongoing_gc_reqs_per_plane = 2;
+    bool dynamic_wl_enabled = true;
+    bool static_wl_enabled = false;
+    uint64_t static_wl_threshold = 100;
 };
 
 struct SlcCacheParam
@@ -121,13 +146,91 @@ struct SlcCacheParam
     double slc_dynamic_ratio = 0.3; // in percentage
 };
 
+enum class WriteHintMode
+{
+    NONE, // 每个流每个 plane 只有一个用户数据写入点
+    HOST, // 按请求携带的写入提示(NVMe directive)选择写入点
+    AUTO  // 请求未携带提示时按 LPA 更新频率自动分类冷热
+};
+
+// 写入 plane 的选择方式。静态方案按名字中字母的顺序把 LPA 依次在 channel(C)/chip(W)/die(D)/plane(P) 间取余条带化
+enum class PlaneAllocationScheme
+{
+    CWDP, CWPD, CDWP, CDPW, CPWD, CPDW,
+    WCDP, WCPD, WDCP, WDPC, WPCD, WPDC,
+    DCWP, DCPW, DWCP, DWPC, DPCW, DPWC,
+    PCWD, PCDW, PWCD, PWDC, PDCW, PDWC,
+    DYNAMIC // 每次写按芯片队列深度、die 忙闲和 plane 空闲块余量动态选择
+};
+
+// 写入提示：同一流内寿命相近的数据写入同一组打开块，降低 GC 搬移量
+struct PlacementParam
+{
+    PlaneAllocationScheme plane_allocation_scheme = PlaneAllocationScheme::CWDP;
+    WriteHintMode write_hint_mode = WriteHintMode::NONE;
+    uint64_t write_hint_count = 4;             // 每个流每个 plane 的用户数据打开块个数，提示 0 最冷
+    uint64_t classifier_table_size = 1 << 20;  // 冷热分类器的计数器个数，取2的幂
+    uint64_t classifier_decay_interval = 0;    // 每多少次写入把所有计数器减半，0 表示取所有流的逻辑页数
+    // 每个流每个 plane 的 GC 打开块个数，0 最冷：GC 搬移的页按冷热分类器估计的更新频率分开写入，
+    // 不再更新的冷页集中到冷块里，不会和很快又被覆盖的热页混在一起反复搬移。大于1时即使不用 AUTO 提示也创建分类器。
+    // 每多一个类别每个 plane 多占一个打开块和一个回收预留块，更新均匀或空闲块很少时反而增加搬移
+    uint64_t gc_temperature_count = 1;
+};
+
+struct RecoveryParam
+{
+    bool parallel_scan = true; // 上电挂载时每个 channel 一个线程并行扫描页备用区
+};
+
+// 映射表检查点：定期把 L2P 表和块状态写入保留块，两次检查点之间记增量日志，挂载时只需扫描日志之后可能写入的块
+struct CheckpointParam
+{
+    bool enabled = false;
+    uint64_t interval = 32;                 // 每写满多少个日志页做一次新的检查点
+    uint64_t reserved_blocks_per_plane = 1; // 每个 plane 末尾(跳过坏块)留给检查点和日志的块数，所有保留块分成两半轮流使用
+};
+
+// 读可靠性模型：每次读按块的擦写次数、数据保持时间和读干扰次数估计原始误码率(RBER)，
+// 抽样各码字的错误比特数决定 LDPC 译码级别；所有级别都纠不过来时换参考电压重读，重试档位用尽为不可纠正。
+// RBER = rber_base + rber_wear * w^wear_exponent + (rber_retention_per_hour * 保持小时数 + rber_read_disturb * 读次数) * (1 + (wear_acceleration - 1) * w)，
+// 其中 w = (擦写次数 + NandParam::InitialPECycles) / BlockPECycle；第 k 档重读时保持和读干扰两项乘以 read_retry_rber_factor^k
+struct ReliabilityParam
+{
+    bool enabled = false;
+    uint64_t seed = 1;
+    double rber_base = 1e-5;
+    double rber_wear = 3e-3;                  // 擦写次数达到寿命时磨损带来的 RBER
+    double wear_exponent = 2.0;
+    double rber_retention_per_hour = 1e-7;    // 新块每小时保持时间增加的 RBER
+    double rber_read_disturb = 3e-9;          // 新块自擦除以来每次读增加的 RBER
+    double wear_acceleration = 10.0;          // 寿命末期保持和读干扰误码的增长速度是新块的多少倍
+    double time_scale = 1.0;                  // 模拟运行 1 秒相当于数据保持多少秒
+    double initial_retention_hours = 0;       // 回放开始前已写入的数据先放置这么多小时，模拟断电存放后再上电
+    uint64_t codeword_size = 2048;            // 字节，页按码字独立译码，取最差的码字
+    std::vector<uint64_t> ldpc_correctable_bits = {80, 150, 200};    // 各译码级别(硬判决、软判决...)每码字可纠正的错误比特数
+    std::vector<uint64_t> ldpc_decode_latency_ns = {2000, 25000, 70000}; // 译码到该级别为止的累计时延，含软判决的额外感测
+    uint64_t page_read_latency_ns = 60000;    // 每次感测+传输(tR)
+    uint64_t max_read_retries = 8;
+    double read_retry_rber_factor = 0.6;
+    uint64_t read_reclaim_read_count = 100000; // 自擦除以来读满这么多次的块触发读回收，0 表示不按读次数回收
+    uint64_t read_reclaim_retry_threshold = 3; // 一次读用了这么多档重试即回收所在块，0 表示不按重试回收
+};
+
 struct SSDParam
 {
     GcParam gc_param;
     SlcCacheParam slc_cache_param;
+    PlacementParam placement_param;
+    RecoveryParam recovery_param;
+    CheckpointParam checkpoint_param;
+    ReliabilityParam reliability_param;
     MAPPING_MODE mapping_mode = MAPPING_MODE::MAPPING_MODE_PAGE_LEVEL;
     uint64_t ChannelNum = 2;
     uint64_t ChipPerChannel = 2;
+    uint64_t StreamNum = 1;
+    double OverprovisioningRatio = 0.125;
+    uint64_t NandQueueDepth = 1024; // 每个 NandChip 提交/完成队列深度，必须是2的幂
+    bool NandBusyPoll = false;      // NAND 工作线程空闲时忙等轮询而不是休眠
 };
 
 struct NandParam
@@ -138,13 +241,87 @@ struct NandParam
     uint64_t PagePerBlock = 8;
     uint64_t PageSize = 16384;
     uint64_t SpareSize = 2208;
+    uint64_t BlockPECycle = 3000; // 块的擦写寿命
+    uint64_t InitialPECycles = 0; // 加到每个块擦除次数上的初始磨损，模拟已经用旧的盘
+
+    // 坏块：出厂坏块按比例随机分布在每个 plane 中(按比例取整为0时取2个)；
+    // 编程/擦除按概率失败，失败概率 = 新块失败率 * FailureRateGrowth^w，w = (擦写次数 + InitialPECycles) / BlockPECycle
+    double FactoryBadBlockRatio = 0.02;
+    uint64_t BadBlockSeed = 1;     // 出厂坏块分布和失败注入的随机种子，同一种子每次得到相同的坏块
+    double ProgramFailureRate = 0; // 新块每次编程失败的概率
+    double EraseFailureRate = 0;   // 新块每次擦除失败的概率
+    double FailureRateGrowth = 1000.0; // 擦写次数达到寿命时失败概率是新块的多少倍
+};
+
+enum class AddressDistribution
+{
+    UNIFORM,
+    ZIPF,
+    HOT_COLD
+};
+
+enum class SizeDistribution
+{
+    FIXED,
+    UNIFORM
+};
+
+enum class ArbitrationMode
+{
+    ROUND_ROBIN,         // 各队列轮流取命令
+    WEIGHTED_ROUND_ROBIN // URGENT 队列严格优先，其余按 HIGH/MEDIUM/LOW 权重轮转
+};
+
+struct HostInterfaceParam
+{
+    uint64_t queue_count = 1;           // 提交/完成队列对的个数
+    uint64_t queue_depth = 1024;        // 每个队列最多容纳的未完成请求数
+    uint64_t device_queue_depth = 256;  // 设备同时处理的请求数上限，超出部分留在提交队列中等待仲裁
+    ArbitrationMode arbitration = ArbitrationMode::ROUND_ROBIN;
+    uint64_t arbitration_burst = 1;     // 每次仲裁选中一个队列后最多连续取出的命令数
+    uint64_t weight_high = 4;
+    uint64_t weight_medium = 2;
+    uint64_t weight_low = 1;
+    std::vector<Priority> queue_priorities; // 各队列的优先级类，下标为队列号；未列出的队列为 MEDIUM
+};
+
+// 单个流的合成负载参数，扇区为单位
+struct StreamWorkloadParam
+{
+    double weight = 1.0;     // 该流在总请求中所占份额(相对值)
+    double read_ratio = 0.5; // 其余为写
+    double trim_ratio = 0.0;
+    SizeDistribution size_distribution = SizeDistribution::FIXED;
+    uint64_t size_min = 8;  // FIXED 时即请求大小
+    uint64_t size_max = 8;
+    uint64_t alignment = 8; // 请求起始地址对齐
+    AddressDistribution address_distribution = AddressDistribution::UNIFORM;
+    double zipf_exponent = 0.99;
+    double hot_space_ratio = 0.2;  // 热区占地址范围的比例
+    double hot_access_ratio = 0.8; // 落在热区的访问比例
+    uint64_t sequential_run_length = 1; // 连续多少个请求地址首尾相接，1 表示完全随机
+    uint64_t write_hint = NO_VALUE;     // 写请求携带的写入提示，NO_VALUE 表示不携带
+    uint64_t start_lsa = 0;
+    uint64_t address_range = 0; // 0 表示从 start_lsa 到逻辑空间末尾
+};
+
+struct WorkloadParam
+{
+    uint64_t seed = 1;
+    uint64_t request_count = 100000;
+    uint64_t mean_inter_arrival_ns = 10000; // 指数分布的平均到达间隔，0 表示全部同时到达
+    std::vector<StreamWorkloadParam> streams; // 为空时使用一个默认流
 };
 
 struct Config
 {
     SSDParam ssd_param;
     NandParam nand_param;
+    CacheParam cache_param;
+    WorkloadParam workload_param;
+    HostInterfaceParam host_param;
 };
+extern Config config;
 
 class FTL;
 class UserRequest;
@@ -165,12 +342,19 @@ class TransactionRead;
 class TransactionWrite;
 class TransactionErase;
 class CacheManager;
+class PageBuffer;
+class HostInterface;
+class CheckpointManager;
+class ReliabilityModel;
+class SnapshotWriter;
+class SnapshotReader;
 
 using FTLPtr = std::shared_ptr<FTL>;
-using TransactionPtr = std::shared_ptr<Transaction>;
-using TransactionReadPtr = std::shared_ptr<TransactionRead>;
-using TransactionWritePtr = std::shared_ptr<TransactionWrite>;
-using TransactionErasePtr = std::shared_ptr<TransactionErase>;
+using TransactionPtr = IntrusivePtr<Transaction>;
+using TransactionReadPtr = IntrusivePtr<TransactionRead>;
+using TransactionWritePtr = IntrusivePtr<TransactionWrite>;
+using TransactionErasePtr = IntrusivePtr<TransactionErase>;
+using PageBufferPtr = IntrusivePtr<PageBuffer>;
 using UserRequestPtr = std::shared_ptr<UserRequest>;
 using AddressMappingDomainPtr = std::shared_ptr<AddressMappingDomain>;
 using AddressMappingPageLevelPtr = std::shared_ptr<AddressMappingPageLevel>;
@@ -179,9 +363,10 @@ using BlockManagerPtr = std::shared_ptr<BlockManager>;
 using PlaneBookKeepingPtr = std::shared_ptr<PlaneBookKeeping>;
 using NandDriverPtr = std::shared_ptr<NandDriver>;
 using NandChipPtr = std::shared_ptr<NandChip>;
-using PhysicalPageAddressPtr = std::shared_ptr<PhysicalPageAddress>;
 using GcWlUnitPtr = std::shared_ptr<GcWlUnit>;
-using TransactionErasePtr = std::shared_ptr<TransactionErase>;
 using CMTSlotPtr = std::shared_ptr<CMTSlot>;
 using CachedMappingTablePtr = std::shared_ptr<CachedMappingTable>;
 using CacheManagerPtr = std::shared_ptr<CacheManager>;
+using HostInterfacePtr = std::shared_ptr<HostInterface>;
+using CheckpointManagerPtr = std::shared_ptr<CheckpointManager>;
+using ReliabilityModelPtr = std::shared_ptr<ReliabilityModel>;
@@ -0,0 +1,511 @@
+#include "checkpoint_manager.h"
+#include "nand_driver.h"
+#include "address_mapping.h"
+#include "block_manager.h"
+#include "transaction.h"
+#include "state_snapshot.h"
+
+namespace
+{
+    constexpr uint64_t STREAM_FIELD_MASK = (1ULL << 56) - 1; // 日志项首字低 56 位存流号，高 8 位存类型
+
+    // 检查点按 64 位字顺序写满各页
+    void WriteWords(const std::vector<uint64_t> &words, std::vector<PageBufferPtr> &pages, uint64_t page_size)
+    {
+        uint64_t words_per_page = page_size / sizeof(uint64_t);
+        for (uint64_t first = 0; first < words.size(); first += words_per_page)
+        {
+            PageBufferPtr page = PageBufferPool::GetInstance().Allocate(0);
+            uint64_t count = std::min<uint64_t>(words_per_page, words.size() - first);
+            std::memcpy(page->data, words.data() + first, count * sizeof(uint64_t));
+            pages.push_back(std::move(page));
+        }
+    }
+
+    inline uint64_t ReadWord(const PageBufferPtr &page, uint64_t index)
+    {
+        uint64_t word;
+        std::memcpy(&word, page->data + index * sizeof(uint64_t), sizeof(uint64_t));
+        return word;
+    }
+
+    void OnCheckpointPageRead(void *context, NandResult &result)
+    {
+        auto &pages = *static_cast<std::vector<PageBufferPtr> *>(context);
+        if (result.status == 0)
+        {
+            pages[result.tag] = std::move(result.data);
+        }
+    }
+}
+
+CheckpointManager::CheckpointManager(NandDriverPtr nand_driver, AddressMappingPageLevelPtr address_mapping, BlockManagerPtr block_manager,
+                                     uint64_t interval, uint64_t reserved_blocks_per_plane)
+    : nand_driver(nand_driver), address_mapping(address_mapping), block_manager(block_manager), interval(std::max<uint64_t>(interval, 1))
+{
+    pages_per_block = config.nand_param.PagePerBlock;
+    blocks_per_plane = config.nand_param.BlockPerPlane;
+    page_size = config.nand_param.PageSize;
+    entries_per_journal_page = (page_size / sizeof(uint64_t) - 1) / WORDS_PER_JOURNAL_ENTRY;
+    uint64_t data_words = 2 * address_mapping->GetDevicePhysicalPagesCount() / pages_per_block;
+    for (uint64_t stream_id = 0; stream_id < address_mapping->GetStreamsNo(); stream_id++)
+    {
+        data_words += 2 * address_mapping->GetLogicalPagesNo(stream_id);
+    }
+    checkpoint_data_page_count = (data_words * sizeof(uint64_t) + page_size - 1) / page_size;
+
+    // 同一位置序号相邻的页落在不同 channel/chip/die，检查点页和日志页可以并行编程
+    for (uint64_t block_offset = 0; block_offset < reserved_blocks_per_plane; block_offset++)
+        for (uint64_t plane_id = 0; plane_id < config.nand_param.PlanePerDie; plane_id++)
+            for (uint64_t die_id = 0; die_id < config.nand_param.DiePerChip; die_id++)
+                for (uint64_t chip_id = 0; chip_id < config.ssd_param.ChipPerChannel; chip_id++)
+                    for (uint64_t channel_id = 0; channel_id < config.ssd_param.ChannelNum; channel_id++)
+                    {
+                        PhysicalPageAddress plane_address(channel_id, chip_id, die_id, plane_id, 0, 0);
+                        uint64_t block_id = block_manager->GetPlaneBookKeepingEntry(plane_address)->reserved_blocks[block_offset];
+                        log_blocks.emplace_back(channel_id, chip_id, die_id, plane_id, block_id, 0);
+                    }
+    blocks_per_half = log_blocks.size() / 2;
+    uint64_t commit_word_count = 5 + address_mapping->GetStreamsNo();
+    if (blocks_per_half == 0 || GetHalfCapacity() < checkpoint_data_page_count + 2 || commit_word_count * sizeof(uint64_t) > page_size ||
+        entries_per_journal_page == 0)
+    {
+        PRINT_ERROR("Reserved blocks cannot hold a checkpoint of " << checkpoint_data_page_count << " pages!")
+    }
+}
+
+uint64_t CheckpointManager::GetBlockIndex(const PhysicalPageAddress address) const
+{
+    PhysicalPageAddress block_address = address;
+    block_address.page_id = 0;
+    return address_mapping->ConvertAddresstoPPA(block_address) / pages_per_block;
+}
+
+PhysicalPageAddress CheckpointManager::GetLogPageAddress(const uint64_t half, const uint64_t position) const
+{
+    PhysicalPageAddress address = log_blocks[half * blocks_per_half + position % blocks_per_half];
+    address.page_id = position / blocks_per_half;
+    return address;
+}
+
+double CheckpointManager::GetWriteAmplification() const
+{
+    return user_program_count == 0 ? 0 : static_cast<double>(checkpoint_page_count + journal_page_count) / user_program_count;
+}
+
+void CheckpointManager::OnProgramCompleted(const TransactionWrite &tr)
+{
+    if (tr.source == TransactionSourceType::USERIO)
+    {
+        user_program_count++;
+    }
+    if (state == CheckpointState::WRITING && tr.sequence < snapshot_sequence)
+    {
+        writes_before_snapshot--;
+    }
+    AppendJournalEntry({JournalEntryType::MAP, tr.stream_id, tr.lpa, tr.ppa, tr.write_sectors_bitmap, tr.sequence});
+    auto block = block_manager->GetPlaneBookKeepingEntry(tr.physical_address)->blocks[tr.physical_address.block_id];
+    if (block->current_write_page_index == pages_per_block && block->ongoing_user_program_cnt == 0)
+    {
+        AppendJournalEntry({JournalEntryType::BLOCK_CLOSE, block->stream_id, GetBlockIndex(tr.physical_address), block->erase_count, 0, NO_VALUE});
+    }
+    TryCommit();
+}
+
+void CheckpointManager::OnTrim(const uint64_t stream_id, const uint64_t lpa, const uint64_t ppa, const uint64_t write_state_bitmap)
+{
+    AppendJournalEntry({JournalEntryType::TRIM, stream_id, lpa, ppa, write_state_bitmap, address_mapping->GetProgramSequence()});
+}
+
+void CheckpointManager::OnBlockErased(const PhysicalPageAddress block_address)
+{
+    auto block = block_manager->GetPlaneBookKeepingEntry(block_address)->blocks[block_address.block_id];
+    AppendJournalEntry({JournalEntryType::BLOCK_ERASE, NO_VALUE, GetBlockIndex(block_address), block->erase_count, 0, NO_VALUE});
+}
+
+void CheckpointManager::AppendJournalEntry(const JournalEntry &entry)
+{
+    pending_entries.push_back(entry);
+    if (state == CheckpointState::IDLE && active_half == NO_VALUE)
+    {
+        // 刚格式化或刚挂载，还没有本次上电后的检查点
+        StartCheckpoint();
+        return;
+    }
+    if (state == CheckpointState::IDLE || state == CheckpointState::ERASING)
+    {
+        FlushJournal(false);
+    }
+}
+
+void CheckpointManager::FlushJournal(bool partial)
+{
+    if (active_half == NO_VALUE)
+    {
+        return;
+    }
+    std::vector<TransactionPtr> batch;
+    uint64_t flushed_entries = 0;
+    while (journal_position < GetHalfCapacity())
+    {
+        uint64_t count = std::min(entries_per_journal_page, pending_entries.size() - flushed_entries);
+        if (count == 0 || (count < entries_per_journal_page && !partial))
+        {
+            break;
+        }
+        std::vector<uint64_t> words;
+        words.reserve(1 + count * WORDS_PER_JOURNAL_ENTRY);
+        words.push_back(count);
+        for (uint64_t i = flushed_entries; i < flushed_entries + count; i++)
+        {
+            const JournalEntry &entry = pending_entries[i];
+            words.push_back((static_cast<uint64_t>(entry.type) << 56) | (entry.stream_id & STREAM_FIELD_MASK));
+            words.push_back(entry.lpa_or_block);
+            words.push_back(entry.ppa_or_erase_count);
+            words.push_back(entry.write_state_bitmap);
+            words.push_back(entry.sequence);
+        }
+        std::vector<PageBufferPtr> pages;
+        WriteWords(words, pages, page_size);
+        batch.push_back(MakeLogPageWrite(active_half, journal_position++, CheckpointPageType::JOURNAL, active_epoch, pages[0]));
+        flushed_entries += count;
+        journal_page_count++;
+        journal_pages_in_epoch++;
+    }
+    pending_entries.erase(pending_entries.begin(), pending_entries.begin() + flushed_entries);
+    if (!batch.empty())
+    {
+        transaction_dispatcher(batch);
+    }
+    if (state == CheckpointState::IDLE && (journal_pages_in_epoch >= interval || journal_position == GetHalfCapacity()))
+    {
+        StartCheckpoint();
+    }
+}
+
+TransactionPtr CheckpointManager::MakeLogPageWrite(const uint64_t half, const uint64_t position, const CheckpointPageType type,
+                                                   const uint64_t epoch, PageBufferPtr content)
+{
+    uint64_t sectors_per_page = page_size / SECTOR_SIZE_IN_BYTE;
+    PhysicalPageAddress address = GetLogPageAddress(half, position);
+    auto write_tr = MakeTransaction<TransactionWrite>(static_cast<uint64_t>(type), TransactionSourceType::MAPPING, TransactionType::WRITE, Priority::MEDIUM,
+                                                      address, true, UserRequestType::WRITE, position, address_mapping->ConvertAddresstoPPA(address),
+                                                      page_size, sectors_per_page);
+    write_tr->sequence = epoch;
+    write_tr->write_sectors_bitmap = 0;
+    write_tr->content = std::move(content);
+    return write_tr;
+}
+
+void CheckpointManager::RequestCheckpoint()
+{
+    if (state != CheckpointState::IDLE)
+    {
+        PRINT_ERROR("Cannot request a checkpoint while another one is in progress!")
+    }
+    StartCheckpoint();
+}
+
+void CheckpointManager::StartCheckpoint()
+{
+    state = CheckpointState::ERASING;
+    if (active_half != NO_VALUE)
+        target_half = 1 - active_half;
+    else
+        target_half = recovered_half == NO_VALUE ? 0 : 1 - recovered_half;
+    target_epoch = next_epoch++;
+    pending_operations = blocks_per_half;
+    std::vector<TransactionPtr> batch;
+    for (uint64_t i = 0; i < blocks_per_half; i++)
+    {
+        batch.push_back(MakeTransaction<TransactionErase>(static_cast<uint64_t>(CheckpointPageType::DATA), TransactionSourceType::MAPPING, TransactionType::ERASE,
+                                                          Priority::MEDIUM, log_blocks[target_half * blocks_per_half + i], true, UserRequestType::WRITE,
+                                                          NO_VALUE, NO_VALUE, 0, 0));
+    }
+    transaction_dispatcher(batch);
+}
+
+void CheckpointManager::TakeSnapshot()
+{
+    // 快照之前的日志属于旧检查点，尽量写进旧的一半；写不下的丢弃，新检查点已经包含这些修改
+    FlushJournal(true);
+    dropped_journal_entry_count += pending_entries.size();
+    pending_entries.clear();
+
+    state = CheckpointState::WRITING;
+    snapshot_sequence = address_mapping->GetProgramSequence();
+    writes_before_snapshot = 0;
+    uint64_t stream_no = address_mapping->GetStreamsNo();
+    std::vector<uint64_t> words;
+    for (uint64_t stream_id = 0; stream_id < stream_no; stream_id++)
+    {
+        for (uint64_t lpa = 0; lpa < address_mapping->GetLogicalPagesNo(stream_id); lpa++)
+        {
+            uint64_t ppa, write_state_bitmap;
+            address_mapping->GetMappingEntry(stream_id, lpa, ppa, write_state_bitmap);
+            words.push_back(ppa);
+            words.push_back(write_state_bitmap);
+        }
+    }
+    uint64_t block_count = address_mapping->GetDevicePhysicalPagesCount() / pages_per_block;
+    for (uint64_t block_index = 0; block_index < block_count; block_index++)
+    {
+        PhysicalPageAddress address = address_mapping->ConvertPPAtoAddress(block_index * pages_per_block);
+        auto block = block_manager->GetPlaneBookKeepingEntry(address)->blocks[address.block_id];
+        writes_before_snapshot += block->ongoing_user_program_cnt;
+        bool closed = !block->is_reserved && block->current_write_page_index == pages_per_block && block->ongoing_user_program_cnt == 0;
+        words.push_back(block->stream_id);
+        words.push_back(block->erase_count | (closed ? 1ULL << 63 : 0));
+    }
+
+    commit_words = {target_epoch, snapshot_sequence, checkpoint_data_page_count, stream_no, block_count};
+    for (uint64_t stream_id = 0; stream_id < stream_no; stream_id++)
+    {
+        commit_words.push_back(address_mapping->GetLogicalPagesNo(stream_id));
+    }
+
+    std::vector<PageBufferPtr> pages;
+    WriteWords(words, pages, page_size);
+    std::vector<TransactionPtr> batch;
+    for (uint64_t position = 0; position < pages.size(); position++)
+    {
+        batch.push_back(MakeLogPageWrite(target_half, position, CheckpointPageType::DATA, target_epoch, pages[position]));
+    }
+    pending_operations = batch.size();
+    checkpoint_page_count += batch.size();
+    transaction_dispatcher(batch);
+}
+
+void CheckpointManager::TryCommit()
+{
+    // 快照之前分配的写全部落盘后，检查点的 L2P 表才只指向已编程的页
+    if (state != CheckpointState::WRITING || pending_operations > 0 || writes_before_snapshot > 0)
+    {
+        return;
+    }
+    state = CheckpointState::COMMITTING;
+    std::vector<PageBufferPtr> pages;
+    WriteWords(commit_words, pages, page_size);
+    std::vector<TransactionPtr> batch{MakeLogPageWrite(target_half, checkpoint_data_page_count, CheckpointPageType::COMMIT, target_epoch, pages[0])};
+    checkpoint_page_count++;
+    transaction_dispatcher(batch);
+}
+
+void CheckpointManager::OnTransactionServiced(const TransactionPtr &tr)
+{
+    if (tr->type == TransactionType::ERASE)
+    {
+        block_manager->GetPlaneBookKeepingEntry(tr->physical_address)->blocks[tr->physical_address.block_id]->Erase();
+        erase_count++;
+        if (--pending_operations == 0)
+        {
+            TakeSnapshot();
+        }
+        return;
+    }
+    switch (static_cast<CheckpointPageType>(tr->stream_id))
+    {
+    case CheckpointPageType::DATA:
+        pending_operations--;
+        TryCommit();
+        break;
+    case CheckpointPageType::COMMIT:
+        state = CheckpointState::IDLE;
+        active_half = target_half;
+        active_epoch = target_epoch;
+        recovered_half = NO_VALUE;
+        journal_position = checkpoint_data_page_count + 1;
+        journal_pages_in_epoch = 0;
+        committed_checkpoint_count++;
+        FlushJournal(false);
+        break;
+    default:
+        break;
+    }
+}
+
+bool CheckpointManager::LoadLatestCheckpoint(CheckpointImage &image, MountStatistics &statistics)
+{
+    uint64_t capacity = GetHalfCapacity();
+    std::vector<PageMetadata> spares(2 * capacity);
+    uint64_t max_epoch = NO_VALUE;
+    for (uint64_t half = 0; half < 2; half++)
+    {
+        for (uint64_t position = 0; position < capacity; position++)
+        {
+            PageMetadata &metadata = spares[half * capacity + position];
+            metadata = nand_driver->GetPageMetadata(GetLogPageAddress(half, position));
+            statistics.scanned_pages++;
+            if (metadata.sequence == NO_VALUE)
+            {
+                continue;
+            }
+            max_epoch = max_epoch == NO_VALUE ? metadata.sequence : std::max(max_epoch, metadata.sequence);
+            // 保留块的擦除次数只记在备用区中
+            PhysicalPageAddress address = GetLogPageAddress(half, position);
+            auto block = block_manager->GetPlaneBookKeepingEntry(address)->blocks[address.block_id];
+            block->erase_count = std::max(block->erase_count, metadata.erase_count);
+        }
+    }
+    next_epoch = max_epoch == NO_VALUE ? 0 : max_epoch + 1;
+
+    // 提交页之前的检查点页都属于同一编号才是完整的检查点
+    uint64_t best_half = NO_VALUE, best_epoch = 0;
+    for (uint64_t half = 0; half < 2; half++)
+    {
+        const PageMetadata &commit = spares[half * capacity + checkpoint_data_page_count];
+        if (commit.sequence == NO_VALUE || commit.stream_id != static_cast<uint64_t>(CheckpointPageType::COMMIT))
+        {
+            continue;
+        }
+        bool complete = true;
+        for (uint64_t position = 0; position < checkpoint_data_page_count && complete; position++)
+        {
+            const PageMetadata &metadata = spares[half * capacity + position];
+            complete = metadata.sequence == commit.sequence && metadata.stream_id == static_cast<uint64_t>(CheckpointPageType::DATA);
+        }
+        if (complete && (best_half == NO_VALUE || commit.sequence > best_epoch))
+        {
+            best_half = half;
+            best_epoch = commit.sequence;
+        }
+    }
+    recovered_half = best_half;
+    if (best_half == NO_VALUE)
+    {
+        return false;
+    }
+    uint64_t journal_pages = 0;
+    for (uint64_t position = checkpoint_data_page_count + 1; position < capacity; position++, journal_pages++)
+    {
+        const PageMetadata &metadata = spares[best_half * capacity + position];
+        if (metadata.sequence != best_epoch || metadata.stream_id != static_cast<uint64_t>(CheckpointPageType::JOURNAL))
+        {
+            break;
+        }
+    }
+
+    // 检查点页、提交页和日志页都用读命令取出
+    uint64_t page_count = checkpoint_data_page_count + 1 + journal_pages;
+    std::vector<PageBufferPtr> pages(page_count);
+    std::vector<NandTask> tasks;
+    for (uint64_t position = 0; position < page_count; position++)
+    {
+        NandTask task;
+        task.tag = position;
+        task.cmd = NandCmd::READ;
+        task.addr = GetLogPageAddress(best_half, position);
+        task.callback = &OnCheckpointPageRead;
+        task.context = &pages;
+        tasks.push_back(std::move(task));
+    }
+    nand_driver->SubmitCommands(tasks);
+    nand_driver->WaitForAllCompletions();
+    statistics.checkpoint_pages_read = checkpoint_data_page_count + 1;
+    statistics.journal_pages_read = journal_pages;
+    for (auto &page : pages)
+    {
+        if (page == nullptr)
+        {
+            return false;
+        }
+    }
+
+    const PageBufferPtr &commit_page = pages[checkpoint_data_page_count];
+    uint64_t stream_no = address_mapping->GetStreamsNo();
+    uint64_t block_count = address_mapping->GetDevicePhysicalPagesCount() / pages_per_block;
+    if (ReadWord(commit_page, 0) != best_epoch || ReadWord(commit_page, 2) != checkpoint_data_page_count ||
+        ReadWord(commit_page, 3) != stream_no || ReadWord(commit_page, 4) != block_count)
+    {
+        return false;
+    }
+    for (uint64_t stream_id = 0; stream_id < stream_no; stream_id++)
+    {
+        if (ReadWord(commit_page, 5 + stream_id) != address_mapping->GetLogicalPagesNo(stream_id))
+        {
+            return false;
+        }
+    }
+    image.epoch = best_epoch;
+    image.snapshot_sequence = ReadWord(commit_page, 1);
+
+    uint64_t words_per_page = page_size / sizeof(uint64_t);
+    uint64_t word_index = 0;
+    auto next_word = [&]()
+    {
+        uint64_t word = ReadWord(pages[word_index / words_per_page], word_index % words_per_page);
+        word_index++;
+        return word;
+    };
+    image.mapping.resize(stream_no);
+    for (uint64_t stream_id = 0; stream_id < stream_no; stream_id++)
+    {
+        image.mapping[stream_id].resize(address_mapping->GetLogicalPagesNo(stream_id));
+        for (auto &entry : image.mapping[stream_id])
+        {
+            entry.ppa = next_word();
+            entry.write_state_bitmap = next_word();
+        }
+    }
+    image.blocks.resize(block_count);
+    for (auto &block : image.blocks)
+    {
+        block.stream_id = next_word();
+        uint64_t word = next_word();
+        block.erase_count = word & ~(1ULL << 63);
+        block.closed = (word >> 63) != 0;
+    }
+    for (uint64_t page_index = checkpoint_data_page_count + 1; page_index < page_count; page_index++)
+    {
+        const PageBufferPtr &page = pages[page_index];
+        uint64_t count = std::min(ReadWord(page, 0), entries_per_journal_page);
+        for (uint64_t i = 0; i < count; i++)
+        {
+            uint64_t base = 1 + i * WORDS_PER_JOURNAL_ENTRY;
+            uint64_t head = ReadWord(page, base);
+            JournalEntry entry;
+            entry.type = static_cast<JournalEntryType>(head >> 56);
+            entry.stream_id = (head & STREAM_FIELD_MASK) == STREAM_FIELD_MASK ? NO_VALUE : (head & STREAM_FIELD_MASK);
+            entry.lpa_or_block = ReadWord(page, base + 1);
+            entry.ppa_or_erase_count = ReadWord(page, base + 2);
+            entry.write_state_bitmap = ReadWord(page, base + 3);
+            entry.sequence = ReadWord(page, base + 4);
+            image.journal.push_back(entry);
+        }
+    }
+    statistics.checkpoint_epoch = best_epoch;
+    return true;
+}
+
+void CheckpointManager::SaveSnapshot(SnapshotWriter &writer) const
+{
+    if (state != CheckpointState::IDLE)
+    {
+        PRINT_ERROR("Cannot take a snapshot while a checkpoint is in progress!")
+    }
+    writer.BeginSection(SnapshotSection::CHECKPOINT);
+    writer.Write(active_half);
+    writer.Write(active_epoch);
+    writer.Write(next_epoch);
+    writer.Write(recovered_half);
+    writer.Write(journal_position);
+    writer.Write(journal_pages_in_epoch);
+    writer.WriteVector(pending_entries);
+}
+
+void CheckpointManager::LoadSnapshot(SnapshotReader &reader)
+{
+    reader.ExpectSection(SnapshotSection::CHECKPOINT);
+    state = CheckpointState::IDLE;
+    active_half = reader.Read<uint64_t>();
+    active_epoch = reader.Read<uint64_t>();
+    next_epoch = reader.Read<uint64_t>();
+    recovered_half = reader.Read<uint64_t>();
+    journal_position = reader.Read<uint64_t>();
+    journal_pages_in_epoch = reader.Read<uint64_t>();
+    reader.ReadVector(pending_entries);
+    if ((active_half != NO_VALUE && active_half > 1) || (recovered_half != NO_VALUE && recovered_half > 1) || journal_position > GetHalfCapacity())
+    {
+        PRINT_ERROR("Corrupted checkpoint state in snapshot!")
+    }
+}
@@ -0,0 +1,157 @@
+#pragma once
+#include "param.h"
+#include "nand_chip.h"
+#include "recovery_manager.h"
+#include <functional>
+
+// 保留块中页的类型，编程时写入备用区的 stream_id
+enum class CheckpointPageType : uint64_t
+{
+    DATA,    // 检查点内容：各流 L2P 表，之后是块状态表
+    COMMIT,  // 检查点提交页：布局信息；只有提交页落盘的检查点才可用
+    JOURNAL, // 检查点之后的增量日志
+};
+
+enum class JournalEntryType : uint64_t
+{
+    MAP,         // 用户/GC 写编程完成
+    TRIM,        // TRIM 修改了表项
+    BLOCK_CLOSE, // 块的所有页都已编程完成
+    BLOCK_ERASE, // GC 擦除了块
+};
+
+// 一条日志：MAP/TRIM 用 (stream_id, lpa, ppa, write_state_bitmap, sequence)；块事件用 (stream_id, block, erase_count)
+struct JournalEntry
+{
+    JournalEntryType type;
+    uint64_t stream_id;
+    uint64_t lpa_or_block;
+    uint64_t ppa_or_erase_count;
+    uint64_t write_state_bitmap;
+    uint64_t sequence; // MAP 为编程序号；TRIM 为 TRIM 时的下一个编程序号，序号更小的写都早于这次 TRIM
+};
+
+struct CheckpointBlockEntry
+{
+    uint64_t stream_id;
+    uint64_t erase_count;
+    bool closed; // 块已写满且所有页都已编程完成，挂载时只需核对首页
+};
+
+struct CheckpointMappingEntry
+{
+    uint64_t ppa;
+    uint64_t write_state_bitmap;
+};
+
+// 挂载时从保留块读出的最新完整检查点及其后连续落盘的日志
+struct CheckpointImage
+{
+    uint64_t epoch = NO_VALUE;
+    uint64_t snapshot_sequence = 0;                           // 快照时的下一个编程序号，L2P 表反映了序号更小的所有写
+    std::vector<std::vector<CheckpointMappingEntry>> mapping; // [stream][lpa]
+    std::vector<CheckpointBlockEntry> blocks;                 // 按全局块号(PPA / 每块页数)
+    std::vector<JournalEntry> journal;
+};
+
+/*
+ * 映射表检查点与增量日志
+ * 所有保留块分成两半轮流使用：新检查点先擦除另一半，再把快照时刻的 L2P 表和块状态表写入，
+ * 等快照之前分配的写全部编程完成后写提交页，此后的增量日志追加在同一半中。日志记录编程完成的写、TRIM、块写满和块擦除，
+ * 挂载时以检查点为基础按序重放日志，只有日志之后可能被写入的块(空闲、打开或被擦除过的块)需要扫描页备用区。
+ * 日志凑满一页才写出，掉电时未写出的 TRIM 会丢失，对应的旧数据在尚未被 GC 回收时重新可见。
+ * 保留块中的页用 MAPPING 事务读写，备用区记录 (页类型, 在该半中的位置, 检查点编号)
+ */
+class CheckpointManager
+{
+public:
+    using TransactionDispatcher = std::function<void(std::vector<TransactionPtr> &)>;
+
+    CheckpointManager(NandDriverPtr nand_driver, AddressMappingPageLevelPtr address_mapping, BlockManagerPtr block_manager,
+                      uint64_t interval, uint64_t reserved_blocks_per_plane);
+    void SetTransactionDispatcher(TransactionDispatcher dispatcher) { transaction_dispatcher = std::move(dispatcher); }
+
+    // 用户/GC 写在 NAND 上编程完成，块计数已更新
+    void OnProgramCompleted(const TransactionWrite &tr);
+    void OnTrim(const uint64_t stream_id, const uint64_t lpa, const uint64_t ppa, const uint64_t write_state_bitmap);
+    // GC 擦除完成，块已放回空闲池
+    void OnBlockErased(const PhysicalPageAddress block_address);
+    // MAPPING 事务在 NAND 上完成
+    void OnTransactionServiced(const TransactionPtr &tr);
+    // 绕过日志批量修改了映射表和块状态(快速预处理)之后调用：立即开始一次检查点，新检查点包含这些修改；不能有进行中的检查点
+    void RequestCheckpoint();
+
+    // 挂载：扫描保留块的备用区，读出编号最大的完整检查点和其后连续的日志页；没有可用检查点时返回 false。
+    // 无论是否找到，之后的检查点都写入另一半，不覆盖这次挂载所依据的检查点
+    bool LoadLatestCheckpoint(CheckpointImage &image, MountStatistics &statistics);
+    // 保存/恢复日志写入位置和尚未写出的日志项；保存时不能有进行中的检查点
+    void SaveSnapshot(SnapshotWriter &writer) const;
+    void LoadSnapshot(SnapshotReader &reader);
+
+    uint64_t GetBlockIndex(const PhysicalPageAddress address) const;
+    uint64_t GetCommittedCheckpointCount() const { return committed_checkpoint_count; }
+    uint64_t GetCheckpointPageCount() const { return checkpoint_page_count; }
+    uint64_t GetJournalPageCount() const { return journal_page_count; }
+    uint64_t GetEraseCount() const { return erase_count; }
+    uint64_t GetDroppedJournalEntryCount() const { return dropped_journal_entry_count; }
+    uint64_t GetUserProgramCount() const { return user_program_count; }
+    // 检查点和日志页数与用户写页数之比，即检查点带来的写放大增量
+    double GetWriteAmplification() const;
+
+private:
+    enum class CheckpointState
+    {
+        IDLE,      // 没有进行中的检查点
+        ERASING,   // 正在擦除目标一半
+        WRITING,   // 快照已下发，等检查点页和快照之前分配的写全部编程完成
+        COMMITTING // 提交页已下发
+    };
+    static constexpr uint64_t WORDS_PER_JOURNAL_ENTRY = 5;
+
+    void AppendJournalEntry(const JournalEntry &entry);
+    void StartCheckpoint();
+    void TakeSnapshot();
+    void TryCommit();
+    // 把缓存的日志写入当前检查点所在的一半；partial 为 true 时不足一页的尾部也写出
+    void FlushJournal(bool partial);
+    TransactionPtr MakeLogPageWrite(const uint64_t half, const uint64_t position, const CheckpointPageType type, const uint64_t epoch, PageBufferPtr content);
+    PhysicalPageAddress GetLogPageAddress(const uint64_t half, const uint64_t position) const;
+    uint64_t GetHalfCapacity() const { return blocks_per_half * pages_per_block; }
+
+    NandDriverPtr nand_driver;
+    AddressMappingPageLevelPtr address_mapping;
+    BlockManagerPtr block_manager;
+    TransactionDispatcher transaction_dispatcher;
+    uint64_t interval;
+    uint64_t pages_per_block;
+    uint64_t blocks_per_plane;
+    uint64_t page_size;
+    uint64_t entries_per_journal_page;
+    uint64_t checkpoint_data_page_count; // 每个检查点的 DATA 页数
+
+    std::vector<PhysicalPageAddress> log_blocks; // 两半依次排列，每半内相邻位置落在不同 plane
+    uint64_t blocks_per_half;
+
+    CheckpointState state = CheckpointState::IDLE;
+    uint64_t active_half = NO_VALUE;  // 最新已提交检查点所在的一半，日志写在这里
+    uint64_t active_epoch = NO_VALUE;
+    uint64_t next_epoch = 0;
+    uint64_t recovered_half = NO_VALUE; // 挂载所依据的检查点所在的一半，新检查点提交前不能擦除
+    uint64_t journal_position = 0;      // 当前一半中下一个日志页的位置
+    uint64_t journal_pages_in_epoch = 0;
+    std::vector<JournalEntry> pending_entries;
+
+    uint64_t target_half = NO_VALUE;
+    uint64_t target_epoch = 0;
+    uint64_t pending_operations = 0;        // 进行中检查点尚未完成的擦除或检查点页编程
+    uint64_t snapshot_sequence = 0;
+    uint64_t writes_before_snapshot = 0;    // 快照时已分配物理页、尚未编程完成的写
+    std::vector<uint64_t> commit_words;
+
+    uint64_t committed_checkpoint_count = 0;
+    uint64_t checkpoint_page_count = 0;
+    uint64_t journal_page_count = 0;
+    uint64_t erase_count = 0;
+    uint64_t dropped_journal_entry_count = 0;
+    uint64_t user_program_count = 0;
+};
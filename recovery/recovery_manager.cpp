@@ -0,0 +1,291 @@
+#include "recovery_manager.h"
+#include "checkpoint_manager.h"
+#include "nand_driver.h"
+#include "address_mapping.h"
+#include "block_manager.h"
+#include <chrono>
+
+namespace
+{
+    constexpr uint64_t TRUSTED_PAGE = NO_VALUE - 1;
+
+    // 把序号换算成可比较的版本：序号 S 的检查点晚于序号小于 S 的写；检查点之后序号下界为 S 的 TRIM 晚于检查点，
+    // 又早于它之后分配的序号为 S 的写。版本不低于表项时取代表项
+    inline uint64_t CheckpointVersion(uint64_t sequence) { return 3 * sequence; }
+    inline uint64_t TrimVersion(uint64_t sequence) { return 3 * sequence + 1; }
+    inline uint64_t ProgramVersion(uint64_t sequence) { return 3 * sequence + 2; }
+}
+
+RecoveryManager::RecoveryManager(NandDriverPtr nand_driver, AddressMappingPageLevelPtr address_mapping, BlockManagerPtr block_manager,
+                                 CheckpointManagerPtr checkpoint_manager, bool parallel_scan)
+    : nand_driver(nand_driver), address_mapping(address_mapping), block_manager(block_manager),
+      checkpoint_manager(checkpoint_manager), parallel_scan(parallel_scan)
+{
+    stream_no = address_mapping->GetStreamsNo();
+    pages_per_block = config.nand_param.PagePerBlock;
+}
+
+void RecoveryManager::ScanChannel(const uint64_t channel_id, ChannelScanResult &result)
+{
+    PhysicalPageAddress address;
+    address.channel_id = channel_id;
+    for (uint64_t chip_id = 0; chip_id < config.ssd_param.ChipPerChannel; chip_id++)
+    {
+        address.chip_id = chip_id;
+        for (uint64_t die_id = 0; die_id < config.nand_param.DiePerChip; die_id++)
+        {
+            address.die_id = die_id;
+            for (uint64_t plane_id = 0; plane_id < config.nand_param.PlanePerDie; plane_id++)
+            {
+                address.plane_id = plane_id;
+                auto plane = block_manager->GetPlaneBookKeepingEntry(address);
+                for (uint64_t block_id = 0; block_id < config.nand_param.BlockPerPlane; block_id++)
+                {
+                    // 退役的坏块在退役前数据已经搬走
+                    if (plane->blocks[block_id]->is_reserved || plane->blocks[block_id]->is_bad)
+                    {
+                        continue;
+                    }
+                    address.block_id = block_id;
+                    address.page_id = 0;
+                    uint64_t first_ppa = address_mapping->ConvertAddresstoPPA(address);
+                    const BlockState &state = block_states[first_ppa / pages_per_block];
+                    ScannedBlock block{address, NO_VALUE, 0, state.erase_count};
+                    PageMetadata first_page = nand_driver->GetPageMetadata(address);
+                    result.scanned_pages++;
+                    if (state.closed && first_page.sequence != NO_VALUE && first_page.erase_count == state.erase_count &&
+                        first_page.stream_id == state.stream_id)
+                    {
+                        // 检查点之后没有被擦除过，块内容与检查点一致
+                        block.stream_id = state.stream_id;
+                        block.programmed_page_count = pages_per_block;
+                        std::fill(page_owners.begin() + first_ppa, page_owners.begin() + first_ppa + pages_per_block, TRUSTED_PAGE);
+                        result.blocks.push_back(block);
+                        result.verified_blocks++;
+                        continue;
+                    }
+                    for (uint64_t page_id = 0; page_id < pages_per_block; page_id++)
+                    {
+                        address.page_id = page_id;
+                        PageMetadata metadata = page_id == 0 ? first_page : nand_driver->GetPageMetadata(address);
+                        if (page_id > 0)
+                        {
+                            result.scanned_pages++;
+                        }
+                        if (metadata.sequence == NO_VALUE)
+                        {
+                            // 部分页更新的写要等旧页读出后才下发，可能晚于同一块中后分配的页编程；掉电后块内会留下空洞，按无效页处理
+                            continue;
+                        }
+                        block.stream_id = metadata.stream_id;
+                        block.programmed_page_count = page_id + 1;
+                        block.erase_count = std::max(block.erase_count, metadata.erase_count);
+                        page_owners[first_ppa + page_id] = GetOwnerKey(metadata.stream_id, metadata.lpa);
+                        result.pages.push_back({first_ppa + page_id, metadata});
+                    }
+                    result.blocks.push_back(block);
+                }
+            }
+        }
+    }
+}
+
+bool RecoveryManager::RebuildMapping(const CheckpointImage *image, MountStatistics &statistics)
+{
+    uint64_t total_pages = address_mapping->GetDevicePhysicalPagesCount();
+    block_states.assign(total_pages / pages_per_block, BlockState());
+    entries.resize(stream_no);
+    for (uint64_t stream_id = 0; stream_id < stream_no; stream_id++)
+    {
+        entries[stream_id].assign(address_mapping->GetLogicalPagesNo(stream_id), RecoveredEntry());
+    }
+    next_sequence = 0;
+    auto check_lpa = [this](uint64_t stream_id, uint64_t lpa)
+    {
+        if (stream_id >= stream_no || lpa >= entries[stream_id].size())
+        {
+            PRINT_ERROR("Corrupted page metadata found during recovery!")
+        }
+    };
+
+    if (image != nullptr)
+    {
+        uint64_t version = CheckpointVersion(image->snapshot_sequence);
+        for (uint64_t stream_id = 0; stream_id < stream_no; stream_id++)
+        {
+            for (uint64_t lpa = 0; lpa < entries[stream_id].size(); lpa++)
+            {
+                const CheckpointMappingEntry &entry = image->mapping[stream_id][lpa];
+                entries[stream_id][lpa] = {entry.ppa, entry.write_state_bitmap, version};
+            }
+        }
+        for (uint64_t block_index = 0; block_index < block_states.size(); block_index++)
+        {
+            const CheckpointBlockEntry &block = image->blocks[block_index];
+            block_states[block_index] = {block.stream_id, block.erase_count, block.closed};
+        }
+        next_sequence = image->snapshot_sequence;
+        for (const JournalEntry &entry : image->journal)
+        {
+            switch (entry.type)
+            {
+            case JournalEntryType::MAP:
+            case JournalEntryType::TRIM:
+            {
+                check_lpa(entry.stream_id, entry.lpa_or_block);
+                bool is_trim = entry.type == JournalEntryType::TRIM;
+                uint64_t entry_version = is_trim ? TrimVersion(entry.sequence) : ProgramVersion(entry.sequence);
+                RecoveredEntry &recovered = entries[entry.stream_id][entry.lpa_or_block];
+                if (entry_version >= recovered.version)
+                {
+                    recovered = {entry.ppa_or_erase_count, entry.write_state_bitmap, entry_version};
+                }
+                next_sequence = std::max(next_sequence, is_trim ? entry.sequence : entry.sequence + 1);
+                break;
+            }
+            case JournalEntryType::BLOCK_CLOSE:
+            case JournalEntryType::BLOCK_ERASE:
+                if (entry.lpa_or_block >= block_states.size())
+                {
+                    PRINT_ERROR("Corrupted checkpoint journal found during recovery!")
+                }
+                block_states[entry.lpa_or_block] = {entry.stream_id, entry.ppa_or_erase_count, entry.type == JournalEntryType::BLOCK_CLOSE};
+                break;
+            }
+            statistics.journal_entries++;
+        }
+    }
+
+    page_owners.assign(total_pages, NO_VALUE);
+    uint64_t channel_no = config.ssd_param.ChannelNum;
+    results.assign(channel_no, ChannelScanResult());
+    if (parallel_scan && channel_no > 1)
+    {
+        std::vector<std::future<void>> scans;
+        for (uint64_t channel_id = 0; channel_id < channel_no; channel_id++)
+        {
+            scans.push_back(std::async(std::launch::async, [this, channel_id]
+                                       { ScanChannel(channel_id, results[channel_id]); }));
+        }
+        for (auto &scan : scans)
+        {
+            scan.get();
+        }
+        statistics.scan_threads = channel_no;
+    }
+    else
+    {
+        for (uint64_t channel_id = 0; channel_id < channel_no; channel_id++)
+        {
+            ScanChannel(channel_id, results[channel_id]);
+        }
+        statistics.scan_threads = 1;
+    }
+
+    for (auto &result : results)
+    {
+        statistics.scanned_pages += result.scanned_pages;
+        statistics.programmed_pages += result.pages.size();
+        statistics.verified_blocks += result.verified_blocks;
+        for (auto &page : result.pages)
+        {
+            const PageMetadata &metadata = page.metadata;
+            check_lpa(metadata.stream_id, metadata.lpa);
+            next_sequence = std::max(next_sequence, metadata.sequence + 1);
+            RecoveredEntry &recovered = entries[metadata.stream_id][metadata.lpa];
+            uint64_t version = ProgramVersion(metadata.sequence);
+            if (version >= recovered.version)
+            {
+                recovered = {page.ppa, metadata.write_state_bitmap, version};
+            }
+        }
+    }
+
+    // 检查点或日志中的表项必须指向仍保存着该 LPA 的页。
+    // 指向的页已被擦除或改写，说明该 LPA 在最后一次落盘的日志之后被 TRIM、旧页随后被 GC 回收，数据已不存在，按未映射处理；
+    // 改为全盘扫描反而会找回更早的副本。只有越界的表项才说明检查点本身损坏
+    for (uint64_t stream_id = 0; stream_id < stream_no; stream_id++)
+    {
+        for (uint64_t lpa = 0; lpa < entries[stream_id].size(); lpa++)
+        {
+            RecoveredEntry &recovered = entries[stream_id][lpa];
+            if (recovered.ppa == NO_VALUE)
+            {
+                continue;
+            }
+            if (recovered.ppa >= total_pages)
+            {
+                return false;
+            }
+            if (page_owners[recovered.ppa] != TRUSTED_PAGE && page_owners[recovered.ppa] != GetOwnerKey(stream_id, lpa))
+            {
+                recovered.ppa = NO_VALUE;
+                statistics.discarded_mappings++;
+            }
+        }
+    }
+    return true;
+}
+
+MountStatistics RecoveryManager::Recover()
+{
+    auto start_time = std::chrono::steady_clock::now();
+    MountStatistics statistics;
+    CheckpointImage image;
+    bool checkpoint_loaded = checkpoint_manager != nullptr && checkpoint_manager->LoadLatestCheckpoint(image, statistics);
+    bool consistent = RebuildMapping(checkpoint_loaded ? &image : nullptr, statistics);
+    for (auto &result : results)
+    {
+        statistics.full_scan_pages += result.blocks.size() * pages_per_block;
+    }
+    if (!consistent)
+    {
+        statistics.fallback_full_scan = true;
+        statistics.discarded_mappings = 0;
+        RebuildMapping(nullptr, statistics);
+    }
+
+    block_manager->ResetForRecovery();
+    std::vector<uint8_t> referenced(address_mapping->GetDevicePhysicalPagesCount(), 0);
+    for (uint64_t stream_id = 0; stream_id < stream_no; stream_id++)
+    {
+        for (uint64_t lpa = 0; lpa < entries[stream_id].size(); lpa++)
+        {
+            const RecoveredEntry &entry = entries[stream_id][lpa];
+            if (entry.ppa == NO_VALUE)
+            {
+                continue;
+            }
+            address_mapping->RestoreMappingEntry(stream_id, lpa, entry.ppa, entry.write_state_bitmap);
+            referenced[entry.ppa] = 1;
+            statistics.recovered_mappings++;
+        }
+    }
+    // 映射表之外的已写入页都是无效页：被取代的旧副本，或写入位置之前的空洞
+    for (auto &result : results)
+    {
+        for (auto &block : result.blocks)
+        {
+            block_manager->RestoreBlock(block.address, block.stream_id, block.programmed_page_count, block.erase_count);
+            uint64_t first_ppa = address_mapping->ConvertAddresstoPPA(block.address);
+            for (uint64_t page_id = 0; page_id < block.programmed_page_count; page_id++)
+            {
+                if (referenced[first_ppa + page_id])
+                {
+                    continue;
+                }
+                PhysicalPageAddress address = block.address;
+                address.page_id = page_id;
+                block_manager->InvalidatePageInBlock(block.stream_id, address);
+                if (page_owners[first_ppa + page_id] == NO_VALUE)
+                    statistics.unprogrammed_holes++;
+                else
+                    statistics.stale_pages++;
+            }
+        }
+    }
+    address_mapping->SetProgramSequence(next_sequence);
+    statistics.closed_blocks = block_manager->FinishRecovery();
+    statistics.elapsed_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_time).count();
+    return statistics;
+}
@@ -0,0 +1,94 @@
+#pragma once
+#include "param.h"
+#include "nand_chip.h"
+
+// 一次上电挂载的统计
+struct MountStatistics
+{
+    uint64_t scanned_pages = 0;      // 读取了备用区的页数
+    uint64_t full_scan_pages = 0;    // 不用检查点时全盘扫描需要读取备用区的页数
+    uint64_t programmed_pages = 0;   // 扫描到的已编程页数
+    uint64_t unprogrammed_holes = 0; // 块写入位置之前未编程的页数，按无效页处理
+    uint64_t recovered_mappings = 0; // 重建的 L2P 表项数
+    uint64_t stale_pages = 0;        // 被更新副本取代、恢复为无效的页数
+    uint64_t closed_blocks = 0;      // 部分写入、又没有空出的打开块可以续用而被封闭的块数
+    uint64_t verified_blocks = 0;    // 检查点中已写满、只核对首页就恢复的块数
+    uint64_t checkpoint_epoch = NO_VALUE; // 所依据的检查点编号，NO_VALUE 表示没有可用的检查点
+    uint64_t checkpoint_pages_read = 0;
+    uint64_t journal_pages_read = 0;
+    uint64_t journal_entries = 0;    // 重放的日志项数
+    uint64_t discarded_mappings = 0; // 检查点或日志中指向已被擦除/改写的页、按未映射恢复的表项数
+    bool fallback_full_scan = false; // 检查点与闪存内容不一致，改为全盘扫描
+    uint64_t scan_threads = 0;
+    uint64_t elapsed_ns = 0;
+};
+
+struct CheckpointImage;
+
+/*
+ * 掉电恢复
+ * 以最新的完整检查点和其后的日志为基础：检查点中已写满的块核对首页的擦除次数后直接恢复，其余块逐页扫描备用区。
+ * 每个 LPA 的表项带有版本(编程序号，或检查点/TRIM 对应的序号下界)，扫描到的副本只有版本不低于表项时才取代它。
+ * 页的有效性由最终的映射表决定，块状态交给 BlockManager 重建空闲池和打开块。
+ * 没有检查点时所有块都逐页扫描；映射指向的页与闪存内容不符时丢弃检查点改为全盘扫描。
+ * 扫描可以每个 channel 一个线程并行；扫描期间 NAND 没有在途命令，只读访问页备用区
+ */
+class RecoveryManager
+{
+public:
+    RecoveryManager(NandDriverPtr nand_driver, AddressMappingPageLevelPtr address_mapping, BlockManagerPtr block_manager,
+                    CheckpointManagerPtr checkpoint_manager, bool parallel_scan);
+    MountStatistics Recover();
+
+private:
+    struct ScannedPage
+    {
+        uint64_t ppa;
+        PageMetadata metadata;
+    };
+    struct ScannedBlock
+    {
+        PhysicalPageAddress address;
+        uint64_t stream_id;
+        uint64_t programmed_page_count;
+        uint64_t erase_count;
+    };
+    struct ChannelScanResult
+    {
+        std::vector<ScannedPage> pages;
+        std::vector<ScannedBlock> blocks; // 所有非保留块，包括空白块
+        uint64_t scanned_pages = 0;
+        uint64_t verified_blocks = 0;
+    };
+    struct BlockState
+    {
+        uint64_t stream_id = NO_VALUE;
+        uint64_t erase_count = 0;
+        bool closed = false;
+    };
+    struct RecoveredEntry
+    {
+        uint64_t ppa = NO_VALUE;
+        uint64_t write_state_bitmap = 0;
+        uint64_t version = 0;
+    };
+
+    // 以检查点和日志(image 为空时从全空开始)为基础扫描各块、重建映射；映射指向的页与闪存内容不符时返回 false
+    bool RebuildMapping(const CheckpointImage *image, MountStatistics &statistics);
+    void ScanChannel(const uint64_t channel_id, ChannelScanResult &result);
+    uint64_t GetOwnerKey(const uint64_t stream_id, const uint64_t lpa) const { return lpa * stream_no + stream_id; }
+
+    NandDriverPtr nand_driver;
+    AddressMappingPageLevelPtr address_mapping;
+    BlockManagerPtr block_manager;
+    CheckpointManagerPtr checkpoint_manager;
+    bool parallel_scan;
+    uint64_t stream_no;
+    uint64_t pages_per_block;
+
+    std::vector<BlockState> block_states;              // 按全局块号
+    std::vector<std::vector<RecoveredEntry>> entries;  // [stream][lpa]
+    std::vector<ChannelScanResult> results;            // [channel]
+    std::vector<uint64_t> page_owners;                 // 按 PPA：扫描到的页为 GetOwnerKey，核对过首页的块为 TRUSTED_PAGE，未编程为 NO_VALUE
+    uint64_t next_sequence = 0;
+};
@@ -0,0 +1,134 @@
+#include "state_snapshot.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static_assert(sizeof(StateSnapshotHeader) == 112, "StateSnapshotHeader layout changed");
+
+//============================================== SnapshotWriter ==============================================
+
+SnapshotWriter::SnapshotWriter(const std::string &path)
+{
+    file = fopen(path.c_str(), "wb");
+    if (file == nullptr)
+    {
+        PRINT_ERROR("Cannot create snapshot file " << path)
+    }
+    // NAND 页数据占快照的绝大部分，用大缓冲减少系统调用
+    setvbuf(file, nullptr, _IOFBF, 1 << 20);
+}
+
+SnapshotWriter::~SnapshotWriter()
+{
+    if (!finished)
+    {
+        fclose(file);
+    }
+}
+
+void SnapshotWriter::WriteBytes(const void *data, uint64_t size)
+{
+    if (size > 0 && fwrite(data, 1, size, file) != size)
+    {
+        PRINT_ERROR("Write snapshot file failed")
+    }
+    file_offset += size;
+}
+
+uint64_t SnapshotWriter::Finish()
+{
+    if (!finished)
+    {
+        BeginSection(SnapshotSection::END);
+        if (fclose(file) != 0)
+        {
+            PRINT_ERROR("Write snapshot file failed")
+        }
+        finished = true;
+    }
+    return file_offset;
+}
+
+//============================================== SnapshotReader ==============================================
+
+SnapshotReader::SnapshotReader(const std::string &path) : path(path)
+{
+    fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        PRINT_ERROR("Cannot open snapshot file " << path)
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        PRINT_ERROR("Cannot stat snapshot file " << path)
+    }
+    file_size = static_cast<uint64_t>(st.st_size);
+    if (file_size < sizeof(StateSnapshotHeader))
+    {
+        PRINT_ERROR("Snapshot file " << path << " is truncated")
+    }
+    void *addr = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr == MAP_FAILED)
+    {
+        PRINT_ERROR("mmap failed on snapshot file " << path)
+    }
+    madvise(addr, file_size, MADV_SEQUENTIAL);
+    base = static_cast<const uint8_t *>(addr);
+    header = Read<StateSnapshotHeader>();
+    if (header.magic != STATE_SNAPSHOT_MAGIC || header.version != STATE_SNAPSHOT_VERSION)
+    {
+        PRINT_ERROR(path << " is not a state snapshot of version " << STATE_SNAPSHOT_VERSION)
+    }
+}
+
+SnapshotReader::~SnapshotReader()
+{
+    if (base != nullptr)
+    {
+        munmap(const_cast<uint8_t *>(base), file_size);
+    }
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+}
+
+const uint8_t *SnapshotReader::ReadBytes(uint64_t size)
+{
+    if (size > file_size - offset)
+    {
+        PRINT_ERROR("Snapshot file " << path << " is truncated")
+    }
+    const uint8_t *data = base + offset;
+    offset += size;
+    return data;
+}
+
+uint64_t SnapshotReader::ReadCount(uint64_t element_size)
+{
+    uint64_t count = Read<uint64_t>();
+    if (element_size > 0 && count > (file_size - offset) / element_size)
+    {
+        PRINT_ERROR("Snapshot file " << path << " is corrupted")
+    }
+    return count;
+}
+
+void SnapshotReader::ExpectSection(SnapshotSection section)
+{
+    if (Read<SnapshotSection>() != section)
+    {
+        PRINT_ERROR("Snapshot file " << path << " is corrupted: section " << static_cast<uint64_t>(section) << " not found")
+    }
+}
+
+void SnapshotReader::Finish()
+{
+    ExpectSection(SnapshotSection::END);
+    if (offset != file_size)
+    {
+        PRINT_ERROR("Snapshot file " << path << " has trailing data")
+    }
+}
@@ -0,0 +1,135 @@
+#pragma once
+#include "param.h"
+#include <string>
+#include <type_traits>
+
+/*
+ * 模拟器状态快照文件
+ *
+ * | StateSnapshotHeader | NAND | 块管理 | 地址映射 | 检查点 | 冷热分类器 | END |
+ *
+ * 每一段以 SnapshotSection 标记开头，段内是各模块按固定顺序写出的定长字段和数组(数组前是元素个数)，
+ * 字节序与本机相同。文件头记录 NAND 几何、流数、写入点数、GC 温度类别数和逻辑空间大小，载入时必须与当前配置一致；
+ * GC 策略、CMT 容量、plane 分配方案等不影响状态布局的参数可以不同，用同一块老化盘比较不同策略。
+ * 快照只保存模型状态，不保存统计计数(GC 次数、检查点写放大等)，载入后的统计只反映载入之后的负载
+ */
+
+#define STATE_SNAPSHOT_MAGIC 0x3150414e53445353ULL // "SSDSNAP1"
+#define STATE_SNAPSHOT_VERSION 3
+#define STATE_SNAPSHOT_FLAG_PAGE_DATA 0x1 // 保存了已编程页的主数据区；没有时载入后主数据区保持擦除状态，只适合不校验数据的实验
+
+enum class SnapshotSection : uint64_t
+{
+    NAND = 1,
+    BLOCK_MANAGER,
+    ADDRESS_MAPPING,
+    CHECKPOINT,
+    CLASSIFIER,
+    END
+};
+
+struct StateSnapshotHeader
+{
+    uint64_t magic;
+    uint32_t version;
+    uint32_t flags;
+    uint64_t channel_no;
+    uint64_t chips_per_channel;
+    uint64_t dies_per_chip;
+    uint64_t planes_per_die;
+    uint64_t blocks_per_plane;
+    uint64_t pages_per_block;
+    uint64_t page_size;
+    uint64_t stream_no;
+    uint64_t write_hint_count;
+    uint64_t gc_temperature_count;
+    uint64_t reserved_blocks_per_plane; // 未启用检查点时为0
+    uint64_t logical_pages_no;          // 所有流的逻辑页数之和，由预留空间比例决定
+};
+
+class SnapshotWriter
+{
+public:
+    explicit SnapshotWriter(const std::string &path);
+    ~SnapshotWriter();
+    SnapshotWriter(const SnapshotWriter &) = delete;
+    SnapshotWriter &operator=(const SnapshotWriter &) = delete;
+
+    void WriteBytes(const void *data, uint64_t size);
+    template <typename T>
+    void Write(const T &value)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "Snapshot fields must be trivially copyable");
+        WriteBytes(&value, sizeof(T));
+    }
+    template <typename T>
+    void WriteArray(const T *values, uint64_t count)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "Snapshot fields must be trivially copyable");
+        WriteBytes(values, count * sizeof(T));
+    }
+    // 元素个数 + 数组
+    template <typename T>
+    void WriteVector(const std::vector<T> &values)
+    {
+        Write<uint64_t>(values.size());
+        WriteArray(values.data(), values.size());
+    }
+    void BeginSection(SnapshotSection section) { Write(section); }
+    // 写出结束标记并关闭文件，返回文件大小
+    uint64_t Finish();
+
+private:
+    FILE *file;
+    uint64_t file_offset = 0;
+    bool finished = false;
+};
+
+// 整个快照文件只读映射，各模块按写出时的顺序依次读取；越界或段标记不符时报错退出
+class SnapshotReader
+{
+public:
+    explicit SnapshotReader(const std::string &path);
+    ~SnapshotReader();
+    SnapshotReader(const SnapshotReader &) = delete;
+    SnapshotReader &operator=(const SnapshotReader &) = delete;
+
+    const StateSnapshotHeader &GetHeader() const { return header; }
+    bool HasPageData() const { return header.flags & STATE_SNAPSHOT_FLAG_PAGE_DATA; }
+    // 返回文件中接下来 size 字节的只读指针，不拷贝
+    const uint8_t *ReadBytes(uint64_t size);
+    template <typename T>
+    T Read()
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "Snapshot fields must be trivially copyable");
+        T value;
+        std::memcpy(&value, ReadBytes(sizeof(T)), sizeof(T));
+        return value;
+    }
+    template <typename T>
+    void ReadArray(T *values, uint64_t count)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "Snapshot fields must be trivially copyable");
+        std::memcpy(static_cast<void *>(values), ReadBytes(count * sizeof(T)), count * sizeof(T));
+    }
+    template <typename T>
+    void ReadVector(std::vector<T> &values)
+    {
+        values.resize(ReadCount(sizeof(T)));
+        ReadArray(values.data(), values.size());
+    }
+    // 读出元素个数，并检查剩余字节数足够容纳这么多 element_size 字节的元素
+    uint64_t ReadCount(uint64_t element_size);
+    void ExpectSection(SnapshotSection section);
+    // 读到结束标记，且其后没有多余内容
+    void Finish();
+    uint64_t GetFileSize() const { return file_size; }
+
+private:
+    std::string path;
+    int fd = -1;
+    const uint8_t *base = nullptr;
+    uint64_t file_size = 0;
+    uint64_t offset = 0;
+    StateSnapshotHeader header{};
+};
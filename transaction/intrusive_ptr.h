@@ -0,0 +1,77 @@
+#pragma once
+#include <cstddef>
+#include <functional>
+#include <type_traits>
+#include <utility>
+
+/*
+ * 侵入式智能指针：引用计数存放在对象内部，T 需提供 AddRef() / Release()。
+ * 与 shared_ptr 相比没有独立的控制块，拷贝只是一次整数自增，
+ * 对象的回收方式(放回对象池等)由 T::Release 决定。
+ */
+template <typename T>
+class IntrusivePtr
+{
+public:
+    IntrusivePtr() noexcept : ptr(nullptr) {}
+    IntrusivePtr(std::nullptr_t) noexcept : ptr(nullptr) {}
+    explicit IntrusivePtr(T *p) : ptr(p)
+    {
+        if (ptr)
+            ptr->AddRef();
+    }
+    IntrusivePtr(const IntrusivePtr &other) : ptr(other.ptr)
+    {
+        if (ptr)
+            ptr->AddRef();
+    }
+    IntrusivePtr(IntrusivePtr &&other) noexcept : ptr(other.ptr) { other.ptr = nullptr; }
+    template <typename U, typename = std::enable_if_t<std::is_convertible<U *, T *>::value>>
+    IntrusivePtr(const IntrusivePtr<U> &other) : ptr(other.get())
+    {
+        if (ptr)
+            ptr->AddRef();
+    }
+    ~IntrusivePtr()
+    {
+        if (ptr)
+            ptr->Release();
+    }
+
+    IntrusivePtr &operator=(const IntrusivePtr &other)
+    {
+        IntrusivePtr(other).swap(*this);
+        return *this;
+    }
+    IntrusivePtr &operator=(IntrusivePtr &&other) noexcept
+    {
+        IntrusivePtr(std::move(other)).swap(*this);
+        return *this;
+    }
+    IntrusivePtr &operator=(std::nullptr_t)
+    {
+        reset();
+        return *this;
+    }
+
+    void reset() { IntrusivePtr().swap(*this); }
+    void swap(IntrusivePtr &other) noexcept { std::swap(ptr, other.ptr); }
+    T *get() const noexcept { return ptr; }
+    T &operator*() const noexcept { return *ptr; }
+    T *operator->() const noexcept { return ptr; }
+    explicit operator bool() const noexcept { return ptr != nullptr; }
+
+private:
+    T *ptr;
+};
+
+template <typename T, typename U>
+bool operator==(const IntrusivePtr<T> &a, const IntrusivePtr<U> &b) { return a.get() == b.get(); }
+template <typename T, typename U>
+bool operator!=(const IntrusivePtr<T> &a, const IntrusivePtr<U> &b) { return a.get() != b.get(); }
+template <typename T>
+bool operator==(const IntrusivePtr<T> &a, std::nullptr_t) { return a.get() == nullptr; }
+template <typename T>
+bool operator!=(const IntrusivePtr<T> &a, std::nullptr_t) { return a.get() != nullptr; }
+template <typename T>
+bool operator<(const IntrusivePtr<T> &a, const IntrusivePtr<T> &b) { return std::less<T *>()(a.get(), b.get()); }
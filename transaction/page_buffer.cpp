@@ -0,0 +1,83 @@
+#include "page_buffer.h"
+
+void PageBuffer::Release()
+{
+    if (ref_count.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+        pool->Free(this);
+    }
+}
+
+PageBufferPool &PageBufferPool::GetInstance()
+{
+    // 进程生命周期内不析构：FTL 各模块互相持有 shared_ptr 不会被销毁，芯片工作线程在 main 返回后仍然存在，
+    // 静态析构先于它们释放缓冲区会造成释放后使用
+    static PageBufferPool *instance = new PageBufferPool(config.nand_param.PageSize);
+    return *instance;
+}
+
+PageBufferPool::PageBufferPool(uint64_t page_size, uint64_t buffers_per_chunk)
+    : page_size(page_size), buffers_per_chunk(buffers_per_chunk)
+{
+    aligned_page_size = (page_size + BUFFER_ALIGNMENT - 1) / BUFFER_ALIGNMENT * BUFFER_ALIGNMENT;
+}
+
+PageBufferPool::~PageBufferPool()
+{
+    for (auto chunk : data_chunks)
+    {
+        std::free(chunk);
+    }
+}
+
+PageBufferPtr PageBufferPool::Allocate()
+{
+    PageBuffer *buffer = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (free_list == nullptr)
+        {
+            Grow();
+        }
+        buffer = free_list;
+        free_list = buffer->next_free;
+    }
+    buffer->next_free = nullptr;
+    return PageBufferPtr(buffer);
+}
+
+PageBufferPtr PageBufferPool::Allocate(uint8_t fill)
+{
+    PageBufferPtr buffer = Allocate();
+    std::memset(buffer->data, fill, page_size);
+    return buffer;
+}
+
+void PageBufferPool::Grow()
+{
+    // 一次申请一整块连续内存，拆成 buffers_per_chunk 个按页对齐的缓冲区；池只增长不收缩
+    uint8_t *chunk = static_cast<uint8_t *>(std::aligned_alloc(BUFFER_ALIGNMENT, aligned_page_size * buffers_per_chunk));
+    if (chunk == nullptr)
+    {
+        PRINT_ERROR("Failed to allocate page buffer chunk!")
+    }
+    std::unique_ptr<PageBuffer[]> headers(new PageBuffer[buffers_per_chunk]);
+    for (uint64_t i = 0; i < buffers_per_chunk; i++)
+    {
+        headers[i].data = chunk + i * aligned_page_size;
+        headers[i].size = page_size;
+        headers[i].pool = this;
+        headers[i].next_free = free_list;
+        free_list = &headers[i];
+    }
+    data_chunks.push_back(chunk);
+    buffer_headers.push_back(std::move(headers));
+    total_buffer_count += buffers_per_chunk;
+}
+
+void PageBufferPool::Free(PageBuffer *buffer)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    buffer->next_free = free_list;
+    free_list = buffer;
+}
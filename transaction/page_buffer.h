@@ -0,0 +1,60 @@
+#pragma once
+#include "param.h"
+#include <atomic>
+
+class PageBufferPool;
+
+/*
+ * 页缓冲区：按页对齐、带引用计数的数据页，由 PageBufferPool 统一分配和回收。
+ * 一个缓冲区可以在 UserRequest / 事务 / 缓存槽 / NAND 命令之间传递所有权而无需拷贝，
+ * 最后一个引用释放时自动归还到池中。引用计数是原子的，NAND 工作线程也可以安全释放。
+ */
+class PageBuffer
+{
+public:
+    uint8_t *data;
+    uint64_t size;
+
+    void AddRef() { ref_count.fetch_add(1, std::memory_order_relaxed); }
+    void Release();
+
+private:
+    friend class PageBufferPool;
+    std::atomic<uint32_t> ref_count{0};
+    PageBuffer *next_free = nullptr;
+    PageBufferPool *pool = nullptr;
+};
+
+class PageBufferPool
+{
+public:
+    // 全局页缓冲池，页大小取自 config.nand_param.PageSize
+    static PageBufferPool &GetInstance();
+
+    PageBufferPool(uint64_t page_size, uint64_t buffers_per_chunk = 64);
+    ~PageBufferPool();
+    PageBufferPool(const PageBufferPool &) = delete;
+    PageBufferPool &operator=(const PageBufferPool &) = delete;
+
+    PageBufferPtr Allocate();             // 内容未定义
+    PageBufferPtr Allocate(uint8_t fill); // 用 fill 填满整页
+    uint64_t GetPageSize() const { return page_size; }
+    uint64_t GetTotalBufferCount() const { return total_buffer_count; }
+
+private:
+    friend class PageBuffer;
+    static constexpr uint64_t BUFFER_ALIGNMENT = 4096;
+
+    void Grow();
+    void Free(PageBuffer *buffer);
+
+    uint64_t page_size;
+    uint64_t aligned_page_size;
+    uint64_t buffers_per_chunk;
+    uint64_t total_buffer_count = 0;
+
+    std::mutex mtx;
+    PageBuffer *free_list = nullptr;
+    std::vector<std::unique_ptr<PageBuffer[]>> buffer_headers;
+    std::vector<uint8_t *> data_chunks;
+};
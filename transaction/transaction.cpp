@@ -0,0 +1,55 @@
+#include "transaction.h"
+
+void Transaction::Release()
+{
+    if (--ref_count == 0)
+    {
+        TransactionPool::GetInstance().Free(this);
+    }
+}
+
+TransactionPool &TransactionPool::GetInstance()
+{
+    // 与 PageBufferPool 一样不析构，在途命令的完成回调可能在静态析构之后才释放事务
+    static TransactionPool *instance = new TransactionPool();
+    return *instance;
+}
+
+void *TransactionPool::AcquireSlot()
+{
+    if (free_list == nullptr)
+    {
+        std::unique_ptr<TransactionSlot[]> chunk(new TransactionSlot[slots_per_chunk]);
+        for (uint64_t i = 0; i < slots_per_chunk; i++)
+        {
+            chunk[i].next_free = free_list;
+            free_list = &chunk[i];
+        }
+        chunks.push_back(std::move(chunk));
+        total_slot_count += slots_per_chunk;
+    }
+    TransactionSlot *slot = free_list;
+    free_list = slot->next_free;
+    return slot;
+}
+
+void TransactionPool::Free(Transaction *tr)
+{
+    switch (tr->type)
+    {
+    case TransactionType::READ:
+        static_cast<TransactionRead *>(tr)->~TransactionRead();
+        break;
+    case TransactionType::WRITE:
+        static_cast<TransactionWrite *>(tr)->~TransactionWrite();
+        break;
+    case TransactionType::ERASE:
+        static_cast<TransactionErase *>(tr)->~TransactionErase();
+        break;
+    default:
+        PRINT_ERROR("Unknown transaction type tag in TransactionPool!")
+    }
+    TransactionSlot *slot = reinterpret_cast<TransactionSlot *>(tr);
+    slot->next_free = free_list;
+    free_list = slot;
+}
@@ -1,57 +1,81 @@
 #pragma once
 #include "param.h"
+#include "page_buffer.h"
+#include <deque>
 
+// 物理页地址：打包进一个64位整数的值类型，按值传递，不再堆分配
 class PhysicalPageAddress
 {
 public:
-    uint64_t channel_id;
-    uint64_t chip_id;
-    uint64_t die_id;
-    uint64_t plane_id;
-    uint64_t block_id;
-    uint64_t page_id;
-    PhysicalPageAddress(const uint64_t channel_id = 0, const uint64_t chip_id = 0, const uint64_t die_id = 0,
+    uint64_t channel_id : PPA_CHANNEL_BITS;
+    uint64_t chip_id : PPA_CHIP_BITS;
+    uint64_t die_id : PPA_DIE_BITS;
+    uint64_t plane_id : PPA_PLANE_BITS;
+    uint64_t block_id : PPA_BLOCK_BITS;
+    uint64_t page_id : PPA_PAGE_BITS;
+    constexpr PhysicalPageAddress(const uint64_t channel_id = 0, const uint64_t chip_id = 0, const uint64_t die_id = 0,
                         const uint64_t plane_id = 0, const uint64_t block_id = 0, const uint64_t page_id = 0)
         : channel_id(channel_id), chip_id(chip_id), die_id(die_id), plane_id(plane_id), block_id(block_id), page_id(page_id) {}
     PhysicalPageAddress(const PhysicalPageAddress &other) = default;
+    PhysicalPageAddress &operator=(const PhysicalPageAddress &other) = default;
+
+    // 检查几何参数是否能装入各字段的位宽
+    static bool FitsGeometry(uint64_t channel_no, uint64_t chips_per_channel, uint64_t dies_per_chip,
+                             uint64_t planes_per_die, uint64_t blocks_per_plane, uint64_t pages_per_block)
+    {
+        return channel_no <= (1ULL << PPA_CHANNEL_BITS) && chips_per_channel <= (1ULL << PPA_CHIP_BITS) &&
+               dies_per_chip <= (1ULL << PPA_DIE_BITS) && planes_per_die <= (1ULL << PPA_PLANE_BITS) &&
+               blocks_per_plane <= (1ULL << PPA_BLOCK_BITS) && pages_per_block <= (1ULL << PPA_PAGE_BITS);
+    }
 };
+static_assert(sizeof(PhysicalPageAddress) == sizeof(uint64_t), "PhysicalPageAddress must pack into 64 bits");
+static_assert(std::is_trivially_copyable<PhysicalPageAddress>::value, "PhysicalPageAddress must be trivially copyable");
 
 class Transaction
 {
 public:
     Transaction(uint64_t stream_id, TransactionSourceType source, TransactionType type, Priority priority,
-                PhysicalPageAddressPtr physical_address, bool physical_address_determined, UserRequestType req_type,
+                const PhysicalPageAddress physical_address, bool physical_address_determined, UserRequestType req_type,
                 uint64_t lpa, uint64_t ppa, uint64_t size_in_bytes, uint64_t size_in_sectors)
         : stream_id(stream_id), source(source), type(type), priority(priority),
           physical_address(physical_address), physical_address_determined(physical_address_determined),
           req_type(req_type), lpa(lpa), ppa(ppa), size_in_bytes(size_in_bytes), size_in_sectors(size_in_sectors) {}
-    virtual ~Transaction() = default;
 
-    uint64_t transaction_id;
+    // 侵入式引用计数，事务只在 FTL 线程中流转，不需要原子操作；计数归零时放回 TransactionPool
+    void AddRef() { ref_count++; }
+    void Release();
+
+    uint64_t transaction_id = 0;
     uint64_t stream_id;
     TransactionSourceType source;
     TransactionType type;
     Priority priority;
-    PhysicalPageAddressPtr physical_address;
+    PhysicalPageAddress physical_address;
     bool physical_address_determined; // 物理地址是否已确定
     UserRequestType req_type;
     uint64_t lpa;             // 事务的起始逻辑块地址
     uint64_t ppa;             // 事务的起始物理页地址
     uint64_t size_in_bytes;   // 事务的大小，单位为字节
     uint64_t size_in_sectors; // 事务的大小，单位为扇区
+    UserRequestPtr user_request; // 所属的用户请求，GC/映射等内部事务为空
+
+private:
+    uint32_t ref_count = 0;
 };
 class TransactionRead : public Transaction
 {
 public:
     TransactionRead(uint64_t stream_id, TransactionSourceType source, TransactionType type, Priority priority,
-                    PhysicalPageAddressPtr physical_address, bool physical_address_determined, UserRequestType req_type,
+                    const PhysicalPageAddress physical_address, bool physical_address_determined, UserRequestType req_type,
                     uint64_t lpa, uint64_t ppa, uint64_t size_in_bytes, uint64_t size_in_sectors)
         : Transaction(stream_id, source, type, priority, physical_address, physical_address_determined, req_type,
                       lpa, ppa, size_in_bytes, size_in_sectors) {}
-    std::vector<uint8_t> content;
+    PageBufferPtr content; // 读出的数据，从 PageBufferPool 借用
     TransactionWritePtr related_write;
-    uint64_t read_sectors_bitmap;
-    uint64_t timestamp;
+    uint64_t read_sectors_bitmap = 0;
+    uint64_t timestamp = 0;
+    uint64_t read_retry_step = 0;    // 当前读重试档位，0 为默认参考电压
+    uint64_t modeled_latency_ns = 0; // 可靠性模型给出的累计感测和译码时延
 };
 
 enum class WriteExecutionModeType
@@ -63,25 +87,142 @@ class TransactionWrite : public Transaction
 {
 public:
     TransactionWrite(uint64_t stream_id, TransactionSourceType source, TransactionType type, Priority priority,
-                     PhysicalPageAddressPtr physical_address, bool physical_address_determined, UserRequestType req_type,
+                     const PhysicalPageAddress physical_address, bool physical_address_determined, UserRequestType req_type,
                      uint64_t lpa, uint64_t ppa, uint64_t size_in_bytes, uint64_t size_in_sectors)
         : Transaction(stream_id, source, type, priority, physical_address, physical_address_determined, req_type,
                       lpa, ppa, size_in_bytes, size_in_sectors) {}
-    std::vector<uint8_t> content;
+    PageBufferPtr content; // 待写入的数据，从 PageBufferPool 借用
     TransactionReadPtr related_read;
     TransactionErasePtr related_erase;
-    uint64_t write_sectors_bitmap;
-    uint64_t timestamp;
-    WriteExecutionModeType execution_mode;
+    uint64_t write_sectors_bitmap = 0;
+    uint64_t write_hint = 0; // 决定写入流内的哪个打开块
+    uint64_t sequence = NO_VALUE; // 分配物理页时取得的编程序号，随页写入备用区
+    uint64_t overwritten_ppa = NO_VALUE; // 被本次用户写取代的旧页，编程完成前旧页所在块不能擦除
+    uint64_t timestamp = 0;
+    WriteExecutionModeType execution_mode = WriteExecutionModeType::SIMPLE;
 };
 
 class TransactionErase : public Transaction
 {
 public:
     TransactionErase(uint64_t stream_id, TransactionSourceType source, TransactionType type, Priority priority,
-                     PhysicalPageAddressPtr physical_address, bool physical_address_determined, UserRequestType req_type,
+                     const PhysicalPageAddress physical_address, bool physical_address_determined, UserRequestType req_type,
                      uint64_t lpa, uint64_t ppa, uint64_t size_in_bytes, uint64_t size_in_sectors)
         : Transaction(stream_id, source, type, priority, physical_address, physical_address_determined, req_type,
                       lpa, ppa, size_in_bytes, size_in_sectors) {}
     std::vector<TransactionWritePtr> page_movement_actions;
-};
\ No newline at end of file
+};
+
+/*
+ * 事务对象池
+ * 三种事务共用同一种定长槽位，按 type 字段区分具体类型(READ/WRITE/ERASE)。
+ * 槽位按块批量申请后只在池内循环使用，稳态下创建/销毁事务不再触发堆分配。
+ */
+class TransactionPool
+{
+public:
+    static TransactionPool &GetInstance();
+
+    TransactionPool(uint64_t slots_per_chunk = 1024) : slots_per_chunk(slots_per_chunk) {}
+    TransactionPool(const TransactionPool &) = delete;
+    TransactionPool &operator=(const TransactionPool &) = delete;
+
+    template <typename T, typename... Args>
+    IntrusivePtr<T> Allocate(Args &&...args)
+    {
+        static_assert(sizeof(T) <= sizeof(TransactionSlot) && alignof(T) <= alignof(TransactionSlot), "Transaction slot too small");
+        T *tr = new (AcquireSlot()) T(std::forward<Args>(args)...);
+        if (!IsSlotTypeMatched<T>(tr->type))
+        {
+            PRINT_ERROR("Transaction type tag does not match its record type!")
+        }
+        return IntrusivePtr<T>(tr);
+    }
+    void Free(Transaction *tr);
+    uint64_t GetTotalSlotCount() const { return total_slot_count; }
+
+private:
+    union TransactionSlot
+    {
+        alignas(TransactionRead) uint8_t read[sizeof(TransactionRead)];
+        alignas(TransactionWrite) uint8_t write[sizeof(TransactionWrite)];
+        alignas(TransactionErase) uint8_t erase[sizeof(TransactionErase)];
+        TransactionSlot *next_free;
+    };
+
+    template <typename T>
+    static bool IsSlotTypeMatched(TransactionType type)
+    {
+        if (std::is_same<T, TransactionRead>::value)
+            return type == TransactionType::READ;
+        if (std::is_same<T, TransactionWrite>::value)
+            return type == TransactionType::WRITE;
+        if (std::is_same<T, TransactionErase>::value)
+            return type == TransactionType::ERASE;
+        return false;
+    }
+    void *AcquireSlot();
+
+    uint64_t slots_per_chunk;
+    uint64_t total_slot_count = 0;
+    TransactionSlot *free_list = nullptr;
+    std::vector<std::unique_ptr<TransactionSlot[]>> chunks;
+};
+
+// 下发途中的暂存事务批次：下发可能嵌套(如 GC 同步完成后重试挂起的写)，每层嵌套借用一个复用的 vector，
+// 容量留在栈中，批次大小稳定后每次下发不再堆分配。Batch 析构时清空并归还
+class TransactionBatchStack
+{
+public:
+    class Batch
+    {
+    public:
+        explicit Batch(TransactionBatchStack &stack) : transactions(stack.Push()), stack(stack) {}
+        ~Batch() { stack.Pop(); }
+        Batch(const Batch &) = delete;
+        Batch &operator=(const Batch &) = delete;
+
+        std::vector<TransactionPtr> &transactions;
+
+    private:
+        TransactionBatchStack &stack;
+    };
+
+private:
+    std::vector<TransactionPtr> &Push()
+    {
+        if (depth == levels.size())
+        {
+            levels.emplace_back();
+        }
+        return levels[depth++];
+    }
+    void Pop() { levels[--depth].clear(); }
+
+    std::deque<std::vector<TransactionPtr>> levels; // deque 扩展时不移动已有元素，外层持有的引用保持有效
+    uint64_t depth = 0;
+};
+
+// 从全局事务池中创建事务，用法同 std::make_shared
+template <typename T, typename... Args>
+IntrusivePtr<T> MakeTransaction(Args &&...args)
+{
+    return TransactionPool::GetInstance().Allocate<T>(std::forward<Args>(args)...);
+}
+
+// 按 type 标签做向下转换，取代 dynamic_pointer_cast；标签不匹配时返回空指针
+template <typename T>
+IntrusivePtr<T> TransactionCast(const TransactionPtr &tr)
+{
+    if (tr == nullptr)
+    {
+        return nullptr;
+    }
+    if ((std::is_same<T, TransactionRead>::value && tr->type != TransactionType::READ) ||
+        (std::is_same<T, TransactionWrite>::value && tr->type != TransactionType::WRITE) ||
+        (std::is_same<T, TransactionErase>::value && tr->type != TransactionType::ERASE))
+    {
+        return nullptr;
+    }
+    return IntrusivePtr<T>(static_cast<T *>(tr.get()));
+}
@@ -1,16 +1,25 @@
+#pragma once
 #include "param.h"
-enum class UserRequestType { READ, WRITE, TRIM };
+#include "page_buffer.h"
 
 class UserRequest {
 public:
-    uint64_t id;
-    UserRequestType req_type;
-    uint64_t start_lpa;
-    uint64_t size_in_sectors;
-    uint64_t size_in_bytes;
-    uint64_t stream_id;
-    std::vector<uint8_t> data;
-    uint64_t sectors_from_cache;
+    uint64_t id = 0;
+    UserRequestType req_type = UserRequestType::READ;
+    uint64_t arrival_time = 0; // 相对回放开始的到达时间，单位ns
+    uint64_t start_lsa = 0;    // 起始逻辑扇区地址
+    uint64_t start_lpa = 0;
+    uint64_t size_in_sectors = 0;
+    uint64_t size_in_bytes = 0;
+    uint64_t stream_id = 0;
+    uint64_t write_hint = NO_VALUE; // 主机给出的写入提示(数据寿命类别)，NO_VALUE 表示未给出
+    uint64_t queue_id = 0;    // 所在的主机提交队列
+    uint64_t submit_time = 0; // 进入主机提交队列的时间，单位ns
+    std::vector<PageBufferPtr> data; // 每个逻辑页一个页缓冲区，沿缓存和 NAND 命令传递，不做拷贝
+    uint64_t sectors_from_cache = 0;
+    bool media_error = false; // 有页读出不可纠正的错误
+    bool write_rejected = false; // 设备空闲块耗尽转为只读，写请求(或其中部分页)没有写入
+    uint64_t pending_transaction_count = 0; // 拆分出的子事务中尚未完成的个数，归零时请求完成
 };
 using UserRequestPtr = std::shared_ptr<UserRequest>;
 
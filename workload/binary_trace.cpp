@@ -0,0 +1,332 @@
+#include "binary_trace.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static_assert(sizeof(BinaryTraceHeader) == 40, "BinaryTraceHeader layout changed");
+static_assert(sizeof(BinaryTraceBlockHeader) == 16, "BinaryTraceBlockHeader layout changed");
+static_assert(sizeof(BinaryTraceIndexEntry) == 24, "BinaryTraceIndexEntry layout changed");
+
+namespace
+{
+    inline void PutVarint(std::vector<uint8_t> &out, uint64_t value)
+    {
+        while (value >= 0x80)
+        {
+            out.push_back(static_cast<uint8_t>(value) | 0x80);
+            value >>= 7;
+        }
+        out.push_back(static_cast<uint8_t>(value));
+    }
+
+    inline uint64_t GetVarint(const uint8_t *&p, const uint8_t *end)
+    {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64 && p < end; shift += 7)
+        {
+            uint8_t byte = *p++;
+            value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0)
+            {
+                return value;
+            }
+        }
+        PRINT_ERROR("Corrupted binary trace: bad varint")
+    }
+
+    inline uint64_t ZigzagEncode(int64_t value) { return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63); }
+    inline int64_t ZigzagDecode(uint64_t value) { return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1); }
+}
+
+//============================================== BinaryTraceWriter ==============================================
+
+BinaryTraceWriter::BinaryTraceWriter(const std::string &path, uint32_t records_per_block)
+    : records_per_block(records_per_block == 0 ? BINARY_TRACE_RECORDS_PER_BLOCK : records_per_block)
+{
+    file = fopen(path.c_str(), "wb");
+    if (file == nullptr)
+    {
+        PRINT_ERROR("Cannot create binary trace file " << path)
+    }
+    // 文件头在 Finish 时回填
+    BinaryTraceHeader header{};
+    WriteBytes(&header, sizeof(header));
+    block_payload.reserve(this->records_per_block * 8);
+}
+
+BinaryTraceWriter::~BinaryTraceWriter()
+{
+    Finish();
+}
+
+void BinaryTraceWriter::WriteBytes(const void *data, uint64_t size)
+{
+    if (fwrite(data, 1, size, file) != size)
+    {
+        PRINT_ERROR("Write binary trace file failed")
+    }
+    file_offset += size;
+}
+
+void BinaryTraceWriter::Append(const TraceRecord &record)
+{
+    if (finished)
+    {
+        PRINT_ERROR("Append to a finished binary trace")
+    }
+    if (block_header.record_count == 0)
+    {
+        block_header.first_timestamp = record.timestamp;
+        prev_timestamp = record.timestamp;
+        prev_end_lsa = 0;
+    }
+    // 时间戳回退时记为0增量
+    PutVarint(block_payload, record.timestamp > prev_timestamp ? record.timestamp - prev_timestamp : 0);
+    PutVarint(block_payload, (record.stream_id << 2) | static_cast<uint64_t>(record.req_type));
+    PutVarint(block_payload, ZigzagEncode(static_cast<int64_t>(record.start_lsa - prev_end_lsa)));
+    PutVarint(block_payload, record.size_in_sectors);
+    prev_timestamp = std::max(prev_timestamp, record.timestamp);
+    prev_end_lsa = record.start_lsa + record.size_in_sectors;
+    record_count++;
+    if (++block_header.record_count == records_per_block)
+    {
+        FlushBlock();
+    }
+}
+
+void BinaryTraceWriter::FlushBlock()
+{
+    if (block_header.record_count == 0)
+    {
+        return;
+    }
+    index.push_back({file_offset, record_count - block_header.record_count, block_header.first_timestamp});
+    block_header.payload_size = static_cast<uint32_t>(block_payload.size());
+    WriteBytes(&block_header, sizeof(block_header));
+    WriteBytes(block_payload.data(), block_payload.size());
+    block_payload.clear();
+    block_header = BinaryTraceBlockHeader{};
+}
+
+void BinaryTraceWriter::Finish()
+{
+    if (finished)
+    {
+        return;
+    }
+    finished = true;
+    FlushBlock();
+    // 索引按8字节对齐，读取时可以直接当数组访问
+    static const uint8_t padding[8] = {0};
+    WriteBytes(padding, (8 - file_offset % 8) % 8);
+
+    BinaryTraceHeader header;
+    header.magic = BINARY_TRACE_MAGIC;
+    header.version = BINARY_TRACE_VERSION;
+    header.records_per_block = records_per_block;
+    header.record_count = record_count;
+    header.block_count = index.size();
+    header.index_offset = file_offset;
+    WriteBytes(index.data(), index.size() * sizeof(BinaryTraceIndexEntry));
+    if (fseek(file, 0, SEEK_SET) != 0 || fwrite(&header, 1, sizeof(header), file) != sizeof(header))
+    {
+        PRINT_ERROR("Write binary trace header failed")
+    }
+    fclose(file);
+    file = nullptr;
+}
+
+//============================================== BinaryTraceReader ==============================================
+
+BinaryTraceReader::BinaryTraceReader(const std::string &path, uint64_t stream_no, uint64_t logical_sector_no, uint64_t sectors_per_page)
+    : stream_no(stream_no == 0 ? 1 : stream_no), logical_sector_no(logical_sector_no), sectors_per_page(sectors_per_page)
+{
+    fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        PRINT_ERROR("Cannot open binary trace file " << path)
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        PRINT_ERROR("Cannot stat binary trace file " << path)
+    }
+    file_size = static_cast<uint64_t>(st.st_size);
+    if (file_size < sizeof(BinaryTraceHeader))
+    {
+        PRINT_ERROR("Binary trace file " << path << " is truncated")
+    }
+    void *addr = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr == MAP_FAILED)
+    {
+        PRINT_ERROR("mmap failed on binary trace file " << path)
+    }
+    // 顺序读取，内核会提前预读并及时回收已读过的页
+    madvise(addr, file_size, MADV_SEQUENTIAL);
+    base = static_cast<const uint8_t *>(addr);
+    std::memcpy(&header, base, sizeof(header));
+    if (header.magic != BINARY_TRACE_MAGIC || header.version != BINARY_TRACE_VERSION)
+    {
+        PRINT_ERROR(path << " is not a binary trace file of version " << BINARY_TRACE_VERSION)
+    }
+    if (header.index_offset % 8 != 0 || header.index_offset + header.block_count * sizeof(BinaryTraceIndexEntry) > file_size)
+    {
+        PRINT_ERROR("Binary trace file " << path << " has a corrupted index")
+    }
+    index = reinterpret_cast<const BinaryTraceIndexEntry *>(base + header.index_offset);
+    SeekToRecord(0);
+}
+
+BinaryTraceReader::~BinaryTraceReader()
+{
+    if (base != nullptr)
+    {
+        munmap(const_cast<uint8_t *>(base), file_size);
+    }
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+}
+
+void BinaryTraceReader::LoadBlock(uint64_t block_id)
+{
+    current_block = block_id;
+    if (block_id >= header.block_count)
+    {
+        records_left_in_block = 0;
+        next_record_id = header.record_count;
+        return;
+    }
+    BinaryTraceBlockHeader block_header;
+    std::memcpy(&block_header, base + index[block_id].offset, sizeof(block_header));
+    cursor = base + index[block_id].offset + sizeof(block_header);
+    block_end = cursor + block_header.payload_size;
+    if (block_end > base + header.index_offset)
+    {
+        PRINT_ERROR("Corrupted binary trace: block " << block_id << " overruns the index")
+    }
+    records_left_in_block = block_header.record_count;
+    next_record_id = index[block_id].first_record_id;
+    prev_timestamp = block_header.first_timestamp;
+    prev_end_lsa = 0;
+}
+
+void BinaryTraceReader::SeekToRecord(uint64_t record_id)
+{
+    if (header.block_count == 0 || record_id >= header.record_count)
+    {
+        LoadBlock(header.block_count);
+        return;
+    }
+    // 找最后一个 first_record_id <= record_id 的 block
+    auto it = std::upper_bound(index, index + header.block_count, record_id,
+                               [](uint64_t id, const BinaryTraceIndexEntry &entry)
+                               { return id < entry.first_record_id; });
+    LoadBlock(static_cast<uint64_t>(it - index) - 1);
+    TraceRecord record;
+    while (next_record_id < record_id && NextRecord(record))
+        ;
+}
+
+void BinaryTraceReader::SeekToTime(uint64_t timestamp)
+{
+    if (header.block_count == 0)
+    {
+        LoadBlock(0);
+        return;
+    }
+    // 从最后一个起始时间早于 timestamp 的 block 开始向后找
+    auto it = std::lower_bound(index, index + header.block_count, timestamp,
+                               [](const BinaryTraceIndexEntry &entry, uint64_t ts)
+                               { return entry.first_timestamp < ts; });
+    uint64_t block_id = it == index ? 0 : static_cast<uint64_t>(it - index) - 1;
+    LoadBlock(block_id);
+    while (next_record_id < header.record_count)
+    {
+        // 先保存状态，读到第一条不早于 timestamp 的记录后回退一步
+        const uint8_t *saved_cursor = cursor;
+        uint64_t saved_block = current_block, saved_left = records_left_in_block, saved_id = next_record_id;
+        uint64_t saved_ts = prev_timestamp, saved_lsa = prev_end_lsa;
+        TraceRecord record;
+        if (!NextRecord(record))
+        {
+            return;
+        }
+        if (record.timestamp >= timestamp)
+        {
+            if (current_block != saved_block)
+            {
+                LoadBlock(current_block);
+                return;
+            }
+            cursor = saved_cursor;
+            records_left_in_block = saved_left;
+            next_record_id = saved_id;
+            prev_timestamp = saved_ts;
+            prev_end_lsa = saved_lsa;
+            return;
+        }
+    }
+}
+
+bool BinaryTraceReader::NextRecord(TraceRecord &record)
+{
+    while (records_left_in_block == 0)
+    {
+        if (current_block + 1 >= header.block_count)
+        {
+            return false;
+        }
+        LoadBlock(current_block + 1);
+    }
+    record.timestamp = prev_timestamp + GetVarint(cursor, block_end);
+    uint64_t type_and_stream = GetVarint(cursor, block_end);
+    record.req_type = static_cast<UserRequestType>(type_and_stream & 3);
+    record.stream_id = type_and_stream >> 2;
+    record.start_lsa = prev_end_lsa + ZigzagDecode(GetVarint(cursor, block_end));
+    record.size_in_sectors = GetVarint(cursor, block_end);
+    prev_timestamp = record.timestamp;
+    prev_end_lsa = record.start_lsa + record.size_in_sectors;
+    records_left_in_block--;
+    next_record_id++;
+    return true;
+}
+
+UserRequestPtr BinaryTraceReader::Next()
+{
+    TraceRecord record;
+    while (NextRecord(record))
+    {
+        uint64_t start = record.start_lsa, size = record.size_in_sectors;
+        if (!FoldSectorRange(start, size, logical_sector_no))
+        {
+            continue;
+        }
+        auto req = std::make_shared<UserRequest>();
+        req->id = next_record_id - 1;
+        req->req_type = record.req_type;
+        req->arrival_time = record.timestamp;
+        req->start_lsa = start;
+        req->start_lpa = start / sectors_per_page;
+        req->size_in_sectors = size;
+        req->size_in_bytes = size * SECTOR_SIZE_IN_BYTE;
+        req->stream_id = record.stream_id % stream_no;
+        return req;
+    }
+    return nullptr;
+}
+
+uint64_t ConvertTraceToBinary(const std::string &text_path, TraceFormat format, const std::string &binary_path)
+{
+    // 转换时不折叠地址和流号，保留 trace 原始信息
+    TraceReader reader(text_path, format, NO_VALUE, NO_VALUE, 1);
+    BinaryTraceWriter writer(binary_path);
+    while (UserRequestPtr req = reader.Next())
+    {
+        writer.Append({req->arrival_time, req->req_type, req->stream_id, req->start_lsa, req->size_in_sectors});
+    }
+    writer.Finish();
+    return writer.GetRecordCount();
+}
@@ -0,0 +1,136 @@
+#pragma once
+#include "param.h"
+#include "user_request.h"
+#include "trace_reader.h"
+#include <string>
+
+/*
+ * 二进制 trace 格式
+ *
+ * | BinaryTraceHeader | block 0 | block 1 | ... | BinaryTraceIndexEntry x block_count |
+ *
+ * 每个 block 由 BinaryTraceBlockHeader 和最多 records_per_block 条变长编码记录组成，
+ * 记录依次为(均为 LEB128 varint)：
+ *   到达时间相对上一条记录的增量(block 内第一条相对 block 头的 first_timestamp)
+ *   (stream_id << 2) | 请求类型
+ *   起始扇区相对上一条记录结束扇区的差值(zigzag 编码，顺序流为0)
+ *   扇区数
+ * block 之间互不依赖，借助末尾的索引可以按请求序号或时间直接定位到 block。
+ * 记录中保存 trace 原始的扇区地址和流号，回放时再按目标盘的逻辑空间折叠。
+ */
+
+#define BINARY_TRACE_MAGIC 0x3143525454445353ULL // "SSDTTRC1"
+#define BINARY_TRACE_VERSION 1
+#define BINARY_TRACE_RECORDS_PER_BLOCK 4096
+
+struct BinaryTraceHeader
+{
+    uint64_t magic;
+    uint32_t version;
+    uint32_t records_per_block;
+    uint64_t record_count;
+    uint64_t block_count;
+    uint64_t index_offset; // 索引在文件中的偏移
+};
+
+struct BinaryTraceBlockHeader
+{
+    uint64_t first_timestamp; // block 内第一条记录的到达时间，ns
+    uint32_t record_count;
+    uint32_t payload_size; // 紧随其后的编码记录字节数
+};
+
+struct BinaryTraceIndexEntry
+{
+    uint64_t offset; // block 头在文件中的偏移
+    uint64_t first_record_id;
+    uint64_t first_timestamp;
+};
+
+// 解码后的定长记录
+struct TraceRecord
+{
+    uint64_t timestamp; // ns
+    UserRequestType req_type;
+    uint64_t stream_id;
+    uint64_t start_lsa;
+    uint64_t size_in_sectors;
+};
+
+class BinaryTraceWriter
+{
+public:
+    BinaryTraceWriter(const std::string &path, uint32_t records_per_block = BINARY_TRACE_RECORDS_PER_BLOCK);
+    ~BinaryTraceWriter();
+    BinaryTraceWriter(const BinaryTraceWriter &) = delete;
+    BinaryTraceWriter &operator=(const BinaryTraceWriter &) = delete;
+
+    void Append(const TraceRecord &record);
+    // 写出最后一个 block、索引并回填文件头，之后不能再 Append
+    void Finish();
+    uint64_t GetRecordCount() const { return record_count; }
+
+private:
+    void FlushBlock();
+    void WriteBytes(const void *data, uint64_t size);
+
+    FILE *file;
+    uint32_t records_per_block;
+    uint64_t file_offset = 0;
+    uint64_t record_count = 0;
+    bool finished = false;
+
+    std::vector<uint8_t> block_payload;
+    BinaryTraceBlockHeader block_header{};
+    uint64_t prev_timestamp = 0;
+    uint64_t prev_end_lsa = 0;
+    std::vector<BinaryTraceIndexEntry> index;
+};
+
+/*
+ * 二进制 trace 读取：整个文件只读映射，按 block 顺序解码，
+ * 每条记录只有几次 varint 解码，没有文本解析和内存分配(NextRecord)。
+ */
+class BinaryTraceReader
+{
+public:
+    BinaryTraceReader(const std::string &path, uint64_t stream_no, uint64_t logical_sector_no, uint64_t sectors_per_page);
+    ~BinaryTraceReader();
+    BinaryTraceReader(const BinaryTraceReader &) = delete;
+    BinaryTraceReader &operator=(const BinaryTraceReader &) = delete;
+
+    // 读取下一条原始记录，结束返回 false
+    bool NextRecord(TraceRecord &record);
+    // 读取下一条记录并按目标盘的逻辑空间和流数折叠成 UserRequest，结束返回 nullptr
+    UserRequestPtr Next();
+    // 借助索引定位到第 record_id 条 / 第一条到达时间不早于 timestamp 的记录
+    void SeekToRecord(uint64_t record_id);
+    void SeekToTime(uint64_t timestamp);
+
+    uint64_t GetRecordCount() const { return header.record_count; }
+
+private:
+    void LoadBlock(uint64_t block_id);
+
+    int fd = -1;
+    const uint8_t *base = nullptr;
+    uint64_t file_size = 0;
+    BinaryTraceHeader header{};
+    const BinaryTraceIndexEntry *index = nullptr;
+
+    uint64_t stream_no;
+    uint64_t logical_sector_no;
+    uint64_t sectors_per_page;
+
+    uint64_t current_block = 0;
+    const uint8_t *cursor = nullptr;
+    const uint8_t *block_end = nullptr;
+    uint64_t records_left_in_block = 0;
+    uint64_t next_record_id = 0;
+    uint64_t prev_timestamp = 0;
+    uint64_t prev_end_lsa = 0;
+};
+using BinaryTraceReaderPtr = std::shared_ptr<BinaryTraceReader>;
+
+// 把文本 trace 转成二进制格式，返回转换的记录数
+uint64_t ConvertTraceToBinary(const std::string &text_path, TraceFormat format, const std::string &binary_path);
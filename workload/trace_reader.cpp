@@ -0,0 +1,382 @@
+#include "trace_reader.h"
+#include <charconv>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+    // 按分隔符切分字段；delim 为 ' ' 时连续空白视为一个分隔符。返回字段数
+    uint64_t SplitFields(std::string_view line, char delim, std::string_view *fields, uint64_t max_fields)
+    {
+        uint64_t cnt = 0;
+        uint64_t pos = 0;
+        while (pos <= line.size() && cnt < max_fields)
+        {
+            if (delim == ' ')
+            {
+                while (pos < line.size() && (line[pos] == ' ' || line[pos] == '\t'))
+                    pos++;
+                if (pos == line.size())
+                    break;
+            }
+            uint64_t end = pos;
+            while (end < line.size() && line[end] != delim && !(delim == ' ' && line[end] == '\t'))
+                end++;
+            fields[cnt++] = line.substr(pos, end - pos);
+            pos = end + 1;
+        }
+        return cnt;
+    }
+
+    std::string_view Trim(std::string_view s)
+    {
+        while (!s.empty() && (s.front() == ' ' || s.front() == '\t'))
+            s.remove_prefix(1);
+        while (!s.empty() && (s.back() == ' ' || s.back() == '\t' || s.back() == '\r'))
+            s.remove_suffix(1);
+        return s;
+    }
+
+    bool ParseUint(std::string_view s, uint64_t &value)
+    {
+        s = Trim(s);
+        auto res = std::from_chars(s.data(), s.data() + s.size(), value);
+        return res.ec == std::errc() && res.ptr == s.data() + s.size();
+    }
+
+    bool ParseDouble(std::string_view s, double &value)
+    {
+        s = Trim(s);
+        auto res = std::from_chars(s.data(), s.data() + s.size(), value);
+        return res.ec == std::errc() && res.ptr == s.data() + s.size();
+    }
+
+    bool EqualsIgnoreCase(std::string_view a, std::string_view b)
+    {
+        if (a.size() != b.size())
+            return false;
+        for (uint64_t i = 0; i < a.size(); i++)
+        {
+            if (std::tolower(static_cast<unsigned char>(a[i])) != std::tolower(static_cast<unsigned char>(b[i])))
+                return false;
+        }
+        return true;
+    }
+}
+
+bool ParseTraceFormat(const std::string &name, TraceFormat &format)
+{
+    if (name == "msr")
+        format = TraceFormat::MSR_CAMBRIDGE;
+    else if (name == "snia")
+        format = TraceFormat::SNIA;
+    else if (name == "blktrace" || name == "blkparse")
+        format = TraceFormat::BLKPARSE;
+    else if (name == "fio")
+        format = TraceFormat::FIO_IOLOG;
+    else
+        return false;
+    return true;
+}
+
+bool FoldSectorRange(uint64_t &start, uint64_t &size, uint64_t logical_sector_no)
+{
+    if (size == 0 || logical_sector_no == 0)
+    {
+        return false;
+    }
+    if (size > logical_sector_no)
+    {
+        size = logical_sector_no;
+    }
+    start %= logical_sector_no;
+    if (start + size > logical_sector_no)
+    {
+        start = logical_sector_no - size;
+    }
+    return true;
+}
+
+//============================================== MmapLineReader ==============================================
+
+MmapLineReader::MmapLineReader(const std::string &path, uint64_t window_size)
+{
+    fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        PRINT_ERROR("Cannot open trace file " << path)
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        PRINT_ERROR("Cannot stat trace file " << path)
+    }
+    file_size = static_cast<uint64_t>(st.st_size);
+    system_page_size = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+    this->window_size = (window_size + system_page_size - 1) / system_page_size * system_page_size;
+}
+
+MmapLineReader::~MmapLineReader()
+{
+    if (window != nullptr)
+    {
+        munmap(const_cast<char *>(window), window_length);
+    }
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+}
+
+void MmapLineReader::MapWindow(uint64_t file_offset)
+{
+    if (window != nullptr)
+    {
+        munmap(const_cast<char *>(window), window_length);
+        window = nullptr;
+    }
+    // mmap 的偏移必须按系统页对齐，多出来的部分通过 cursor 跳过
+    uint64_t aligned_offset = file_offset / system_page_size * system_page_size;
+    window_offset = aligned_offset;
+    window_length = std::min(window_size, file_size - aligned_offset);
+    cursor = file_offset - aligned_offset;
+    void *addr = mmap(nullptr, window_length, PROT_READ, MAP_PRIVATE, fd, static_cast<off_t>(aligned_offset));
+    if (addr == MAP_FAILED)
+    {
+        PRINT_ERROR("mmap failed on trace file at offset " << aligned_offset)
+    }
+    madvise(addr, window_length, MADV_SEQUENTIAL);
+    window = static_cast<const char *>(addr);
+}
+
+bool MmapLineReader::NextLine(std::string_view &line)
+{
+    if (file_size == 0)
+    {
+        return false;
+    }
+    if (window == nullptr)
+    {
+        MapWindow(0);
+    }
+    while (true)
+    {
+        if (window_offset + cursor >= file_size)
+        {
+            return false;
+        }
+        const char *start = window + cursor;
+        const char *newline = static_cast<const char *>(std::memchr(start, '\n', window_length - cursor));
+        if (newline != nullptr)
+        {
+            line = std::string_view(start, newline - start);
+            cursor += line.size() + 1;
+            return true;
+        }
+        if (window_offset + window_length == file_size)
+        {
+            // 文件最后一行没有换行符
+            line = std::string_view(start, window_length - cursor);
+            cursor = window_length;
+            return true;
+        }
+        // 当前窗口中只剩半行：从该行起点重新映射；若一整行比窗口还长则扩大窗口
+        uint64_t line_offset = window_offset + cursor;
+        if (cursor <= system_page_size)
+        {
+            window_size *= 2;
+        }
+        MapWindow(line_offset);
+    }
+}
+
+//============================================== TraceReader ==============================================
+
+TraceReader::TraceReader(const std::string &path, TraceFormat format, uint64_t stream_no, uint64_t logical_sector_no, uint64_t sectors_per_page)
+    : line_reader(path), format(format), stream_no(stream_no == 0 ? 1 : stream_no),
+      logical_sector_no(logical_sector_no), sectors_per_page(sectors_per_page)
+{
+}
+
+UserRequestPtr TraceReader::Next()
+{
+    std::string_view line;
+    while (line_reader.NextLine(line))
+    {
+        auto req = std::make_shared<UserRequest>();
+        bool parsed = false;
+        switch (format)
+        {
+        case TraceFormat::MSR_CAMBRIDGE:
+            parsed = ParseMsr(line, *req);
+            break;
+        case TraceFormat::SNIA:
+            parsed = ParseSnia(line, *req);
+            break;
+        case TraceFormat::BLKPARSE:
+            parsed = ParseBlkparse(line, *req);
+            break;
+        case TraceFormat::FIO_IOLOG:
+            parsed = ParseFioIolog(line, *req);
+            break;
+        default:
+            PRINT_ERROR("Unsupported trace format!")
+        }
+        if (parsed)
+        {
+            return req;
+        }
+        skipped_line_count++;
+    }
+    return nullptr;
+}
+
+bool TraceReader::FillRequest(UserRequest &req, UserRequestType type, uint64_t timestamp_ns, uint64_t offset_in_sectors,
+                              uint64_t size_in_sectors, uint64_t stream_id)
+{
+    uint64_t start = offset_in_sectors;
+    if (!FoldSectorRange(start, size_in_sectors, logical_sector_no))
+    {
+        return false;
+    }
+    if (!first_timestamp_seen)
+    {
+        first_timestamp_seen = true;
+        first_timestamp_ns = timestamp_ns;
+    }
+    // trace 中偶有时间戳回退，按 0 处理
+    req.arrival_time = timestamp_ns > first_timestamp_ns ? timestamp_ns - first_timestamp_ns : 0;
+    req.id = parsed_request_count++;
+    req.req_type = type;
+    req.start_lsa = start;
+    req.start_lpa = start / sectors_per_page;
+    req.size_in_sectors = size_in_sectors;
+    req.size_in_bytes = size_in_sectors * SECTOR_SIZE_IN_BYTE;
+    req.stream_id = stream_id % stream_no;
+    req.sectors_from_cache = 0;
+    return true;
+}
+
+bool TraceReader::ParseMsr(std::string_view line, UserRequest &req)
+{
+    std::string_view fields[7];
+    if (SplitFields(line, ',', fields, 7) < 6)
+    {
+        return false;
+    }
+    uint64_t timestamp = 0, disk = 0, offset = 0, size = 0;
+    if (!ParseUint(fields[0], timestamp) || !ParseUint(fields[2], disk) || !ParseUint(fields[4], offset) || !ParseUint(fields[5], size))
+    {
+        return false;
+    }
+    std::string_view type = Trim(fields[3]);
+    UserRequestType req_type;
+    if (EqualsIgnoreCase(type, "Read"))
+        req_type = UserRequestType::READ;
+    else if (EqualsIgnoreCase(type, "Write"))
+        req_type = UserRequestType::WRITE;
+    else
+        return false;
+    // Windows filetime，单位 100ns
+    return FillRequest(req, req_type, timestamp * 100, offset / SECTOR_SIZE_IN_BYTE,
+                       (size + SECTOR_SIZE_IN_BYTE - 1) / SECTOR_SIZE_IN_BYTE, disk);
+}
+
+bool TraceReader::ParseSnia(std::string_view line, UserRequest &req)
+{
+    std::string_view fields[6];
+    if (SplitFields(line, ',', fields, 6) < 6)
+    {
+        return false;
+    }
+    double timestamp = 0;
+    uint64_t lun = 0, offset = 0, size = 0;
+    if (!ParseDouble(fields[0], timestamp) || !ParseUint(fields[3], lun) || !ParseUint(fields[4], offset) || !ParseUint(fields[5], size))
+    {
+        return false; // 表头或损坏的行
+    }
+    std::string_view type = Trim(fields[2]);
+    UserRequestType req_type;
+    if (EqualsIgnoreCase(type, "R") || EqualsIgnoreCase(type, "Read"))
+        req_type = UserRequestType::READ;
+    else if (EqualsIgnoreCase(type, "W") || EqualsIgnoreCase(type, "Write"))
+        req_type = UserRequestType::WRITE;
+    else
+        return false;
+    return FillRequest(req, req_type, static_cast<uint64_t>(timestamp * 1e9), offset / SECTOR_SIZE_IN_BYTE,
+                       (size + SECTOR_SIZE_IN_BYTE - 1) / SECTOR_SIZE_IN_BYTE, lun);
+}
+
+bool TraceReader::ParseBlkparse(std::string_view line, UserRequest &req)
+{
+    // maj,min cpu seq time pid action rwbs sector + blocks [process]
+    std::string_view fields[10];
+    if (SplitFields(line, ' ', fields, 10) < 10 || fields[5] != "Q" || fields[8] != "+")
+    {
+        return false;
+    }
+    double timestamp = 0;
+    uint64_t sector = 0, blocks = 0;
+    if (!ParseDouble(fields[3], timestamp) || !ParseUint(fields[7], sector) || !ParseUint(fields[9], blocks))
+    {
+        return false;
+    }
+    std::string_view rwbs = fields[6];
+    UserRequestType req_type;
+    if (rwbs.find('D') != std::string_view::npos)
+        req_type = UserRequestType::TRIM;
+    else if (rwbs.find('W') != std::string_view::npos)
+        req_type = UserRequestType::WRITE;
+    else if (rwbs.find('R') != std::string_view::npos)
+        req_type = UserRequestType::READ;
+    else
+        return false;
+    return FillRequest(req, req_type, static_cast<uint64_t>(timestamp * 1e9), sector, blocks, 0);
+}
+
+bool TraceReader::ParseFioIolog(std::string_view line, UserRequest &req)
+{
+    if (fio_iolog_version == 0)
+    {
+        // 首行为 "fio version N iolog"
+        std::string_view fields[4];
+        if (SplitFields(line, ' ', fields, 4) == 4 && fields[0] == "fio" && fields[1] == "version")
+        {
+            uint64_t version = 0;
+            if (ParseUint(fields[2], version) && (version == 2 || version == 3))
+            {
+                fio_iolog_version = static_cast<int>(version);
+                return false;
+            }
+        }
+        PRINT_ERROR("Unsupported fio iolog header: " << line)
+    }
+    // v2: filename action offset length
+    // v3: timestamp(ms) filename action offset length
+    std::string_view fields[5];
+    uint64_t field_cnt = SplitFields(line, ' ', fields, 5);
+    uint64_t base = fio_iolog_version == 3 ? 1 : 0;
+    if (field_cnt < base + 4)
+    {
+        return false; // add/open/close 等文件操作
+    }
+    uint64_t timestamp_ms = 0, offset = 0, length = 0;
+    if ((base == 1 && !ParseUint(fields[0], timestamp_ms)) || !ParseUint(fields[base + 2], offset) || !ParseUint(fields[base + 3], length))
+    {
+        return false;
+    }
+    std::string_view action = fields[base + 1];
+    UserRequestType req_type;
+    if (action == "read")
+        req_type = UserRequestType::READ;
+    else if (action == "write")
+        req_type = UserRequestType::WRITE;
+    else if (action == "trim")
+        req_type = UserRequestType::TRIM;
+    else
+        return false;
+    return FillRequest(req, req_type, timestamp_ms * 1000000, offset / SECTOR_SIZE_IN_BYTE,
+                       (length + SECTOR_SIZE_IN_BYTE - 1) / SECTOR_SIZE_IN_BYTE, 0);
+}
@@ -0,0 +1,83 @@
+#pragma once
+#include "param.h"
+#include "user_request.h"
+#include <string>
+#include <string_view>
+
+enum class TraceFormat
+{
+    MSR_CAMBRIDGE, // Timestamp(100ns),Hostname,DiskNumber,Type,Offset,Size,ResponseTime
+    SNIA,          // SNIA IOTTA SYSTOR'17: Timestamp(s),Response,IOType,LUN,Offset,Size
+    BLKPARSE,      // blkparse 默认文本输出，只取 Q(入队) 事件
+    FIO_IOLOG      // fio iolog v2 / v3
+};
+
+bool ParseTraceFormat(const std::string &name, TraceFormat &format);
+// 把扇区区间折叠进 [0, logical_sector_no)：起始地址取模，跨越末尾的区间整体前移。size 为0时返回 false
+bool FoldSectorRange(uint64_t &start, uint64_t &size, uint64_t logical_sector_no);
+
+/*
+ * 基于 mmap 的分块按行读取
+ * 每次只映射 window_size 大小的窗口，读到窗口末尾时向后滑动并解除旧映射，
+ * 多 GB 的 trace 文件也不会整体驻留内存。
+ */
+class MmapLineReader
+{
+public:
+    MmapLineReader(const std::string &path, uint64_t window_size = 64ULL << 20);
+    ~MmapLineReader();
+    MmapLineReader(const MmapLineReader &) = delete;
+    MmapLineReader &operator=(const MmapLineReader &) = delete;
+
+    // 取下一行(不含换行符)，返回 false 表示文件结束；返回的视图在下一次调用前有效
+    bool NextLine(std::string_view &line);
+    uint64_t GetFileSize() const { return file_size; }
+
+private:
+    void MapWindow(uint64_t file_offset);
+
+    int fd = -1;
+    uint64_t file_size = 0;
+    uint64_t system_page_size;
+    uint64_t window_size;
+    const char *window = nullptr;
+    uint64_t window_offset = 0; // 窗口在文件中的起始偏移
+    uint64_t window_length = 0;
+    uint64_t cursor = 0; // 窗口内的读取位置
+};
+
+/*
+ * 块设备 trace 解析：把每条记录转换成 UserRequest
+ * 超出逻辑空间的地址按逻辑扇区数取模折叠；到达时间统一换算成相对第一条记录的 ns。
+ */
+class TraceReader
+{
+public:
+    TraceReader(const std::string &path, TraceFormat format, uint64_t stream_no, uint64_t logical_sector_no, uint64_t sectors_per_page);
+
+    // 读取下一条请求，文件结束返回 nullptr
+    UserRequestPtr Next();
+    uint64_t GetParsedRequestCount() const { return parsed_request_count; }
+    uint64_t GetSkippedLineCount() const { return skipped_line_count; }
+
+private:
+    bool ParseMsr(std::string_view line, UserRequest &req);
+    bool ParseSnia(std::string_view line, UserRequest &req);
+    bool ParseBlkparse(std::string_view line, UserRequest &req);
+    bool ParseFioIolog(std::string_view line, UserRequest &req);
+    bool FillRequest(UserRequest &req, UserRequestType type, uint64_t timestamp_ns, uint64_t offset_in_sectors,
+                     uint64_t size_in_sectors, uint64_t stream_id);
+
+    MmapLineReader line_reader;
+    TraceFormat format;
+    uint64_t stream_no;
+    uint64_t logical_sector_no;
+    uint64_t sectors_per_page;
+
+    int fio_iolog_version = 0;
+    bool first_timestamp_seen = false;
+    uint64_t first_timestamp_ns = 0;
+    uint64_t parsed_request_count = 0;
+    uint64_t skipped_line_count = 0;
+};
+using TraceReaderPtr = std::shared_ptr<TraceReader>;
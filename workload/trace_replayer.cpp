@@ -0,0 +1,107 @@
+#include "trace_replayer.h"
+#include <thread>
+
+bool ParseReplayMode(const std::string &name, ReplayMode &mode)
+{
+    if (name == "open")
+        mode = ReplayMode::OPEN_LOOP;
+    else if (name == "closed")
+        mode = ReplayMode::CLOSED_LOOP;
+    else
+        return false;
+    return true;
+}
+
+TraceReplayer::TraceReplayer(RequestSource source, ReplayMode mode, uint64_t queue_depth, double speedup,
+                             RequestSink sink, PollFunction poll)
+    : source(std::move(source)), mode(mode), queue_depth(queue_depth == 0 ? 1 : queue_depth), speedup(speedup),
+      sink(std::move(sink)), poll(std::move(poll))
+{
+    if (this->source == nullptr || this->sink == nullptr)
+    {
+        PRINT_ERROR("TraceReplayer requires a request source and a request sink")
+    }
+}
+
+uint64_t TraceReplayer::NowNs() const
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_time).count();
+}
+
+void TraceReplayer::Progress()
+{
+    if (poll != nullptr)
+    {
+        poll();
+    }
+    else
+    {
+        std::this_thread::yield();
+    }
+}
+
+void TraceReplayer::WaitUntil(uint64_t arrival_time)
+{
+    if (speedup <= 0)
+    {
+        return;
+    }
+    uint64_t due_time = static_cast<uint64_t>(arrival_time / speedup);
+    while (true)
+    {
+        uint64_t now = NowNs();
+        if (now >= due_time)
+        {
+            return;
+        }
+        if (poll != nullptr)
+        {
+            poll();
+        }
+        else
+        {
+            std::this_thread::sleep_for(std::chrono::nanoseconds(due_time - now));
+        }
+    }
+}
+
+void TraceReplayer::WaitForSlot()
+{
+    while (submitted_request_count - completed_request_count.load(std::memory_order_acquire) >= queue_depth)
+    {
+        Progress();
+    }
+}
+
+void TraceReplayer::WaitForAllCompleted()
+{
+    while (completed_request_count.load(std::memory_order_acquire) < submitted_request_count)
+    {
+        Progress();
+    }
+}
+
+void TraceReplayer::OnRequestCompleted(const UserRequestPtr &)
+{
+    completed_request_count.fetch_add(1, std::memory_order_release);
+}
+
+void TraceReplayer::Run()
+{
+    start_time = std::chrono::steady_clock::now();
+    while (UserRequestPtr req = source())
+    {
+        if (mode == ReplayMode::OPEN_LOOP)
+        {
+            WaitUntil(req->arrival_time);
+        }
+        else
+        {
+            WaitForSlot();
+        }
+        submitted_request_count++;
+        sink(req);
+    }
+    WaitForAllCompleted();
+    elapsed_time_ns = NowNs();
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include "param.h"
+#include "trace_reader.h"
+#include <atomic>
+#include <chrono>
+#include <functional>
+
+enum class ReplayMode
+{
+    OPEN_LOOP,  // 按 trace 时间戳提交，不管前面的请求是否完成
+    CLOSED_LOOP // 忽略时间戳，始终保持 queue_depth 个请求在途
+};
+
+bool ParseReplayMode(const std::string &name, ReplayMode &mode);
+
+/*
+ * trace 回放：从 source(文本或二进制 trace 读取器)流式取请求交给 sink，source 返回 nullptr 表示结束。
+ * sink 可以同步完成请求，也可以稍后由完成路径调用 OnRequestCompleted；
+ * 等待期间反复调用 poll(例如 NandDriver::PollCompletions)推进完成处理。
+ */
+class TraceReplayer
+{
+public:
+    using RequestSource = std::function<UserRequestPtr()>;
+    using RequestSink = std::function<void(const UserRequestPtr &)>;
+    using PollFunction = std::function<void()>;
+
+    // speedup: 开环模式下的时间压缩倍数，<=0 表示忽略时间戳尽快提交
+    TraceReplayer(RequestSource source, ReplayMode mode, uint64_t queue_depth, double speedup,
+                  RequestSink sink, PollFunction poll = nullptr);
+
+    // 回放整个 trace，所有请求完成后返回
+    void Run();
+    void OnRequestCompleted(const UserRequestPtr &req);
+
+    uint64_t GetSubmittedRequestCount() const { return submitted_request_count; }
+    uint64_t GetCompletedRequestCount() const { return completed_request_count.load(std::memory_order_acquire); }
+    uint64_t GetElapsedTimeNs() const { return elapsed_time_ns; }
+
+private:
+    void WaitUntil(uint64_t arrival_time);
+    void WaitForSlot();
+    void WaitForAllCompleted();
+    void Progress();
+    uint64_t NowNs() const;
+
+    RequestSource source;
+    ReplayMode mode;
+    uint64_t queue_depth;
+    double speedup;
+    RequestSink sink;
+    PollFunction poll;
+
+    std::chrono::steady_clock::time_point start_time;
+    uint64_t submitted_request_count = 0;
+    std::atomic<uint64_t> completed_request_count{0};
+    uint64_t elapsed_time_ns = 0;
+};
+using TraceReplayerPtr = std::shared_ptr<TraceReplayer>;
@@ -0,0 +1,277 @@
+#include "workload_generator.h"
+#include <cmath>
+
+uint64_t GetLogicalSectorCount()
+{
+    uint64_t total_pages = config.ssd_param.ChannelNum * config.ssd_param.ChipPerChannel * config.nand_param.DiePerChip *
+                           config.nand_param.PlanePerDie * config.nand_param.BlockPerPlane * config.nand_param.PagePerBlock;
+    uint64_t logical_pages = static_cast<uint64_t>(total_pages * (1 - config.ssd_param.OverprovisioningRatio));
+    uint64_t stream_no = config.ssd_param.StreamNum == 0 ? 1 : config.ssd_param.StreamNum;
+    return logical_pages * (config.nand_param.PageSize / SECTOR_SIZE_IN_BYTE) / stream_no;
+}
+
+//============================================== WorkloadRandom ==============================================
+
+WorkloadRandom::WorkloadRandom(uint64_t seed)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        seed += 0x9e3779b97f4a7c15ULL;
+        uint64_t z = seed;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        state[i] = z ^ (z >> 31);
+    }
+}
+
+uint64_t WorkloadRandom::Next()
+{
+    auto rotl = [](uint64_t x, int k)
+    { return (x << k) | (x >> (64 - k)); };
+    uint64_t result = rotl(state[1] * 5, 7) * 9;
+    uint64_t t = state[1] << 17;
+    state[2] ^= state[0];
+    state[3] ^= state[1];
+    state[1] ^= state[2];
+    state[0] ^= state[3];
+    state[2] ^= t;
+    state[3] = rotl(state[3], 45);
+    return result;
+}
+
+double WorkloadRandom::NextExponential(double mean)
+{
+    return -std::log1p(-NextDouble()) * mean;
+}
+
+//============================================== ZipfSampler ==============================================
+
+namespace
+{
+    // log1p(x)/x，x 趋近0时用泰勒展开保证精度
+    double Helper1(double x)
+    {
+        if (std::fabs(x) > 1e-8)
+            return std::log1p(x) / x;
+        return 1 - x * (0.5 - x * (1.0 / 3 - 0.25 * x));
+    }
+    // expm1(x)/x
+    double Helper2(double x)
+    {
+        if (std::fabs(x) > 1e-8)
+            return std::expm1(x) / x;
+        return 1 + x * 0.5 * (1 + x * (1.0 / 3) * (1 + 0.25 * x));
+    }
+}
+
+ZipfSampler::ZipfSampler(uint64_t n, double exponent) : n(n == 0 ? 1 : n), exponent(exponent)
+{
+    if (exponent <= 0)
+    {
+        PRINT_ERROR("Zipf exponent must be positive")
+    }
+    h_integral_x1 = HIntegral(1.5) - 1;
+    h_integral_n = HIntegral(this->n + 0.5);
+    s = 2 - HIntegralInverse(HIntegral(2.5) - H(2));
+}
+
+double ZipfSampler::H(double x) const
+{
+    return std::exp(-exponent * std::log(x));
+}
+
+double ZipfSampler::HIntegral(double x) const
+{
+    double log_x = std::log(x);
+    return Helper2((1 - exponent) * log_x) * log_x;
+}
+
+double ZipfSampler::HIntegralInverse(double x) const
+{
+    double t = x * (1 - exponent);
+    if (t < -1)
+    {
+        t = -1; // 浮点误差保护
+    }
+    return std::exp(Helper1(t) * x);
+}
+
+uint64_t ZipfSampler::Sample(WorkloadRandom &rng) const
+{
+    while (true)
+    {
+        double u = h_integral_n + rng.NextDouble() * (h_integral_x1 - h_integral_n);
+        double x = HIntegralInverse(u);
+        double k = std::floor(x + 0.5);
+        if (k < 1)
+            k = 1;
+        else if (k > n)
+            k = static_cast<double>(n);
+        if (k - x <= s || u >= HIntegral(k + 0.5) - H(k))
+        {
+            return static_cast<uint64_t>(k);
+        }
+    }
+}
+
+//============================================== WorkloadGenerator ==============================================
+
+WorkloadGenerator::WorkloadGenerator(const WorkloadParam &param, uint64_t logical_sector_no, uint64_t sectors_per_page)
+    : param(param), sectors_per_page(sectors_per_page == 0 ? 1 : sectors_per_page), rng(param.seed)
+{
+    if (logical_sector_no == 0)
+    {
+        PRINT_ERROR("WorkloadGenerator requires a non-empty logical space")
+    }
+    std::vector<StreamWorkloadParam> stream_params = param.streams;
+    if (stream_params.empty())
+    {
+        stream_params.emplace_back();
+    }
+    uint64_t stream_no = config.ssd_param.StreamNum == 0 ? 1 : config.ssd_param.StreamNum;
+    double weight_sum = 0;
+    for (uint64_t i = 0; i < stream_params.size(); i++)
+    {
+        StreamWorkloadParam &sp = stream_params[i];
+        if (sp.alignment == 0)
+            sp.alignment = 1;
+        if (sp.size_min == 0)
+            sp.size_min = 1;
+        if (sp.size_max < sp.size_min)
+            sp.size_max = sp.size_min;
+        if (sp.sequential_run_length == 0)
+            sp.sequential_run_length = 1;
+        uint64_t range_start = sp.start_lsa % logical_sector_no;
+        uint64_t range_size = logical_sector_no - range_start;
+        if (sp.address_range != 0 && sp.address_range < range_size)
+            range_size = sp.address_range;
+        uint64_t slot_no = std::max<uint64_t>(1, range_size / sp.alignment);
+
+        std::shared_ptr<ZipfSampler> zipf;
+        if (sp.address_distribution == AddressDistribution::ZIPF)
+        {
+            zipf = std::make_shared<ZipfSampler>(slot_no, sp.zipf_exponent);
+        }
+        // 每个流使用独立的随机序列，增删其他流不影响本流的地址序列
+        streams.push_back(StreamState{sp, i % stream_no, range_start, range_size, slot_no, zipf,
+                                      WorkloadRandom(param.seed ^ ((i + 1) * 0xd1b54a32d192ed03ULL))});
+        weight_sum += std::max(sp.weight, 0.0);
+        stream_weight_prefix.push_back(weight_sum);
+    }
+    if (weight_sum <= 0)
+    {
+        PRINT_ERROR("WorkloadGenerator: all stream weights are zero")
+    }
+}
+
+uint64_t WorkloadGenerator::PickStream()
+{
+    if (streams.size() == 1)
+    {
+        return 0;
+    }
+    double r = rng.NextDouble() * stream_weight_prefix.back();
+    auto it = std::upper_bound(stream_weight_prefix.begin(), stream_weight_prefix.end(), r);
+    return std::min<uint64_t>(it - stream_weight_prefix.begin(), streams.size() - 1);
+}
+
+uint64_t WorkloadGenerator::PickStartLsa(StreamState &stream)
+{
+    uint64_t slot = 0;
+    switch (stream.param.address_distribution)
+    {
+    case AddressDistribution::UNIFORM:
+        slot = stream.rng.NextBounded(stream.slot_no);
+        break;
+    case AddressDistribution::ZIPF:
+        slot = stream.zipf->Sample(stream.rng) - 1;
+        break;
+    case AddressDistribution::HOT_COLD:
+    {
+        uint64_t hot_slot_no = std::max<uint64_t>(1, static_cast<uint64_t>(stream.slot_no * stream.param.hot_space_ratio));
+        if (hot_slot_no >= stream.slot_no || stream.rng.NextDouble() < stream.param.hot_access_ratio)
+            slot = stream.rng.NextBounded(std::min(hot_slot_no, stream.slot_no));
+        else
+            slot = hot_slot_no + stream.rng.NextBounded(stream.slot_no - hot_slot_no);
+        break;
+    }
+    default:
+        PRINT_ERROR("Unsupported address distribution!")
+    }
+    return stream.range_start + slot * stream.param.alignment;
+}
+
+uint64_t WorkloadGenerator::PickSize(StreamState &stream)
+{
+    if (stream.param.size_distribution == SizeDistribution::UNIFORM)
+    {
+        return stream.param.size_min + stream.rng.NextBounded(stream.param.size_max - stream.param.size_min + 1);
+    }
+    return stream.param.size_min;
+}
+
+UserRequestPtr WorkloadGenerator::Next()
+{
+    if (generated_request_count >= param.request_count)
+    {
+        return nullptr;
+    }
+    StreamState &stream = streams[PickStream()];
+    uint64_t range_end = stream.range_start + stream.range_size;
+
+    double op = stream.rng.NextDouble();
+    UserRequestType req_type = UserRequestType::WRITE;
+    if (op < stream.param.read_ratio)
+        req_type = UserRequestType::READ;
+    else if (op < stream.param.read_ratio + stream.param.trim_ratio)
+        req_type = UserRequestType::TRIM;
+
+    uint64_t size = std::min(PickSize(stream), stream.range_size);
+    uint64_t start;
+    if (stream.run_remaining > 0)
+    {
+        start = stream.next_sequential_lsa;
+        if (start + size > range_end)
+        {
+            start = stream.range_start; // 顺序流走到范围末尾后回绕
+        }
+    }
+    else
+    {
+        start = PickStartLsa(stream);
+        stream.run_remaining = stream.param.sequential_run_length;
+    }
+    if (start + size > range_end)
+    {
+        size = range_end - start;
+    }
+    stream.run_remaining--;
+    stream.next_sequential_lsa = start + size;
+
+    if (param.mean_inter_arrival_ns > 0 && generated_request_count > 0)
+    {
+        current_time += static_cast<uint64_t>(rng.NextExponential(static_cast<double>(param.mean_inter_arrival_ns)));
+    }
+
+    auto req = std::make_shared<UserRequest>();
+    req->id = generated_request_count++;
+    req->req_type = req_type;
+    req->arrival_time = current_time;
+    req->start_lsa = start;
+    req->start_lpa = start / sectors_per_page;
+    req->size_in_sectors = size;
+    req->size_in_bytes = size * SECTOR_SIZE_IN_BYTE;
+    req->stream_id = stream.stream_id;
+    if (req_type == UserRequestType::WRITE)
+    {
+        req->write_hint = stream.param.write_hint;
+    }
+    return req;
+}
+
+UserRequestPtr generate_user_requests_ramdomly()
+{
+    static WorkloadGenerator generator(config.workload_param, GetLogicalSectorCount(),
+                                       config.nand_param.PageSize / SECTOR_SIZE_IN_BYTE);
+    return generator.Next();
+}
@@ -0,0 +1,84 @@
+#pragma once
+#include "param.h"
+#include "user_request.h"
+
+// 按 config 中的几何参数和预留空间比例计算每个流(各自独立的逻辑地址空间)可见的逻辑扇区数
+uint64_t GetLogicalSectorCount();
+
+/*
+ * SplitMix64 种子展开 + xoshiro256** 随机数发生器
+ * 不依赖标准库分布的具体实现，相同种子在任何平台上都产生完全相同的序列
+ */
+class WorkloadRandom
+{
+public:
+    explicit WorkloadRandom(uint64_t seed);
+    uint64_t Next();
+    // [0, 1) 均匀分布
+    double NextDouble() { return static_cast<double>(Next() >> 11) * 0x1.0p-53; }
+    // [0, bound) 均匀整数，乘法取高位避免取模偏差的主要部分
+    uint64_t NextBounded(uint64_t bound) { return static_cast<uint64_t>((static_cast<unsigned __int128>(Next()) * bound) >> 64); }
+    double NextExponential(double mean);
+
+private:
+    uint64_t state[4];
+};
+
+/*
+ * Zipf 分布采样，rejection-inversion 方法(Hörmann & Derflinger 1996)
+ * 不需要 O(n) 的累积概率表，每次采样期望不到两次迭代；返回 [1, n]，1 最热
+ */
+class ZipfSampler
+{
+public:
+    ZipfSampler(uint64_t n, double exponent);
+    uint64_t Sample(WorkloadRandom &rng) const;
+
+private:
+    double H(double x) const;
+    double HIntegral(double x) const;
+    double HIntegralInverse(double x) const;
+
+    uint64_t n;
+    double exponent;
+    double h_integral_x1;
+    double h_integral_n;
+    double s;
+};
+
+class WorkloadGenerator
+{
+public:
+    WorkloadGenerator(const WorkloadParam &param, uint64_t logical_sector_no, uint64_t sectors_per_page);
+
+    // 生成下一条请求，达到 request_count 后返回 nullptr
+    UserRequestPtr Next();
+    uint64_t GetGeneratedRequestCount() const { return generated_request_count; }
+
+private:
+    struct StreamState
+    {
+        StreamWorkloadParam param;
+        uint64_t stream_id;
+        uint64_t range_start;
+        uint64_t range_size;
+        uint64_t slot_no; // 按 alignment 划分的起始地址个数
+        std::shared_ptr<ZipfSampler> zipf;
+        WorkloadRandom rng;
+        uint64_t run_remaining = 0;
+        uint64_t next_sequential_lsa = 0;
+    };
+
+    uint64_t PickStream();
+    uint64_t PickStartLsa(StreamState &stream);
+    uint64_t PickSize(StreamState &stream);
+
+    WorkloadParam param;
+    uint64_t sectors_per_page;
+    std::vector<StreamState> streams;
+    std::vector<double> stream_weight_prefix;
+    WorkloadRandom rng;
+    uint64_t generated_request_count = 0;
+    uint64_t current_time = 0;
+};
+using WorkloadGeneratorPtr = std::shared_ptr<WorkloadGenerator>;